@@ -1,38 +1,118 @@
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <netdb.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <arpa/inet.h>
 
 #include "getip.h"
 
 #define BUFFER_LEN 1024
-#define SERVICE "http"
-#define HTTP_REQUEST    "GET / HTTP/1.1\n"\
-                        "Host: " NODE_NAME "\n"\
-                        "Connection: close\n"\
-                        "\n"
+#define REQUEST_LEN 256
+#define CACHE_NAME ".getip_cache"   /* Nombre de la caché dentro de $HOME */
+
+/* Estados de una consulta en segundo plano */
+#define LOOKUP_PENDING 0
+#define LOOKUP_READY 1
+#define LOOKUP_FAILED -1
+
+/**
+ * Consulta de la IP externa en segundo plano.
+ */
+struct IpLookup {
+    int state;                      /* LOOKUP_PENDING, LOOKUP_READY o LOOKUP_FAILED (acceso atómico) */
+    int refs;                       /* Usuarios de la estructura: el hilo y el llamante (acceso atómico) */
+    char ip[INET6_ADDRSTRLEN];      /* IP obtenida, válida cuando state es LOOKUP_READY */
+};
+
+
+/**
+ * @brief   Devuelve el valor de una variable de entorno, o uno por defecto si no está definida.
+ *
+ * @param name      Nombre de la variable.
+ * @param fallback  Valor por defecto.
+ *
+ * @return  Valor de la variable o fallback.
+ */
+static const char* env_or(const char* name, const char* fallback) {
+    const char* value = getenv(name);
+
+    return value ? value : fallback;
+}
+
+
+/**
+ * @brief   Construye la ruta del fichero de la caché.
+ *
+ * @param path  String en la que guardar la ruta.
+ * @param len   Longitud de la string path.
+ *
+ * @return  path, o NULL si no se debe usar caché.
+ */
+static char* cache_path(char* path, size_t len) {
+    const char* value;
+
+    if ( (value = getenv("GETIP_CACHE")) ) {
+        if (!*value) return NULL;
+        snprintf(path, len, "%s", value);
+    } else {
+        if ( !(value = getenv("HOME")) ) return NULL;
+        snprintf(path, len, "%s/%s", value, CACHE_NAME);
+    }
+
+    return path;
+}
+
+
+/**
+ * @brief   Comprueba que una string es una dirección IPv4 o IPv6 válida.
+ *
+ * @param ip    String a comprobar.
+ *
+ * @return  Distinto de 0 si es una dirección válida.
+ */
+static int valid_ip(const char* ip) {
+    unsigned char address[sizeof(struct in6_addr)];
+
+    return inet_pton(AF_INET, ip, address) == 1 || inet_pton(AF_INET6, ip, address) == 1;
+}
+
 
 /**
  * @brief   Obtiene la IP externa
  *
  * Envía una petición HTTP a la página web api.ipify.org, <url>https://ipify.org</url>, para obtener la dirección
- * IP externa con la que el equipo se conecta a internet. 
- * 
+ * IP externa con la que el equipo se conecta a internet. La respuesta se lee entera aunque llegue en varios trozos.
+ *
  * @param ip    String en la que guardar la dirección IP obtenida.
  * @param len   Longitud de la string ip. Para asegurarse de que la IP cabe entera, debería ser por lo menos INET_ADDRSTRLEN.
  *
  * @return  Puntero a la string de destino ip, o NULL en caso de error.
  */
 char* getip(char* ip, size_t len) {
-    struct addrinfo hints;  
+    struct addrinfo hints;
     struct addrinfo* result, *rp;
+    struct timeval timeout = { .tv_sec = GETIP_TIMEOUT };
+    const char* node = env_or("GETIP_HOST", NODE_NAME);
+    const char* service = env_or("GETIP_PORT", SERVICE);
     int status;
     int sockfd;
-    char http_request[] = HTTP_REQUEST;
-    char input_buffer[BUFFER_LEN] = {0};
+    char http_request[REQUEST_LEN];
+    char input_buffer[BUFFER_LEN];
+    char *body, *end;
+    size_t request_len, total = 0;
+    ssize_t bytes;
 
     memset(&hints, 0, sizeof(struct addrinfo)); /* Inicializar a 0 */
     /* Especifica criterios para seleccionar las estructuras de direcciones de socket en la lista que se obtiene con getaddrinfo() */
@@ -44,7 +124,7 @@ char* getip(char* ip, size_t len) {
     };
 
     /* Obtenemos las estructuras con direcciones de internet a las que preguntar por nuestra IP */
-    if ( (status = getaddrinfo(NODE_NAME, SERVICE, &hints, &result)) ) {
+    if ( (status = getaddrinfo(node, service, &hints, &result)) ) {
         fprintf(stderr, "Error al obtener la información del servidor: %s\n", gai_strerror(status));
         return NULL;
     }
@@ -54,34 +134,251 @@ char* getip(char* ip, size_t len) {
     for (rp = result; rp != NULL; rp = rp->ai_next) {
         if ( (sockfd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol)) < 0) continue;   /* Esta dirección no permite crear el socket */
 
+        /* Acotar la espera: el plazo de envío también se aplica a connect() */
+        setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
         if (connect(sockfd, rp->ai_addr, rp->ai_addrlen) == 0) break; /* Conectado con éxito */
 
         close(sockfd);  /* Cerrar el socket si no se pudo conectar */
     }
+    freeaddrinfo(result);
 
     if (!rp) {
-        fprintf(stderr, "No se pudo conectar a %s\n", NODE_NAME);
+        fprintf(stderr, "No se pudo conectar a %s\n", node);
         return NULL;
     }
 
     /* Ya estamos conectados a ipify.org. Ahora tenemos que enviarle la petición
-     * HTTP y procesar la respuesta */
-    if (send(sockfd, http_request, strlen(http_request) + 1, 0) == 0 ) {    /* No se envió ningún byte */
-        perror("No se pudo enviar la petición de http");
-        return NULL;
+     * HTTP y procesar la respuesta. send() puede enviar solo una parte */
+    request_len = snprintf(http_request, REQUEST_LEN, "GET / HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n", node);
+    while (total < request_len) {
+        if ( (bytes = send(sockfd, http_request + total, request_len - total, MSG_NOSIGNAL)) < 0 ) {
+            if (errno == EINTR) continue;
+            perror("No se pudo enviar la petición de http");
+            close(sockfd);
+            return NULL;
+        }
+        total += bytes;
     }
 
-    if (recv(sockfd, input_buffer, BUFFER_LEN, 0) == 0 ) {      /* No se recibió ningún byte */
-        perror("No se pudo recibir la respuesta de http");
+    /* La respuesta puede llegar en varios trozos: se lee hasta que el servidor cierre la conexión */
+    total = 0;
+    while (total < BUFFER_LEN - 1) {
+        if ( (bytes = recv(sockfd, input_buffer + total, BUFFER_LEN - 1 - total, 0)) < 0 ) {
+            if (errno == EINTR) continue;
+            perror("No se pudo recibir la respuesta de http");
+            close(sockfd);
+            return NULL;
+        }
+        if (bytes == 0) break;
+        total += bytes;
+    }
+    input_buffer[total] = '\0';
+    close(sockfd);
+
+    /* Solo sirve una respuesta correcta (código 200) */
+    if (strncmp(input_buffer, "HTTP/1.", 7) || strncmp(input_buffer + 8, " 200", 4)) {
+        fprintf(stderr, "Respuesta de http inesperada de %s\n", node);
         return NULL;
     }
 
-    /* Parsear el input_buffer hasta encontrar dos saltos de línea seguidos */
     /* Buscamos la primera aparición de dos saltos de línea, que indica que inicia el cuerpo del mensaje, que solo
      * contiene nuestra IP externa */
-    strncpy(ip, strstr(input_buffer, "\r\n\r\n") + 4, len);
+    if ( !(body = strstr(input_buffer, "\r\n\r\n")) ) {
+        fprintf(stderr, "Respuesta de http incompleta de %s\n", node);
+        return NULL;
+    }
+    body += 4;
+    for (end = body; *end && !isspace((unsigned char) *end); end++);
+    *end = '\0';
+
+    if (!valid_ip(body) || (size_t) (end - body) >= len) {
+        fprintf(stderr, "La respuesta de %s no contiene una IP válida\n", node);
+        return NULL;
+    }
+    strcpy(ip, body);
+
+    return ip;
+}
+
+
+/**
+ * @brief   Obtiene la IP externa guardada en la caché, si todavía es válida.
+ *
+ * @param ip    String en la que guardar la dirección IP.
+ * @param len   Longitud de la string ip.
+ *
+ * @return  Puntero a la string de destino ip, o NULL si no hay caché o ya caducó.
+ */
+char* getip_cached(char* ip, size_t len) {
+    char path[BUFFER_LEN];
+    char buffer[INET6_ADDRSTRLEN + 2] = {0};
+    struct stat info;
+    FILE* fp;
+    long ttl = atol(env_or("GETIP_TTL", "-1"));
+
+    if (ttl < 0) ttl = GETIP_CACHE_TTL;
+    if (!cache_path(path, BUFFER_LEN) || !(fp = fopen(path, "r"))) return NULL;
+
+    /* La fecha de modificación del fichero es la de la última consulta */
+    if (fstat(fileno(fp), &info) < 0 || time(NULL) - info.st_mtime > ttl || !fgets(buffer, sizeof(buffer), fp)) {
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+
+    buffer[strcspn(buffer, "\r\n")] = '\0';
+    if (!valid_ip(buffer) || strlen(buffer) >= len) return NULL;
+    strcpy(ip, buffer);
+
+    return ip;
+}
+
+
+/**
+ * @brief   Guarda la IP externa en la caché.
+ *
+ * @param ip    IP a guardar.
+ */
+void getip_store(const char* ip) {
+    char path[BUFFER_LEN], temporary[BUFFER_LEN + 32];
+    FILE* fp;
+
+    if (!cache_path(path, BUFFER_LEN)) return;
+
+    /* Se escribe en un fichero temporal y se renombra, para que otro proceso nunca lea la caché a medias */
+    snprintf(temporary, sizeof(temporary), "%s.%ld", path, (long) getpid());
+    if ( !(fp = fopen(temporary, "w")) ) {
+        perror("No se pudo crear la caché de la IP externa");
+        return;
+    }
+    if (fprintf(fp, "%s\n", ip) < 0 || fclose(fp) || rename(temporary, path)) {
+        perror("No se pudo guardar la caché de la IP externa");
+        unlink(temporary);
+    }
+}
+
 
-    freeaddrinfo(result);    
+/**
+ * @brief   Obtiene una IP de las interfaces de red locales, sin acceder a la red.
+ *
+ * @param ip    String en la que guardar la dirección IP.
+ * @param len   Longitud de la string ip.
+ *
+ * @return  Puntero a la string de destino ip, o NULL en caso de error.
+ */
+char* getip_local(char* ip, size_t len) {
+    struct ifaddrs *interfaces, *it, *chosen = NULL;
+
+    if (getifaddrs(&interfaces) < 0) {
+        perror("No se pudieron obtener las interfaces de red");
+        return NULL;
+    }
+
+    for (it = interfaces; it; it = it->ifa_next) {
+        if (!it->ifa_addr || it->ifa_addr->sa_family != AF_INET || !(it->ifa_flags & IFF_UP)) continue;
+        if (!(it->ifa_flags & IFF_LOOPBACK)) {
+            chosen = it;
+            break;
+        }
+        if (!chosen) chosen = it;   /* La de loopback solo si no aparece otra */
+    }
+
+    if (!chosen || !inet_ntop(AF_INET, &((struct sockaddr_in *) chosen->ifa_addr)->sin_addr, ip, len)) {
+        freeifaddrs(interfaces);
+        return NULL;
+    }
+    freeifaddrs(interfaces);
 
     return ip;
 }
+
+
+/**
+ * @brief   Libera la consulta si ya nadie la usa.
+ *
+ * @param lookup    Consulta.
+ */
+static void lookup_unref(IpLookup* lookup) {
+    if (__atomic_sub_fetch(&lookup->refs, 1, __ATOMIC_ACQ_REL) == 0) free(lookup);
+}
+
+
+/**
+ * @brief   Función del hilo de la consulta en segundo plano.
+ *
+ * @param arg   Puntero a la consulta.
+ *
+ * @return  NULL.
+ */
+static void* lookup_main(void* arg) {
+    IpLookup* lookup = (IpLookup *) arg;
+    int state = LOOKUP_FAILED;
+
+    if (getip(lookup->ip, sizeof(lookup->ip))) {
+        getip_store(lookup->ip);
+        state = LOOKUP_READY;
+    }
+    /* Publicar el resultado: la IP queda escrita antes de que se vea el estado */
+    __atomic_store_n(&lookup->state, state, __ATOMIC_RELEASE);
+    lookup_unref(lookup);
+
+    return NULL;
+}
+
+
+/**
+ * @brief   Empieza a consultar la IP externa en un hilo aparte.
+ *
+ * @return  Consulta en curso, o NULL si no se pudo crear el hilo.
+ */
+IpLookup* getip_async(void) {
+    IpLookup* lookup;
+    pthread_t thread;
+
+    if ( !(lookup = (IpLookup *) calloc(1, sizeof(IpLookup))) ) return NULL;
+    lookup->state = LOOKUP_PENDING;
+    lookup->refs = 2;
+
+    if (pthread_create(&thread, NULL, lookup_main, lookup)) {
+        free(lookup);
+        return NULL;
+    }
+    pthread_detach(thread);     /* Nadie espera al hilo: puede seguir si el programa termina antes */
+
+    return lookup;
+}
+
+
+/**
+ * @brief   Comprueba, sin bloquearse, si terminó una consulta en segundo plano.
+ *
+ * @param lookup    Consulta.
+ * @param ip        String en la que guardar la dirección IP si ya se obtuvo.
+ * @param len       Longitud de la string ip.
+ *
+ * @return  1 si se obtuvo la IP, 0 si la consulta sigue en curso y -1 si falló.
+ */
+int getip_poll(IpLookup* lookup, char* ip, size_t len) {
+    switch (__atomic_load_n(&lookup->state, __ATOMIC_ACQUIRE)) {
+        case LOOKUP_PENDING:
+            return 0;
+        case LOOKUP_READY:
+            if (strlen(lookup->ip) >= len) return -1;
+            strcpy(ip, lookup->ip);
+            return 1;
+        default:
+            return -1;
+    }
+}
+
+
+/**
+ * @brief   Abandona una consulta en segundo plano.
+ *
+ * @param lookup    Consulta.
+ */
+void getip_release(IpLookup* lookup) {
+    lookup_unref(lookup);
+}
@@ -6,12 +6,35 @@
 /* Nombre de la pagína web que proporciona la IP pública */
 #define NODE_NAME "api.ipify.org"
 
+/* Servicio (o puerto) de la página web */
+#define SERVICE "http"
+
+/* Segundos durante los que la IP guardada en la caché se considera válida */
+#define GETIP_CACHE_TTL 3600
+
+/* Segundos máximos de espera al conectar, enviar o recibir en la consulta HTTP */
+#define GETIP_TIMEOUT 3
+
+/*
+ * Variables de entorno que cambian el comportamiento por defecto:
+ *  GETIP_HOST   Servidor HTTP al que preguntar en lugar de NODE_NAME (por ejemplo, un servidor local de pruebas).
+ *  GETIP_PORT   Servicio o puerto de ese servidor en lugar de SERVICE.
+ *  GETIP_CACHE  Fichero de la caché en lugar de $HOME/.getip_cache (vacío para no usar caché).
+ *  GETIP_TTL    Validez de la caché en segundos en lugar de GETIP_CACHE_TTL.
+ */
+
+/**
+ * Consulta de la IP externa en segundo plano. Solo se maneja a través de punteros.
+ */
+typedef struct IpLookup IpLookup;
+
+
 /**
  * @brief   Obtiene la IP externa
  *
  * Envía una petición HTTP a la página web api.ipify.org, <url>https://ipify.org</url>, para obtener la dirección
- * IP externa con la que el equipo se conecta a internet. 
- * 
+ * IP externa con la que el equipo se conecta a internet. La respuesta se lee entera aunque llegue en varios trozos.
+ *
  * @param ip    String en la que guardar la dirección IP obtenida.
  * @param len   Longitud de la string ip. Para asegurarse de que la IP cabe entera, debería ser por lo menos INET_ADDRSTRLEN.
  *
@@ -19,6 +42,67 @@
  */
 char* getip(char* ip, size_t len);
 
+/**
+ * @brief   Obtiene la IP externa guardada en la caché, si todavía es válida.
+ *
+ * @param ip    String en la que guardar la dirección IP.
+ * @param len   Longitud de la string ip.
+ *
+ * @return  Puntero a la string de destino ip, o NULL si no hay caché o ya caducó.
+ */
+char* getip_cached(char* ip, size_t len);
 
-#endif /* GETIP_H */
+/**
+ * @brief   Guarda la IP externa en la caché.
+ *
+ * El fichero se reemplaza de forma atómica, así que nunca se lee a medio escribir.
+ *
+ * @param ip    IP a guardar.
+ */
+void getip_store(const char* ip);
 
+/**
+ * @brief   Obtiene una IP de las interfaces de red locales, sin acceder a la red.
+ *
+ * Devuelve la primera dirección IPv4 de una interfaz activa que no sea de loopback,
+ * o la de loopback si no hay otra.
+ *
+ * @param ip    String en la que guardar la dirección IP.
+ * @param len   Longitud de la string ip.
+ *
+ * @return  Puntero a la string de destino ip, o NULL en caso de error.
+ */
+char* getip_local(char* ip, size_t len);
+
+/**
+ * @brief   Empieza a consultar la IP externa en un hilo aparte.
+ *
+ * Si la consulta tiene éxito, además se guarda el resultado en la caché.
+ *
+ * @return  Consulta en curso, o NULL si no se pudo crear el hilo.
+ */
+IpLookup* getip_async(void);
+
+/**
+ * @brief   Comprueba, sin bloquearse, si terminó una consulta en segundo plano.
+ *
+ * @param lookup    Consulta.
+ * @param ip        String en la que guardar la dirección IP si ya se obtuvo.
+ * @param len       Longitud de la string ip.
+ *
+ * @return  1 si se obtuvo la IP, 0 si la consulta sigue en curso y -1 si falló.
+ */
+int getip_poll(IpLookup* lookup, char* ip, size_t len);
+
+/**
+ * @brief   Abandona una consulta en segundo plano.
+ *
+ * No espera a que termine: la memoria de la consulta la libera el último de los dos
+ * (el llamante o el hilo) que deje de usarla.
+ *
+ * @param lookup    Consulta.
+ */
+void getip_release(IpLookup* lookup);
+
+
+#endif /* GETIP_H */
@@ -0,0 +1,55 @@
+#include <string.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#include "gso.h"
+
+/* Por si las cabeceras de la libc son anteriores a la segmentación UDP (Linux 4.18 y 5.0) */
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+
+int gso_enable(int socket, int gro) {
+    int enable = 1, segment = 0;
+    socklen_t len = sizeof(segment);
+
+    /* Leer UDP_SEGMENT falla con ENOPROTOOPT si el kernel no la conoce */
+    if (getsockopt(socket, SOL_UDP, UDP_SEGMENT, &segment, &len) < 0) return -1;
+
+    return gro ? setsockopt(socket, SOL_UDP, UDP_GRO, &enable, sizeof(enable)) : 0;
+}
+
+
+void gso_set_segment(struct msghdr* msg, char* control, uint16_t segment) {
+    struct cmsghdr* cmsg;
+
+    msg->msg_control = control;
+    msg->msg_controllen = GSO_CONTROL_LEN;
+    cmsg = CMSG_FIRSTHDR(msg);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(segment));
+    memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+}
+
+
+size_t gso_read_segment(struct msghdr* msg) {
+    struct cmsghdr* cmsg;
+    int segment;
+
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            memcpy(&segment, CMSG_DATA(cmsg), sizeof(segment));
+            return segment;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,57 @@
+#ifndef GSO_H
+#define GSO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+/* Segmentos como mucho por envío segmentado (UDP_MAX_SEGMENTS del kernel) */
+#define GSO_MAX_SEGMENTS 64
+
+/* Bytes como mucho de un envío segmentado o de una recepción agregada: los de un datagrama IPv4 */
+#define GSO_MAX_BYTES (65535 - 20 - 8)
+
+/* Espacio para el mensaje de control con el tamaño de segmento de un envío (UDP_SEGMENT) */
+#define GSO_CONTROL_LEN CMSG_SPACE(sizeof(uint16_t))
+
+/* Espacio para el mensaje de control con el tamaño de segmento de una recepción agregada (UDP_GRO) */
+#define GRO_CONTROL_LEN CMSG_SPACE(sizeof(int))
+
+
+/**
+ * @brief   Prepara un socket UDP para segmentar al enviar y, opcionalmente, agregar al recibir.
+ *
+ * Comprueba que el kernel admite UDP_SEGMENT y, si se pide, activa UDP_GRO, de modo que el kernel
+ * entrega juntos los datagramas consecutivos del mismo emisor y tamaño (ver gso_read_segment). Solo
+ * debe activarse la agregación si los buffers de recepción tienen sitio para GSO_MAX_BYTES bytes.
+ *
+ * @param socket    Socket UDP.
+ * @param gro       Distinto de 0 para activar también la agregación.
+ *
+ * @return  0 si el kernel admite lo pedido, -1 si no (con errno).
+ */
+int gso_enable(int socket, int gro);
+
+/**
+ * @brief   Pide al kernel que divida un envío en segmentos de segment bytes.
+ *
+ * Cada segmento sale como un datagrama independiente; todos deben medir segment bytes, salvo el
+ * último, que puede ser más corto. Como mucho GSO_MAX_SEGMENTS segmentos y GSO_MAX_BYTES bytes.
+ *
+ * @param msg       Cabecera del envío; se apunta su control a control.
+ * @param control   Buffer de GSO_CONTROL_LEN bytes para el mensaje de control, que debe existir hasta el envío.
+ * @param segment   Tamaño de cada segmento.
+ */
+void gso_set_segment(struct msghdr* msg, char* control, uint16_t segment);
+
+/**
+ * @brief   Lee el tamaño de segmento de una recepción agregada.
+ *
+ * @param msg   Cabecera de la recepción, con sus mensajes de control.
+ *
+ * @return  Tamaño de cada datagrama agregado (el último puede ser más corto), o 0 si se recibió un solo datagrama.
+ */
+size_t gso_read_segment(struct msghdr* msg);
+
+
+#endif  /* GSO_H */
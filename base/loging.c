@@ -3,34 +3,263 @@
 #include <unistd.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
 #include <sys/time.h>
 
 #include "loging.h"
 
 #define BUFFER_LEN 128
+#define SPEC_LEN 16             /* Longitud máxima de una conversión del formato, como "%-08llx" */
+#define DRAIN_INTERVAL 1000000  /* Espera del hilo de fondo cuando no hay registros (ns) */
+
+/* String en memoria estática a devolver por la función identify, una por hilo */
+static __thread char identify_buffer[BUFFER_LEN];
+static __thread time_t identify_second = -1;   /* Segundo para el que está formateado el principio de identify_buffer */
+static __thread size_t identify_prefix_len;    /* Longitud de ese principio (fecha y hora sin los microsegundos) */
+
+/**
+ * Registro binario de un evento, tal como lo guarda el hilo que lo produce.
+ */
+typedef struct {
+    uint64_t timestamp;             /* Instante del evento (ns, CLOCK_REALTIME) */
+    const char* format;             /* Formato del mensaje (un literal) */
+    uint64_t args[LOG_MAX_ARGS];    /* Argumentos enteros */
+    uint8_t level;                  /* Nivel del evento */
+    uint8_t n_args;                 /* Número de argumentos */
+    uint16_t text_len;              /* Bytes de texto guardados */
+    char text[LOG_TEXT_LEN];        /* Texto para el %s del formato */
+} LogRecord;
+
+/**
+ * Anillo de registros de un hilo. Solo escribe en él su hilo y solo lee de él el hilo de fondo,
+ * así que basta con dos índices atómicos (en líneas de caché distintas) y no hace falta ningún cerrojo.
+ */
+typedef struct LogRing {
+    LogRecord records[LOG_RING_SIZE];
+    unsigned int head __attribute__((aligned(64)));     /* Siguiente registro a leer (hilo de fondo) */
+    unsigned int tail __attribute__((aligned(64)));     /* Siguiente registro a escribir (hilo dueño) */
+    unsigned long dropped;          /* Eventos descartados por tener el anillo lleno */
+    struct LogRing* next;           /* Siguiente anillo de la lista global */
+} LogRing;
+
+int log_threshold = -1;             /* Hasta llamar a log_init no se registra nada */
+unsigned int log_sample_rate = 1;
+
+static __thread LogRing* own_ring;  /* Anillo del hilo, creado en su primer evento */
+static LogRing* rings;              /* Lista de todos los anillos */
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;  /* Solo protege altas en la lista */
+static FILE* log_output;
+static pthread_t drainer;
+static int running;                 /* Distinto de 0 mientras el hilo de fondo deba seguir (acceso atómico) */
+
+static const char* level_names[] = { "ERROR", "AVISO", "INFO", "DEPURACIÓN" };
 
-/* String global en memoria estática a devolver por la función identify */
-char identify_buffer[BUFFER_LEN];
 
 /**
  * @brief   Devuelve una string formateada para identificar cuándo se produce un evento.
  *
  * Devuelve una string propiamente formateada con el instante temporal en que se invoca
  * y el PID del proceso que la llama. Sirve para identificar y localizar temporalmente las acciones.
+ * La fecha y la hora solo se vuelven a formatear cuando cambia el segundo.
  *
  * @return  String con el instante de tiempo en el momento de ejecución y el PID del proceso que la invoca.
  */
 char* identify(void) {
     struct timeval current_time;
-    struct tm* timestamp;
-    
+    struct tm timestamp;
+
     if (gettimeofday(&current_time, NULL) == -1)
         perror("No se pudo obtener el tiempo");
 
-    timestamp = localtime(&(current_time.tv_sec));
+    if (current_time.tv_sec != identify_second) {
+        localtime_r(&current_time.tv_sec, &timestamp);
+        identify_prefix_len = strftime(identify_buffer, BUFFER_LEN, ANSI_COLOR_CYAN "[%a, %d %b %Y, %H:%M:%S.", &timestamp);
+        identify_second = current_time.tv_sec;
+    }
+    snprintf(identify_buffer + identify_prefix_len, BUFFER_LEN - identify_prefix_len, "%06lu; PID=%d]" ANSI_COLOR_RESET,
+            (unsigned long) current_time.tv_usec, getpid());   /* Añadimos al final los microsegundos y el PID */
 
-    strftime(identify_buffer, BUFFER_LEN, ANSI_COLOR_CYAN "[%a, %d %b %Y, %H:%M:%S.", timestamp);
-    sprintf(identify_buffer + strlen(identify_buffer), "%06lu; PID=%d]" ANSI_COLOR_RESET, current_time.tv_usec, getpid());   /* Añadimos al final los microsegundos y el PID */
-    
     return identify_buffer;
 }
+
+
+void log_push(int level, const char* format, const char* text, size_t text_len, const uint64_t* args, size_t n_args) {
+    LogRing* ring = own_ring;
+    LogRecord* record;
+    struct timespec now;
+    unsigned int tail;
+
+    if (!ring) {
+        /* Primer evento del hilo: se crea su anillo y se añade a la lista */
+        if ( !(ring = (LogRing *) calloc(1, sizeof(LogRing))) ) return;
+        pthread_mutex_lock(&rings_lock);
+        ring->next = rings;
+        rings = ring;
+        pthread_mutex_unlock(&rings_lock);
+        own_ring = ring;
+    }
+
+    tail = ring->tail;
+    if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == LOG_RING_SIZE) {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);   /* Lleno: se descarta antes que bloquear */
+        return;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    record = &ring->records[tail & (LOG_RING_SIZE - 1)];
+    record->timestamp = now.tv_sec * 1000000000ULL + now.tv_nsec;
+    record->format = format;
+    record->level = level;
+    record->n_args = n_args < LOG_MAX_ARGS ? n_args : LOG_MAX_ARGS;
+    memcpy(record->args, args, record->n_args * sizeof(uint64_t));
+    record->text_len = 0;
+    if (text) {
+        record->text_len = text_len < LOG_TEXT_LEN - 1 ? text_len : LOG_TEXT_LEN - 1;
+        memcpy(record->text, text, record->text_len);
+    }
+
+    /* Publicar el registro: su contenido queda escrito antes de que el hilo de fondo vea el índice */
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * @brief   Escribe un registro formateado en el fichero de salida.
+ *
+ * El principio de la línea (fecha y hora hasta los segundos) se guarda y solo se vuelve
+ * a formatear cuando cambia el segundo.
+ *
+ * @param record    Registro a escribir.
+ */
+static void write_record(const LogRecord* record) {
+    static time_t prefix_second = -1;
+    static char prefix[BUFFER_LEN];
+    static pid_t pid;
+    time_t second = record->timestamp / 1000000000ULL;
+    struct tm timestamp;
+    const char *p, *next;
+    char spec[SPEC_LEN];
+    size_t spec_len;
+    unsigned int arg = 0;
+    uint64_t value;
+
+    if (second != prefix_second) {
+        localtime_r(&second, &timestamp);
+        strftime(prefix, BUFFER_LEN, ANSI_COLOR_CYAN "[%a, %d %b %Y, %H:%M:%S.", &timestamp);
+        prefix_second = second;
+        pid = getpid();
+    }
+    fprintf(log_output, "%s%06lu; PID=%d]" ANSI_COLOR_RESET " %s: ", prefix,
+            (unsigned long) (record->timestamp % 1000000000ULL / 1000), pid, level_names[record->level]);
+
+    /* Interpretar el formato: el texto va en %s y los argumentos enteros, en orden, en el resto de conversiones */
+    for (p = record->format; *p; p = next) {
+        if (*p != '%') {
+            if ( !(next = strchr(p, '%')) ) next = p + strlen(p);
+            fwrite(p, 1, next - p, log_output);
+            continue;
+        }
+        if (p[1] == '%') {
+            fputc('%', log_output);
+            next = p + 2;
+            continue;
+        }
+
+        /* Copiar banderas, anchura y precisión, saltar el modificador de longitud y poner siempre "ll" */
+        spec_len = strspn(p + 1, "-+ #0123456789.");
+        next = p + 1 + spec_len;
+        next += strspn(next, "hlLqjzt");
+        if (!*next) break;
+
+        if (*next == 's') {
+            /* Sin el salto de línea final, que ya pone el propio registro */
+            fwrite(record->text, 1, record->text_len - (record->text_len && record->text[record->text_len - 1] == '\n'), log_output);
+        } else if (arg < record->n_args && strchr("diouxXc", *next)) {
+            value = record->args[arg++];
+            if (*next == 'c') {
+                fputc((int) value, log_output);
+            } else if (spec_len + 5 <= SPEC_LEN) {
+                snprintf(spec, SPEC_LEN, "%%%.*sll%c", (int) spec_len, p + 1, *next);
+                if (*next == 'd' || *next == 'i') fprintf(log_output, spec, (long long) value);
+                else fprintf(log_output, spec, (unsigned long long) value);
+            }
+        }
+        next++;
+    }
+    fputc('\n', log_output);
+}
+
+
+/**
+ * @brief   Vacía todos los anillos.
+ *
+ * @return  Número de registros escritos.
+ */
+static unsigned long drain_rings(void) {
+    LogRing* ring;
+    unsigned int head, tail;
+    unsigned long written = 0;
+
+    pthread_mutex_lock(&rings_lock);
+    ring = rings;
+    pthread_mutex_unlock(&rings_lock);
+
+    /* Los anillos nunca se quitan de la lista mientras el hilo de fondo está activo */
+    for (; ring; ring = ring->next) {
+        head = ring->head;
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++, written++) write_record(&ring->records[head & (LOG_RING_SIZE - 1)]);
+        __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+    }
+    if (written) fflush(log_output);
+
+    return written;
+}
+
+
+/**
+ * @brief   Función del hilo de fondo: vacía los anillos y, si no había nada, espera un poco.
+ *
+ * @param arg   No se usa.
+ *
+ * @return  NULL.
+ */
+static void* drainer_main(void* arg) {
+    struct timespec pause = { .tv_sec = 0, .tv_nsec = DRAIN_INTERVAL };
+
+    while (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        if (!drain_rings()) nanosleep(&pause, NULL);
+    }
+
+    return NULL;
+}
+
+
+void log_init(FILE* output, int level, unsigned int sample) {
+    log_output = output;
+    log_sample_rate = sample ? sample : 1;
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&drainer, NULL, drainer_main, NULL)) fail("No se pudo crear el hilo de registro");
+    log_threshold = level;
+}
+
+
+void log_shutdown(void) {
+    LogRing* ring;
+    unsigned long dropped = 0;
+
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) return;
+    log_threshold = -1;
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    if (pthread_join(drainer, NULL)) fail("No se pudo esperar al hilo de registro");
+    drain_rings();  /* Lo que quedase desde la última pasada */
+
+    while ( (ring = rings) ) {
+        rings = ring->next;
+        dropped += ring->dropped;
+        free(ring);
+    }
+    own_ring = NULL;
+    if (dropped) fprintf(log_output, "Registro: %lu eventos descartados por tener el anillo lleno\n", dropped);
+    fflush(log_output);
+}
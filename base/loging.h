@@ -2,6 +2,8 @@
 #define LOGING_H
 
 #include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
 
 /* Colores estándar de ANSI para impresión */
 #define ANSI_COLOR_RED     "\x1b[31m"
@@ -33,11 +35,84 @@
  *
  * Devuelve una string propiamente formateada con el instante temporal en que se invoca
  * y el PID del proceso que la llama. Sirve para identificar y localizar temporalmente las acciones.
- * La string devuelta está alojada estáticamente, por lo que no hace falta liberarla, pero se sobrescribe en
- * sucesivas llamadas.
+ * La string devuelta está alojada estáticamente (una por hilo), por lo que no hace falta liberarla, pero se
+ * sobrescribe en sucesivas llamadas del mismo hilo.
  *
  * @return  String con el instante de tiempo en el momento de ejecución y el PID del proceso que la invoca.
  */
 char* identify(void);
 
+
+/*
+ * Registro asíncrono de eventos.
+ *
+ * Cada hilo escribe sus eventos como registros binarios de tamaño fijo en su propio anillo, sin cerrojos
+ * ni llamadas al sistema: solo guarda la hora, el formato (que debe ser un literal) y los argumentos.
+ * Un hilo de fondo vacía los anillos y les da formato. Si un anillo está lleno, el evento se descarta
+ * (y se cuenta) en lugar de detener al hilo que lo registra.
+ *
+ * Los argumentos del formato solo pueden ser enteros (con cualquier conversión entera: %d, %u, %x...),
+ * más como mucho un texto, que se pasa aparte y se imprime en el lugar de %s (truncado a LOG_TEXT_LEN - 1 bytes).
+ */
+
+/* Niveles de registro, de más a menos importante */
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN  1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_DEBUG 3
+
+#define LOG_RING_SIZE 1024      /* Registros de cada anillo (potencia de 2) */
+#define LOG_MAX_ARGS 4          /* Argumentos enteros máximos por registro */
+#define LOG_TEXT_LEN 64         /* Bytes de texto guardados por registro, con el '\0' */
+
+/* Nivel máximo que se registra y frecuencia del muestreo (1 de cada log_sample_rate eventos) */
+extern int log_threshold;
+extern unsigned int log_sample_rate;
+
+/* Macro para saber si un nivel se registra, antes de preparar los argumentos */
+#define log_enabled(level) ((level) <= log_threshold)
+
+/* Macro para registrar un evento con un texto opcional (NULL si no hay) y argumentos enteros */
+#define log_event(level, text, text_len, format, ...) do { \
+        if (log_enabled(level)) { \
+            const uint64_t log_args_[] = { 0, ##__VA_ARGS__ }; \
+            log_push((level), (format), (text), (text_len), log_args_ + 1, sizeof(log_args_) / sizeof(uint64_t) - 1); \
+        } \
+    } while (0)
+
+/* Macro para registrar solo uno de cada log_sample_rate eventos de este punto del código (y de este hilo) */
+#define log_sampled(level, text, text_len, format, ...) do { \
+        static __thread unsigned long log_seen_; \
+        if (log_enabled(level) && log_seen_++ % log_sample_rate == 0) log_event(level, text, text_len, format, ##__VA_ARGS__); \
+    } while (0)
+
+
+/**
+ * @brief   Arranca el hilo que vacía los anillos de registro.
+ *
+ * @param output    Fichero en el que escribir los eventos.
+ * @param level     Nivel máximo que se registra (LOG_LEVEL_*).
+ * @param sample    Frecuencia del muestreo de log_sampled (1 para registrar todos los eventos).
+ */
+void log_init(FILE* output, int level, unsigned int sample);
+
+/**
+ * @brief   Guarda un evento en el anillo del hilo que llama. Se usa a través de log_event y log_sampled.
+ *
+ * @param level     Nivel del evento.
+ * @param format    Formato, que debe seguir existiendo hasta que se vacíe el registro (un literal).
+ * @param text      Texto para el %s del formato, o NULL.
+ * @param text_len  Longitud del texto.
+ * @param args      Argumentos enteros del formato.
+ * @param n_args    Número de argumentos (como mucho LOG_MAX_ARGS).
+ */
+void log_push(int level, const char* format, const char* text, size_t text_len, const uint64_t* args, size_t n_args);
+
+/**
+ * @brief   Vacía los anillos pendientes, detiene el hilo de fondo y libera los anillos.
+ *
+ * Debe llamarse cuando ningún otro hilo vaya a registrar más eventos.
+ */
+void log_shutdown(void);
+
 #endif /* LOGING_H */
@@ -0,0 +1,184 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+#define EXTENDED 15     /* Valor de una longitud del byte de control que sigue en bytes adicionales */
+
+
+/**
+ * @brief   Lee 4 bytes sin requisitos de alineamiento.
+ */
+static uint32_t read32(const unsigned char* p) {
+    uint32_t value;
+
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+
+/**
+ * @brief   Calcula el hash de 4 bytes (multiplicativo de Knuth), para buscar coincidencias anteriores.
+ */
+static unsigned int hash4(uint32_t value) {
+    return (value * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+
+/**
+ * @brief   Escribe la parte de una longitud que no cabe en el byte de control.
+ *
+ * @param op        Posición en la que escribir.
+ * @param op_end    Final del buffer.
+ * @param len       Longitud restante (ya descontados los 15 del byte de control).
+ *
+ * @return  Posición siguiente a lo escrito, o NULL si no cabe.
+ */
+static unsigned char* write_length(unsigned char* op, const unsigned char* op_end, size_t len) {
+    for (; len >= 255; len -= 255) {
+        if (op == op_end) return NULL;
+        *op++ = 255;
+    }
+    if (op == op_end) return NULL;
+    *op++ = len;
+
+    return op;
+}
+
+
+/**
+ * @brief   Escribe una secuencia: literales y, si match_len no es 0, una coincidencia.
+ *
+ * @param op            Posición en la que escribir.
+ * @param op_end        Final del buffer.
+ * @param literals      Literales de la secuencia.
+ * @param n_literals    Número de literales.
+ * @param offset        Distancia hacia atrás de la coincidencia.
+ * @param match_len     Longitud de la coincidencia, o 0 en la última secuencia.
+ *
+ * @return  Posición siguiente a lo escrito, o NULL si no cabe.
+ */
+static unsigned char* write_sequence(unsigned char* op, const unsigned char* op_end, const unsigned char* literals, size_t n_literals,
+        size_t offset, size_t match_len) {
+    unsigned char* token = op++;
+    size_t extra = match_len ? match_len - LZ_MIN_MATCH : 0;
+
+    if (token >= op_end) return NULL;
+    *token = (n_literals < EXTENDED ? n_literals : EXTENDED) << 4 | (extra < EXTENDED ? extra : EXTENDED);
+    if (n_literals >= EXTENDED && !(op = write_length(op, op_end, n_literals - EXTENDED))) return NULL;
+    if (op_end - op < n_literals) return NULL;
+    memcpy(op, literals, n_literals);
+    op += n_literals;
+    if (!match_len) return op;
+
+    if (op_end - op < 2) return NULL;
+    *op++ = offset & 0xFF;
+    *op++ = offset >> 8;
+    if (extra >= EXTENDED && !(op = write_length(op, op_end, extra - EXTENDED))) return NULL;
+
+    return op;
+}
+
+
+size_t lz_compress(const char* source, size_t len, char* destination, size_t capacity) {
+    const unsigned char* src = (const unsigned char *) source;
+    const unsigned char* src_end = src + len;
+    const unsigned char *ip = src, *anchor = src, *match;
+    unsigned char* op = (unsigned char *) destination;
+    const unsigned char* op_end = op + capacity;
+    uint16_t table[1 << LZ_HASH_BITS];     /* Última posición (más 1) con cada hash, o 0 */
+    unsigned int hash, candidate;
+    size_t match_len;
+
+    if (len > LZ_MAX_INPUT) return 0;
+    memset(table, 0, sizeof(table));
+
+    /* Buscar en cada posición la anterior con el mismo hash; si los 4 bytes coinciden, alargar la coincidencia */
+    while (len >= LZ_MIN_MATCH && ip <= src_end - LZ_MIN_MATCH) {
+        hash = hash4(read32(ip));
+        candidate = table[hash];
+        table[hash] = ip - src + 1;
+        match = src + candidate - 1;
+        if (!candidate || read32(match) != read32(ip)) {
+            ip++;
+            continue;
+        }
+
+        for (match_len = LZ_MIN_MATCH; ip + match_len < src_end && match[match_len] == ip[match_len]; match_len++);
+        if ( !(op = write_sequence(op, op_end, anchor, ip - anchor, ip - match, match_len)) ) return 0;
+        ip += match_len;
+        anchor = ip;
+    }
+
+    /* Los últimos bytes van como literales */
+    if ( !(op = write_sequence(op, op_end, anchor, src_end - anchor, 0, 0)) ) return 0;
+
+    return op - (unsigned char *) destination;
+}
+
+
+/**
+ * @brief   Lee la parte de una longitud que no cabe en el byte de control, y la suma a len.
+ *
+ * @param ip    Posición de lectura, que se avanza.
+ * @param end   Final de los datos comprimidos.
+ * @param len   Longitud a completar.
+ * @param limit Longitud máxima con sentido (el espacio que queda en la salida).
+ *
+ * @return  0 si es válida, -1 si los datos se acaban o la longitud supera limit.
+ */
+static int read_length(const unsigned char** ip, const unsigned char* end, size_t* len, size_t limit) {
+    unsigned char byte;
+
+    do {
+        if (*ip == end) return -1;
+        byte = *(*ip)++;
+        *len += byte;
+        if (*len > limit) return -1;
+    } while (byte == 255);
+
+    return 0;
+}
+
+
+ssize_t lz_decompress(const char* source, size_t len, char* destination, size_t capacity) {
+    const unsigned char* ip = (const unsigned char *) source;
+    const unsigned char* end = ip + len;
+    unsigned char* dst = (unsigned char *) destination;
+    unsigned char* op = dst;
+    const unsigned char* op_end = dst + capacity;
+    const unsigned char* match;
+    unsigned int token;
+    size_t n, offset;
+
+    while (ip < end) {
+        token = *ip++;
+
+        /* Literales */
+        n = token >> 4;
+        if (n == EXTENDED && read_length(&ip, end, &n, op_end - op) < 0) return -1;
+        if (end - ip < n || op_end - op < n) return -1;
+        memcpy(op, ip, n);
+        ip += n;
+        op += n;
+        if (ip == end) break;   /* Última secuencia */
+
+        /* Coincidencia: puede solaparse con lo que copia, así que solo se copia de golpe si no lo hace */
+        if (end - ip < 2) return -1;
+        offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        n = token & 0x0F;
+        if (n == EXTENDED && read_length(&ip, end, &n, op_end - op) < 0) return -1;
+        n += LZ_MIN_MATCH;
+        if (!offset || offset > op - dst || op_end - op < n) return -1;
+        match = op - offset;
+        if (offset >= n) {
+            memcpy(op, match, n);
+            op += n;
+        } else {
+            while (n--) *op++ = *match++;
+        }
+    }
+
+    return op - dst;
+}
@@ -0,0 +1,55 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Longitud mínima de una coincidencia: las más cortas no ahorran nada frente a copiar los literales */
+#define LZ_MIN_MATCH 4
+
+/* Bits del hash de las posiciones ya vistas (la tabla ocupa 2^LZ_HASH_BITS entradas de 2 bytes) */
+#define LZ_HASH_BITS 12
+
+/* Tamaño máximo de los datos a comprimir: las posiciones y las distancias se guardan en 16 bits */
+#define LZ_MAX_INPUT 0xFFFE
+
+/* Longitud máxima de len bytes comprimidos, si no se encuentra ninguna coincidencia */
+#define LZ_BOUND(len) ((len) + (len) / 255 + 16)
+
+
+/**
+ * @brief   Comprime un bloque de datos con LZ77.
+ *
+ * El formato es una serie de secuencias, cada una con un byte de control (longitud de los literales
+ * en los 4 bits altos y de la coincidencia, menos LZ_MIN_MATCH, en los 4 bajos; 15 indica que la
+ * longitud sigue en bytes adicionales, sumando mientras valgan 255), los literales, y la distancia
+ * hacia atrás de la coincidencia en 2 bytes little endian. La última secuencia solo tiene literales.
+ * Cada bloque se comprime por separado, sin diccionario compartido, así que cada datagrama se
+ * puede descomprimir aunque se pierdan o desordenen los demás.
+ *
+ * @param source        Datos a comprimir.
+ * @param len           Longitud de los datos (como mucho LZ_MAX_INPUT).
+ * @param destination   Buffer en el que escribir los datos comprimidos.
+ * @param capacity      Tamaño del buffer. Con LZ_BOUND(len) bytes siempre caben.
+ *
+ * @return  Longitud de los datos comprimidos, o 0 si no caben en capacity bytes o len es demasiado grande.
+ */
+size_t lz_compress(const char* source, size_t len, char* destination, size_t capacity);
+
+/**
+ * @brief   Descomprime un bloque comprimido con lz_compress.
+ *
+ * Comprueba todas las longitudes y distancias, así que no lee ni escribe fuera de los buffers
+ * aunque los datos estén corruptos o sean malintencionados.
+ *
+ * @param source        Datos comprimidos.
+ * @param len           Longitud de los datos comprimidos.
+ * @param destination   Buffer en el que escribir los datos originales.
+ * @param capacity      Tamaño del buffer.
+ *
+ * @return  Longitud de los datos originales, o -1 si los datos no son válidos o no caben en capacity bytes.
+ */
+ssize_t lz_decompress(const char* source, size_t len, char* destination, size_t capacity);
+
+
+#endif  /* LZ_H */
@@ -0,0 +1,238 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "metrics.h"
+#include "loging.h"
+
+#define PATH_LEN 4096
+
+/* Macro para leer un contador que otro hilo puede estar modificando */
+#define metrics_get(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+/* Nombres de las etapas en el fichero de métricas */
+static const char* stage_names[METRICS_STAGES] = { "process", "send", "rtt", "queue", "service" };
+
+/* Estado del hilo exportador */
+static struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t stop;        /* Se señala para que el hilo termine sin esperar al siguiente intervalo */
+    int running;
+    char path[PATH_LEN];
+    MetricsSource* sources;
+    unsigned int n_sources;
+} exporter = { .lock = PTHREAD_MUTEX_INITIALIZER, .stop = PTHREAD_COND_INITIALIZER };
+
+
+int metrics_enable_drops(int socket) {
+    int enable = 1;
+
+    return setsockopt(socket, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable));
+}
+
+
+int metrics_enable_timestamps(int socket) {
+    int enable = 1;
+
+    return setsockopt(socket, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable));
+}
+
+
+uint64_t metrics_read_control(Metrics* metrics, struct msghdr* msg) {
+    struct cmsghdr* cmsg;
+    struct timespec arrival;
+    uint64_t arrival_ns = 0;
+    uint32_t drops;
+
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET) continue;
+        if (cmsg->cmsg_type == SO_RXQ_OVFL) {
+            memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+            if (drops != metrics->socket_drops) {
+                metrics_add(metrics->kernel_drops, drops - metrics->socket_drops);
+                metrics->socket_drops = drops;
+            }
+        } else if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            memcpy(&arrival, CMSG_DATA(cmsg), sizeof(arrival));
+            arrival_ns = arrival.tv_sec * 1000000000ULL + arrival.tv_nsec;
+        }
+    }
+
+    return arrival_ns;
+}
+
+
+void metrics_record(Histogram* histogram, uint64_t ns) {
+    unsigned int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+
+    if (bucket >= METRICS_BUCKETS) bucket = METRICS_BUCKETS - 1;
+    metrics_add(histogram->buckets[bucket], 1);
+    metrics_add(histogram->count, 1);
+    metrics_add(histogram->sum, ns);
+}
+
+
+void metrics_merge(Histogram* into, const Histogram* from) {
+    unsigned int bucket;
+
+    for (bucket = 0; bucket < METRICS_BUCKETS; bucket++) into->buckets[bucket] += metrics_get(from->buckets[bucket]);
+    into->count += metrics_get(from->count);
+    into->sum += metrics_get(from->sum);
+}
+
+
+uint64_t metrics_percentile(const Histogram* histogram, double p) {
+    uint64_t count = metrics_get(histogram->count), in_bucket, cumulative = 0;
+    double rank = p / 100 * count;
+    unsigned int bucket;
+
+    if (!count) return 0;
+    for (bucket = 0; bucket < METRICS_BUCKETS; bucket++) {
+        in_bucket = metrics_get(histogram->buckets[bucket]);
+        if (in_bucket && cumulative + in_bucket >= rank) break;
+        cumulative += in_bucket;
+    }
+    if (bucket == METRICS_BUCKETS) bucket = METRICS_BUCKETS - 1;
+
+    /* El cubo b cubre [2^b, 2^(b+1)) ns (el 0 empieza en 0) */
+    return (bucket ? 1ULL << bucket : 0) + (uint64_t) ((rank - cumulative) / (in_bucket ? in_bucket : 1) * ((bucket ? 1ULL << bucket : 2)));
+}
+
+
+/**
+ * @brief   Escribe un contador de todos los sockets.
+ *
+ * @param fp        Fichero en el que escribir.
+ * @param name      Nombre de la métrica.
+ * @param help      Descripción de la métrica.
+ * @param sources   Métricas.
+ * @param n_sources Número de métricas.
+ * @param offset    Posición del contador dentro de Metrics.
+ */
+static void write_counter(FILE* fp, const char* name, const char* help, const MetricsSource* sources, unsigned int n_sources, size_t offset) {
+    unsigned int i;
+
+    fprintf(fp, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+    for (i = 0; i < n_sources; i++) {
+        fprintf(fp, "%s{socket=\"%s\"} %llu\n", name, sources[i].name,
+                (unsigned long long) metrics_get(*(const uint64_t *) ((const char *) sources[i].metrics + offset)));
+    }
+}
+
+
+void metrics_write(FILE* fp, const MetricsSource* sources, unsigned int n_sources) {
+    const Histogram* histogram;
+    unsigned long long cumulative;
+    unsigned int i, stage, bucket;
+
+    write_counter(fp, "udp_datagrams_in_total", "Datagramas recibidos.", sources, n_sources, offsetof(Metrics, datagrams_in));
+    write_counter(fp, "udp_bytes_in_total", "Bytes recibidos.", sources, n_sources, offsetof(Metrics, bytes_in));
+    write_counter(fp, "udp_datagrams_out_total", "Datagramas enviados.", sources, n_sources, offsetof(Metrics, datagrams_out));
+    write_counter(fp, "udp_bytes_out_total", "Bytes enviados.", sources, n_sources, offsetof(Metrics, bytes_out));
+    write_counter(fp, "udp_recv_errors_total", "Errores al recibir.", sources, n_sources, offsetof(Metrics, recv_errors));
+    write_counter(fp, "udp_send_errors_total", "Envíos fallidos o descartados.", sources, n_sources, offsetof(Metrics, send_errors));
+    write_counter(fp, "udp_truncated_total", "Datagramas recibidos truncados.", sources, n_sources, offsetof(Metrics, truncated));
+    write_counter(fp, "udp_kernel_drops_total", "Datagramas descartados por el kernel (SO_RXQ_OVFL).", sources, n_sources, offsetof(Metrics, kernel_drops));
+
+    /* Histogramas acumulados: cada cubo cuenta los valores menores o iguales que su límite "le". El cubo i termina
+     * justo antes de 2^(i+1) ns, y las latencias son enteras, así que su límite es 2^(i+1) - 1 */
+    fprintf(fp, "# HELP udp_stage_latency_ns Latencia de cada etapa del procesamiento.\n# TYPE udp_stage_latency_ns histogram\n");
+    for (i = 0; i < n_sources; i++) {
+        for (stage = 0; stage < METRICS_STAGES; stage++) {
+            histogram = &sources[i].metrics->stages[stage];
+            if (!metrics_get(histogram->count)) continue;
+            cumulative = 0;
+            for (bucket = 0; bucket < METRICS_BUCKETS - 1; bucket++) {
+                cumulative += metrics_get(histogram->buckets[bucket]);
+                fprintf(fp, "udp_stage_latency_ns_bucket{socket=\"%s\",stage=\"%s\",le=\"%llu\"} %llu\n",
+                        sources[i].name, stage_names[stage], (1ULL << (bucket + 1)) - 1, cumulative);
+            }
+            cumulative += metrics_get(histogram->buckets[METRICS_BUCKETS - 1]);
+            fprintf(fp, "udp_stage_latency_ns_bucket{socket=\"%s\",stage=\"%s\",le=\"+Inf\"} %llu\n", sources[i].name, stage_names[stage], cumulative);
+            fprintf(fp, "udp_stage_latency_ns_sum{socket=\"%s\",stage=\"%s\"} %llu\n", sources[i].name, stage_names[stage],
+                    (unsigned long long) metrics_get(histogram->sum));
+            fprintf(fp, "udp_stage_latency_ns_count{socket=\"%s\",stage=\"%s\"} %llu\n", sources[i].name, stage_names[stage],
+                    (unsigned long long) metrics_get(histogram->count));
+        }
+    }
+}
+
+
+/**
+ * @brief   Reescribe el fichero de métricas de forma atómica.
+ */
+static void export_once(void) {
+    char temporary[PATH_LEN + 16];
+    FILE* fp;
+
+    snprintf(temporary, sizeof(temporary), "%s.tmp", exporter.path);
+    if ( !(fp = fopen(temporary, "w")) ) {
+        perror("No se pudo crear el fichero de métricas");
+        return;
+    }
+    metrics_write(fp, exporter.sources, exporter.n_sources);
+    if (fclose(fp) || rename(temporary, exporter.path)) {
+        perror("No se pudo escribir el fichero de métricas");
+        unlink(temporary);
+    }
+}
+
+
+/**
+ * @brief   Función del hilo exportador: escribe las métricas cada METRICS_INTERVAL ms hasta que se detenga.
+ *
+ * @param arg   No se usa.
+ *
+ * @return  NULL.
+ */
+static void* export_main(void* arg) {
+    struct timespec deadline;
+
+    pthread_mutex_lock(&exporter.lock);
+    while (exporter.running) {
+        export_once();
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += METRICS_INTERVAL / 1000;
+        deadline.tv_nsec += (METRICS_INTERVAL % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (exporter.running && pthread_cond_timedwait(&exporter.stop, &exporter.lock, &deadline) != ETIMEDOUT);
+    }
+    export_once();  /* Últimos valores */
+    pthread_mutex_unlock(&exporter.lock);
+
+    return NULL;
+}
+
+
+void metrics_export_start(const char* path, const MetricsSource* sources, unsigned int n_sources) {
+    snprintf(exporter.path, PATH_LEN, "%s", path);
+    if ( !(exporter.sources = (MetricsSource *) malloc(n_sources * sizeof(MetricsSource))) ) fail("No se pudo reservar memoria para las métricas");
+    memcpy(exporter.sources, sources, n_sources * sizeof(MetricsSource));
+    exporter.n_sources = n_sources;
+    exporter.running = 1;
+    if (pthread_create(&exporter.thread, NULL, export_main, NULL)) fail("No se pudo crear el hilo de las métricas");
+}
+
+
+void metrics_export_stop(void) {
+    if (!exporter.sources) return;
+
+    pthread_mutex_lock(&exporter.lock);
+    exporter.running = 0;
+    pthread_cond_signal(&exporter.stop);
+    pthread_mutex_unlock(&exporter.lock);
+    if (pthread_join(exporter.thread, NULL)) fail("No se pudo esperar al hilo de las métricas");
+
+    free(exporter.sources);
+    exporter.sources = NULL;
+}
@@ -0,0 +1,154 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#define METRICS_BUCKETS 40      /* Cubos de los histogramas: el cubo i cuenta los valores en [2^i, 2^(i+1)) ns */
+#define METRICS_INTERVAL 1000   /* Milisegundos entre dos escrituras del fichero de métricas */
+
+/* Espacio de control de recvmsg para el contador de descartes del kernel (SO_RXQ_OVFL)
+ * y el instante de llegada del datagrama (SO_TIMESTAMPNS) */
+#define METRICS_CONTROL_LEN (CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(struct timespec)))
+
+/* Etapas del procesamiento con histograma de latencias */
+#define METRICS_STAGE_PROCESS 0     /* Transformar las líneas recibidas (servidor) */
+#define METRICS_STAGE_SEND 1        /* Llamada de envío de las respuestas (servidor) o de los datagramas (cliente) */
+#define METRICS_STAGE_RTT 2         /* Tiempo de ida y vuelta de un datagrama no retransmitido (cliente) */
+#define METRICS_STAGE_QUEUE 3       /* Espera en la cola del socket: de la llegada al kernel a la recogida (servidor) */
+#define METRICS_STAGE_SERVICE 4     /* Servicio: de la recogida del datagrama al envío de su respuesta (servidor) */
+#define METRICS_STAGES 5
+
+/* Macro para sumar a un contador de métricas desde cualquier hilo, sin cerrojos */
+#define metrics_add(counter, value) __atomic_fetch_add(&(counter), (value), __ATOMIC_RELAXED)
+
+/**
+ * Histograma de latencias con cubos logarítmicos (potencias de 2 de nanosegundos).
+ */
+typedef struct {
+    uint64_t buckets[METRICS_BUCKETS];  /* Número de valores en cada cubo (el último acumula los mayores) */
+    uint64_t count;                     /* Número total de valores */
+    uint64_t sum;                       /* Suma de todos los valores (ns) */
+} Histogram;
+
+/**
+ * Contadores de un socket. Se actualizan con operaciones atómicas relajadas y se pueden leer en
+ * cualquier momento desde otro hilo (el que exporta las métricas) sin detener al que las produce.
+ */
+typedef struct {
+    uint64_t datagrams_in;      /* Datagramas recibidos */
+    uint64_t bytes_in;          /* Bytes recibidos */
+    uint64_t datagrams_out;     /* Datagramas enviados */
+    uint64_t bytes_out;         /* Bytes enviados */
+    uint64_t recv_errors;       /* Errores al recibir */
+    uint64_t send_errors;       /* Envíos fallidos o descartados por tener lleno el buffer del socket */
+    uint64_t truncated;         /* Datagramas recibidos que no cabían en el buffer */
+    uint64_t kernel_drops;      /* Datagramas descartados por el kernel por tener lleno el buffer de recepción (del socket
+                                 * y de los que se le sumen, como los sockets conectados del servidor) */
+    uint64_t socket_drops;      /* Último total de descartes leído del propio socket (SO_RXQ_OVFL) */
+    Histogram stages[METRICS_STAGES];   /* Latencias de cada etapa */
+} Metrics;
+
+/**
+ * Conjunto de métricas con el nombre con el que se exportan.
+ */
+typedef struct {
+    char name[64];              /* Nombre del socket en el fichero de métricas */
+    const Metrics* metrics;     /* Métricas (deben existir mientras se exportan) */
+} MetricsSource;
+
+
+/**
+ * @brief   Activa en un socket el contador de datagramas descartados por el kernel (SO_RXQ_OVFL).
+ *
+ * @param socket    Socket.
+ *
+ * @return  0 si se activó, -1 si el kernel no lo permite.
+ */
+int metrics_enable_drops(int socket);
+
+/**
+ * @brief   Activa en un socket el instante de llegada de cada datagrama (SO_TIMESTAMPNS).
+ *
+ * @param socket    Socket.
+ *
+ * @return  0 si se activó, -1 si el kernel no lo permite.
+ */
+int metrics_enable_timestamps(int socket);
+
+/**
+ * @brief   Lee los mensajes de control de un datagrama recibido.
+ *
+ * Actualiza los descartes del kernel (el kernel envía el total acumulado del socket, así que
+ * basta con el último datagrama) y devuelve el instante en que el datagrama llegó al socket.
+ * Lo nuevo desde la lectura anterior se suma a metrics->kernel_drops, que así puede acumular
+ * también los descartes de otros sockets; el total del propio socket queda en metrics->socket_drops.
+ *
+ * @param metrics   Métricas del socket.
+ * @param msg       Cabecera del datagrama, con msg_control de al menos METRICS_CONTROL_LEN bytes.
+ *
+ * @return  Instante de llegada (ns, CLOCK_REALTIME), o 0 si el socket no lo indica.
+ */
+uint64_t metrics_read_control(Metrics* metrics, struct msghdr* msg);
+
+/**
+ * @brief   Añade un valor a un histograma de latencias.
+ *
+ * @param histogram     Histograma.
+ * @param ns            Latencia en nanosegundos.
+ */
+void metrics_record(Histogram* histogram, uint64_t ns);
+
+/**
+ * @brief   Suma un histograma a otro.
+ *
+ * @param into      Histograma acumulado.
+ * @param from      Histograma a sumar.
+ */
+void metrics_merge(Histogram* into, const Histogram* from);
+
+/**
+ * @brief   Estima un percentil de un histograma.
+ *
+ * Dentro del cubo en el que cae el percentil se interpola linealmente, así que el error
+ * está acotado por el ancho del cubo.
+ *
+ * @param histogram Histograma.
+ * @param p         Percentil (entre 0 y 100).
+ *
+ * @return  Latencia estimada (ns), o 0 si el histograma está vacío.
+ */
+uint64_t metrics_percentile(const Histogram* histogram, double p);
+
+/**
+ * @brief   Escribe las métricas en formato de texto de Prometheus.
+ *
+ * @param fp        Fichero en el que escribir.
+ * @param sources   Métricas a escribir.
+ * @param n_sources Número de métricas.
+ */
+void metrics_write(FILE* fp, const MetricsSource* sources, unsigned int n_sources);
+
+/**
+ * @brief   Empieza a escribir periódicamente las métricas en un fichero desde un hilo aparte.
+ *
+ * El fichero se reescribe entero cada METRICS_INTERVAL ms, de forma atómica (se escribe uno
+ * temporal y se renombra), así que quien lo lea nunca lo ve a medias.
+ *
+ * @param path      Fichero de métricas.
+ * @param sources   Métricas a escribir (se copian).
+ * @param n_sources Número de métricas.
+ */
+void metrics_export_start(const char* path, const MetricsSource* sources, unsigned int n_sources);
+
+/**
+ * @brief   Escribe las métricas por última vez y detiene el hilo que las exporta.
+ *
+ * No hace nada si no se llamó antes a metrics_export_start.
+ */
+void metrics_export_stop(void);
+
+
+#endif  /* METRICS_H */
@@ -0,0 +1,115 @@
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "protocol.h"
+
+
+/**
+ * @brief   Escribe una cabecera en un buffer.
+ *
+ * Serializa la cabecera en orden de red al principio de buffer, que debe tener
+ * por lo menos PROTOCOL_HEADER_LEN bytes.
+ *
+ * @param buffer    Buffer en el que escribir la cabecera.
+ * @param type      Tipo del datagrama.
+ * @param flags     Flags del datagrama.
+ * @param seq       Número de secuencia del datagrama.
+ * @param length    Longitud de la carga útil que sigue a la cabecera, relleno incluido.
+ *
+ * @return  Número de bytes escritos (PROTOCOL_HEADER_LEN).
+ */
+size_t protocol_write_header(char* buffer, uint8_t type, uint16_t flags, uint32_t seq, uint16_t length) {
+    uint16_t magic = htons(PROTOCOL_MAGIC);
+
+    flags = htons(flags);
+    length = htons(length);
+    seq = htonl(seq);
+
+    /* Se copia campo a campo con memcpy porque buffer no tiene por qué estar alineado */
+    memcpy(buffer, &magic, sizeof(magic));
+    buffer[2] = PROTOCOL_VERSION;
+    buffer[3] = type;
+    memcpy(buffer + 4, &flags, sizeof(flags));
+    memcpy(buffer + 6, &length, sizeof(length));
+    memcpy(buffer + 8, &seq, sizeof(seq));
+
+    return PROTOCOL_HEADER_LEN;
+}
+
+
+/**
+ * @brief   Lee la cabecera de un datagrama.
+ *
+ * Comprueba si el datagrama empieza por una cabecera válida y, en ese caso, la
+ * deserializa en header (en orden de host). No copia la carga útil: empieza en
+ * buffer + PROTOCOL_HEADER_LEN y mide header->length bytes, que se garantiza que
+ * caben en los len recibidos (los bytes que sobren detrás no son del datagrama).
+ *
+ * @param buffer    Datagrama recibido.
+ * @param len       Longitud del datagrama en bytes.
+ * @param header    Estructura en la que guardar la cabecera leída.
+ *
+ * @return  PROTOCOL_FRAMED si el datagrama tiene una cabecera válida, PROTOCOL_PLAIN si no
+ *          empieza por el número mágico (texto plano), o PROTOCOL_INVALID si lo hace pero la
+ *          cabecera no es válida.
+ */
+int protocol_read_header(const char* buffer, size_t len, ProtocolHeader* header) {
+    if (len < sizeof(header->magic)) return PROTOCOL_PLAIN;
+
+    memcpy(&header->magic, buffer, sizeof(header->magic));
+    if (ntohs(header->magic) != PROTOCOL_MAGIC) return PROTOCOL_PLAIN;
+    if (len < PROTOCOL_HEADER_LEN || buffer[2] != PROTOCOL_VERSION) return PROTOCOL_INVALID;
+
+    memcpy(&header->flags, buffer + 4, sizeof(header->flags));
+    memcpy(&header->length, buffer + 6, sizeof(header->length));
+    memcpy(&header->seq, buffer + 8, sizeof(header->seq));
+
+    header->magic = PROTOCOL_MAGIC;
+    header->version = PROTOCOL_VERSION;
+    header->type = buffer[3];
+    header->flags = ntohs(header->flags);
+    header->length = ntohs(header->length);
+    header->seq = ntohl(header->seq);
+
+    return header->length <= len - PROTOCOL_HEADER_LEN ? PROTOCOL_FRAMED : PROTOCOL_INVALID;
+}
+
+
+/**
+ * @brief   Escribe el final del relleno de un datagrama.
+ *
+ * El relleno permite que datagramas con cargas útiles distintas tengan todos la misma longitud, como
+ * exige la segmentación UDP (UDP_SEGMENT). Son pad bytes cualesquiera al final de la carga útil, de los
+ * que los PROTOCOL_PAD_TRAILER últimos guardan pad en orden de red. Los datagramas con relleno llevan
+ * PROTOCOL_FLAG_PADDED en la cabecera.
+ *
+ * @param trailer   Buffer de PROTOCOL_PAD_TRAILER bytes, que va al final del relleno.
+ * @param pad       Longitud total del relleno, incluido el final (entre PROTOCOL_PAD_TRAILER y 65535).
+ *
+ * @return  Número de bytes escritos (PROTOCOL_PAD_TRAILER).
+ */
+size_t protocol_write_padding(char* trailer, uint16_t pad) {
+    pad = htons(pad);
+    memcpy(trailer, &pad, sizeof(pad));
+
+    return PROTOCOL_PAD_TRAILER;
+}
+
+
+/**
+ * @brief   Quita el relleno de la carga útil de un datagrama con PROTOCOL_FLAG_PADDED.
+ *
+ * @param payload   Carga útil, sin la cabecera.
+ * @param len       Longitud de la carga útil, con el relleno.
+ *
+ * @return  Longitud de la carga útil sin el relleno, o len si el relleno no es válido.
+ */
+size_t protocol_strip_padding(const char* payload, size_t len) {
+    uint16_t pad;
+
+    if (len < PROTOCOL_PAD_TRAILER) return len;
+    memcpy(&pad, payload + len - PROTOCOL_PAD_TRAILER, sizeof(pad));
+    pad = ntohs(pad);
+
+    return pad >= PROTOCOL_PAD_TRAILER && pad <= len ? len - pad : len;
+}
@@ -0,0 +1,124 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Número mágico con el que empiezan los datagramas con cabecera. El byte 0xFE nunca aparece
+ * en texto UTF-8 válido, así que no se puede confundir con una línea de texto plano */
+#define PROTOCOL_MAGIC 0xFE55
+
+/* Versión del formato de la cabecera. Un datagrama con otra versión se descarta, en lugar de
+ * interpretarlo mal */
+#define PROTOCOL_VERSION 1
+
+/* Longitud en bytes de la cabecera tal y como viaja por la red */
+#define PROTOCOL_HEADER_LEN 12
+
+/* Resultados de protocol_read_header */
+#define PROTOCOL_PLAIN 0        /* Sin número mágico: datagrama de texto plano terminado en '\0' (clientes antiguos) */
+#define PROTOCOL_FRAMED 1       /* Cabecera válida */
+#define PROTOCOL_INVALID -1     /* Número mágico, pero cabecera truncada, de otra versión o con una longitud imposible */
+
+/* Tipos de datagrama */
+#define PROTOCOL_TYPE_DATA 0    /* Líneas a pasar a mayúsculas, o su respuesta */
+#define PROTOCOL_TYPE_NAME 1    /* Nombre del fichero que empieza una transferencia, o su respuesta en mayúsculas. Su número
+                                 * de secuencia anuncia la ventana del cliente (0 si no la anuncia), y la respuesta lo repite */
+#define PROTOCOL_TYPE_MESSAGE 2 /* Mensaje del emisor básico al receptor básico */
+
+/* Flags de la cabecera */
+#define PROTOCOL_FLAG_BATCH 0x0001      /* La carga útil agrupa varias líneas completas, cada una terminada en '\n' */
+#define PROTOCOL_FLAG_PADDED 0x0002     /* La carga útil termina en relleno (ver protocol_write_padding) */
+#define PROTOCOL_FLAG_COMPRESSED 0x0004 /* La carga útil está comprimida con lz_compress (el relleno, si lo hay, va detrás) */
+#define PROTOCOL_FLAG_ACCEPTS_LZ 0x0008 /* En el nombre del fichero: el cliente puede comprimir, y en su respuesta, el servidor
+                                         * lo admite. Un servidor que no lo conoce no lo repite, y no se comprime nada */
+#define PROTOCOL_FLAG_FRAGMENT 0x0010   /* La carga útil es un trozo de una línea que no cabe en un datagrama. Los trozos
+                                         * van en datagramas con números de secuencia consecutivos, y sus respuestas
+                                         * también son trozos: basta con escribirlas seguidas */
+#define PROTOCOL_FLAG_FIRST_FRAGMENT 0x0020 /* Primer trozo de la línea */
+#define PROTOCOL_FLAG_LAST_FRAGMENT 0x0040  /* Último trozo de la línea */
+
+/* Número máximo de datagramas que un cliente puede tener en vuelo a la vez. El servidor recuerda las respuestas
+ * de tantos datagramas como anuncie el cliente, así que las de todos los que están en vuelo caben a la vez */
+#define PROTOCOL_MAX_WINDOW 4096
+
+/* Bytes del final del relleno que guardan su longitud */
+#define PROTOCOL_PAD_TRAILER 2
+
+/**
+ * Cabecera de los datagramas de todos los programas. Viaja por la red en orden de red (big endian),
+ * en este orden de campos, seguida directamente de length bytes de carga útil, que no necesita '\0'
+ * ni tiene por qué ser texto. Las respuestas del servidor repiten el tipo y el número de secuencia
+ * de la petición a la que contestan.
+ */
+typedef struct {
+    uint16_t magic;     /* Siempre PROTOCOL_MAGIC */
+    uint8_t version;    /* Siempre PROTOCOL_VERSION */
+    uint8_t type;       /* Tipo del datagrama (PROTOCOL_TYPE_*) */
+    uint16_t flags;     /* Flags del datagrama (PROTOCOL_FLAG_*) */
+    uint16_t length;    /* Longitud de la carga útil, relleno incluido */
+    uint32_t seq;       /* Número de secuencia del datagrama */
+} ProtocolHeader;
+
+
+/**
+ * @brief   Escribe una cabecera en un buffer.
+ *
+ * Serializa la cabecera en orden de red al principio de buffer, que debe tener
+ * por lo menos PROTOCOL_HEADER_LEN bytes.
+ *
+ * @param buffer    Buffer en el que escribir la cabecera.
+ * @param type      Tipo del datagrama.
+ * @param flags     Flags del datagrama.
+ * @param seq       Número de secuencia del datagrama.
+ * @param length    Longitud de la carga útil que sigue a la cabecera, relleno incluido.
+ *
+ * @return  Número de bytes escritos (PROTOCOL_HEADER_LEN).
+ */
+size_t protocol_write_header(char* buffer, uint8_t type, uint16_t flags, uint32_t seq, uint16_t length);
+
+/**
+ * @brief   Lee la cabecera de un datagrama.
+ *
+ * Comprueba si el datagrama empieza por una cabecera válida y, en ese caso, la
+ * deserializa en header (en orden de host). No copia la carga útil: empieza en
+ * buffer + PROTOCOL_HEADER_LEN y mide header->length bytes, que se garantiza que
+ * caben en los len recibidos (los bytes que sobren detrás no son del datagrama).
+ *
+ * @param buffer    Datagrama recibido.
+ * @param len       Longitud del datagrama en bytes.
+ * @param header    Estructura en la que guardar la cabecera leída.
+ *
+ * @return  PROTOCOL_FRAMED si el datagrama tiene una cabecera válida, PROTOCOL_PLAIN si no
+ *          empieza por el número mágico (texto plano), o PROTOCOL_INVALID si lo hace pero la
+ *          cabecera no es válida.
+ */
+int protocol_read_header(const char* buffer, size_t len, ProtocolHeader* header);
+
+/**
+ * @brief   Escribe el final del relleno de un datagrama.
+ *
+ * El relleno permite que datagramas con cargas útiles distintas tengan todos la misma longitud, como
+ * exige la segmentación UDP (UDP_SEGMENT). Son pad bytes cualesquiera al final de la carga útil, de los
+ * que los PROTOCOL_PAD_TRAILER últimos guardan pad en orden de red. Los datagramas con relleno llevan
+ * PROTOCOL_FLAG_PADDED en la cabecera.
+ *
+ * @param trailer   Buffer de PROTOCOL_PAD_TRAILER bytes, que va al final del relleno.
+ * @param pad       Longitud total del relleno, incluido el final (entre PROTOCOL_PAD_TRAILER y 65535).
+ *
+ * @return  Número de bytes escritos (PROTOCOL_PAD_TRAILER).
+ */
+size_t protocol_write_padding(char* trailer, uint16_t pad);
+
+/**
+ * @brief   Quita el relleno de la carga útil de un datagrama con PROTOCOL_FLAG_PADDED.
+ *
+ * @param payload   Carga útil, sin la cabecera.
+ * @param len       Longitud de la carga útil, con el relleno.
+ *
+ * @return  Longitud de la carga útil sin el relleno, o len si el relleno no es válido.
+ */
+size_t protocol_strip_padding(const char* payload, size_t len);
+
+
+#endif  /* PROTOCOL_H */
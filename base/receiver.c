@@ -26,13 +26,15 @@
  *                      un protocolo para la combinación dominio-tipo dada, en cuyo caso se
  *                      puede especificar con un 0.
  * @param receiver_port Número de puerto en el que escucha el receiver.
+ * @param options       Opciones del socket, o NULL para usar las opciones por defecto.
  *
  * @return  Receiver que guarda toda la información relevante sobre sí mismo con la que
  *          fue creado, y con un socket abierto en el cual está listo para recibir información.
  */
-Receiver create_receiver(int domain, int type, int protocol, uint16_t receiver_port) {
+Receiver create_receiver(int domain, int type, int protocol, uint16_t receiver_port, const ReceiverOptions* options) {
     Receiver receiver;
-    
+    ReceiverOptions default_options = {0};
+
 
     memset(&receiver, 0, sizeof(Receiver));     /* Inicializar los campos a 0 */
 
@@ -52,6 +54,24 @@ Receiver create_receiver(int domain, int type, int protocol, uint16_t receiver_p
 
     /* Crear el socket del receiver */
     if ( (receiver.socket = socket(domain, type, protocol)) < 0) fail("No se pudo crear el socket");
+
+    if (!options) options = &default_options;
+
+    /* Escuchar solo en la IP indicada, si se indicó alguna */
+    if (options->bind_address && inet_pton(domain, options->bind_address, &receiver.receiver_address.sin_addr) != 1) {
+        fprintf(stderr, "La dirección de escucha especificada (%s) no es válida\n", options->bind_address);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Buffers, prioridad y SO_REUSEPORT, que permite que otros sockets (de otros hilos o procesos) se asocien
+     * al mismo puerto; el kernel reparte entre ellos los datagramas según la dirección de origen */
+    sockopts_apply(receiver.socket, &options->socket, &receiver.rcvbuf);
+
+    /* Que cada datagrama recibido traiga el número de datagramas que el kernel descartó por falta de espacio */
+    if (metrics_enable_drops(receiver.socket) < 0) perror("No se pudo activar SO_RXQ_OVFL");
+
+    /* Y el instante en que llegó al socket, para separar la espera en cola del tiempo de servicio */
+    if (metrics_enable_timestamps(receiver.socket) < 0) perror("No se pudo activar SO_TIMESTAMPNS");
     
     /* Asignar IPs a las que escuchar y número de puerto por el que atender peticiones (bind) */
     if (bind(receiver.socket, (struct sockaddr *) &receiver.receiver_address, sizeof(struct sockaddr_in)) < 0) {
@@ -4,6 +4,8 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
+#include "metrics.h"
+#include "sockopts.h"
 
 /**
  * Estructura que contiene toda la información relevante del
@@ -20,9 +22,21 @@ typedef struct {
     uint16_t sender_port;   /* Puerto usado por el emisor para enviar datos (en orden de host) */
     struct sockaddr_in receiver_address;       /* Estructura con el dominio de comunicación e IP y puerto por los que se comunica el receiver */
     struct sockaddr_in sender_address;  /* Estructura con el dominio de comunicación e IP y puerto del emisor que envió la información */
+    Metrics metrics;    /* Contadores del socket, que se pueden exportar mientras se usa */
+    RcvbufAdapter rcvbuf;   /* Crecimiento adaptativo del buffer de recepción */
 } Receiver;
 
 
+/**
+ * Opciones de configuración del socket del receiver. Un puntero NULL en create_receiver
+ * equivale a usar todas las opciones con valor 0 (comportamiento por defecto del kernel).
+ */
+typedef struct {
+    SocketOptions socket;       /* Opciones del socket (buffers, prioridad, SO_REUSEPORT...) */
+    const char* bind_address;   /* IP (en formato textual) en la que escuchar, o NULL para escuchar en todas (INADDR_ANY) */
+} ReceiverOptions;
+
+
 /**
  * @brief   Crea un receiver.
  *
@@ -35,12 +49,13 @@ typedef struct {
  *                      un protocolo para la combinación dominio-tipo dada, en cuyo caso se
  *                      puede especificar con un 0.
  * @param receiver_port   Número de puerto en el que escucha el receiver (en orden de host).
+ * @param options       Opciones del socket, o NULL para usar las opciones por defecto.
  *
  * @return  Receivere que guarda toda la información relevante sobre sí mismo con la que
  *          fue creado, y con un socket abierto
  */
 
-Receiver create_receiver(int domain, int type, int protocol, uint16_t receiver_port);
+Receiver create_receiver(int domain, int type, int protocol, uint16_t receiver_port, const ReceiverOptions* options);
 
 
 /**
@@ -32,12 +32,13 @@
  * @param own_port      Número de puerto por el que emite el sender (en orden de host).
  * @param receiver_port   Número de puerto en el que escucha el receiver (en orden de host).
  * @param remote_address   IP en formato textual del receptor.
+ * @param options       Opciones del sender, o NULL para usar las opciones por defecto.
  *
  * @return  Receivere que guarda toda la información relevante sobre sí mismo con la que
  *          fue creado, y con un socket abierto
  */
 
-Sender create_sender(int domain, int type, int protocol, uint16_t own_port, uint16_t remote_port, char* remote_address) {
+Sender create_sender(int domain, int type, int protocol, uint16_t own_port, uint16_t remote_port, char* remote_address, const SenderOptions* options) {
     Sender sender;
     char buffer[BUFFER_LEN] = {0};
 
@@ -69,11 +70,15 @@ Sender create_sender(int domain, int type, int protocol, uint16_t own_port, uint
         strcpy(sender.hostname, buffer);
     }
 
-    if (!getip(buffer, BUFFER_LEN)) {
-        perror("No se pudo obtener la IP externa del emisor");
-    } else {
-        sender.ip = (char *) calloc(strlen(buffer) + 1, sizeof(char));
-        strcpy(sender.ip, buffer);
+    /* IP externa: la de una interfaz local sin conexión, la de la caché si es reciente, o
+     * si no una consulta en segundo plano para no retrasar el arranque */
+    if (options && options->offline) {
+        if (!getip_local(buffer, BUFFER_LEN)) fprintf(stderr, "No se pudo obtener la IP local del emisor\n");
+        else sender.ip = strdup(buffer);
+    } else if (getip_cached(buffer, BUFFER_LEN)) {
+        sender.ip = strdup(buffer);
+    } else if ( !(sender.ip_lookup = getip_async()) ) {
+        fprintf(stderr, "No se pudo empezar a consultar la IP externa del emisor\n");
     }
 
     /* Crear el socket del emisor */
@@ -81,13 +86,19 @@ Sender create_sender(int domain, int type, int protocol, uint16_t own_port, uint
         fail("No se pudo crear el socket");
     }
 
+    /* Buffers, prioridad y TOS de los datagramas enviados */
+    sockopts_apply(sender.socket, options ? &options->socket : NULL, &sender.rcvbuf);
+
+    /* Que cada respuesta recibida traiga el número de datagramas que el kernel descartó por falta de espacio */
+    if (metrics_enable_drops(sender.socket) < 0) perror("No se pudo activar SO_RXQ_OVFL");
+
     /* Asignar IPs a las que escuchar y número de puerto por el que atender peticiones (bind) */
     if (bind(sender.socket, (struct sockaddr *) &sender.own_address, sizeof(struct sockaddr_in)) < 0) {
         fail("No se pudo asignar dirección IP");
     }
 
     printf("Emisor creado con éxito y listo para recibir/enviar.\n"
-            "Hostname: %s; IP: %s; Puerto: %d; IP receptor: %s; Puerto receptor: %d\n\n", sender.hostname, sender.ip, sender.own_port, sender.remote_ip, sender.remote_port);
+            "Hostname: %s; IP: %s; Puerto: %d; IP receptor: %s; Puerto receptor: %d\n\n", sender.hostname, sender.ip ? sender.ip : "(consultando)", sender.own_port, sender.remote_ip, sender.remote_port);
 
     return sender;
 }
@@ -112,6 +123,7 @@ void close_sender(Sender* sender) {
 
     if (sender->hostname) free(sender->hostname);
     if (sender->ip) free(sender->ip);
+    if (sender->ip_lookup) getip_release(sender->ip_lookup);
     if (sender->remote_ip) free(sender->remote_ip);
 
     /* Limpiar la estructura poniendo todos los campos a 0 */
@@ -120,3 +132,28 @@ void close_sender(Sender* sender) {
     
     return;
 }
+
+
+/**
+ * @brief   Devuelve la IP externa del sender, sin bloquearse.
+ *
+ * @param sender    Sender.
+ *
+ * @return  sender->ip, o NULL si todavía no se conoce (o no se pudo obtener).
+ */
+
+const char* sender_ip(Sender* sender) {
+    char buffer[BUFFER_LEN];
+    int status;
+
+    if (sender->ip || !sender->ip_lookup) return sender->ip;
+
+    if ( (status = getip_poll(sender->ip_lookup, buffer, BUFFER_LEN)) == 0 ) return NULL;   /* Sigue en curso */
+    if (status > 0) sender->ip = strdup(buffer);
+    else fprintf(stderr, "No se pudo obtener la IP externa del emisor\n");
+
+    getip_release(sender->ip_lookup);
+    sender->ip_lookup = NULL;
+
+    return sender->ip;
+}
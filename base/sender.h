@@ -5,6 +5,9 @@
 #include <sys/types.h>
 #include <netinet/in.h>
 #include "receiver.h"
+#include "getip.h"
+#include "metrics.h"
+#include "sockopts.h"
 
 /**
  * Estructura que contiene toda la información relevante 
@@ -18,14 +21,27 @@ typedef struct {
     uint16_t own_port;  /* Puerto en el que el emisor envia mensajes (en orden de host) */
     uint16_t remote_port;  /* Puerto en el que el receptor recibirá datos (en orden de host) */
     char* hostname; /* Nombre del equipo en el que está ejecutándose el emisor (vestigios del anterior proyecto) */
-    char* ip;       /* IP externa del emisor (en formato textual) */
+    char* ip;       /* IP externa del emisor (en formato textual), o NULL si todavía no se conoce */
+    IpLookup* ip_lookup;    /* Consulta de la IP externa en segundo plano, o NULL si no hay ninguna en curso */
     char* remote_ip; /* IP del receptor en formato textual */
     struct sockaddr_in own_address;  /* Estructura con el dominio de comunicación, IPs a las que atender (dirección propia)*/
     struct sockaddr_in remote_address;  /* Estructura con el dominio de comunicación, IPs a las que atender (dirección del emisor)*/
+    Metrics metrics;    /* Contadores del socket, que se pueden exportar mientras se usa */
+    RcvbufAdapter rcvbuf;   /* Crecimiento adaptativo del buffer de recepción */
 
 } Sender;
 
 
+/**
+ * Opciones de creación del sender. Un puntero NULL en create_sender equivale a usar
+ * todas las opciones con valor 0.
+ */
+typedef struct {
+    int offline;    /* Si es distinto de 0, no se accede a la red para obtener la IP externa: se usa la de una interfaz local */
+    SocketOptions socket;   /* Opciones del socket (buffers, prioridad, TOS...) */
+} SenderOptions;
+
+
 /**
  * @brief   Crea un sender.
  *
@@ -40,12 +56,29 @@ typedef struct {
  * @param own_port      Número de puerto por el que emite el sender (en orden de host).
  * @param receiver_port   Número de puerto en el que escucha el receiver (en orden de host).
  * @param remote_address   IP en formato textual del receptor.
+ * @param options       Opciones del sender, o NULL para usar las opciones por defecto.
+ *
+ * La IP externa se toma de la caché si es reciente; si no, se consulta en segundo plano
+ * y se rellena más tarde con sender_ip, de modo que la creación nunca espera a la red.
+ * En modo sin conexión se usa directamente la IP de una interfaz local.
  *
  * @return  Receivere que guarda toda la información relevante sobre sí mismo con la que
  *          fue creado, y con un socket abierto
  */
  
-Sender create_sender(int domain, int type, int protocol, uint16_t own_port, uint16_t remote_port, char* remote_address);
+Sender create_sender(int domain, int type, int protocol, uint16_t own_port, uint16_t remote_port, char* remote_address, const SenderOptions* options);
+
+/**
+ * @brief   Devuelve la IP externa del sender, sin bloquearse.
+ *
+ * Si la consulta en segundo plano ya terminó, guarda su resultado en sender->ip.
+ *
+ * @param sender    Sender.
+ *
+ * @return  sender->ip, o NULL si todavía no se conoce (o no se pudo obtener).
+ */
+
+const char* sender_ip(Sender* sender);
 
 /**
  * @brief   Cierra el sender.
@@ -0,0 +1,151 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+
+#include "sockopts.h"
+#include "loging.h"
+
+#define PROFILE_LEN 256
+
+
+/**
+ * @brief   Lee un valor numérico de un perfil, con sufijo K o M opcional.
+ *
+ * @param text      Valor en formato textual (decimal o hexadecimal con 0x).
+ * @param value     Donde guardar el valor.
+ *
+ * @return  0 si es válido, -1 si no.
+ */
+static int parse_value(const char* text, int* value) {
+    char* end;
+    long long number = strtoll(text, &end, 0);
+
+    if (end == text || number < 0) return -1;
+    if (*end == 'K' || *end == 'k') number <<= 10, end++;
+    else if (*end == 'M' || *end == 'm') number <<= 20, end++;
+    if (*end || number > INT_MAX) return -1;
+
+    *value = number;
+    return 0;
+}
+
+
+int sockopts_parse(SocketOptions* options, const char* profile) {
+    char copy[PROFILE_LEN];
+    char *item, *value, *saveptr;
+    int* field;
+
+    if (strlen(profile) >= PROFILE_LEN) return -1;
+    strcpy(copy, profile);
+
+    for (item = strtok_r(copy, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+        if ( !(value = strchr(item, '=')) ) return -1;
+        *value++ = '\0';
+
+        if (!strcmp(item, "rcvbuf")) field = &options->rcvbuf;
+        else if (!strcmp(item, "sndbuf")) field = &options->sndbuf;
+        else if (!strcmp(item, "priority")) field = &options->priority;
+        else if (!strcmp(item, "busy_poll")) field = &options->busy_poll;
+        else if (!strcmp(item, "tos")) field = &options->tos;
+        else if (!strcmp(item, "reuse_port")) field = &options->reuse_port;
+        else if (!strcmp(item, "adaptive")) field = &options->rcvbuf_max;
+        else return -1;
+
+        if (parse_value(value, field) < 0) return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief   Cambia el tamaño del buffer de recepción.
+ *
+ * Prueba primero SO_RCVBUFFORCE, que ignora net.core.rmem_max pero necesita CAP_NET_ADMIN.
+ *
+ * @param socket    Socket.
+ * @param size      Tamaño pedido (bytes).
+ *
+ * @return  Tamaño efectivo, tal como se pediría a setsockopt (el kernel reserva el doble), o -1 en caso de error.
+ */
+static int set_rcvbuf(int socket, int size) {
+    socklen_t len = sizeof(size);
+
+    if (setsockopt(socket, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0
+            && setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0) return -1;
+    if (getsockopt(socket, SOL_SOCKET, SO_RCVBUF, &size, &len) < 0) return -1;
+
+    return size / 2;
+}
+
+
+/**
+ * @brief   Activa una opción entera de un socket, avisando si el kernel la rechaza.
+ */
+static void set_option(int socket, int level, int name, int value, const char* message) {
+    if (setsockopt(socket, level, name, &value, sizeof(value)) < 0) perror(message);
+}
+
+
+void sockopts_apply(int socket, const SocketOptions* options, RcvbufAdapter* adapter) {
+    socklen_t len = sizeof(int);
+    int size, sndbuf;
+
+    memset(adapter, 0, sizeof(RcvbufAdapter));
+    if (!options) return;
+
+    if (options->reuse_port && setsockopt(socket, SOL_SOCKET, SO_REUSEPORT, &options->reuse_port, sizeof(int)) < 0) {
+        fail("No se pudo activar SO_REUSEPORT");
+    }
+    if (options->rcvbuf) {
+        if ( (size = set_rcvbuf(socket, options->rcvbuf)) < 0 ) perror("No se pudo cambiar SO_RCVBUF");
+        else if (size < options->rcvbuf) fprintf(stderr, "El kernel limitó el buffer de recepción a %d bytes (net.core.rmem_max)\n", size);
+    }
+    if (options->sndbuf) {
+        set_option(socket, SOL_SOCKET, SO_SNDBUF, options->sndbuf, "No se pudo cambiar SO_SNDBUF");
+        if (getsockopt(socket, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) == 0 && sndbuf / 2 < options->sndbuf) {
+            fprintf(stderr, "El kernel limitó el buffer de envío a %d bytes (net.core.wmem_max)\n", sndbuf / 2);
+        }
+    }
+    if (options->priority) set_option(socket, SOL_SOCKET, SO_PRIORITY, options->priority, "No se pudo cambiar SO_PRIORITY");
+#ifdef SO_BUSY_POLL
+    if (options->busy_poll) set_option(socket, SOL_SOCKET, SO_BUSY_POLL, options->busy_poll, "No se pudo activar SO_BUSY_POLL");
+#endif
+    if (options->tos) set_option(socket, IPPROTO_IP, IP_TOS, options->tos, "No se pudo cambiar IP_TOS");
+
+    /* El modo adaptativo parte del tamaño actual del buffer */
+    if (options->rcvbuf_max) {
+        len = sizeof(size);
+        if (getsockopt(socket, SOL_SOCKET, SO_RCVBUF, &size, &len) < 0) {
+            perror("No se pudo leer SO_RCVBUF");
+            return;
+        }
+        adapter->size = size / 2;
+        adapter->limit = options->rcvbuf_max;
+    }
+}
+
+
+int sockopts_adapt(int socket, RcvbufAdapter* adapter, uint64_t drops, uint64_t now) {
+    int size;
+
+    if (!adapter->limit || drops <= adapter->drops || now - adapter->grown_at < SOCKOPTS_ADAPT_INTERVAL) return 0;
+    adapter->drops = drops;
+    adapter->grown_at = now;
+    if (adapter->size >= adapter->limit) return 0;
+
+    size = adapter->size * 2 < adapter->limit ? adapter->size * 2 : adapter->limit;
+    if ( (size = set_rcvbuf(socket, size)) <= adapter->size ) {
+        /* Sin privilegios el kernel no pasa de net.core.rmem_max: no tiene sentido seguir intentándolo */
+        fprintf(stderr, "El buffer de recepción no puede crecer más de %d bytes, se desactiva el modo adaptativo\n", adapter->size);
+        adapter->limit = 0;
+        return 0;
+    }
+    adapter->size = size;
+
+    return size;
+}
@@ -0,0 +1,86 @@
+#ifndef SOCKOPTS_H
+#define SOCKOPTS_H
+
+#include <stdint.h>
+
+/* Tiempo mínimo entre dos ampliaciones del buffer de recepción en modo adaptativo (ns) */
+#define SOCKOPTS_ADAPT_INTERVAL (100 * 1000000ULL)
+
+/* Descripción de las claves de un perfil, para las ayudas de los programas */
+#define SOCKOPTS_HELP \
+    "Perfil de opciones de socket: lista de clave=valor separadas por comas. Los tamaños admiten los sufijos K y M.\n" \
+    "  rcvbuf=<bytes>     Buffer de recepción (SO_RCVBUF).\n" \
+    "  sndbuf=<bytes>     Buffer de envío (SO_SNDBUF).\n" \
+    "  priority=<n>       Prioridad de los paquetes enviados (SO_PRIORITY, 0-6 sin privilegios).\n" \
+    "  busy_poll=<us>     Microsegundos de sondeo activo del dispositivo al recibir (SO_BUSY_POLL).\n" \
+    "  tos=<n>            Campo TOS/DSCP de la cabecera IP (IP_TOS, admite 0x).\n" \
+    "  reuse_port=<0|1>   Permitir varios sockets en el mismo puerto (SO_REUSEPORT).\n" \
+    "  adaptive=<bytes>   Duplicar el buffer de recepción mientras el kernel descarte datagramas, hasta <bytes>.\n"
+
+/**
+ * Perfil de opciones de un socket. Los campos con valor 0 dejan el valor por defecto del kernel.
+ */
+typedef struct {
+    int rcvbuf;         /* Tamaño pedido del buffer de recepción (bytes) */
+    int sndbuf;         /* Tamaño pedido del buffer de envío (bytes) */
+    int priority;       /* Prioridad de los paquetes enviados */
+    int busy_poll;      /* Microsegundos de sondeo activo al recibir */
+    int tos;            /* Campo TOS de la cabecera IP */
+    int reuse_port;     /* Si es distinto de 0, activa SO_REUSEPORT para que varios sockets puedan escuchar en el mismo puerto */
+    int rcvbuf_max;     /* Si es distinto de 0, límite del crecimiento adaptativo del buffer de recepción (bytes) */
+} SocketOptions;
+
+/**
+ * Estado del crecimiento adaptativo del buffer de recepción de un socket.
+ */
+typedef struct {
+    int size;           /* Tamaño actual del buffer, tal como se pide a setsockopt (bytes) */
+    int limit;          /* Tamaño máximo, o 0 si el modo adaptativo está desactivado */
+    uint64_t drops;     /* Descartes del kernel vistos en la última ampliación */
+    uint64_t grown_at;  /* Instante de la última ampliación (ns, reloj monótono) */
+} RcvbufAdapter;
+
+
+/**
+ * @brief   Lee un perfil de opciones de socket.
+ *
+ * El perfil es una lista de clave=valor separadas por comas (ver SOCKOPTS_HELP).
+ * Las claves que no aparecen no se modifican.
+ *
+ * @param options   Opciones a rellenar.
+ * @param profile   Perfil en formato textual.
+ *
+ * @return  0 si el perfil es válido, -1 si no.
+ */
+int sockopts_parse(SocketOptions* options, const char* profile);
+
+/**
+ * @brief   Aplica un perfil de opciones a un socket.
+ *
+ * Debe llamarse antes de bind, por SO_REUSEPORT. No poder activar SO_REUSEPORT es un error fatal;
+ * el resto de opciones que el kernel rechace solo se avisan, y el socket sigue con su valor por defecto.
+ *
+ * @param socket    Socket.
+ * @param options   Opciones a aplicar, o NULL para no cambiar nada.
+ * @param adapter   Estado del modo adaptativo a inicializar (desactivado si options->rcvbuf_max es 0).
+ */
+void sockopts_apply(int socket, const SocketOptions* options, RcvbufAdapter* adapter);
+
+/**
+ * @brief   Amplía el buffer de recepción si el kernel sigue descartando datagramas.
+ *
+ * Duplica el buffer, hasta el límite, si los descartes aumentaron desde la última ampliación y ya pasó
+ * SOCKOPTS_ADAPT_INTERVAL. Es barata cuando no hay nada que hacer, así que puede llamarse tras cada recepción.
+ * Si el kernel no deja crecer el buffer (net.core.rmem_max sin privilegios), el modo se desactiva.
+ *
+ * @param socket    Socket.
+ * @param adapter   Estado del modo adaptativo.
+ * @param drops     Total de descartes del socket (SO_RXQ_OVFL).
+ * @param now       Instante actual (ns, reloj monótono).
+ *
+ * @return  Nuevo tamaño del buffer si se amplió, o 0 si no.
+ */
+int sockopts_adapt(int socket, RcvbufAdapter* adapter, uint64_t drops, uint64_t now);
+
+
+#endif  /* SOCKOPTS_H */
@@ -0,0 +1,398 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UPPER_X86
+#endif
+
+#include "upper.h"
+#include "upper_tables.h"
+
+_Static_assert(UPPER_TABLES_MAX_EXPANSION <= UPPER_MAX_EXPANSION, "UPPER_MAX_EXPANSION es menor que la expansión de las tablas");
+
+#define HIGH_BITS 0x8080808080808080ULL     /* Bit más significativo de cada byte de una palabra de 64 bits */
+#define ONES 0x0101010101010101ULL          /* Un 1 en cada byte de una palabra de 64 bits */
+
+
+/**
+ * @brief   Núcleo ASCII escalar.
+ *
+ * Procesa el buffer de 8 en 8 bytes con aritmética de palabra (SWAR), sin instrucciones vectoriales.
+ * Sirve en cualquier CPU.
+ *
+ * @param buffer    Buffer a transformar.
+ * @param len       Número de bytes de buffer.
+ *
+ * @return  Número de bytes del principio de buffer que eran ASCII y ya están en mayúsculas.
+ */
+static size_t toupper_ascii_scalar(char* buffer, size_t len) {
+    uint64_t word, heptets, is_lower;
+    size_t i;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        memcpy(&word, buffer + i, 8);   /* buffer no tiene por qué estar alineado */
+        if (word & HIGH_BITS) return i; /* Hay algún byte no ASCII en el bloque */
+
+        /* El bit alto de cada byte queda a 1 si el byte está en ['a', 'z'] */
+        heptets = word & ~HIGH_BITS;
+        is_lower = (heptets + ONES * (0x80 - 'a')) & ~(heptets + ONES * (0x7F - 'z')) & HIGH_BITS;
+        word ^= is_lower >> 2;          /* 0x80 >> 2 == 0x20, la diferencia entre minúscula y mayúscula */
+        memcpy(buffer + i, &word, 8);
+    }
+
+    for (; i < len; i++) {
+        if (buffer[i] & 0x80) return i;
+        if (buffer[i] >= 'a' && buffer[i] <= 'z') buffer[i] ^= 0x20;
+    }
+
+    return len;
+}
+
+
+#ifdef UPPER_X86
+/**
+ * @brief   Núcleo ASCII con SSE2.
+ *
+ * Procesa el buffer de 16 en 16 bytes y deja el resto al núcleo escalar.
+ *
+ * @param buffer    Buffer a transformar.
+ * @param len       Número de bytes de buffer.
+ *
+ * @return  Número de bytes del principio de buffer que eran ASCII y ya están en mayúsculas.
+ */
+__attribute__((target("sse2")))
+static size_t toupper_ascii_sse2(char* buffer, size_t len) {
+    const __m128i before_a = _mm_set1_epi8('a' - 1);
+    const __m128i after_z = _mm_set1_epi8('z' + 1);
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    __m128i block, is_lower;
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        block = _mm_loadu_si128((const __m128i *) (buffer + i));
+        if (_mm_movemask_epi8(block)) return i;     /* Hay algún byte no ASCII en el bloque */
+
+        /* Al ser todos los bytes ASCII, las comparaciones con signo son correctas */
+        is_lower = _mm_and_si128(_mm_cmpgt_epi8(block, before_a), _mm_cmplt_epi8(block, after_z));
+        block = _mm_xor_si128(block, _mm_and_si128(is_lower, case_bit));
+        _mm_storeu_si128((__m128i *) (buffer + i), block);
+    }
+
+    return i + toupper_ascii_scalar(buffer + i, len - i);
+}
+
+
+/**
+ * @brief   Núcleo ASCII con AVX2.
+ *
+ * Procesa el buffer de 32 en 32 bytes y deja el resto al núcleo SSE2.
+ *
+ * @param buffer    Buffer a transformar.
+ * @param len       Número de bytes de buffer.
+ *
+ * @return  Número de bytes del principio de buffer que eran ASCII y ya están en mayúsculas.
+ */
+__attribute__((target("avx2")))
+static size_t toupper_ascii_avx2(char* buffer, size_t len) {
+    const __m256i before_a = _mm256_set1_epi8('a' - 1);
+    const __m256i after_z = _mm256_set1_epi8('z' + 1);
+    const __m256i case_bit = _mm256_set1_epi8(0x20);
+    __m256i block, is_lower;
+    size_t i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        block = _mm256_loadu_si256((const __m256i *) (buffer + i));
+        if (_mm256_movemask_epi8(block)) return i;  /* Hay algún byte no ASCII en el bloque */
+
+        is_lower = _mm256_and_si256(_mm256_cmpgt_epi8(block, before_a), _mm256_cmpgt_epi8(after_z, block));
+        block = _mm256_xor_si256(block, _mm256_and_si256(is_lower, case_bit));
+        _mm256_storeu_si256((__m256i *) (buffer + i), block);
+    }
+
+    return i + toupper_ascii_sse2(buffer + i, len - i);
+}
+#endif
+
+
+/* Núcleos ordenados del más lento al más rápido */
+static const AsciiKernelInfo ascii_kernels[] = {
+    { "scalar", toupper_ascii_scalar },
+#ifdef UPPER_X86
+    { "sse2", toupper_ascii_sse2 },
+    { "avx2", toupper_ascii_avx2 },
+#endif
+};
+
+/* Número de núcleos de ascii_kernels que soporta la CPU; se calcula una sola vez al cargar el programa */
+static size_t ascii_kernel_count = 1;
+
+/* Núcleo usado por toupper_ascii: el más rápido disponible */
+static AsciiKernel ascii_kernel = toupper_ascii_scalar;
+
+
+/**
+ * @brief   Elige el núcleo ASCII según la CPU.
+ *
+ * Se ejecuta automáticamente antes de main, de forma que toupper_ascii no necesita
+ * ninguna comprobación ni sincronización entre hilos.
+ */
+__attribute__((constructor))
+static void select_ascii_kernel(void) {
+#ifdef UPPER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) ascii_kernel_count = 2;
+    if (__builtin_cpu_supports("avx2")) ascii_kernel_count = 3;
+#endif
+    ascii_kernel = ascii_kernels[ascii_kernel_count - 1].function;
+}
+
+
+/**
+ * @brief   Pasa a mayúsculas in situ el prefijo ASCII de un buffer.
+ *
+ * Recorre buffer en una sola pasada, comprobando a la vez que los bytes son ASCII y pasando a mayúsculas
+ * las letras minúsculas. Usa el núcleo vectorial más rápido que soporte la CPU (AVX2, SSE2 o escalar),
+ * elegido en tiempo de ejecución. Se detiene en el bloque que contiene el primer byte no ASCII, que queda
+ * sin modificar, de forma que el resto puede procesarse con toupper_utf8.
+ *
+ * @param buffer    Buffer a transformar.
+ * @param len       Número de bytes de buffer.
+ *
+ * @return  Número de bytes del principio de buffer que eran ASCII y ya están en mayúsculas.
+ *          Si es igual a len, todo el buffer era ASCII y ya está transformado.
+ */
+size_t toupper_ascii(char* buffer, size_t len) {
+    return ascii_kernel(buffer, len);
+}
+
+
+/**
+ * @brief   Devuelve los núcleos ASCII disponibles.
+ *
+ * @param count     Variable en la que guardar el número de núcleos disponibles en la CPU actual.
+ *
+ * @return  Array con los núcleos disponibles, del más lento al más rápido. El último es el que usa toupper_ascii.
+ */
+const AsciiKernelInfo* toupper_ascii_kernels(size_t* count) {
+    *count = ascii_kernel_count;
+    return ascii_kernels;
+}
+
+
+/**
+ * @brief   Decodifica un carácter UTF-8.
+ *
+ * Solo acepta secuencias bien formadas: sin formas sobrelargas, sin sustitutos y sin pasar de U+10FFFF.
+ *
+ * @param source        Bytes a decodificar.
+ * @param len           Número de bytes disponibles en source (al menos 1).
+ * @param codepoint     Variable en la que guardar el punto de código decodificado.
+ *
+ * @return  Número de bytes que ocupa el carácter, o 0 si la secuencia no es válida.
+ */
+static size_t decode_utf8(const unsigned char* source, size_t len, uint32_t* codepoint) {
+    unsigned char lead = source[0];
+    unsigned char min = 0x80, max = 0xBF;   /* Rango permitido para el segundo byte */
+    size_t size, i;
+
+    if (lead < 0x80) {
+        *codepoint = lead;
+        return 1;
+    } else if (lead >= 0xC2 && lead <= 0xDF) {
+        size = 2;
+        *codepoint = lead & 0x1F;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+        size = 3;
+        *codepoint = lead & 0x0F;
+        if (lead == 0xE0) min = 0xA0;       /* Forma sobrelarga */
+        if (lead == 0xED) max = 0x9F;       /* Sustitutos U+D800-U+DFFF */
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+        size = 4;
+        *codepoint = lead & 0x07;
+        if (lead == 0xF0) min = 0x90;       /* Forma sobrelarga */
+        if (lead == 0xF4) max = 0x8F;       /* Más allá de U+10FFFF */
+    } else {
+        return 0;
+    }
+
+    if (len < size || source[1] < min || source[1] > max) return 0;
+    for (i = 1; i < size; i++) {
+        if ((source[i] & 0xC0) != 0x80) return 0;
+        *codepoint = (*codepoint << 6) | (source[i] & 0x3F);
+    }
+
+    return size;
+}
+
+
+/**
+ * @brief   Codifica un punto de código en UTF-8.
+ *
+ * @param codepoint     Punto de código a codificar.
+ * @param destiny       Buffer en el que escribir, de por lo menos 4 bytes.
+ *
+ * @return  Número de bytes escritos.
+ */
+static size_t encode_utf8(uint32_t codepoint, char* destiny) {
+    if (codepoint < 0x80) {
+        destiny[0] = codepoint;
+        return 1;
+    } else if (codepoint < 0x800) {
+        destiny[0] = 0xC0 | (codepoint >> 6);
+        destiny[1] = 0x80 | (codepoint & 0x3F);
+        return 2;
+    } else if (codepoint < 0x10000) {
+        destiny[0] = 0xE0 | (codepoint >> 12);
+        destiny[1] = 0x80 | ((codepoint >> 6) & 0x3F);
+        destiny[2] = 0x80 | (codepoint & 0x3F);
+        return 3;
+    }
+    destiny[0] = 0xF0 | (codepoint >> 18);
+    destiny[1] = 0x80 | ((codepoint >> 12) & 0x3F);
+    destiny[2] = 0x80 | ((codepoint >> 6) & 0x3F);
+    destiny[3] = 0x80 | (codepoint & 0x3F);
+    return 4;
+}
+
+
+/**
+ * @brief   Busca la correspondencia de varios caracteres de un punto de código.
+ *
+ * @param codepoint     Punto de código marcado como UPPER_SPECIAL en las tablas.
+ *
+ * @return  Índice de la correspondencia en upper_special.
+ */
+static size_t find_special(uint32_t codepoint) {
+    size_t low = 0, high = sizeof(upper_special) / sizeof(upper_special[0]) - 1, middle;
+
+    /* Bisección: upper_special está ordenada y siempre contiene codepoint */
+    while (low < high) {
+        middle = (low + high) / 2;
+        if (upper_special[middle].codepoint < codepoint) low = middle + 1;
+        else high = middle;
+    }
+
+    return low;
+}
+
+
+/**
+ * @brief   Pasa a mayúsculas texto UTF-8.
+ *
+ * Transforma directamente los bytes UTF-8 de source, sin pasar por wchar_t, usando tablas de Unicode
+ * generadas en tiempo de compilación (tools/gen_upper_tables.py). El resultado no depende del locale del
+ * proceso e incluye las correspondencias que cambian de longitud (por ejemplo, 'ß' -> "SS"). Las secuencias
+ * UTF-8 no válidas se copian sin modificar.
+ *
+ * @param source    Texto a transformar (no tiene por qué terminar en '\0').
+ * @param len       Número de bytes de source.
+ * @param destiny   Buffer en el que escribir el resultado, que no se termina en '\0'.
+ * @param capacity  Tamaño de destiny. Con UPPER_MAX_EXPANSION * len bytes siempre cabe el resultado.
+ *
+ * @return  Número de bytes escritos en destiny, o -1 si el resultado no cabe en capacity bytes.
+ */
+ssize_t toupper_utf8(const char* source, size_t len, char* destiny, size_t capacity) {
+    const unsigned char* input = (const unsigned char *) source;
+    size_t i = 0, written = 0, size, special;
+    uint32_t codepoint;
+    uint8_t entry;
+
+    while (i < len) {
+        /* ASCII: caso más frecuente, sin consultar las tablas */
+        if (input[i] < 0x80) {
+            if (written == capacity) return -1;
+            destiny[written++] = (input[i] >= 'a' && input[i] <= 'z') ? input[i] ^ 0x20 : input[i];
+            i++;
+            continue;
+        }
+
+        /* Secuencia no válida: se copia el byte tal cual y se sigue con el siguiente */
+        if ( !(size = decode_utf8(input + i, len - i, &codepoint)) ) {
+            if (written == capacity) return -1;
+            destiny[written++] = source[i++];
+            continue;
+        }
+
+        entry = codepoint > UPPER_LAST_CODEPOINT ? 0 : upper_stage2[upper_stage1[codepoint >> UPPER_BLOCK_BITS]][codepoint & ((1 << UPPER_BLOCK_BITS) - 1)];
+        if (entry == UPPER_SPECIAL) {       /* Correspondencia de varios caracteres, ya codificada */
+            special = find_special(codepoint);
+            if (capacity - written < upper_special[special].len) return -1;
+            memcpy(destiny + written, upper_special[special].utf8, upper_special[special].len);
+            written += upper_special[special].len;
+        } else if (entry) {                 /* Correspondencia simple; puede cambiar el número de bytes */
+            codepoint += upper_deltas[entry];
+            if (capacity - written < (codepoint < 0x80 ? 1 : codepoint < 0x800 ? 2 : codepoint < 0x10000 ? 3 : 4)) return -1;
+            written += encode_utf8(codepoint, destiny + written);
+        } else {                            /* Sin mayúscula distinta: se copia */
+            if (capacity - written < size) return -1;
+            memcpy(destiny + written, source + i, size);
+            written += size;
+        }
+        i += size;
+    }
+
+    return written;
+}
+
+
+/**
+ * @brief   Pasa a mayúsculas un buffer, in situ si es posible.
+ *
+ * Intenta primero toupper_ascii sobre source; si todo el buffer es ASCII el resultado queda en el propio
+ * source sin copias. Si no, copia el prefijo ASCII ya transformado a destiny y procesa el resto con toupper_utf8.
+ *
+ * @param source    Texto a transformar. Su prefijo ASCII se modifica in situ.
+ * @param len       Número de bytes de source.
+ * @param destiny   Buffer para el resultado cuando el texto no es ASCII.
+ * @param capacity  Tamaño de destiny.
+ * @param output    Variable en la que guardar dónde está el resultado (source o destiny).
+ *
+ * @return  Longitud del resultado, o -1 si no cabe en capacity bytes.
+ */
+ssize_t toupper_buffer(char* source, size_t len, char* destiny, size_t capacity, char** output) {
+    size_t ascii;
+    ssize_t rest;
+
+    if ( (ascii = toupper_ascii(source, len)) == len ) {
+        *output = source;
+        return len;
+    }
+
+    *output = destiny;
+    if (capacity < ascii) return -1;
+    memcpy(destiny, source, ascii);
+    if ( (rest = toupper_utf8(source + ascii, len - ascii, destiny + ascii, capacity - ascii)) < 0 ) return -1;
+
+    return ascii + rest;
+}
+
+
+/**
+ * @brief   Calcula hasta dónde llegan los caracteres UTF-8 completos de un buffer.
+ *
+ * Sirve para partir un texto en trozos que se puedan transformar por separado: si el buffer termina
+ * a mitad de una secuencia UTF-8 (como mucho, 3 de sus 4 bytes), esos bytes se dejan fuera. Los bytes
+ * que no pueden formar parte de ninguna secuencia válida no se dejan fuera, porque se copian tal cual.
+ *
+ * @param buffer    Texto.
+ * @param len       Número de bytes de buffer.
+ *
+ * @return  Longitud del prefijo de buffer que no termina en un carácter incompleto (len, o hasta 3 menos).
+ */
+size_t utf8_complete_len(const char* buffer, size_t len) {
+    const unsigned char* input = (const unsigned char *) buffer;
+    size_t back, needed;
+
+    /* Buscar el byte inicial de la última secuencia entre los 3 últimos bytes */
+    for (back = 1; back <= 3 && back <= len; back++) {
+        if ((input[len - back] & 0xC0) == 0x80) continue;      /* Byte de continuación */
+        if (input[len - back] < 0xC0) return len;               /* ASCII: el último carácter está completo */
+        needed = input[len - back] >= 0xF0 ? 4 : input[len - back] >= 0xE0 ? 3 : 2;
+        return needed > back ? len - back : len;
+    }
+
+    return len;
+}
@@ -0,0 +1,97 @@
+#ifndef UPPER_H
+#define UPPER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Máximo factor de crecimiento en bytes al pasar UTF-8 a mayúsculas (por ejemplo, 'ΐ' -> "Ϊ́", de 2 a 6 bytes).
+ * Un buffer de destino de UPPER_MAX_EXPANSION * len bytes siempre es suficiente */
+#define UPPER_MAX_EXPANSION 3
+
+/* Tipo de los núcleos que pasan a mayúsculas un buffer ASCII in situ */
+typedef size_t (*AsciiKernel)(char* buffer, size_t len);
+
+/**
+ * Núcleo de conversión ASCII disponible en la CPU actual, con su nombre
+ * para poder mostrarlo en las estadísticas y en los benchmarks.
+ */
+typedef struct {
+    const char* name;       /* Nombre del juego de instrucciones usado ("scalar", "sse2", "avx2") */
+    AsciiKernel function;   /* Función que implementa el núcleo */
+} AsciiKernelInfo;
+
+
+/**
+ * @brief   Pasa a mayúsculas in situ el prefijo ASCII de un buffer.
+ *
+ * Recorre buffer en una sola pasada, comprobando a la vez que los bytes son ASCII y pasando a mayúsculas
+ * las letras minúsculas. Usa el núcleo vectorial más rápido que soporte la CPU (AVX2, SSE2 o escalar),
+ * elegido en tiempo de ejecución. Se detiene en el bloque que contiene el primer byte no ASCII, que queda
+ * sin modificar, de forma que el resto puede procesarse con toupper_utf8.
+ *
+ * @param buffer    Buffer a transformar.
+ * @param len       Número de bytes de buffer.
+ *
+ * @return  Número de bytes del principio de buffer que eran ASCII y ya están en mayúsculas.
+ *          Si es igual a len, todo el buffer era ASCII y ya está transformado.
+ */
+size_t toupper_ascii(char* buffer, size_t len);
+
+/**
+ * @brief   Devuelve los núcleos ASCII disponibles.
+ *
+ * @param count     Variable en la que guardar el número de núcleos disponibles en la CPU actual.
+ *
+ * @return  Array con los núcleos disponibles, del más lento al más rápido. El último es el que usa toupper_ascii.
+ */
+const AsciiKernelInfo* toupper_ascii_kernels(size_t* count);
+
+/**
+ * @brief   Pasa a mayúsculas texto UTF-8.
+ *
+ * Transforma directamente los bytes UTF-8 de source, sin pasar por wchar_t, usando tablas de Unicode
+ * generadas en tiempo de compilación (tools/gen_upper_tables.py). El resultado no depende del locale del
+ * proceso e incluye las correspondencias que cambian de longitud (por ejemplo, 'ß' -> "SS"). Las secuencias
+ * UTF-8 no válidas se copian sin modificar.
+ *
+ * @param source    Texto a transformar (no tiene por qué terminar en '\0').
+ * @param len       Número de bytes de source.
+ * @param destiny   Buffer en el que escribir el resultado, que no se termina en '\0'.
+ * @param capacity  Tamaño de destiny. Con UPPER_MAX_EXPANSION * len bytes siempre cabe el resultado.
+ *
+ * @return  Número de bytes escritos en destiny, o -1 si el resultado no cabe en capacity bytes.
+ */
+ssize_t toupper_utf8(const char* source, size_t len, char* destiny, size_t capacity);
+
+/**
+ * @brief   Pasa a mayúsculas un buffer, in situ si es posible.
+ *
+ * Intenta primero toupper_ascii sobre source; si todo el buffer es ASCII el resultado queda en el propio
+ * source sin copias. Si no, copia el prefijo ASCII ya transformado a destiny y procesa el resto con toupper_utf8.
+ *
+ * @param source    Texto a transformar. Su prefijo ASCII se modifica in situ.
+ * @param len       Número de bytes de source.
+ * @param destiny   Buffer para el resultado cuando el texto no es ASCII.
+ * @param capacity  Tamaño de destiny.
+ * @param output    Variable en la que guardar dónde está el resultado (source o destiny).
+ *
+ * @return  Longitud del resultado, o -1 si no cabe en capacity bytes.
+ */
+ssize_t toupper_buffer(char* source, size_t len, char* destiny, size_t capacity, char** output);
+
+/**
+ * @brief   Calcula hasta dónde llegan los caracteres UTF-8 completos de un buffer.
+ *
+ * Sirve para partir un texto en trozos que se puedan transformar por separado: si el buffer termina
+ * a mitad de una secuencia UTF-8 (como mucho, 3 de sus 4 bytes), esos bytes se dejan fuera. Los bytes
+ * que no pueden formar parte de ninguna secuencia válida no se dejan fuera, porque se copian tal cual.
+ *
+ * @param buffer    Texto.
+ * @param len       Número de bytes de buffer.
+ *
+ * @return  Longitud del prefijo de buffer que no termina en un carácter incompleto (len, o hasta 3 menos).
+ */
+size_t utf8_complete_len(const char* buffer, size_t len);
+
+
+#endif  /* UPPER_H */
@@ -0,0 +1,244 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+#include "loging.h"
+
+
+/* Los índices compartidos con el kernel se leen con semántica de adquisición y se escriben con
+ * semántica de liberación, para que los datos que protegen sean visibles antes que el índice */
+#define load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+
+/**
+ * @brief   Devuelve una entrada libre de la cola de envío, puesta a cero.
+ *
+ * Si la cola está llena, envía antes al kernel las peticiones ya preparadas.
+ *
+ * @param ring  Instancia de io_uring.
+ *
+ * @return  Entrada de la cola de envío.
+ */
+static struct io_uring_sqe* get_sqe(IoUring* ring);
+
+
+int uring_init(IoUring* ring, unsigned int entries) {
+    struct io_uring_params params;
+    unsigned int i;
+
+    memset(ring, 0, sizeof(IoUring));
+    memset(&params, 0, sizeof(params));
+    ring->fd = -1;
+
+    if ( (ring->fd = syscall(__NR_io_uring_setup, entries, &params)) < 0) return -1;
+
+    /* Proyectar las colas de envío y de finalización; en kernels modernos comparten una sola zona */
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) fail("No se pudo proyectar la cola de envío de io_uring");
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) fail("No se pudo proyectar la cola de finalización de io_uring");
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) fail("No se pudieron proyectar las peticiones de io_uring");
+
+    ring->sq_head = (unsigned int *) ((char *) ring->sq_ring + params.sq_off.head);
+    ring->sq_tail = (unsigned int *) ((char *) ring->sq_ring + params.sq_off.tail);
+    ring->sq_mask = *(unsigned int *) ((char *) ring->sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *) ((char *) ring->sq_ring + params.sq_off.array);
+    ring->sq_local_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned int *) ((char *) ring->cq_ring + params.cq_off.head);
+    ring->cq_tail = (unsigned int *) ((char *) ring->cq_ring + params.cq_off.tail);
+    ring->cq_mask = *(unsigned int *) ((char *) ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_ring + params.cq_off.cqes);
+
+    /* Cada posición de la cola de envío apunta siempre a la petición con su mismo índice */
+    for (i = 0; i <= ring->sq_mask; i++) ring->sq_array[i] = i;
+
+    return 0;
+}
+
+
+int uring_setup_buffers(IoUring* ring, unsigned int count, size_t size) {
+    struct io_uring_buf_reg reg;
+    unsigned int i;
+
+    ring->buffer_count = count;
+    ring->buffer_size = size;
+    ring->buffer_ring = mmap(NULL, count * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->buffer_ring == MAP_FAILED) fail("No se pudo reservar el anillo de buffers de io_uring");
+    if ( !(ring->buffers = (char *) malloc(count * size)) ) fail("No se pudo reservar memoria para los buffers de io_uring");
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t) ring->buffer_ring;
+    reg.ring_entries = count;
+    reg.bgid = URING_BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) return -1;
+
+    /* Entregar todos los buffers al kernel */
+    ring->buffer_ring->tail = 0;
+    for (i = 0; i < count; i++) uring_recycle_buffer(ring, i);
+
+    return 0;
+}
+
+
+static struct io_uring_sqe* get_sqe(IoUring* ring) {
+    struct io_uring_sqe* sqe;
+
+    /* La cola está llena cuando el kernel aún no ha consumido tantas peticiones como caben en ella */
+    while (ring->sq_local_tail - load_acquire(ring->sq_head) > ring->sq_mask) {
+        if (uring_submit(ring, 0, -1) < 0) fail("No se pudieron enviar las peticiones a io_uring");
+    }
+
+    sqe = &ring->sqes[ring->sq_local_tail & ring->sq_mask];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sq_local_tail++;
+    ring->to_submit++;
+
+    return sqe;
+}
+
+
+void uring_prep_recvmsg_multishot(IoUring* ring, int socket, struct msghdr* msg, uint64_t user_data) {
+    struct io_uring_sqe* sqe = get_sqe(ring);
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = socket;
+    sqe->addr = (uintptr_t) msg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;   /* El kernel elige un buffer del grupo para cada datagrama */
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = user_data;
+}
+
+
+void uring_prep_sendmsg(IoUring* ring, int socket, const struct msghdr* msg, uint64_t user_data, int link) {
+    struct io_uring_sqe* sqe = get_sqe(ring);
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = socket;
+    sqe->addr = (uintptr_t) msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_DONTWAIT;
+    sqe->flags = link ? IOSQE_IO_LINK : 0;
+    sqe->user_data = user_data;
+}
+
+
+void uring_prep_poll(IoUring* ring, int fd, unsigned int events, uint64_t user_data) {
+    struct io_uring_sqe* sqe = get_sqe(ring);
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->user_data = user_data;
+}
+
+
+int uring_submit(IoUring* ring, unsigned int wait_nr, int64_t timeout) {
+    struct io_uring_getevents_arg arg;
+    struct timespec ts;
+    unsigned int flags = 0;
+    void* enter_arg = NULL;
+    size_t enter_arg_size = 0;
+    int submitted;
+
+    /* Hacer visibles al kernel las peticiones preparadas */
+    store_release(ring->sq_tail, ring->sq_local_tail);
+
+    if (wait_nr) flags |= IORING_ENTER_GETEVENTS;
+    if (wait_nr && timeout >= 0) {
+        ts.tv_sec = timeout / 1000000000;
+        ts.tv_nsec = timeout % 1000000000;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (uintptr_t) &ts;
+        flags |= IORING_ENTER_EXT_ARG;
+        enter_arg = &arg;
+        enter_arg_size = sizeof(arg);
+    }
+    if (!ring->to_submit && !wait_nr) return 0;
+
+    if ( (submitted = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, wait_nr, flags, enter_arg, enter_arg_size)) < 0) {
+        /* Vencer el plazo o recibir una señal no son errores: el llamante vuelve a mirar la cola */
+        if (errno == ETIME || errno == EINTR) return 0;
+        return -1;
+    }
+    ring->to_submit -= submitted;
+
+    return 0;
+}
+
+
+struct io_uring_cqe* uring_peek(IoUring* ring) {
+    unsigned int head = *ring->cq_head;
+
+    if (head == load_acquire(ring->cq_tail)) return NULL;
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+
+void uring_seen(IoUring* ring) {
+    store_release(ring->cq_head, *ring->cq_head + 1);
+}
+
+
+char* uring_recvmsg_payload(IoUring* ring, const struct io_uring_cqe* cqe, const struct msghdr* msg, struct msghdr* result, size_t* len) {
+    char* buffer = ring->buffers + (cqe->flags >> IORING_CQE_BUFFER_SHIFT) * ring->buffer_size;
+    struct io_uring_recvmsg_out* out = (struct io_uring_recvmsg_out *) buffer;
+    char* name = buffer + sizeof(struct io_uring_recvmsg_out);
+
+    /* Detrás de la cabecera va siempre el espacio completo reservado para la dirección y el control, aunque ocupen menos */
+    if (result) {
+        result->msg_name = name;
+        result->msg_namelen = out->namelen < msg->msg_namelen ? out->namelen : msg->msg_namelen;
+        result->msg_control = out->controllen ? name + msg->msg_namelen : NULL;
+        result->msg_controllen = out->controllen;
+        result->msg_flags = out->flags;
+    }
+    if (out->flags & MSG_TRUNC) return NULL;
+    *len = out->payloadlen;
+
+    return name + msg->msg_namelen + msg->msg_controllen;
+}
+
+
+void uring_recycle_buffer(IoUring* ring, unsigned int bid) {
+    unsigned short tail = ring->buffer_ring->tail;     /* Solo lo modifica este hilo */
+    struct io_uring_buf* buf = &ring->buffer_ring->bufs[tail & (ring->buffer_count - 1)];
+
+    buf->addr = (uintptr_t) (ring->buffers + bid * ring->buffer_size);
+    buf->len = ring->buffer_size - 1;   /* Un byte libre para el '\0' final */
+    buf->bid = bid;
+    store_release(&ring->buffer_ring->tail, (unsigned short) (tail + 1));
+}
+
+
+void uring_free(IoUring* ring) {
+    if (ring->buffer_ring && ring->buffer_ring != MAP_FAILED) munmap(ring->buffer_ring, ring->buffer_count * sizeof(struct io_uring_buf));
+    free(ring->buffers);
+    if (ring->sqes) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring) munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->fd >= 0 && close(ring->fd)) fail("No se pudo cerrar la instancia de io_uring");
+
+    memset(ring, 0, sizeof(IoUring));
+    ring->fd = -1;
+}
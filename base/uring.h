@@ -0,0 +1,192 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+/* Grupo de buffers proporcionados que usan las recepciones multishot */
+#define URING_BUFFER_GROUP 0
+
+/* Tipo de operación codificado en los 8 bits altos del user_data de cada petición */
+#define URING_OP_SHIFT 56
+#define uring_user_data(op, index) (((uint64_t) (op) << URING_OP_SHIFT) | (uint32_t) (index))
+#define uring_user_op(user_data) ((unsigned) ((user_data) >> URING_OP_SHIFT))
+#define uring_user_index(user_data) ((uint32_t) (user_data))
+
+/**
+ * Instancia de io_uring con la que el Sender y el Receiver pueden enviar y recibir datagramas
+ * sin una llamada al sistema por datagrama. Se maneja directamente con las llamadas al sistema
+ * io_uring_setup, io_uring_enter e io_uring_register, sin depender de liburing.
+ *
+ * Las recepciones son multishot: una sola petición por socket genera una respuesta en la cola
+ * de finalización por cada datagrama, que el kernel escribe en uno de los buffers proporcionados
+ * (un anillo de buffer_count buffers de buffer_size bytes registrado con el grupo URING_BUFFER_GROUP).
+ * Cada buffer, tras usarlo, hay que devolverlo al anillo con uring_recycle_buffer.
+ */
+typedef struct {
+    int fd;                             /* Descriptor de la instancia de io_uring */
+
+    /* Cola de envío (compartida con el kernel) */
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int sq_mask;
+    unsigned int* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned int sq_local_tail;         /* Peticiones preparadas, todavía no visibles para el kernel */
+    unsigned int to_submit;             /* Peticiones preparadas desde el último io_uring_enter */
+
+    /* Cola de finalización (compartida con el kernel) */
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe* cqes;
+
+    /* Zonas de memoria proyectadas, para poder liberarlas */
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+
+    /* Buffers proporcionados para las recepciones */
+    struct io_uring_buf_ring* buffer_ring;  /* Anillo de descriptores de buffer compartido con el kernel */
+    char* buffers;                          /* buffer_count buffers consecutivos de buffer_size bytes */
+    unsigned int buffer_count;              /* Número de buffers (potencia de 2) */
+    size_t buffer_size;                     /* Tamaño de cada buffer */
+} IoUring;
+
+
+/**
+ * @brief   Crea una instancia de io_uring.
+ *
+ * Si el kernel no soporta io_uring (o no permite usarlo), no se considera un error: se devuelve -1
+ * para que el llamante use las llamadas bloqueantes de siempre.
+ *
+ * @param ring      Instancia a inicializar.
+ * @param entries   Tamaño de la cola de envío (se redondea a potencia de 2 por el kernel).
+ *
+ * @return  0 si se pudo crear, -1 si io_uring no está disponible (errno indica la causa).
+ */
+int uring_init(IoUring* ring, unsigned int entries);
+
+/**
+ * @brief   Reserva y registra los buffers proporcionados para las recepciones multishot.
+ *
+ * Cada buffer se registra con un byte menos de su tamaño, de modo que el llamante siempre puede
+ * añadir un '\0' detrás de los datos recibidos.
+ *
+ * @param ring      Instancia de io_uring.
+ * @param count     Número de buffers (potencia de 2, como mucho 32768).
+ * @param size      Tamaño de cada buffer.
+ *
+ * @return  0 si se pudieron registrar, -1 si el kernel no soporta buffers proporcionados en anillo.
+ */
+int uring_setup_buffers(IoUring* ring, unsigned int count, size_t size);
+
+/**
+ * @brief   Prepara una recepción multishot de datagramas en un socket.
+ *
+ * Cada datagrama genera una respuesta con IORING_CQE_F_BUFFER y el índice del buffer en los flags.
+ * El contenido del buffer empieza por una estructura io_uring_recvmsg_out, seguida de la dirección
+ * del emisor (de msg_namelen bytes), los mensajes de control (de msg_controllen bytes) y los datos:
+ * ver uring_recvmsg_payload. Si una respuesta no trae
+ * IORING_CQE_F_MORE, la recepción terminó (por ejemplo por quedarse sin buffers) y hay que volver a pedirla.
+ *
+ * @param ring      Instancia de io_uring.
+ * @param socket    Socket del que recibir.
+ * @param msg       Cabecera con msg_namelen y msg_controllen indicando el espacio para la dirección del
+ *                  emisor y los mensajes de control. Debe seguir existiendo mientras la recepción esté activa.
+ * @param user_data Identificador de la petición, que se devuelve en cada respuesta.
+ */
+void uring_prep_recvmsg_multishot(IoUring* ring, int socket, struct msghdr* msg, uint64_t user_data);
+
+/**
+ * @brief   Prepara el envío de un datagrama.
+ *
+ * El envío nunca se queda esperando (MSG_DONTWAIT): si el datagrama no cabe en el buffer del socket,
+ * su respuesta trae -EAGAIN (y los envíos encadenados detrás, -ECANCELED), igual que si se perdiera.
+ * Así todos los envíos terminan dentro de la llamada a uring_submit que los encola.
+ *
+ * @param ring      Instancia de io_uring.
+ * @param socket    Socket por el que enviar.
+ * @param msg       Cabecera del mensaje. Tanto ella como los datos deben seguir existiendo hasta que
+ *                  se envíe la petición al kernel con uring_submit.
+ * @param user_data Identificador de la petición, que se devuelve en su respuesta.
+ * @param link      Si es distinto de 0, la siguiente petición que se prepare no empieza hasta que
+ *                  termine esta (IOSQE_IO_LINK), lo que mantiene el orden de los envíos.
+ */
+void uring_prep_sendmsg(IoUring* ring, int socket, const struct msghdr* msg, uint64_t user_data, int link);
+
+/**
+ * @brief   Prepara la espera de un evento de poll en un descriptor.
+ *
+ * La respuesta llega una sola vez, cuando el descriptor tiene alguno de los eventos pedidos,
+ * con los eventos que tiene como resultado.
+ *
+ * @param ring      Instancia de io_uring.
+ * @param fd        Descriptor a vigilar.
+ * @param events    Eventos de poll a esperar (POLLIN, POLLRDHUP...).
+ * @param user_data Identificador de la petición, que se devuelve en su respuesta.
+ */
+void uring_prep_poll(IoUring* ring, int fd, unsigned int events, uint64_t user_data);
+
+/**
+ * @brief   Envía al kernel las peticiones preparadas y espera respuestas.
+ *
+ * @param ring      Instancia de io_uring.
+ * @param wait_nr   Número mínimo de respuestas a esperar (0 para no bloquear).
+ * @param timeout   Tiempo máximo de espera en nanosegundos, o -1 para esperar indefinidamente.
+ *
+ * @return  0 si fue bien (también si venció el plazo), -1 si hubo un error.
+ */
+int uring_submit(IoUring* ring, unsigned int wait_nr, int64_t timeout);
+
+/**
+ * @brief   Devuelve la siguiente respuesta de la cola de finalización, sin consumirla.
+ *
+ * @param ring  Instancia de io_uring.
+ *
+ * @return  Respuesta, o NULL si la cola está vacía.
+ */
+struct io_uring_cqe* uring_peek(IoUring* ring);
+
+/**
+ * @brief   Consume la respuesta devuelta por uring_peek.
+ *
+ * @param ring  Instancia de io_uring.
+ */
+void uring_seen(IoUring* ring);
+
+/**
+ * @brief   Localiza los datos de un datagrama recibido con una recepción multishot.
+ *
+ * @param ring      Instancia de io_uring.
+ * @param cqe       Respuesta de la recepción.
+ * @param msg       Cabecera con la que se preparó la recepción.
+ * @param result    Si no es NULL, se guardan en ella la dirección del emisor (msg_name), los mensajes de
+ *                  control (msg_control) y los flags de la recepción, apuntando dentro del buffer.
+ * @param len       Se guarda la longitud de los datos.
+ *
+ * @return  Puntero a los datos dentro del buffer proporcionado, o NULL si el datagrama no cabía.
+ */
+char* uring_recvmsg_payload(IoUring* ring, const struct io_uring_cqe* cqe, const struct msghdr* msg, struct msghdr* result, size_t* len);
+
+/**
+ * @brief   Devuelve un buffer proporcionado al anillo para que el kernel lo vuelva a usar.
+ *
+ * @param ring  Instancia de io_uring.
+ * @param bid   Índice del buffer (cqe->flags >> IORING_CQE_BUFFER_SHIFT).
+ */
+void uring_recycle_buffer(IoUring* ring, unsigned int bid);
+
+/**
+ * @brief   Cierra la instancia de io_uring y libera sus buffers.
+ *
+ * @param ring  Instancia de io_uring.
+ */
+void uring_free(IoUring* ring);
+
+
+#endif  /* URING_H */
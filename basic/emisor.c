@@ -8,6 +8,7 @@
 
 #include "sender.h"
 #include "loging.h"
+#include "protocol.h"
 
 #define MESSAGE_SIZE 128
 #define DEFAULT_PORT 8000
@@ -27,6 +28,7 @@ struct arguments {
     uint16_t* own_port;
     uint16_t* remote_port;
     char* remote_address;
+    SenderOptions* sender_options;
 };
 
 /**
@@ -53,7 +55,8 @@ static void print_help(char* exe_name);
 /**
  * @brief   Envía el mensaje al receptor.
  *
- * Envío de mensaje al receptor e impresión del número de bytes enviados.
+ * Envío de mensaje al receptor, detrás de una cabecera de tipo PROTOCOL_TYPE_MESSAGE que
+ * da su longitud, e impresión del número de bytes enviados.
  *
  * @param sender    Sender que envia los datos.
  */
@@ -64,6 +67,7 @@ int main(int argc, char** argv) {
     uint16_t own_port;
     uint16_t remote_port;
     char remote_address[INET_ADDRSTRLEN];
+    SenderOptions sender_options;
 
 
     struct arguments args = {
@@ -72,6 +76,7 @@ int main(int argc, char** argv) {
         .own_port = &own_port,
         .remote_port = &remote_port,
         .remote_address = remote_address,
+        .sender_options = &sender_options,
     };
 
     set_colors();
@@ -80,8 +85,9 @@ int main(int argc, char** argv) {
 
    
     printf("Ejecutando emisor con parámetro: PORT=%u.\n\n", own_port);
-    sender = create_sender(AF_INET, SOCK_DGRAM, 0, own_port, remote_port, remote_address); /*Pasamos los argumentos a la funcion de crear el sender*/
+    sender = create_sender(AF_INET, SOCK_DGRAM, 0, own_port, remote_port, remote_address, &sender_options); /*Pasamos los argumentos a la funcion de crear el sender*/
 
+    sender_ip(&sender);     /* Recoger la IP externa si la consulta en segundo plano ya terminó */
 
     handle_data(sender);
 
@@ -92,29 +98,35 @@ int main(int argc, char** argv) {
 
 
 void handle_data(Sender sender) {
-    char message[MESSAGE_SIZE] = {0};
+    char datagram[PROTOCOL_HEADER_LEN + MESSAGE_SIZE];
+    char* message = datagram + PROTOCOL_HEADER_LEN;
+    int message_len;
     ssize_t sent_bytes;
     socklen_t length = sizeof(struct sockaddr_in);
     
     printf("\nEnviando mensaje al receptor %s:%u...\n", sender.remote_ip, sender.remote_port);
 
-    snprintf(message, MESSAGE_SIZE, "Mensaje enviado desde %s en %s:%u. Hola Mundo!\n", sender.hostname, sender.ip, sender.own_port);
+    /* snprintf devuelve la longitud que habría tenido el mensaje completo; lo que no cupo no se envía */
+    message_len = snprintf(message, MESSAGE_SIZE, "Mensaje enviado desde %s en %s:%u. Hola Mundo!\n", sender.hostname, sender.ip ? sender.ip : "(desconocida)", sender.own_port);
+    if (message_len >= MESSAGE_SIZE) message_len = MESSAGE_SIZE - 1;
+    protocol_write_header(datagram, PROTOCOL_TYPE_MESSAGE, 0, 0, message_len);
 
-    if ( (sent_bytes = sendto(sender.socket, message, strlen(message) + 1, 0, (struct sockaddr *) &sender.remote_address, length)) < 0) fail("No se pudo enviar el mensaje");
+    if ( (sent_bytes = sendto(sender.socket, datagram, PROTOCOL_HEADER_LEN + message_len, 0, (struct sockaddr *) &sender.remote_address, length)) < 0) fail("No se pudo enviar el mensaje");
     
-    printf("Número de bytes enviados: %ld\n", strlen(message) + 1);
+    printf("Número de bytes enviados: %ld\n", sent_bytes);
 }
 
 
 static void print_help(char* exe_name){
     /** Cabecera y modo de ejecución **/
-    printf("Uso: %s [[-p] <port>] [-r <remote port>] [-a <address>] [-h]\n\n", exe_name);
+    printf("Uso: %s [[-p] <port>] [-r <remote port>] [-a <address>] [-o] [-h]\n\n", exe_name);
 
     /** Lista de opciones de uso **/
     printf(" Opción\t\tOpción larga\t\tSignificado\n");
     printf(" -p <port>\t--port <port>\t\tPuerto en el que escuchará el servidor.\n");
     printf(" -r <remote port>\t--remote port <remote port>\tPuerto por el cual el programa receptor escucha.\n");
     printf(" -a <address>\t--address <address>\t\tDirección a la que enviar el mensaje.\n");
+    printf(" -o\t\t--offline\t\tNo acceder a la red para obtener la IP externa: usar la de una interfaz local.\n");
     printf(" -h\t\t--help\t\t\tMostrar este texto de ayuda y salir.\n");
 
     /** Consideraciones adicionales **/
@@ -130,6 +142,8 @@ static void process_args(struct arguments args) {
 
     /* Inicializar los valores de puerto y backlog a sus valores por defecto */
     *args.own_port = DEFAULT_PORT;
+    *args.remote_port = 0;
+    memset(args.sender_options, 0, sizeof(SenderOptions));
 
     for (i = 1; i < args.argc; i++) { /* Procesamos los argumentos (sin contar el nombre del ejecutable) */
         current_arg = args.argv[i];
@@ -139,6 +153,7 @@ static void process_args(struct arguments args) {
                 if (!strcmp(current_arg, "--own_port")) current_arg = "-p";
                 else if( (!strcmp(current_arg, "--remote_port"))) current_arg = "-r";               
                 else if (!strcmp(current_arg, "--address")) current_arg = "-a";             
+                else if (!strcmp(current_arg, "--offline")) current_arg = "-o";
                 else if (!strcmp(current_arg, "--help")) current_arg = "-h";
             } 
             switch(current_arg[1]) {
@@ -181,6 +196,9 @@ static void process_args(struct arguments args) {
                         exit(EXIT_FAILURE);
                     }
                     break;
+                case 'o':   /* Sin conexión */
+                    args.sender_options->offline = 1;
+                    break;
                 case 'h':   /* Ayuda */
                     print_help(args.argv[0]);
                     exit(EXIT_SUCCESS);
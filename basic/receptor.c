@@ -9,6 +9,7 @@
 
 #include "receiver.h"
 #include "loging.h"
+#include "protocol.h"
 
 #define MAX_BYTES_RECV 128
 #define DEFAULT_PORT 8500
@@ -47,7 +48,8 @@ static void print_help(char* exe_name);
 /**
  * @brief   Maneja los datos que envía el emisor.
  *
- * Recibe el mensaje del emisor.
+ * Recibe el mensaje del emisor y lo imprime. La longitud del mensaje la da su cabecera; los
+ * emisores antiguos, sin cabecera, lo terminan en '\0'.
  *
  * @param receiver    Receiver que recibe los datos.
  */
@@ -68,7 +70,7 @@ int main(int argc, char** argv){
 	
     process_args(args);
 
-	receiver = create_receiver(AF_INET, SOCK_DGRAM, 0, receiver_port);
+	receiver = create_receiver(AF_INET, SOCK_DGRAM, 0, receiver_port, NULL);
     
 	handle_data(receiver);
 	
@@ -81,14 +83,36 @@ int main(int argc, char** argv){
 void handle_data(Receiver receiver){
     ssize_t recv_bytes;
     socklen_t address_size = sizeof(struct sockaddr_in); 
-    char message[MAX_BYTES_RECV];
+    char datagram[PROTOCOL_HEADER_LEN + MAX_BYTES_RECV];
+    char* message = datagram;
+    size_t message_len;
+    ProtocolHeader header;
 
     /* Ejecutamos el recvfrom, es bloqueante */
-    if ((recv_bytes = recvfrom(receiver.socket, message, MAX_BYTES_RECV, 0, (struct sockaddr *) &(receiver.sender_address), &address_size)) < 0) fail("No se pudo recibir el mensaje");
+    if ((recv_bytes = recvfrom(receiver.socket, datagram, sizeof(datagram), 0, (struct sockaddr *) &(receiver.sender_address), &address_size)) < 0) fail("No se pudo recibir el mensaje");
     
     /* Guardamos la ip del emisor en formato textual*/
     inet_ntop(receiver.domain, &receiver.sender_address.sin_addr, receiver.sender_ip, INET_ADDRSTRLEN);
     printf("Mensaje recibido de %ld bytes con éxito al emisor %s por el puerto %d\n", recv_bytes, receiver.sender_ip, receiver.receiver_port);
+
+    /* El mensaje se lee directamente del datagrama, sin copiarlo ni buscar su final */
+    switch (protocol_read_header(datagram, recv_bytes, &header)) {
+        case PROTOCOL_FRAMED:
+            if (header.type != PROTOCOL_TYPE_MESSAGE) {
+                fprintf(stderr, "El datagrama no es un mensaje (tipo %u)\n", header.type);
+                return;
+            }
+            message += PROTOCOL_HEADER_LEN;
+            message_len = header.length;
+            break;
+        case PROTOCOL_PLAIN:
+            message_len = strnlen(datagram, recv_bytes);
+            break;
+        default:
+            fprintf(stderr, "El datagrama tiene una cabecera no válida\n");
+            return;
+    }
+    printf("%.*s", (int) message_len, message);
     return;
 }
 
@@ -0,0 +1,623 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "loging.h"
+#include "protocol.h"
+
+#define DEFAULT_ADDRESS "127.0.0.1"
+#define DEFAULT_PORT 8500
+#define DEFAULT_CLIENTS 16
+#define DEFAULT_THREADS 4
+#define DEFAULT_DURATION 5          /* Segundos de medida */
+#define DEFAULT_PAYLOAD 64          /* Bytes de texto por petición, incluido el '\n' final */
+#define DEFAULT_DEPTH 1             /* Peticiones en vuelo por cliente en lazo cerrado */
+#define DEFAULT_TIMEOUT 1000        /* Milisegundos tras los que una petición sin respuesta se da por perdida */
+#define MAX_PAYLOAD (2056 - PROTOCOL_HEADER_LEN)    /* Lo máximo que acepta el servidor */
+#define MAX_REPLY (4 * 2056)        /* Respuesta más larga que puede enviar el servidor */
+#define MAX_THREADS 256
+#define MAX_CLIENTS 65536
+#define IN_FLIGHT 1024              /* Peticiones en vuelo que se recuerdan por cliente (potencia de 2) */
+#define SCAN_INTERVAL (10 * 1000000LL)  /* Cada cuánto se buscan peticiones caducadas (ns) */
+#define EVENTS 64
+
+/**
+ * Estructura de datos para pasar a la función process_args.
+ * Debe contener siempre los campos int argc, char** argv, provenientes de main,
+ * y luego una cantidad variable de punteros a las variables que se quieran inicializar
+ * a partir de la entrada del programa.
+ */
+struct arguments {
+    int argc;
+    char** argv;
+    struct load_options* options;
+};
+
+/**
+ * Configuración de la carga, elegida por línea de comandos.
+ */
+struct load_options {
+    char address[INET_ADDRSTRLEN];  /* Dirección del servidor */
+    uint16_t port;                  /* Puerto del servidor */
+    unsigned int clients;           /* Clientes simulados (un socket cada uno) */
+    unsigned int threads;           /* Hilos entre los que se reparten los clientes */
+    double duration;                /* Segundos de medida */
+    double warmup;                  /* Segundos iniciales que no se miden */
+    double rate;                    /* Peticiones por segundo en total en lazo abierto, o 0 para lazo cerrado */
+    unsigned int depth;             /* Peticiones en vuelo por cliente en lazo cerrado */
+    size_t payload;                 /* Bytes de texto por petición */
+    unsigned int utf8;              /* Porcentaje de caracteres no ASCII (de 2 bytes) en el texto */
+    int64_t timeout;                /* Plazo para dar por perdida una petición (ns) */
+    char* output;                   /* Fichero en el que escribir el JSON, o NULL para la salida estándar */
+};
+
+/**
+ * Petición en vuelo de un cliente simulado.
+ */
+typedef struct {
+    uint32_t seq;           /* Número de secuencia de la petición */
+    int active;             /* Distinto de 0 si todavía no llegó la respuesta */
+    int measured;           /* Distinto de 0 si se envió dentro del periodo de medida */
+    int64_t sent_at;        /* Instante en que debía enviarse (ns, reloj monótono) */
+} Request;
+
+/**
+ * Cliente simulado: un socket conectado al servidor con su propia secuencia de peticiones.
+ */
+typedef struct {
+    int socket;
+    uint32_t next_seq;      /* Número de secuencia de la siguiente petición */
+    unsigned int in_flight; /* Peticiones sin respuesta */
+    Request requests[IN_FLIGHT];    /* Indexadas por seq % IN_FLIGHT */
+} Client;
+
+/**
+ * Estado y resultados de un hilo generador.
+ */
+typedef struct {
+    pthread_t thread;
+    const struct load_options* options;
+    Client* clients;        /* Clientes del hilo */
+    unsigned int n_clients;
+    const char* payload;    /* Texto de las peticiones (el mismo para todas) */
+    int64_t start;          /* Comienzo de la medida (ns, reloj monótono), tras el calentamiento */
+    int64_t end;            /* Final de la medida */
+    unsigned long sent;     /* Peticiones medidas enviadas */
+    unsigned long received; /* Respuestas medidas recibidas */
+    unsigned long lost;     /* Peticiones medidas sin respuesta en el plazo */
+    unsigned long send_errors;      /* Envíos que el kernel rechazó (buffer lleno) */
+    unsigned long long bytes;       /* Bytes de respuesta medidos */
+    int64_t* latencies;     /* Latencias medidas (ns) */
+    size_t n_latencies;
+    size_t capacity;
+} Generator;
+
+
+/**
+ * @brief   Procesa los argumentos del main.
+ *
+ * @param args  Estructura con los argumentos del programa y punteros a las
+ *              variables que necesitan inicialización.
+ */
+static void process_args(struct arguments args);
+
+/**
+ * @brief Imprime la ayuda del programa.
+ *
+ * @param exe_name  Nombre del ejecutable (argv[0]).
+ */
+static void print_help(char* exe_name);
+
+/**
+ * @brief   Devuelve el instante actual.
+ *
+ * @return  Nanosegundos del reloj monótono.
+ */
+static int64_t now_ns(void);
+
+/**
+ * @brief   Construye el texto de las peticiones.
+ *
+ * @param buffer    Buffer de options->payload bytes.
+ * @param options   Configuración de la carga (tamaño y porcentaje de UTF-8).
+ */
+static void fill_payload(char* buffer, const struct load_options* options);
+
+/**
+ * @brief   Envía una petición de un cliente.
+ *
+ * @param generator Hilo generador.
+ * @param client    Cliente que envía.
+ * @param sent_at   Instante en que debía enviarse (ns). En lazo abierto es el instante programado,
+ *                  para que los retrasos del propio generador también cuenten en la latencia.
+ */
+static void send_request(Generator* generator, Client* client, int64_t sent_at);
+
+/**
+ * @brief   Lee todas las respuestas pendientes de un cliente.
+ *
+ * @param generator Hilo generador.
+ * @param client    Cliente.
+ * @param closed    Si es distinto de 0 (lazo cerrado), cada respuesta lanza una petición nueva.
+ */
+static void receive_replies(Generator* generator, Client* client, int closed);
+
+/**
+ * @brief   Da por perdidas las peticiones que superaron el plazo.
+ *
+ * @param generator Hilo generador.
+ * @param now       Instante actual (ns).
+ * @param closed    Si es distinto de 0 (lazo cerrado), cada petición perdida se sustituye por otra.
+ */
+static void expire_requests(Generator* generator, int64_t now, int closed);
+
+/**
+ * @brief   Función de los hilos generadores.
+ *
+ * @param arg   Generator del hilo.
+ *
+ * @return  NULL.
+ */
+static void* generator_main(void* arg);
+
+/**
+ * @brief   Compara dos latencias para qsort.
+ */
+static int compare_latencies(const void* a, const void* b);
+
+/**
+ * @brief   Devuelve un percentil de un array de latencias ordenado.
+ *
+ * @param latencies Latencias ordenadas.
+ * @param n         Número de latencias.
+ * @param p         Percentil (entre 0 y 100).
+ *
+ * @return  Latencia del percentil, en microsegundos.
+ */
+static double percentile(const int64_t* latencies, size_t n, double p);
+
+
+int main(int argc, char** argv) {
+    struct load_options options;
+    struct sockaddr_in server;
+    Generator generators[MAX_THREADS];
+    Client* clients;
+    char payload[MAX_PAYLOAD];
+    unsigned int i, first;
+    int64_t start, *latencies;
+    size_t n_latencies = 0;
+    unsigned long sent = 0, received = 0, lost = 0, send_errors = 0;
+    unsigned long long bytes = 0;
+    double mean = 0, elapsed;
+    FILE* fp;
+
+    struct arguments args = {
+        .argc = argc,
+        .argv = argv,
+        .options = &options
+    };
+
+    process_args(args);
+
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(options.port);
+    if (inet_pton(AF_INET, options.address, &server.sin_addr) != 1) fail("Dirección del servidor no válida");
+
+    /* Cada cliente simulado tiene su propio socket (su propio puerto), así que el servidor lo trata como un cliente distinto */
+    if ( !(clients = (Client *) calloc(options.clients, sizeof(Client))) ) fail("No se pudo reservar memoria para los clientes");
+    srand(time(NULL) ^ getpid());
+    for (i = 0; i < options.clients; i++) {
+        if ( (clients[i].socket = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ) fail("No se pudo crear el socket");
+        if (connect(clients[i].socket, (struct sockaddr *) &server, sizeof(server)) < 0) fail("No se pudo conectar el socket");
+        /* Secuencia inicial aleatoria: el servidor no debe contestar con respuestas guardadas de una ejecución anterior */
+        clients[i].next_seq = (uint32_t) rand() << 16 ^ (uint32_t) rand();
+    }
+    fill_payload(payload, &options);
+
+    /* Los clientes se reparten en bloques consecutivos entre los hilos */
+    start = now_ns() + (int64_t) (options.warmup * 1e9);
+    for (i = 0, first = 0; i < options.threads; i++) {
+        memset(&generators[i], 0, sizeof(Generator));
+        generators[i].options = &options;
+        generators[i].clients = clients + first;
+        generators[i].n_clients = options.clients / options.threads + (i < options.clients % options.threads);
+        generators[i].payload = payload;
+        generators[i].start = start;
+        generators[i].end = start + (int64_t) (options.duration * 1e9);
+        first += generators[i].n_clients;
+        if (pthread_create(&generators[i].thread, NULL, generator_main, &generators[i])) fail("No se pudo crear el hilo generador");
+    }
+
+    /* Juntar los resultados de todos los hilos */
+    for (i = 0; i < options.threads; i++) {
+        if (pthread_join(generators[i].thread, NULL)) fail("No se pudo esperar al hilo generador");
+        sent += generators[i].sent;
+        received += generators[i].received;
+        lost += generators[i].lost;
+        send_errors += generators[i].send_errors;
+        bytes += generators[i].bytes;
+        n_latencies += generators[i].n_latencies;
+    }
+    if ( !(latencies = (int64_t *) malloc((n_latencies + 1) * sizeof(int64_t))) ) fail("No se pudo reservar memoria para las latencias");
+    for (i = 0, n_latencies = 0; i < options.threads; i++) {
+        memcpy(latencies + n_latencies, generators[i].latencies, generators[i].n_latencies * sizeof(int64_t));
+        n_latencies += generators[i].n_latencies;
+        free(generators[i].latencies);
+    }
+    qsort(latencies, n_latencies, sizeof(int64_t), compare_latencies);
+    for (i = 0; i < n_latencies; i++) mean += latencies[i] / 1e3;
+    if (n_latencies) mean /= n_latencies;
+    elapsed = options.duration;
+
+    if (!options.output) fp = stdout;
+    else if ( !(fp = fopen(options.output, "w")) ) fail("No se pudo abrir el fichero de resultados");
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"server\": \"%s:%u\",\n", options.address, options.port);
+    fprintf(fp, "  \"mode\": \"%s\",\n", options.rate > 0 ? "open" : "closed");
+    fprintf(fp, "  \"clients\": %u,\n  \"threads\": %u,\n", options.clients, options.threads);
+    fprintf(fp, "  \"target_rate\": %.0f,\n  \"depth\": %u,\n", options.rate, options.rate > 0 ? 0 : options.depth);
+    fprintf(fp, "  \"payload_bytes\": %zu,\n  \"utf8_percent\": %u,\n", options.payload, options.utf8);
+    fprintf(fp, "  \"duration_s\": %.3f,\n  \"warmup_s\": %.3f,\n", options.duration, options.warmup);
+    fprintf(fp, "  \"sent\": %lu,\n  \"received\": %lu,\n  \"lost\": %lu,\n  \"send_errors\": %lu,\n", sent, received, lost, send_errors);
+    fprintf(fp, "  \"throughput_rps\": %.1f,\n", received / elapsed);
+    fprintf(fp, "  \"throughput_mbps\": %.3f,\n", bytes * 8 / elapsed / 1e6);
+    fprintf(fp, "  \"latency_us\": {\n");
+    fprintf(fp, "    \"mean\": %.3f,\n", mean);
+    fprintf(fp, "    \"p50\": %.3f,\n", percentile(latencies, n_latencies, 50));
+    fprintf(fp, "    \"p99\": %.3f,\n", percentile(latencies, n_latencies, 99));
+    fprintf(fp, "    \"p99.9\": %.3f,\n", percentile(latencies, n_latencies, 99.9));
+    fprintf(fp, "    \"max\": %.3f\n", n_latencies ? latencies[n_latencies - 1] / 1e3 : 0.0);
+    fprintf(fp, "  }\n}\n");
+    if (fp != stdout && fclose(fp)) fail("No se pudo cerrar el fichero de resultados");
+
+    for (i = 0; i < options.clients; i++) close(clients[i].socket);
+    free(clients);
+    free(latencies);
+    exit(EXIT_SUCCESS);
+}
+
+
+static int64_t now_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+
+static void fill_payload(char* buffer, const struct load_options* options) {
+    const char* text = "el veloz murcielago hindu comia feliz cardillo y kiwi. ";
+    size_t i, text_len = strlen(text);
+    unsigned int accumulated = 0;
+
+    /* Se reparten los caracteres no ASCII uniformemente: uno cada vez que el acumulado supera 100 */
+    for (i = 0; i + 1 < options->payload; ) {
+        accumulated += options->utf8;
+        if (accumulated >= 100 && i + 2 < options->payload) {
+            memcpy(buffer + i, "ñ", 2);
+            accumulated -= 100;
+            i += 2;
+        } else {
+            buffer[i] = text[i % text_len];
+            i++;
+        }
+    }
+    buffer[i] = '\n';
+}
+
+
+static void send_request(Generator* generator, Client* client, int64_t sent_at) {
+    Request* request = &client->requests[client->next_seq & (IN_FLIGHT - 1)];
+    char header[PROTOCOL_HEADER_LEN];
+    struct iovec iov[2] = {
+        { .iov_base = header, .iov_len = PROTOCOL_HEADER_LEN },
+        { .iov_base = (char *) generator->payload, .iov_len = generator->options->payload }
+    };
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 2 };
+    int measured = sent_at >= generator->start && sent_at < generator->end;
+
+    /* Si el hueco sigue ocupado, esa petición lleva IN_FLIGHT peticiones sin respuesta: se da por perdida */
+    if (request->active) {
+        client->in_flight--;
+        if (request->measured) generator->lost++;
+    }
+
+    protocol_write_header(header, PROTOCOL_TYPE_DATA, 0, client->next_seq, generator->options->payload);
+    if (sendmsg(client->socket, &msg, MSG_DONTWAIT) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED) fail("No se pudo enviar la petición");
+        /* Un envío rechazado cuenta como una petición perdida, para que el lazo cerrado siga adelante */
+        generator->send_errors++;
+    }
+
+    request->seq = client->next_seq++;
+    request->active = 1;
+    request->measured = measured;
+    request->sent_at = sent_at;
+    client->in_flight++;
+    if (measured) generator->sent++;
+}
+
+
+static void receive_replies(Generator* generator, Client* client, int closed) {
+    char reply[PROTOCOL_HEADER_LEN + MAX_REPLY];
+    ProtocolHeader header;
+    Request* request;
+    ssize_t recv_bytes;
+    int64_t now;
+
+    while ( (recv_bytes = recv(client->socket, reply, sizeof(reply), MSG_DONTWAIT)) >= 0 || errno == ECONNREFUSED ) {
+        if (recv_bytes < 0 || protocol_read_header(reply, recv_bytes, &header) != PROTOCOL_FRAMED || header.type != PROTOCOL_TYPE_DATA) continue;
+        request = &client->requests[header.seq & (IN_FLIGHT - 1)];
+        if (!request->active || request->seq != header.seq) continue;   /* Duplicada o ya dada por perdida */
+
+        now = now_ns();
+        request->active = 0;
+        client->in_flight--;
+        if (request->measured) {
+            generator->received++;
+            generator->bytes += recv_bytes;
+            if (generator->n_latencies == generator->capacity) {
+                generator->capacity = generator->capacity ? 2 * generator->capacity : 65536;
+                if ( !(generator->latencies = (int64_t *) realloc(generator->latencies, generator->capacity * sizeof(int64_t))) ) fail("No se pudo reservar memoria para las latencias");
+            }
+            generator->latencies[generator->n_latencies++] = now - request->sent_at;
+        }
+        if (closed && now < generator->end) send_request(generator, client, now);
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK) fail("No se pudo recibir la respuesta");
+}
+
+
+static void expire_requests(Generator* generator, int64_t now, int closed) {
+    const struct load_options* options = generator->options;
+    Client* client;
+    Request* request;
+    unsigned int i, j;
+
+    for (i = 0; i < generator->n_clients; i++) {
+        client = &generator->clients[i];
+        if (!client->in_flight) continue;
+        for (j = 0; j < IN_FLIGHT; j++) {
+            request = &client->requests[j];
+            if (!request->active || now - request->sent_at < options->timeout) continue;
+            request->active = 0;
+            client->in_flight--;
+            if (request->measured) generator->lost++;
+            if (closed && now < generator->end) send_request(generator, client, now);
+        }
+    }
+}
+
+
+static void* generator_main(void* arg) {
+    Generator* generator = (Generator *) arg;
+    const struct load_options* options = generator->options;
+    struct epoll_event event, events[EVENTS];
+    int closed = options->rate <= 0;
+    int epoll_fd, ready, timeout, i;
+    int64_t now, next_send, interval = 0, next_scan, drain_end;
+    unsigned int next_client = 0, j, in_flight;
+
+    if (!generator->n_clients) return NULL;
+    if ( (epoll_fd = epoll_create1(0)) < 0 ) fail("No se pudo crear la instancia de epoll");
+    for (j = 0; j < generator->n_clients; j++) {
+        event.events = EPOLLIN;
+        event.data.u32 = j;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, generator->clients[j].socket, &event) < 0) fail("No se pudo añadir el socket a epoll");
+    }
+
+    now = now_ns();
+    next_scan = now + SCAN_INTERVAL;
+    next_send = now;
+    if (closed) {
+        /* Lazo cerrado: cada cliente empieza con depth peticiones y envía otra con cada respuesta */
+        for (j = 0; j < generator->n_clients * options->depth; j++) send_request(generator, &generator->clients[j % generator->n_clients], now);
+    } else {
+        /* Lazo abierto: el hilo reparte su parte del ritmo total entre sus clientes, por turnos */
+        interval = (int64_t) (1e9 * options->threads / options->rate);
+    }
+
+    /* Tras el final se siguen recibiendo respuestas hasta que no quede nada en vuelo o venza el plazo */
+    drain_end = generator->end + options->timeout;
+    while ( (now = now_ns()) < drain_end ) {
+        if (!closed) {
+            for (; next_send <= now && next_send < generator->end; next_send += interval) {
+                send_request(generator, &generator->clients[next_client], next_send);
+                next_client = (next_client + 1) % generator->n_clients;
+            }
+        }
+        if (now >= next_scan) {
+            expire_requests(generator, now, closed);
+            next_scan = now + SCAN_INTERVAL;
+        }
+        if (now >= generator->end) {
+            for (j = 0, in_flight = 0; j < generator->n_clients; j++) in_flight += generator->clients[j].in_flight;
+            if (!in_flight) break;
+        }
+
+        /* epoll solo espera milisegundos completos: si el siguiente envío está más cerca, no se bloquea */
+        timeout = (next_scan - now) / 1000000;
+        if (!closed && next_send < generator->end && (next_send - now) / 1000000 < timeout) timeout = (next_send - now) / 1000000;
+        if ( (ready = epoll_wait(epoll_fd, events, EVENTS, timeout)) < 0 ) {
+            if (errno == EINTR) continue;
+            fail("Error en la espera de epoll");
+        }
+        for (i = 0; i < ready; i++) receive_replies(generator, &generator->clients[events[i].data.u32], closed);
+    }
+
+    /* Lo que siga en vuelo se da por perdido */
+    expire_requests(generator, INT64_MAX, 0);
+    close(epoll_fd);
+
+    return NULL;
+}
+
+
+static int compare_latencies(const void* a, const void* b) {
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+
+static double percentile(const int64_t* latencies, size_t n, double p) {
+    size_t rank;
+
+    if (!n) return 0;
+    /* Método del rango más cercano */
+    rank = (size_t) (p / 100 * n + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > n) rank = n;
+
+    return latencies[rank - 1] / 1e3;
+}
+
+
+static void print_help(char* exe_name) {
+    /** Cabecera y modo de ejecución **/
+    printf("Uso: %s [-a <address>] [-r <port>] [-c <clients>] [-t <threads>] [-d <seconds>] [-W <seconds>] [-R <rate>] [-n <depth>] [-s <bytes>] [-u <percent>] [-T <ms>] [-o <file>] [-h]\n\n", exe_name);
+
+    /** Lista de opciones de uso **/
+    printf(" Opción\t\tOpción larga\t\tSignificado\n");
+    printf(" -a <address>\t--address <address>\tDirección del servidor (por defecto %s).\n", DEFAULT_ADDRESS);
+    printf(" -r <port>\t--remote_port <port>\tPuerto del servidor (por defecto %d).\n", DEFAULT_PORT);
+    printf(" -c <clients>\t--clients <clients>\tClientes simulados, cada uno con su socket (1-%d, por defecto %d).\n", MAX_CLIENTS, DEFAULT_CLIENTS);
+    printf(" -t <threads>\t--threads <threads>\tHilos generadores (1-%d, por defecto %d).\n", MAX_THREADS, DEFAULT_THREADS);
+    printf(" -d <seconds>\t--duration <seconds>\tSegundos de medida (por defecto %d).\n", DEFAULT_DURATION);
+    printf(" -W <seconds>\t--warmup <seconds>\tSegundos de calentamiento previos, que no se miden (por defecto 0).\n");
+    printf(" -R <rate>\t--rate <rate>\t\tLazo abierto: peticiones por segundo en total a ritmo fijo. Sin esta opción, lazo cerrado.\n");
+    printf(" -n <depth>\t--depth <depth>\t\tLazo cerrado: peticiones en vuelo por cliente (1-%d, por defecto %d).\n", IN_FLIGHT, DEFAULT_DEPTH);
+    printf(" -s <bytes>\t--size <bytes>\t\tBytes de texto por petición (2-%d, por defecto %d).\n", MAX_PAYLOAD, DEFAULT_PAYLOAD);
+    printf(" -u <percent>\t--utf8 <percent>\tPorcentaje de caracteres no ASCII en el texto (0-100, por defecto 0).\n");
+    printf(" -T <ms>\t--timeout <ms>\t\tMilisegundos tras los que una petición sin respuesta se da por perdida (por defecto %d).\n", DEFAULT_TIMEOUT);
+    printf(" -o <file>\t--output <file>\t\tEscribir el resultado en JSON en <file> en lugar de en la salida estándar.\n");
+    printf(" -h\t\t--help\t\t\tMostrar este texto de ayuda y salir.\n");
+
+    /** Consideraciones adicionales **/
+    printf("\nEn lazo abierto la latencia se mide desde el instante en que debía enviarse cada petición, así que también cuenta el tiempo que el generador va retrasado.\n");
+}
+
+
+static void process_args(struct arguments args) {
+    struct load_options* options = args.options;
+    char* current_arg;
+    char* end;
+    long value;
+    double real;
+    int i;
+
+    /* Valores por defecto */
+    snprintf(options->address, INET_ADDRSTRLEN, "%s", DEFAULT_ADDRESS);
+    options->port = DEFAULT_PORT;
+    options->clients = DEFAULT_CLIENTS;
+    options->threads = DEFAULT_THREADS;
+    options->duration = DEFAULT_DURATION;
+    options->warmup = 0;
+    options->rate = 0;
+    options->depth = DEFAULT_DEPTH;
+    options->payload = DEFAULT_PAYLOAD;
+    options->utf8 = 0;
+    options->timeout = DEFAULT_TIMEOUT * 1000000LL;
+    options->output = NULL;
+
+    for (i = 1; i < args.argc; i++) {
+        current_arg = args.argv[i];
+
+        if (current_arg[0] != '-') {
+            fprintf(stderr, "Argumento '%s' no esperado.\n\n", current_arg);
+            print_help(args.argv[0]);
+            exit(EXIT_FAILURE);
+        }
+
+        /* Traducir las opciones largas a las cortas */
+        if (current_arg[1] == '-') {
+            if (!strcmp(current_arg, "--address")) current_arg = "-a";
+            else if (!strcmp(current_arg, "--remote_port")) current_arg = "-r";
+            else if (!strcmp(current_arg, "--clients")) current_arg = "-c";
+            else if (!strcmp(current_arg, "--threads")) current_arg = "-t";
+            else if (!strcmp(current_arg, "--duration")) current_arg = "-d";
+            else if (!strcmp(current_arg, "--warmup")) current_arg = "-W";
+            else if (!strcmp(current_arg, "--rate")) current_arg = "-R";
+            else if (!strcmp(current_arg, "--depth")) current_arg = "-n";
+            else if (!strcmp(current_arg, "--size")) current_arg = "-s";
+            else if (!strcmp(current_arg, "--utf8")) current_arg = "-u";
+            else if (!strcmp(current_arg, "--timeout")) current_arg = "-T";
+            else if (!strcmp(current_arg, "--output")) current_arg = "-o";
+            else if (!strcmp(current_arg, "--help")) current_arg = "-h";
+        }
+
+        if (current_arg[1] == 'h') {
+            print_help(args.argv[0]);
+            exit(EXIT_SUCCESS);
+        }
+        if (strlen(current_arg) != 2 || !strchr("arctdWRnsuTo", current_arg[1])) {
+            fprintf(stderr, "Opción '%s' desconocida\n\n", current_arg);
+            print_help(args.argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (++i >= args.argc) {
+            fprintf(stderr, "Falta el valor de la opción '%s'.\n\n", current_arg);
+            print_help(args.argv[0]);
+            exit(EXIT_FAILURE);
+        }
+
+        /* Todas las opciones llevan un valor */
+        switch (current_arg[1]) {
+            case 'a':   /* Dirección del servidor */
+                snprintf(options->address, INET_ADDRSTRLEN, "%s", args.argv[i]);
+                continue;
+            case 'o':   /* Fichero de resultados */
+                options->output = args.argv[i];
+                continue;
+            case 'd':   /* Duración */
+            case 'W':   /* Calentamiento */
+            case 'R':   /* Ritmo */
+                real = strtod(args.argv[i], &end);
+                if (*end || real < 0 || (current_arg[1] == 'd' && real <= 0)) {
+                    fprintf(stderr, "Valor '%s' no válido para la opción '%s'.\n\n", args.argv[i], current_arg);
+                    print_help(args.argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                if (current_arg[1] == 'd') options->duration = real;
+                else if (current_arg[1] == 'W') options->warmup = real;
+                else options->rate = real;
+                continue;
+        }
+
+        /* El resto son enteros con sus propios límites */
+        value = strtol(args.argv[i], &end, 10);
+        if (*end
+                || (current_arg[1] == 'r' && (value < 1 || value > 65535))
+                || (current_arg[1] == 'c' && (value < 1 || value > MAX_CLIENTS))
+                || (current_arg[1] == 't' && (value < 1 || value > MAX_THREADS))
+                || (current_arg[1] == 'n' && (value < 1 || value > IN_FLIGHT))
+                || (current_arg[1] == 's' && (value < 2 || value > MAX_PAYLOAD))
+                || (current_arg[1] == 'u' && (value < 0 || value > 100))
+                || (current_arg[1] == 'T' && value < 1)) {
+            fprintf(stderr, "Valor '%s' no válido para la opción '%s'.\n\n", args.argv[i], current_arg);
+            print_help(args.argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        switch (current_arg[1]) {
+            case 'r': options->port = value; break;
+            case 'c': options->clients = value; break;
+            case 't': options->threads = value; break;
+            case 'n': options->depth = value; break;
+            case 's': options->payload = value; break;
+            case 'u': options->utf8 = value; break;
+            case 'T': options->timeout = value * 1000000LL; break;
+        }
+    }
+
+    if (options->threads > options->clients) options->threads = options->clients;
+}
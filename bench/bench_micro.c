@@ -0,0 +1,551 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "loging.h"
+#include "upper.h"
+#include "receiver.h"
+#include "sender.h"
+#include "lines.h"
+#include "memo.h"
+
+#define NAME_LEN 64
+#define MAX_BENCHMARKS 64
+#define MAX_SIZE 2048               /* Carga útil máxima de un datagrama */
+#define REPETITIONS 7               /* Medidas de cada benchmark; se guarda la mediana */
+#define MIN_DURATION (50 * 1000000LL)   /* Duración mínima de cada medida (ns) */
+#define DEFAULT_THRESHOLD 10        /* Empeoramiento, en porcentaje, a partir del cual se avisa de una regresión */
+#define LINES_FILE_SIZE (4 << 20)   /* Tamaño del fichero de prueba del lector de líneas */
+#define LINE_LEN 64                 /* Longitud de sus líneas, con el '\n' */
+#define MEMO_BUDGET (64 << 10)      /* Memoria de la caché de líneas del servidor */
+
+/* Tamaños de línea a medir en la conversión a mayúsculas */
+static const size_t sizes[] = { 16, 64, 256, 1024, 2048 };
+
+/* Tamaños de línea a medir en la caché de líneas (deben caber en una entrada con su transformación) */
+static const size_t memo_sizes[] = { 32, 128 };
+
+/**
+ * Estructura de datos para pasar a la función process_args.
+ * Debe contener siempre los campos int argc, char** argv, provenientes de main,
+ * y luego una cantidad variable de punteros a las variables que se quieran inicializar
+ * a partir de la entrada del programa.
+ */
+struct arguments {
+    int argc;
+    char** argv;
+    char** output;          /* Fichero JSON en el que guardar los resultados */
+    char** baseline;        /* Fichero JSON con los resultados de referencia con los que comparar */
+    double* threshold;      /* Porcentaje de empeoramiento tolerado */
+    char** filter;          /* Subcadena que deben contener los nombres de los benchmarks a ejecutar */
+};
+
+/**
+ * Benchmark: una operación que se repite iterations veces por medida.
+ */
+typedef struct {
+    char name[NAME_LEN];
+    void (*run)(void* arg, unsigned long iterations);
+    void* arg;
+    size_t bytes;           /* Bytes procesados por operación (0 si no tiene sentido) */
+    double ns_per_op;       /* Resultado: mediana del tiempo por operación */
+    double min_ns_per_op;   /* Resultado: mejor medida */
+} Benchmark;
+
+/**
+ * Argumento de los benchmarks de conversión a mayúsculas.
+ */
+typedef struct {
+    char text[MAX_SIZE + 1];
+    size_t size;
+} UpperArg;
+
+/**
+ * Argumento de los benchmarks de la caché de líneas del servidor.
+ */
+typedef struct {
+    MemoCache memo;         /* Caché en la que ya está la línea */
+    UpperArg line;          /* Línea que se repite */
+} MemoArg;
+
+/**
+ * Argumento de los benchmarks del lector de líneas.
+ */
+typedef struct {
+    char* data;             /* Contenido del fichero */
+    size_t size;
+    int fd;                 /* Fichero regular con ese contenido */
+} LinesArg;
+
+
+/**
+ * @brief   Procesa los argumentos del main.
+ *
+ * @param args  Estructura con los argumentos del programa y punteros a las
+ *              variables que necesitan inicialización.
+ */
+static void process_args(struct arguments args);
+
+/**
+ * @brief Imprime la ayuda del programa.
+ *
+ * @param exe_name  Nombre del ejecutable (argv[0]).
+ */
+static void print_help(char* exe_name);
+
+/**
+ * @brief   Devuelve el instante actual.
+ *
+ * @return  Nanosegundos del reloj monótono.
+ */
+static int64_t now_ns(void);
+
+/**
+ * @brief   Mide un benchmark.
+ *
+ * Primero busca un número de iteraciones que tarde al menos MIN_DURATION, y luego hace
+ * REPETITIONS medidas con ese número. Guarda en el benchmark la mediana y la mejor.
+ *
+ * @param benchmark Benchmark a medir.
+ */
+static void measure(Benchmark* benchmark);
+
+/**
+ * @brief   Busca el resultado de un benchmark en un fichero de referencia.
+ *
+ * @param baseline  Contenido del fichero de referencia.
+ * @param name      Nombre del benchmark.
+ *
+ * @return  Tiempo por operación de la referencia, o un valor negativo si no está.
+ */
+static double baseline_ns(const char* baseline, const char* name);
+
+/**
+ * @brief   Lee un fichero entero en memoria.
+ *
+ * @param path  Fichero.
+ *
+ * @return  Contenido terminado en '\0' (hay que liberarlo).
+ */
+static char* read_file(const char* path);
+
+/**
+ * @brief   Rellena un buffer con texto de prueba.
+ *
+ * @param buffer    Buffer a rellenar, de size + 1 bytes.
+ * @param size      Número de bytes de texto.
+ * @param ascii     Si es 0, se intercala una 'ñ' (2 bytes en UTF-8) cada 32 bytes.
+ */
+static void fill(char* buffer, size_t size, int ascii);
+
+/* Operaciones medidas */
+static void run_toupper(void* arg, unsigned long iterations);
+static void run_memo_hit(void* arg, unsigned long iterations);
+static void run_identify(void* arg, unsigned long iterations);
+static void run_receiver(void* arg, unsigned long iterations);
+static void run_sender(void* arg, unsigned long iterations);
+static void run_lines_mapped(void* arg, unsigned long iterations);
+static void run_lines_stream(void* arg, unsigned long iterations);
+
+
+int main(int argc, char** argv) {
+    Benchmark benchmarks[MAX_BENCHMARKS];
+    UpperArg upper_args[2 * sizeof(sizes) / sizeof(sizes[0])];
+    MemoArg memo_args[2 * sizeof(memo_sizes) / sizeof(memo_sizes[0])];
+    char memo_output[UPPER_MAX_EXPANSION * MAX_SIZE];
+    char* result;
+    LinesArg lines;
+    char path[] = "/tmp/bench_microXXXXXX";
+    char *output, *baseline_path, *filter, *baseline = NULL;
+    double threshold, reference, change;
+    unsigned int n = 0, m = 0, i, s, regressions = 0;
+    int ascii;
+    size_t j;
+    FILE* fp;
+
+    struct arguments args = {
+        .argc = argc,
+        .argv = argv,
+        .output = &output,
+        .baseline = &baseline_path,
+        .threshold = &threshold,
+        .filter = &filter
+    };
+
+    process_args(args);
+    memset(benchmarks, 0, sizeof(benchmarks));
+    if (baseline_path) baseline = read_file(baseline_path);
+
+    /* Conversión a mayúsculas por el camino del servidor, con texto ASCII y con texto UTF-8 */
+    for (ascii = 1; ascii >= 0; ascii--) {
+        for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++, n++) {
+            upper_args[n].size = sizes[s];
+            fill(upper_args[n].text, sizes[s], ascii);
+            snprintf(benchmarks[n].name, NAME_LEN, "toupper_buffer/%s/%zu", ascii ? "ascii" : "utf8", sizes[s]);
+            benchmarks[n].run = run_toupper;
+            benchmarks[n].arg = &upper_args[n];
+            benchmarks[n].bytes = sizes[s];
+        }
+    }
+
+    /* Línea repetida copiada de la caché de líneas del servidor, para compararla con su transformación */
+    for (ascii = 1; ascii >= 0; ascii--) {
+        for (s = 0; s < sizeof(memo_sizes) / sizeof(memo_sizes[0]); s++, n++, m++) {
+            memo_init(&memo_args[m].memo, MEMO_BUDGET);
+            memo_args[m].line.size = memo_sizes[s];
+            fill(memo_args[m].line.text, memo_sizes[s], ascii);
+            memo_toupper(&memo_args[m].memo, memo_args[m].line.text, memo_sizes[s], memo_output, sizeof(memo_output), &result);
+            snprintf(benchmarks[n].name, NAME_LEN, "memo_toupper/%s/%zu", ascii ? "ascii" : "utf8", memo_sizes[s]);
+            benchmarks[n].run = run_memo_hit;
+            benchmarks[n].arg = &memo_args[m];
+            benchmarks[n].bytes = memo_sizes[s];
+        }
+    }
+
+    snprintf(benchmarks[n].name, NAME_LEN, "identify");
+    benchmarks[n++].run = run_identify;
+    snprintf(benchmarks[n].name, NAME_LEN, "create_receiver");
+    benchmarks[n++].run = run_receiver;
+    snprintf(benchmarks[n].name, NAME_LEN, "create_sender");
+    benchmarks[n++].run = run_sender;
+
+    /* Lector de líneas del cliente sobre un fichero de prueba, proyectado y con getline */
+    lines.size = LINES_FILE_SIZE;
+    if ( !(lines.data = (char *) malloc(lines.size)) ) fail("No se pudo reservar memoria para el fichero de prueba");
+    for (j = 0; j < lines.size; j += LINE_LEN) {
+        fill(lines.data + j, LINE_LEN - 1, 1);
+        lines.data[j + LINE_LEN - 1] = '\n';
+    }
+    if ( (lines.fd = mkstemp(path)) < 0 ) fail("No se pudo crear el fichero de prueba");
+    unlink(path);
+    if (write(lines.fd, lines.data, lines.size) != (ssize_t) lines.size) fail("No se pudo escribir el fichero de prueba");
+    snprintf(benchmarks[n].name, NAME_LEN, "line_reader/mapped");
+    benchmarks[n].run = run_lines_mapped;
+    benchmarks[n].arg = &lines;
+    benchmarks[n++].bytes = lines.size;
+    snprintf(benchmarks[n].name, NAME_LEN, "line_reader/getline");
+    benchmarks[n].run = run_lines_stream;
+    benchmarks[n].arg = &lines;
+    benchmarks[n++].bytes = lines.size;
+
+    /* Medir y, si hay referencia, comparar */
+    printf("%-28s %14s %14s %10s\n", "benchmark", "ns/op", "MB/s", baseline ? "cambio" : "");
+    for (i = 0; i < n; i++) {
+        if (filter && !strstr(benchmarks[i].name, filter)) {
+            benchmarks[i].ns_per_op = -1;
+            continue;
+        }
+        measure(&benchmarks[i]);
+        printf("%-28s %14.2f ", benchmarks[i].name, benchmarks[i].ns_per_op);
+        if (benchmarks[i].bytes) printf("%14.1f ", benchmarks[i].bytes / benchmarks[i].ns_per_op * 1e3);
+        else printf("%14s ", "-");
+        if (baseline) {
+            if ( (reference = baseline_ns(baseline, benchmarks[i].name)) <= 0 ) {
+                printf("%10s", "nuevo");
+            } else {
+                change = (benchmarks[i].ns_per_op / reference - 1) * 100;
+                printf("%+9.1f%%", change);
+                if (change > threshold) {
+                    printf("  REGRESIÓN");
+                    regressions++;
+                }
+            }
+        }
+        printf("\n");
+    }
+
+    if (output) {
+        if ( !(fp = fopen(output, "w")) ) fail("No se pudo abrir el fichero de resultados");
+        /* Un benchmark por línea: así es como lo lee baseline_ns */
+        fprintf(fp, "{\n  \"repetitions\": %d,\n  \"benchmarks\": [\n", REPETITIONS);
+        for (i = 0, s = 0; i < n; i++) {
+            if (benchmarks[i].ns_per_op < 0) continue;
+            fprintf(fp, "%s    {\"name\": \"%s\", \"ns_per_op\": %.3f, \"min_ns_per_op\": %.3f, \"bytes_per_op\": %zu}",
+                    s++ ? ",\n" : "", benchmarks[i].name, benchmarks[i].ns_per_op, benchmarks[i].min_ns_per_op, benchmarks[i].bytes);
+        }
+        fprintf(fp, "\n  ]\n}\n");
+        if (fclose(fp)) fail("No se pudo cerrar el fichero de resultados");
+    }
+
+    if (baseline) {
+        printf("\n%u regresiones por encima del %.1f%% respecto a %s\n", regressions, threshold, baseline_path);
+        free(baseline);
+    }
+    close(lines.fd);
+    free(lines.data);
+    for (i = 0; i < m; i++) memo_free(&memo_args[i].memo);
+    exit(regressions ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+
+static int64_t now_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+
+static void fill(char* buffer, size_t size, int ascii) {
+    const char* text = "el veloz murcielago hindu comia feliz cardillo y kiwi. ";
+    size_t i;
+
+    for (i = 0; i < size; i++) buffer[i] = text[i % strlen(text)];
+    if (!ascii) {
+        for (i = 16; i + 2 <= size; i += 32) memcpy(buffer + i, "ñ", 2);
+    }
+    buffer[size] = '\0';
+}
+
+
+/**
+ * @brief   Compara dos tiempos para qsort.
+ */
+static int compare_times(const void* a, const void* b) {
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+
+static void measure(Benchmark* benchmark) {
+    double times[REPETITIONS];
+    unsigned long iterations;
+    int64_t start, elapsed;
+    int stdout_copy, null_fd;
+    unsigned int i;
+
+    /* Crear emisores imprime por la salida estándar: se descarta mientras se mide */
+    fflush(stdout);
+    stdout_copy = dup(STDOUT_FILENO);
+    if ( (null_fd = open("/dev/null", O_WRONLY)) >= 0 ) {
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+    }
+
+    /* Calibrar: duplicar las iteraciones hasta que una medida dure lo suficiente */
+    for (iterations = 1; ; iterations *= 2) {
+        start = now_ns();
+        benchmark->run(benchmark->arg, iterations);
+        if ( (elapsed = now_ns() - start) >= MIN_DURATION ) break;
+        if (elapsed > 0 && elapsed * 2 < MIN_DURATION) iterations = iterations * (MIN_DURATION / elapsed) / 2 + 1;
+    }
+
+    for (i = 0; i < REPETITIONS; i++) {
+        start = now_ns();
+        benchmark->run(benchmark->arg, iterations);
+        times[i] = (double) (now_ns() - start) / iterations;
+    }
+
+    fflush(stdout);
+    dup2(stdout_copy, STDOUT_FILENO);
+    close(stdout_copy);
+
+    qsort(times, REPETITIONS, sizeof(double), compare_times);
+    benchmark->ns_per_op = times[REPETITIONS / 2];
+    benchmark->min_ns_per_op = times[0];
+}
+
+
+static char* read_file(const char* path) {
+    FILE* fp;
+    char* data;
+    long size;
+
+    if ( !(fp = fopen(path, "r")) ) fail("No se pudo abrir el fichero de referencia");
+    if (fseek(fp, 0, SEEK_END) < 0 || (size = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) < 0) fail("No se pudo leer el fichero de referencia");
+    if ( !(data = (char *) malloc(size + 1)) ) fail("No se pudo reservar memoria para el fichero de referencia");
+    if (fread(data, 1, size, fp) != (size_t) size) fail("No se pudo leer el fichero de referencia");
+    data[size] = '\0';
+    fclose(fp);
+
+    return data;
+}
+
+
+static double baseline_ns(const char* baseline, const char* name) {
+    char key[NAME_LEN + 16];
+    const char* entry;
+    double ns;
+
+    snprintf(key, sizeof(key), "\"name\": \"%.*s\"", NAME_LEN, name);
+    if ( !(entry = strstr(baseline, key)) ) return -1;
+    if ( !(entry = strstr(entry, "\"ns_per_op\":")) || sscanf(entry, "\"ns_per_op\": %lf", &ns) != 1 ) return -1;
+
+    return ns;
+}
+
+
+static void run_toupper(void* arg, unsigned long iterations) {
+    UpperArg* upper = (UpperArg *) arg;
+    char output[UPPER_MAX_EXPANSION * MAX_SIZE];
+    volatile ssize_t sink = 0;
+    char* result;
+    unsigned long i;
+
+    for (i = 0; i < iterations; i++) sink += toupper_buffer(upper->text, upper->size, output, sizeof(output), &result);
+}
+
+
+static void run_memo_hit(void* arg, unsigned long iterations) {
+    MemoArg* memo = (MemoArg *) arg;
+    char output[UPPER_MAX_EXPANSION * MAX_SIZE];
+    volatile ssize_t sink = 0;
+    char* result;
+    unsigned long i;
+
+    for (i = 0; i < iterations; i++) sink += memo_toupper(&memo->memo, memo->line.text, memo->line.size, output, sizeof(output), &result);
+}
+
+
+static void run_identify(void* arg, unsigned long iterations) {
+    volatile char sink = 0;
+    unsigned long i;
+
+    for (i = 0; i < iterations; i++) sink += identify()[0];
+}
+
+
+static void run_receiver(void* arg, unsigned long iterations) {
+    Receiver receiver;
+    unsigned long i;
+
+    /* Puerto 0: el kernel elige uno libre en cada iteración */
+    for (i = 0; i < iterations; i++) {
+        receiver = create_receiver(AF_INET, SOCK_DGRAM, 0, 0, NULL);
+        close_receiver(&receiver);
+    }
+}
+
+
+static void run_sender(void* arg, unsigned long iterations) {
+    SenderOptions options = { .offline = 1 };   /* Sin consultas a la red, que no son coste del arranque */
+    Sender sender;
+    unsigned long i;
+
+    for (i = 0; i < iterations; i++) {
+        sender = create_sender(AF_INET, SOCK_DGRAM, 0, 0, 9, "127.0.0.1", &options);
+        close_sender(&sender);
+    }
+}
+
+
+static void run_lines_mapped(void* arg, unsigned long iterations) {
+    LinesArg* lines = (LinesArg *) arg;
+    LineReader reader;
+    const char* line;
+    volatile size_t sink = 0;
+    ssize_t len;
+    unsigned long i;
+    FILE* fp;
+
+    for (i = 0; i < iterations; i++) {
+        if ( !(fp = fdopen(dup(lines->fd), "r")) ) fail("No se pudo abrir el fichero de prueba");
+        line_reader_open(&reader, fp);
+        while ( (len = line_reader_next(&reader, &line)) >= 0 ) sink += len;
+        line_reader_close(&reader);
+        fclose(fp);
+    }
+}
+
+
+static void run_lines_stream(void* arg, unsigned long iterations) {
+    LinesArg* lines = (LinesArg *) arg;
+    LineReader reader;
+    const char* line;
+    volatile size_t sink = 0;
+    ssize_t len;
+    unsigned long i;
+    FILE* fp;
+
+    /* Un FILE en memoria no tiene descriptor, así que el lector recurre a getline como con una tubería */
+    for (i = 0; i < iterations; i++) {
+        if ( !(fp = fmemopen(lines->data, lines->size, "r")) ) fail("No se pudo abrir el fichero de prueba");
+        line_reader_open(&reader, fp);
+        while ( (len = line_reader_next(&reader, &line)) >= 0 ) sink += len;
+        line_reader_close(&reader);
+        fclose(fp);
+    }
+}
+
+
+static void print_help(char* exe_name) {
+    /** Cabecera y modo de ejecución **/
+    printf("Uso: %s [-o <file>] [-c <baseline>] [-n <percent>] [-f <filter>] [-h]\n\n", exe_name);
+
+    /** Lista de opciones de uso **/
+    printf(" Opción\t\tOpción larga\t\tSignificado\n");
+    printf(" -o <file>\t--output <file>\t\tGuardar los resultados en JSON en <file> (por ejemplo, como nueva referencia).\n");
+    printf(" -c <baseline>\t--compare <baseline>\tComparar con los resultados guardados en <baseline> y terminar con error si algún benchmark empeora.\n");
+    printf(" -n <percent>\t--threshold <percent>\tEmpeoramiento tolerado como ruido, en porcentaje (por defecto %d).\n", DEFAULT_THRESHOLD);
+    printf(" -f <filter>\t--filter <filter>\tEjecutar solo los benchmarks cuyo nombre contenga <filter>.\n");
+    printf(" -h\t\t--help\t\t\tMostrar este texto de ayuda y salir.\n");
+
+    /** Consideraciones adicionales **/
+    printf("\nCada benchmark se mide %d veces y se usa la mediana del tiempo por operación.\n", REPETITIONS);
+}
+
+
+static void process_args(struct arguments args) {
+    char* current_arg;
+    char* end;
+    int i;
+
+    /* Valores por defecto */
+    *args.output = NULL;
+    *args.baseline = NULL;
+    *args.threshold = DEFAULT_THRESHOLD;
+    *args.filter = NULL;
+
+    for (i = 1; i < args.argc; i++) {
+        current_arg = args.argv[i];
+
+        if (current_arg[0] == '-') {
+            /* Traducir las opciones largas a las cortas */
+            if (current_arg[1] == '-') {
+                if (!strcmp(current_arg, "--output")) current_arg = "-o";
+                else if (!strcmp(current_arg, "--compare")) current_arg = "-c";
+                else if (!strcmp(current_arg, "--threshold")) current_arg = "-n";
+                else if (!strcmp(current_arg, "--filter")) current_arg = "-f";
+                else if (!strcmp(current_arg, "--help")) current_arg = "-h";
+            }
+
+            switch (current_arg[1]) {
+                case 'o':   /* Fichero de resultados */
+                case 'c':   /* Fichero de referencia */
+                case 'f':   /* Filtro */
+                case 'n':   /* Umbral */
+                    if (++i >= args.argc) {
+                        fprintf(stderr, "Falta el valor de la opción '%s'.\n\n", current_arg);
+                        print_help(args.argv[0]);
+                        exit(EXIT_FAILURE);
+                    }
+                    if (current_arg[1] == 'o') *args.output = args.argv[i];
+                    else if (current_arg[1] == 'c') *args.baseline = args.argv[i];
+                    else if (current_arg[1] == 'f') *args.filter = args.argv[i];
+                    else if ( (*args.threshold = strtod(args.argv[i], &end)) < 0 || *end ) {
+                        fprintf(stderr, "Umbral '%s' no válido.\n\n", args.argv[i]);
+                        print_help(args.argv[0]);
+                        exit(EXIT_FAILURE);
+                    }
+                    break;
+                case 'h':   /* Ayuda */
+                    print_help(args.argv[0]);
+                    exit(EXIT_SUCCESS);
+                default:
+                    fprintf(stderr, "Opción '%s' desconocida\n\n", current_arg);
+                    print_help(args.argv[0]);
+                    exit(EXIT_FAILURE);
+            }
+        } else {
+            fprintf(stderr, "Argumento '%s' no esperado.\n\n", current_arg);
+            print_help(args.argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
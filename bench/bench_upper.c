@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLE_UNIT "bytes/ciclo"
+#else
+#define CYCLE_UNIT "bytes/ns"
+#endif
+
+#include "upper.h"
+
+#define TARGET_BYTES (64UL << 20)   /* Bytes a procesar por cada medida */
+#define MAX_SIZE 4096
+
+/* Tamaños de línea a medir, desde líneas cortas hasta el máximo que cabe en un datagrama */
+static const size_t sizes[] = { 16, 64, 256, 1024, 2048, 4096 };
+
+
+/**
+ * @brief   Devuelve un contador de ciclos.
+ *
+ * En x86 lee el contador de marca de tiempo (TSC), que avanza a frecuencia nominal;
+ * en otras arquitecturas devuelve nanosegundos.
+ *
+ * @return  Valor actual del contador.
+ */
+static uint64_t cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+
+/**
+ * @brief   Rellena un buffer con texto de prueba.
+ *
+ * @param buffer    Buffer a rellenar, de size + 1 bytes.
+ * @param size      Número de bytes de texto.
+ * @param ascii     Si es 0, se intercala una 'ñ' (2 bytes en UTF-8) cada 32 bytes.
+ */
+static void fill(char* buffer, size_t size, int ascii) {
+    const char* text = "el veloz murcielago hindu comia feliz cardillo y kiwi. ";
+    size_t i;
+
+    for (i = 0; i < size; i++) buffer[i] = text[i % strlen(text)];
+    if (!ascii) {
+        for (i = 16; i + 2 <= size; i += 32) memcpy(buffer + i, "ñ", 2);
+    }
+    buffer[size] = '\0';
+}
+
+
+/**
+ * @brief   Mide un núcleo ASCII in situ.
+ *
+ * @param kernel    Núcleo a medir.
+ * @param buffer    Buffer de entrada (se transforma en cada iteración).
+ * @param size      Número de bytes del buffer.
+ *
+ * @return  Bytes procesados por ciclo.
+ */
+static double measure_kernel(AsciiKernel kernel, char* buffer, size_t size) {
+    unsigned long iterations = TARGET_BYTES / size, i;
+    volatile size_t sink = 0;
+    uint64_t start;
+
+    start = cycles();
+    for (i = 0; i < iterations; i++) sink += kernel(buffer, size);
+
+    return (double) iterations * size / (cycles() - start);
+}
+
+
+/**
+ * @brief   Mide el camino lento (toupper_utf8 con las tablas de Unicode).
+ *
+ * @param buffer    Texto de entrada.
+ * @param size      Número de bytes del texto.
+ *
+ * @return  Bytes procesados por ciclo.
+ */
+static double measure_slow(const char* buffer, size_t size) {
+    unsigned long iterations = TARGET_BYTES / size, i;
+    char output[UPPER_MAX_EXPANSION * MAX_SIZE];
+    volatile ssize_t sink = 0;
+    uint64_t start;
+
+    start = cycles();
+    for (i = 0; i < iterations; i++) sink += toupper_utf8(buffer, size, output, sizeof(output));
+
+    return (double) iterations * size / (cycles() - start);
+}
+
+
+/**
+ * @brief   Mide el camino completo del servidor.
+ *
+ * Intenta primero el núcleo ASCII in situ y, si la línea no es ASCII, recurre a toupper_utf8.
+ *
+ * @param buffer    Texto de entrada (se transforma en cada iteración).
+ * @param size      Número de bytes del texto.
+ *
+ * @return  Bytes procesados por ciclo.
+ */
+static double measure_server(char* buffer, size_t size) {
+    unsigned long iterations = TARGET_BYTES / size, i;
+    char output[UPPER_MAX_EXPANSION * MAX_SIZE];
+    volatile ssize_t sink = 0;
+    char* result;
+    uint64_t start;
+
+    start = cycles();
+    for (i = 0; i < iterations; i++) sink += toupper_buffer(buffer, size, output, sizeof(output), &result);
+
+    return (double) iterations * size / (cycles() - start);
+}
+
+
+int main(int argc, char** argv) {
+    const AsciiKernelInfo* kernels;
+    size_t count, k, s;
+    char buffer[MAX_SIZE + 1];
+
+    kernels = toupper_ascii_kernels(&count);
+    printf("Núcleo elegido en tiempo de ejecución: %s\n\n", kernels[count - 1].name);
+    printf("%-8s %-10s %8s %14s\n", "texto", "ruta", "tamaño", CYCLE_UNIT);
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (k = 0; k < count; k++) {
+            fill(buffer, sizes[s], 1);
+            printf("%-8s %-10s %8zu %14.3f\n", "ascii", kernels[k].name, sizes[s], measure_kernel(kernels[k].function, buffer, sizes[s]));
+        }
+        fill(buffer, sizes[s], 1);
+        printf("%-8s %-10s %8zu %14.3f\n", "ascii", "utf8", sizes[s], measure_slow(buffer, sizes[s]));
+    }
+
+    /* Con texto no ASCII el servidor paga el intento ASCII más el camino lento */
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        fill(buffer, sizes[s], 0);
+        printf("%-8s %-10s %8zu %14.3f\n", "utf-8", "servidor", sizes[s], measure_server(buffer, sizes[s]));
+        fill(buffer, sizes[s], 0);
+        printf("%-8s %-10s %8zu %14.3f\n", "utf-8", "utf8", sizes[s], measure_slow(buffer, sizes[s]));
+    }
+
+    exit(EXIT_SUCCESS);
+}
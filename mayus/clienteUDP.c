@@ -1,3 +1,5 @@
+#define _GNU_SOURCE     /* sendmmsg */
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/types.h>
@@ -5,15 +7,63 @@
 #include <netinet/in.h>
 #include <unistd.h>
 #include <string.h>
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
 
 #include "sender.h"
 #include "loging.h"
+#include "protocol.h"
+#include "upper.h"
+#include "uring.h"
+#include "lines.h"
+#include "writer.h"
+#include "gso.h"
+#include "lz.h"
 
 //#define MESSAGE_SIZE 128
 #define DEFAULT_PORT 8000
 #define DEFAULT_LOG "log"
 #define FILENAME_LEN 128
 #define MAX_BYTES_RECV 2056
+#define MAX_BYTES_REPLY (UPPER_MAX_EXPANSION * MAX_BYTES_RECV)   /* Respuesta más larga que puede enviar el servidor */
+#define MAX_WINDOW PROTOCOL_MAX_WINDOW     /* Número máximo de datagramas en vuelo en el modo ventana */
+/* Carga útil por defecto al agrupar líneas: MTU de Ethernet (1500) menos las cabeceras IP (20), UDP (8) y del protocolo */
+#define DEFAULT_PAYLOAD (1500 - 20 - 8 - PROTOCOL_HEADER_LEN)
+#define MAX_PAYLOAD (MAX_BYTES_RECV - PROTOCOL_HEADER_LEN)  /* Lo máximo que acepta el servidor */
+#define DEFAULT_RETRIES 10                  /* Retransmisiones de un mismo datagrama antes de abandonar */
+#define MAX_RETRIES 100                     /* Máximo de -t: con el RTO en MAX_RTO, más de tres minutos esperando a un datagrama */
+#define INITIAL_RTO (200 * 1000000LL)       /* Tiempo de retransmisión antes de tener ninguna medida del RTT (ns) */
+#define MIN_RTO (10 * 1000000LL)            /* Límites del tiempo de retransmisión (ns) */
+#define MAX_RTO (2000 * 1000000LL)
+#define MAX_RESEND_BURST 4                  /* Datagramas vencidos que se retransmiten como mucho cada vez que vence el temporizador */
+#define REORDER_THRESHOLD 3                 /* Respuestas de datagramas posteriores tras las que uno sin respuesta se da por perdido */
+/* Memoria que ocupa cada datagrama en el buffer de recepción del kernel además de sus bytes (sk_buff y redondeo de la reserva) */
+#define DATAGRAM_OVERHEAD 768
+#define CONTROL_LEN (METRICS_CONTROL_LEN + GRO_CONTROL_LEN)     /* Mensajes de control de cada recepción */
+#define MAX_JOBS 64                         /* Número máximo de transferencias simultáneas */
+#define PROGRESS_INTERVAL 1                 /* Segundos entre dos informes de progreso con varios ficheros */
+
+/* Tipos de petición a io_uring */
+#define URING_RECV 1        /* Recepción multishot de las respuestas */
+#define URING_SEND 2        /* Envío (el índice lleva el número de datagramas desplazado URING_SEGMENTS_SHIFT bits) */
+#define URING_SEGMENTS_SHIFT 16
+
+/* Relleno de los datagramas que se segmentan: su contenido da igual, así que todos comparten estos bytes */
+static const char padding[MAX_PAYLOAD];
+
+/**
+ * Lista de ficheros a transferir, en el orden en el que se reparten entre las transferencias.
+ */
+typedef struct {
+    char** names;       /* Rutas de los ficheros (reservadas con malloc) */
+    size_t count;       /* Número de ficheros */
+    size_t capacity;    /* Tamaño reservado para names */
+} FileList;
 
 /**
  * Estructura de datos para pasar a la función process_args.
@@ -28,9 +78,124 @@ struct arguments {
     char* remote_address;
     uint16_t* own_port;
     uint16_t* remote_port;
-    char* input_file_name;
+    FileList* files;
+    unsigned int* jobs;
+    struct transfer_options* options;
+    SenderOptions* sender_options;
+    char** metrics_path;
 };
 
+/**
+ * Opciones de la transferencia del fichero, elegidas por línea de comandos.
+ */
+struct transfer_options {
+    unsigned int window;    /* Número máximo de datagramas en vuelo (1 para el modo de parada y espera) */
+    size_t payload;         /* Bytes máximos de líneas agrupadas por datagrama, o 0 para enviar una línea por datagrama */
+    unsigned int retries;   /* Número máximo de retransmisiones de un mismo datagrama */
+    int use_uring;          /* Si es distinto de 0, se intenta usar io_uring para enviar y recibir */
+    int use_gso;            /* Si es distinto de 0, se intenta segmentar los envíos (UDP_SEGMENT) y agregar las respuestas (UDP_GRO) */
+    int compress;           /* Si es distinto de 0, se comprimen las líneas de cada datagrama si el servidor lo admite */
+    int verbose;            /* Si es distinto de 0, cada transferencia imprime sus estadísticas (con varios ficheros, solo el resumen conjunto) */
+};
+
+/**
+ * Resultado de la transferencia de un fichero, para el resumen conjunto de todas.
+ */
+typedef struct {
+    unsigned long long bytes_in;    /* Bytes de texto leídos del fichero de entrada y enviados */
+    unsigned long long bytes_out;   /* Bytes escritos en el fichero de salida */
+    unsigned long resends;          /* Datagramas retransmitidos */
+    int64_t elapsed;                /* Duración de la transferencia (ns) */
+} TransferReport;
+
+/**
+ * Reparto de los ficheros entre las transferencias simultáneas. Cada hilo coge el siguiente fichero
+ * sin repartir hasta que no quedan; los contadores se actualizan con operaciones atómicas al terminar
+ * cada fichero, y el hilo principal los lee para informar del progreso.
+ */
+typedef struct {
+    const FileList* files;                  /* Ficheros a transferir */
+    const struct transfer_options* options; /* Opciones de todas las transferencias */
+    size_t next;                            /* Siguiente fichero sin repartir */
+    size_t done;                            /* Ficheros terminados */
+    unsigned long long bytes_in;            /* Bytes de texto enviados de los ficheros terminados */
+    unsigned long long bytes_out;           /* Bytes escritos de los ficheros terminados */
+    unsigned long resends;                  /* Retransmisiones de los ficheros terminados */
+    int64_t busy;                           /* Suma de las duraciones de las transferencias (ns) */
+    pthread_mutex_t lock;                   /* Protege running */
+    pthread_cond_t finished;                /* Terminó algún hilo */
+    unsigned int running;                   /* Hilos que todavía no terminaron */
+} JobPool;
+
+/**
+ * Hilo que hace transferencias, con su propio sender: su socket, su puerto y sus métricas.
+ */
+typedef struct {
+    pthread_t thread;
+    Sender sender;
+    JobPool* pool;
+} Job;
+
+/**
+ * Forma de enviar y recibir los datagramas de la ventana: con llamadas bloqueantes (sendto, poll y recv),
+ * o con io_uring, que encola todos los envíos de la ventana en una sola llamada al sistema y recibe
+ * las respuestas con una recepción multishot en buffers proporcionados. En ambos casos se pueden
+ * segmentar los envíos: los datagramas pendientes del mismo tamaño salen juntos en un solo envío
+ * y el kernel los separa; sin io_uring, además, se reciben agregadas las respuestas.
+ */
+typedef struct {
+    Sender* sender;             /* Sender por el que se envían los datos */
+    int use_uring;              /* Distinto de 0 si se usa io_uring */
+    int gso;                    /* Distinto de 0 si se segmentan los envíos */
+    IoUring ring;               /* Instancia de io_uring */
+    struct msghdr recv_msg;     /* Cabecera de la recepción multishot */
+    char control[CONTROL_LEN];  /* Mensajes de control de la recepción con llamadas bloqueantes */
+    int recv_armed;             /* Distinto de 0 si la recepción multishot está activa */
+    struct msghdr* send_msgs;   /* Cabecera del envío de cada hueco de la ventana */
+    struct iovec* send_iovs;    /* Cabecera, datos y relleno del envío de cada hueco de la ventana (cuatro por hueco) */
+    unsigned int* pending;      /* Huecos con envíos pendientes de encolar, en orden */
+    unsigned int n_pending;     /* Número de envíos pendientes */
+    struct mmsghdr* groups;     /* Envíos segmentados: cada uno lleva varios datagramas pendientes seguidos */
+    struct iovec* group_iovs;   /* iovec de los datagramas pendientes, en el orden en el que se envían */
+    char* group_controls;       /* Tamaño de segmento de cada envío, GSO_CONTROL_LEN bytes por envío */
+    unsigned int* segments;     /* Número de datagramas de cada envío */
+    char* coalesced;            /* Última recepción agregada (GSO_MAX_BYTES bytes), o NULL sin agregación */
+    size_t coalesced_len;       /* Longitud de la última recepción agregada */
+    size_t coalesced_offset;    /* Principio del siguiente datagrama por entregar de la recepción agregada */
+    size_t segment;             /* Tamaño de los datagramas de la recepción agregada (el último puede ser más corto) */
+} Transport;
+
+/**
+ * Estimador del tiempo de ida y vuelta (RTT) y del tiempo de retransmisión (RTO), como en el RFC 6298.
+ * Todos los tiempos están en nanosegundos.
+ */
+typedef struct {
+    int64_t srtt;       /* RTT suavizado, o -1 si todavía no hay ninguna medida */
+    int64_t rttvar;     /* Variación del RTT */
+    int64_t rto;        /* Tiempo de espera de una respuesta antes de retransmitir */
+    int64_t backoff_at; /* Instante del último vencimiento (ns, reloj monótono), o 0 si no venció ninguno */
+} RttEstimator;
+
+/**
+ * Hueco de la ventana deslizante. Guarda un datagrama enviado y todavía no escrito
+ * en el fichero de salida, junto con su respuesta si ya llegó.
+ */
+typedef struct {
+    char header[PROTOCOL_HEADER_LEN];   /* Cabecera del datagrama enviado */
+    const char* payload;    /* Una o varias líneas completas: en la proyección del fichero o en copy */
+    size_t payload_len;     /* Longitud de las líneas */
+    size_t pad;             /* Longitud del relleno que va detrás de las líneas, o 0 si no lleva */
+    char trailer[PROTOCOL_PAD_TRAILER]; /* Final del relleno, con su longitud */
+    char* copy;             /* Copia de las líneas cuando el fichero no está proyectado en memoria */
+    size_t capacity;        /* Tamaño reservado para copy */
+    char* packed;           /* Líneas comprimidas (MAX_PAYLOAD bytes), o NULL sin compresión; payload apunta aquí si ocupan menos */
+    char* reply;            /* Líneas transformadas recibidas del servidor (sin cabecera) */
+    ssize_t reply_len;      /* Longitud de la respuesta, o -1 si todavía no llegó */
+    int64_t sent_at;        /* Instante del primer envío (ns, reloj monótono) */
+    int64_t deadline;       /* Instante a partir del cual se retransmite si no llegó la respuesta */
+    unsigned int retries;   /* Número de veces que se ha retransmitido */
+} WindowSlot;
+
 /**
  * @brief   Procesa los argumentos del main.
  *
@@ -52,24 +217,238 @@ static void process_args(struct arguments args);
 
 static void print_help(char* exe_name);
 
+/**
+ * @brief   Añade a la lista un fichero, o los ficheros de un directorio.
+ *
+ * De un directorio se toman, en orden alfabético, los ficheros regulares que no están ocultos ni tienen
+ * ya el nombre en mayúsculas (su salida sería el propio fichero, como las salidas de una ejecución anterior).
+ * No se recorren los subdirectorios.
+ *
+ * @param files     Lista de ficheros.
+ * @param path      Ruta del fichero o del directorio.
+ */
+static void add_input(FileList* files, const char* path);
+
 /**
  * @brief   Envío de datos al servidor y escritura de string en fichero.
  *
  * Procesamiento del archivo de texto, envío de datos al servidor, recepción de datos del servidor y escritura del nuevo archivo.
+ * Al servidor solo se le envía el nombre del fichero, sin directorios, y el fichero de salida se crea en el
+ * mismo directorio que el de entrada.
  *
- * @param sender    Sender que envia los datos.
+ * @param sender    Sender que envia los datos (y en el que se cuentan las métricas).
  * @param input_file_name Nombre del archivo de datos a procesa.
+ * @param options   Opciones de la transferencia.
+ * @param report    Donde guardar el resultado de la transferencia.
  */
  
-void handle_data(Sender sender, char* input_file_name);
+void handle_data(Sender* sender, const char* input_file_name, const struct transfer_options* options, TransferReport* report);
+
+/**
+ * @brief   Hilo de una transferencia simultánea: transfiere ficheros de la lista mientras queden.
+ *
+ * @param arg   Job del hilo.
+ *
+ * @return  NULL.
+ */
+static void* job_thread(void* arg);
+
+/**
+ * @brief   Imprime el progreso conjunto de las transferencias.
+ *
+ * @param pool      Reparto de los ficheros.
+ * @param elapsed   Tiempo desde el comienzo (ns).
+ */
+static void print_progress(JobPool* pool, int64_t elapsed);
+
+/**
+ * @brief   Devuelve el instante actual.
+ *
+ * @return  Nanosegundos del reloj monótono.
+ */
+static int64_t now_ns(void);
+
+/**
+ * @brief   Amplía el buffer de recepción del sender si el kernel descartó respuestas (modo adaptativo).
+ *
+ * @param sender    Sender cuyo buffer se amplía.
+ */
+static void adapt_rcvbuf(Sender* sender);
+
+/**
+ * @brief   Inicializa el estimador de RTT, sin ninguna medida.
+ *
+ * @param rtt   Estimador a inicializar.
+ */
+static void rtt_init(RttEstimator* rtt);
+
+/**
+ * @brief   Añade una medida del RTT al estimador y recalcula el RTO.
+ *
+ * Solo deben usarse medidas de datagramas que no se retransmitieron (algoritmo de Karn),
+ * porque no se sabe a qué envío corresponde la respuesta, y que se enviaron después del último
+ * vencimiento (rtt->backoff_at): las de los enviados antes medirían la misma cola que hizo vencer
+ * el temporizador, y devolverían el RTO a su valor anterior sin que se haya vaciado (RFC 6298, 5.7).
+ *
+ * @param rtt       Estimador.
+ * @param sample    RTT medido (ns).
+ */
+static void rtt_sample(RttEstimator* rtt, int64_t sample);
+
+/**
+ * @brief   Duplica el RTO tras vencer un temporizador, hasta MAX_RTO.
+ *
+ * El RTO duplicado se mantiene hasta que llega la respuesta de un datagrama enviado después.
+ *
+ * @param rtt   Estimador.
+ */
+static void rtt_backoff(RttEstimator* rtt);
+
+/**
+ * @brief   Envía el nombre del fichero y espera a recibirlo en mayúsculas.
+ *
+ * Retransmite el nombre cada vez que vence el RTO, hasta options->retries veces. La primera respuesta,
+ * si no hubo retransmisiones, sirve como primera medida del RTT. El nombre va en un datagrama de tipo
+ * PROTOCOL_TYPE_NAME, con la ventana como número de secuencia para que el servidor recuerde las respuestas de
+ * todos los datagramas en vuelo; si options->compress no es 0, lleva PROTOCOL_FLAG_ACCEPTS_LZ, y el servidor
+ * lo repite si admite la compresión.
+ *
+ * @param sender            Sender que envía los datos.
+ * @param input_file_name   Nombre del fichero.
+ * @param output_file_name  Buffer de MAX_BYTES_RECV bytes en el que guardar el nombre en mayúsculas.
+ * @param options           Opciones de la transferencia.
+ * @param rtt               Estimador de RTT de la transferencia.
+ * @param compress          Donde guardar si se pueden comprimir los datagramas (distinto de 0) o no.
+ *
+ * @return  Número de retransmisiones que fueron necesarias.
+ */
+static unsigned long exchange_file_name(Sender* sender, const char* input_file_name, char* output_file_name, const struct transfer_options* options,
+        RttEstimator* rtt, int* compress);
+
+/**
+ * @brief   Prepara la forma de enviar y recibir los datagramas de la ventana.
+ *
+ * Si se pide io_uring pero el kernel no lo permite, se usan las llamadas bloqueantes. Lo mismo con la
+ * segmentación: si el kernel no la admite, se envía datagrama a datagrama.
+ *
+ * @param transport     Transporte a inicializar.
+ * @param sender        Sender por el que se envían los datos.
+ * @param window        Tamaño de la ventana.
+ * @param options       Opciones de la transferencia (io_uring y segmentación).
+ */
+static void transport_init(Transport* transport, Sender* sender, unsigned int window, const struct transfer_options* options);
+
+/**
+ * @brief   Envía (o encola, con io_uring o segmentación) el datagrama de un hueco de la ventana.
+ *
+ * El datagrama se envía tal cual desde la cabecera, las líneas y el relleno del hueco, sin juntarlos en
+ * un buffer. Si se encola, todos deben seguir existiendo hasta la siguiente llamada a transport_wait.
+ *
+ * @param transport     Transporte.
+ * @param index         Hueco de la ventana.
+ * @param slot          Hueco con el datagrama.
+ */
+static void transport_send(Transport* transport, unsigned int index, const WindowSlot* slot);
+
+/**
+ * @brief   Envía (o encola, con io_uring) los datagramas pendientes, segmentados.
+ *
+ * Los datagramas pendientes consecutivos que miden lo mismo (el último del grupo puede ser más corto)
+ * se juntan en un solo envío de hasta GSO_MAX_SEGMENTS datagramas.
+ *
+ * @param transport     Transporte, con la segmentación activada.
+ */
+static void transport_flush(Transport* transport);
+
+/**
+ * @brief   Copia el siguiente datagrama de la última recepción agregada.
+ *
+ * @param transport     Transporte.
+ * @param buffer        Buffer en el que guardar el datagrama.
+ * @param size          Tamaño del buffer.
+ *
+ * @return  Longitud copiada.
+ */
+static ssize_t transport_next_segment(Transport* transport, char* buffer, size_t size);
+
+/**
+ * @brief   Espera a que llegue una respuesta o venza un plazo.
+ *
+ * Con io_uring, antes de esperar se encolan de una vez todos los envíos pendientes, encadenados
+ * para que salgan en orden.
+ *
+ * @param transport     Transporte.
+ * @param deadline      Instante límite (ns, reloj monótono).
+ *
+ * @return  1 si hay alguna respuesta para leer, 0 si venció el plazo.
+ */
+static int transport_wait(Transport* transport, int64_t deadline);
+
+/**
+ * @brief   Lee una respuesta sin bloquear.
+ *
+ * @param transport     Transporte.
+ * @param buffer        Buffer en el que guardar la respuesta.
+ * @param size          Tamaño del buffer.
+ *
+ * @return  Longitud de la respuesta, o -1 si no queda ninguna.
+ */
+static ssize_t transport_recv(Transport* transport, char* buffer, size_t size);
+
+/**
+ * @brief   Libera los recursos del transporte.
+ *
+ * @param transport     Transporte.
+ */
+static void transport_free(Transport* transport);
+
+/**
+ * @brief   Envía el fichero con una ventana deslizante.
+ *
+ * Mantiene hasta options->window datagramas enviados a la vez, cada uno con un número de secuencia en la
+ * cabecera. Si options->payload no es 0, cada datagrama agrupa tantas líneas completas como quepan en
+ * options->payload bytes; el servidor las transforma juntas y las devuelve en una sola respuesta.
+ * Si el fichero se puede proyectar en memoria, las líneas se envían directamente desde la proyección.
+ * Las respuestas pueden llegar en cualquier orden: se guardan en su hueco de la ventana y se escriben
+ * en el fichero de salida en el orden original en cuanto está disponible la más antigua.
+ * Si la respuesta del datagrama más antiguo no llega antes de que venza su RTO, se retransmiten los
+ * vencidos, empezando por él y hasta MAX_RESEND_BURST; si alguno se retransmite más de options->retries
+ * veces, la transferencia falla. Sin esperar al temporizador, un datagrama sin respuesta cuando ya llegaron
+ * las de REORDER_THRESHOLD posteriores se da por perdido y se retransmite una vez. Además de la ventana, los bytes en vuelo se limitan a la mitad del buffer
+ * de recepción del socket (contando DATAGRAM_OVERHEAD por datagrama), para que una ráfaga de respuestas
+ * no desborde el buffer y se pierda.
+ * Si options->compress no es 0, las líneas de cada datagrama se comprimen siempre que así ocupen menos
+ * (y entonces no se rellenan), y las respuestas comprimidas se descomprimen al recibirlas.
+ * Las líneas que no caben en un datagrama se parten en fragmentos (PROTOCOL_FLAG_FRAGMENT), cada uno
+ * con su número de secuencia y cortados entre caracteres; el servidor contesta cada fragmento con su trozo
+ * de la línea transformada.
+ *
+ * @param transport     Transporte por el que se envían y reciben los datagramas.
+ * @param fp_input      Fichero del que leer las líneas.
+ * @param output        Escritor del fichero en el que escribir las líneas transformadas.
+ * @param options       Opciones de la transferencia.
+ * @param rtt           Estimador de RTT de la transferencia.
+ * @param report        Resultado de la transferencia, al que se suman los bytes enviados y las retransmisiones.
+ */
+static void send_window(Transport* transport, FILE* fp_input, OutputWriter* output, const struct transfer_options* options, RttEstimator* rtt,
+        TransferReport* report);
 
 
 int main(int argc, char** argv) {
-    Sender sender;
+    Job* jobs;
+    JobPool pool;
+    FileList files = { 0 };
+    unsigned int n_jobs, i;
     uint16_t own_port;
     uint16_t remote_port;
-    char input_file_name[FILENAME_LEN];
     char remote_address[INET_ADDRSTRLEN];
+    struct transfer_options options;
+    SenderOptions sender_options, extra_options;
+    MetricsSource* sources;
+    char* metrics_path;
+    struct timespec wake;
+    int64_t started, elapsed;
+    size_t f;
 
 
     struct arguments args = {
@@ -78,91 +457,983 @@ int main(int argc, char** argv) {
         .own_port = &own_port,
         .remote_port = &remote_port,
         .remote_address = remote_address,
-        .input_file_name = input_file_name
+        .files = &files,
+        .jobs = &n_jobs,
+        .options = &options,
+        .sender_options = &sender_options,
+        .metrics_path = &metrics_path
     };
 
     set_colors();
 
     process_args(args);
 
-   
+    /* No tiene sentido abrir más sockets que ficheros; con uno solo se imprimen las estadísticas de la transferencia */
+    if (n_jobs > files.count) n_jobs = files.count;
+    options.verbose = files.count == 1;
+
     printf("Ejecutando emisor con parámetro: PORT=%u.\n\n", own_port);
-    sender = create_sender(AF_INET, SOCK_DGRAM, 0, own_port, remote_port, remote_address); /*Pasamos los argumentos a la funcion de crear el sender*/
+    if (files.count > 1) printf("Se procede a enviar %zu archivos con %u transferencias simultáneas\n", files.count, n_jobs);
+
+    if ( !(jobs = (Job *) calloc(n_jobs, sizeof(Job))) || !(sources = (MetricsSource *) calloc(n_jobs, sizeof(MetricsSource))) ) {
+        fail("No se pudo reservar memoria para las transferencias");
+    }
+    /* Cada transferencia tiene su propio socket, en puertos consecutivos. Solo se muestra la IP externa del primero,
+     * así que los demás no la consultan */
+    extra_options = sender_options;
+    extra_options.offline = 1;
+    for (i = 0; i < n_jobs; i++) {
+        jobs[i].sender = create_sender(AF_INET, SOCK_DGRAM, 0, own_port ? own_port + i : 0, remote_port, remote_address,
+                i ? &extra_options : &sender_options); /*Pasamos los argumentos a la funcion de crear el sender*/
+        jobs[i].pool = &pool;
+        if (n_jobs > 1) snprintf(sources[i].name, sizeof(sources[i].name), "emisor%u", i);
+        else strcpy(sources[i].name, "emisor");
+        sources[i].metrics = &jobs[i].sender.metrics;
+    }
+    if (metrics_path) metrics_export_start(metrics_path, sources, n_jobs);
+
+    memset(&pool, 0, sizeof(JobPool));
+    pool.files = &files;
+    pool.options = &options;
+    pool.running = n_jobs;
+    if (pthread_mutex_init(&pool.lock, NULL) || pthread_cond_init(&pool.finished, NULL)) fail("No se pudo inicializar el reparto de ficheros");
 
+    started = now_ns();
+    for (i = 0; i < n_jobs; i++) {
+        if (pthread_create(&jobs[i].thread, NULL, job_thread, &jobs[i])) fail("No se pudo crear el hilo de la transferencia");
+    }
+
+    /* Esperar a que terminen todos los hilos, informando del progreso cada PROGRESS_INTERVAL segundos si hay varios ficheros */
+    pthread_mutex_lock(&pool.lock);
+    while (pool.running) {
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_sec += PROGRESS_INTERVAL;
+        if (pthread_cond_timedwait(&pool.finished, &pool.lock, &wake) == ETIMEDOUT && files.count > 1) print_progress(&pool, now_ns() - started);
+    }
+    pthread_mutex_unlock(&pool.lock);
+    for (i = 0; i < n_jobs; i++) {
+        if (pthread_join(jobs[i].thread, NULL)) fail("No se pudo esperar al hilo de la transferencia");
+    }
+    elapsed = now_ns() - started;
+    metrics_export_stop();
+
+    if (files.count > 1) {
+        printf("\nArchivos enviados: %zu; texto: %.2f MB; salida: %.2f MB; retransmisiones: %lu\n", pool.done, pool.bytes_in / 1e6, pool.bytes_out / 1e6, pool.resends);
+        printf("Tiempo total: %.3f s; rendimiento conjunto: %.2f MB/s, %.1f archivos/s; suma de las duraciones: %.3f s (%.2f transferencias a la vez de media)\n",
+                elapsed / 1e9, elapsed ? pool.bytes_in / (elapsed / 1e3) : 0.0, elapsed ? pool.done / (elapsed / 1e9) : 0.0,
+                pool.busy / 1e9, elapsed ? (double) pool.busy / elapsed : 0.0);
+    }
 
-    handle_data(sender, input_file_name);
+    /* La consulta de la IP externa, si hizo falta, ha ido avanzando durante la transferencia */
+    printf("IP externa del emisor: %s\n", sender_ip(&jobs[0].sender) ? jobs[0].sender.ip : "(desconocida)");
 
     printf("\nCerrando el emisor y saliendo...\n");
-    close_sender(&sender);
+    for (i = 0; i < n_jobs; i++) close_sender(&jobs[i].sender);
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.finished);
+    for (f = 0; f < files.count; f++) free(files.names[f]);
+    free(files.names);
+    free(sources);
+    free(jobs);
     exit(EXIT_SUCCESS);
 }
 
 
-void handle_data(Sender sender, char* input_file_name){
-    ssize_t sent_bytes = 0, recv_bytes = 0;
-    FILE *fp_input, *fp_output;
-    char recv_buffer[MAX_BYTES_RECV];
-    size_t buffer_size; /* Necesitamos una variable con el tamaño del buffer para getline */
-    char* send_buffer;  /* Buffer para guardar las líneas del archivo a enviar. Como se usa getline, tiene que asignarse dinamicamente */
-    socklen_t address_size = sizeof(struct sockaddr_in);
+/**
+ * @brief   Añade un fichero al final de la lista.
+ *
+ * @param files     Lista de ficheros.
+ * @param name      Ruta del fichero, reservada con malloc (la lista pasa a ser su dueña).
+ */
+static void file_list_push(FileList* files, char* name) {
+    if (files->count == files->capacity) {
+        files->capacity = files->capacity ? 2 * files->capacity : 16;
+        if ( !(files->names = (char **) realloc(files->names, files->capacity * sizeof(char *))) ) fail("No se pudo reservar memoria para la lista de archivos");
+    }
+    files->names[files->count++] = name;
+}
 
-    /* Apertura de los archivos */
-    if ( !(fp_input = fopen(input_file_name, "r")) ) fail("Error en la apertura del archivo de lectura");
-	
-    /* Enviamos el nombre del archivo */
-    printf("Se procede a enviar el archivo: %s\n", input_file_name);
 
-    if ( (sent_bytes = sendto(sender.socket, input_file_name, strlen(input_file_name) + 1, 0, (struct sockaddr *) &sender.remote_address, address_size)) < 0) fail("No se pudo enviar el mensaje");
+/**
+ * @brief   Compara dos rutas de la lista, para ordenarlas con qsort.
+ */
+static int compare_names(const void* a, const void* b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
 
-    /* Esperamos a recibir la linea */
-    if( (recv_bytes = recvfrom(sender.socket, recv_buffer, MAX_BYTES_RECV, 0, (struct sockaddr *) &(sender.remote_address), &address_size)) < 0) fail("No se pudo recibir el mensaje");
 
-    /* Recibido el nombre del archivo en mayúsculas */
-    /* Abrimos en modo escritura el archivo */    
-    if ( !(fp_output = fopen(recv_buffer, "w")) ) fail("Error en la apertura del archivo de escritura");
+static void add_input(FileList* files, const char* path) {
+    struct stat info;
+    DIR* dir;
+    struct dirent* entry;
+    char* name;
+    char upper[UPPER_MAX_EXPANSION * (NAME_MAX + 1)];
+    const char* base_name;
+    size_t first = files->count, name_len;
 
-    /* Procesamiento y envio del archivo */
-    /* Inicializamos el buffer de envío, en el que leeremos del archivo con getline */
-    buffer_size = MAX_BYTES_RECV;
-    send_buffer = (char *) calloc(buffer_size, sizeof(char));
-    while (!feof(fp_input)) {
-    
-        //sleep(7);/* Ejecutamos un sleep para que de tiempo a lanzar un nuevo cliente*/
-        
-        /* Leemos hasta que lo que devuelve getline es EOF, cerramos la conexión en ese caso */
-        if(getline(&send_buffer, &buffer_size, fp_input) == EOF){ /* Escaneamos la linea hasta el final del archivo */
+    if (stat(path, &info) < 0) {
+        fprintf(stderr, "No se puede acceder a '%s': %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (!S_ISDIR(info.st_mode)) {
+        base_name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+        if (strlen(base_name) >= FILENAME_LEN) {
+            fprintf(stderr, "El nombre del archivo '%s' es demasiado largo (máximo %d bytes)\n", base_name, FILENAME_LEN - 1);
+            exit(EXIT_FAILURE);
+        }
+        if ( !(name = strdup(path)) ) fail("No se pudo reservar memoria para la lista de archivos");
+        file_list_push(files, name);
+        return;
+    }
+
+    if ( !(dir = opendir(path)) ) fail("No se pudo abrir el directorio");
+    while ( (entry = readdir(dir)) ) {
+        name_len = strlen(entry->d_name);
+        if (entry->d_name[0] == '.' || name_len >= FILENAME_LEN) continue;   /* Ocultos (y "." y ".."), o nombres que no caben */
+        if (toupper_utf8(entry->d_name, name_len, upper, sizeof(upper)) == (ssize_t) name_len && !memcmp(upper, entry->d_name, name_len)) continue;
+        if (asprintf(&name, "%s/%s", path, entry->d_name) < 0) fail("No se pudo reservar memoria para la lista de archivos");
+        if (stat(name, &info) < 0 || !S_ISREG(info.st_mode)) {
+            free(name);
             continue;
         }
-        if ( (sent_bytes = sendto(sender.socket, send_buffer, strlen(send_buffer) + 1, 0, (struct sockaddr *) &sender.remote_address, address_size)) < 0) fail("No se pudo enviar el mensaje");
+        file_list_push(files, name);
+    }
+    if (closedir(dir)) fail("No se pudo cerrar el directorio");
 
-        /*Esperamos a recibir la linea*/
-        if( (recv_bytes = recvfrom(sender.socket, recv_buffer, MAX_BYTES_RECV, 0, (struct sockaddr *) &(sender.remote_address), &address_size)) < 0) fail("No se pudo recibir el mensaje");
+    /* readdir no sigue ningún orden: se ordenan para que las ejecuciones se repitan igual */
+    qsort(files->names + first, files->count - first, sizeof(char *), compare_names);
+}
+
+
+void handle_data(Sender* sender, const char* input_file_name, const struct transfer_options* options, TransferReport* report){
+    FILE *fp_input;
+    OutputWriter output;
+    struct stat input_info;
+    char output_file_name[MAX_BYTES_RECV];
+    char* output_path;
+    const char* base_name;
+    RttEstimator rtt;
+    Transport transport;
+    struct transfer_options transfer = *options;    /* Opciones, con la compresión que se negoció */
+    int64_t started = now_ns();
 
-        fprintf(fp_output, "%s", recv_buffer);
+    memset(report, 0, sizeof(TransferReport));
+
+    /* Apertura de los archivos */
+    if ( !(fp_input = fopen(input_file_name, "r")) ) fail("Error en la apertura del archivo de lectura");
+
+    /* Enviamos el nombre del archivo, sin los directorios */
+    if (options->verbose) printf("Se procede a enviar el archivo: %s\n", input_file_name);
+    base_name = strrchr(input_file_name, '/') ? strrchr(input_file_name, '/') + 1 : input_file_name;
+
+    rtt_init(&rtt);
+    report->resends = exchange_file_name(sender, base_name, output_file_name, options, &rtt, &transfer.compress);
+    if (options->verbose && options->compress && !transfer.compress) printf("El servidor no admite la compresión: se envía sin comprimir\n");
+
+    /* Recibido el nombre del archivo en mayúsculas: la salida va al directorio del de entrada. Si el nombre ya
+     * estaba en mayúsculas, la salida sería el propio fichero de entrada, y abrirla lo vaciaría */
+    if ( !strcmp(output_file_name, base_name) ) {
+        fprintf(stderr, "El nombre de '%s' ya está en mayúsculas: se omite para no sobrescribirlo\n", input_file_name);
+        if (fclose(fp_input)) fail("No se pudo cerrar el archivo de lectura");
+        return;
+    }
+    if (asprintf(&output_path, "%.*s%s", (int) (base_name - input_file_name), input_file_name, output_file_name) < 0) fail("No se pudo reservar memoria para el nombre de salida");
+
+    /* Abrimos en modo escritura el archivo. Pasar a mayúsculas conserva la longitud de los caracteres
+     * ASCII, así que el tamaño del fichero de entrada es una buena previsión del de salida */
+    output_open(&output, output_path, fstat(fileno(fp_input), &input_info) == 0 && S_ISREG(input_info.st_mode) ? input_info.st_size : 0);
+    free(output_path);
+
+    /* Procesamiento y envio del archivo */
+    transport_init(&transport, sender, options->window, &transfer);
+    send_window(&transport, fp_input, &output, &transfer, &rtt, report);
+    transport_free(&transport);
+    if (options->verbose) {
+        printf("Retransmisiones: %lu; RTT suavizado: %.3f ms; RTO final: %.3f ms\n", report->resends,
+                rtt.srtt < 0 ? 0.0 : rtt.srtt / 1e6, rtt.rto / 1e6);
     }
-    
+
     /* Cerramos los archivos al salir */
     if (fclose(fp_input)) fail("No se pudo cerrar el archivo de lectura");
-    if (fclose(fp_output)) fail("No se pudo cerrar el archivo de escritura");
+    output_close(&output);
+    if (options->verbose) printf("Salida: %lld bytes en %lu llamadas a pwritev; esperas por buffers libres: %lu\n", (long long) output.offset, output.writes, output.stalls);
 
-    if (send_buffer) free(send_buffer);
+    report->bytes_out = output.offset;
+    report->elapsed = now_ns() - started;
 
     return;
 }
 
 
+static void* job_thread(void* arg) {
+    Job* job = (Job *) arg;
+    JobPool* pool = job->pool;
+    TransferReport report;
+    size_t index;
+
+    while ( (index = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->files->count ) {
+        handle_data(&job->sender, pool->files->names[index], pool->options, &report);
+        __atomic_add_fetch(&pool->bytes_in, report.bytes_in, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&pool->bytes_out, report.bytes_out, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&pool->resends, report.resends, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&pool->busy, report.elapsed, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&pool->done, 1, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->running--;
+    pthread_cond_signal(&pool->finished);
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+
+static void print_progress(JobPool* pool, int64_t elapsed) {
+    size_t done = __atomic_load_n(&pool->done, __ATOMIC_ACQUIRE);
+    unsigned long long bytes = __atomic_load_n(&pool->bytes_in, __ATOMIC_RELAXED);
+
+    printf("Progreso: %zu/%zu archivos; %.2f MB en %.1f s (%.2f MB/s)\n", done, pool->files->count, bytes / 1e6, elapsed / 1e9,
+            elapsed ? bytes / (elapsed / 1e3) : 0.0);
+    fflush(stdout);
+}
+
+
+static int64_t now_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+
+static void adapt_rcvbuf(Sender* sender) {
+    int grown;
+
+    if ( (grown = sockopts_adapt(sender->socket, &sender->rcvbuf, sender->metrics.socket_drops, now_ns())) ) {
+        printf("Buffer de recepción ampliado a %d bytes\n", grown);
+    }
+}
+
+
+static void rtt_init(RttEstimator* rtt) {
+    rtt->srtt = -1;
+    rtt->rttvar = 0;
+    rtt->rto = INITIAL_RTO;
+    rtt->backoff_at = 0;
+}
+
+
+static void rtt_sample(RttEstimator* rtt, int64_t sample) {
+    int64_t error;
+
+    if (rtt->srtt < 0) {    /* Primera medida */
+        rtt->srtt = sample;
+        rtt->rttvar = sample / 2;
+    } else {                /* RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|; SRTT = 7/8 SRTT + 1/8 R */
+        error = rtt->srtt - sample;
+        rtt->rttvar += ((error < 0 ? -error : error) - rtt->rttvar) / 4;
+        rtt->srtt += (sample - rtt->srtt) / 8;
+    }
+
+    rtt->rto = rtt->srtt + 4 * rtt->rttvar;
+    if (rtt->rto < MIN_RTO) rtt->rto = MIN_RTO;
+    if (rtt->rto > MAX_RTO) rtt->rto = MAX_RTO;
+}
+
+
+static void rtt_backoff(RttEstimator* rtt) {
+    rtt->rto = rtt->rto * 2 > MAX_RTO ? MAX_RTO : rtt->rto * 2;
+    rtt->backoff_at = now_ns();
+}
+
+
+/**
+ * @brief   Espera a que llegue un datagrama o venza un plazo.
+ *
+ * @param socket    Socket en el que esperar.
+ * @param deadline  Instante límite (ns, reloj monótono).
+ *
+ * @return  1 si hay datos para leer, 0 si venció el plazo.
+ */
+static int wait_readable(int socket, int64_t deadline) {
+    struct pollfd pfd = { .fd = socket, .events = POLLIN };
+    int64_t remaining;
+    int ready;
+
+    do {
+        remaining = deadline - now_ns();
+        if (remaining < 0) remaining = 0;
+        /* poll trabaja en milisegundos: se redondea hacia arriba para no despertar antes de tiempo */
+        ready = poll(&pfd, 1, (remaining + 999999) / 1000000);
+    } while (ready < 0 && errno == EINTR);
+    if (ready < 0) fail("Error al esperar la respuesta del servidor");
+
+    return ready;
+}
+
+
+static unsigned long exchange_file_name(Sender* sender, const char* input_file_name, char* output_file_name, const struct transfer_options* options,
+        RttEstimator* rtt, int* compress) {
+    ProtocolHeader header;
+    char request[PROTOCOL_HEADER_LEN + FILENAME_LEN];
+    char reply[PROTOCOL_HEADER_LEN + MAX_BYTES_RECV];
+    size_t request_len, name_len = strlen(input_file_name);
+    ssize_t recv_bytes;
+    int64_t sent_at, deadline, measured;
+    unsigned int attempt;
+
+    /* Cabecera (con la ventana como número de secuencia) y nombre, sin '\0' */
+    request_len = protocol_write_header(request, PROTOCOL_TYPE_NAME, options->compress ? PROTOCOL_FLAG_ACCEPTS_LZ : 0, options->window, name_len);
+    memcpy(request + request_len, input_file_name, name_len);
+    request_len += name_len;
+
+    for (attempt = 0; attempt <= options->retries; attempt++) {
+        if (attempt) rtt_backoff(rtt);
+        sent_at = now_ns();
+        deadline = sent_at + rtt->rto;
+        if (sendto(sender->socket, request, request_len, 0, (struct sockaddr *) &sender->remote_address, sizeof(struct sockaddr_in)) < 0) {
+            metrics_add(sender->metrics.send_errors, 1);
+            fail("No se pudo enviar el mensaje");
+        }
+        metrics_add(sender->metrics.datagrams_out, 1);
+        metrics_add(sender->metrics.bytes_out, request_len);
+
+        /* Esperar la respuesta, descartando las que no sean el nombre (respuestas retrasadas de otra transferencia) */
+        while (wait_readable(sender->socket, deadline)) {
+            if ( (recv_bytes = recv(sender->socket, reply, sizeof(reply), 0)) < 0) {
+                metrics_add(sender->metrics.recv_errors, 1);
+                fail("No se pudo recibir el mensaje");
+            }
+            metrics_add(sender->metrics.datagrams_in, 1);
+            metrics_add(sender->metrics.bytes_in, recv_bytes);
+            if (protocol_read_header(reply, recv_bytes, &header) != PROTOCOL_FRAMED || header.type != PROTOCOL_TYPE_NAME) continue;
+
+            /* El nombre se usa como nombre de fichero, así que se copia con su '\0' */
+            name_len = header.length < MAX_BYTES_RECV - 1 ? header.length : MAX_BYTES_RECV - 1;
+            memcpy(output_file_name, reply + PROTOCOL_HEADER_LEN, name_len);
+            output_file_name[name_len] = '\0';
+            *compress = options->compress && (header.flags & PROTOCOL_FLAG_ACCEPTS_LZ);
+            if (!attempt) {
+                measured = now_ns() - sent_at;
+                rtt_sample(rtt, measured);
+                metrics_record(&sender->metrics.stages[METRICS_STAGE_RTT], measured);
+            }
+            return attempt;
+        }
+    }
+
+    fprintf(stderr, "El servidor no respondió tras %u retransmisiones del nombre del fichero\n", options->retries);
+    exit(EXIT_FAILURE);
+}
+
+
+static void transport_init(Transport* transport, Sender* sender, unsigned int window, const struct transfer_options* options) {
+    unsigned int n_buffers;
+
+    memset(transport, 0, sizeof(Transport));
+    transport->sender = sender;
+
+    if (options->use_uring) {
+        /* Un buffer por respuesta en vuelo; el anillo exige una potencia de 2 */
+        for (n_buffers = 1; n_buffers < window; n_buffers *= 2);
+        if (uring_init(&transport->ring, 2 * n_buffers + 1) < 0) {
+            perror("io_uring no está disponible, se usan llamadas bloqueantes");
+        } else if (uring_setup_buffers(&transport->ring, n_buffers, sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + METRICS_CONTROL_LEN + PROTOCOL_HEADER_LEN + MAX_BYTES_REPLY + 1) < 0) {
+            perror("El kernel no soporta buffers proporcionados para io_uring, se usan llamadas bloqueantes");
+            uring_free(&transport->ring);
+        } else {
+            transport->recv_msg.msg_namelen = sizeof(struct sockaddr_in);
+            transport->recv_msg.msg_controllen = METRICS_CONTROL_LEN;
+            transport->use_uring = 1;
+        }
+    }
+
+    /* Los buffers proporcionados a io_uring son de una respuesta: con io_uring solo se segmentan los envíos */
+    if (options->use_gso) {
+        if (gso_enable(sender->socket, !transport->use_uring) < 0) {
+            perror("El kernel no admite la segmentación UDP, se envía datagrama a datagrama");
+        } else {
+            transport->gso = 1;
+            if (!transport->use_uring && !(transport->coalesced = (char *) malloc(GSO_MAX_BYTES))) fail("No se pudo reservar memoria para la agregación");
+        }
+    }
+    if (!transport->use_uring && !transport->gso) return;
+
+    /* Entre dos esperas se pueden enviar todos los huecos de la ventana y retransmitirlos una vez */
+    transport->send_msgs = (struct msghdr *) calloc(window, sizeof(struct msghdr));
+    transport->send_iovs = (struct iovec *) calloc(4 * window, sizeof(struct iovec));
+    transport->pending = (unsigned int *) calloc(2 * window, sizeof(unsigned int));
+    if (!transport->send_msgs || !transport->send_iovs || !transport->pending) fail("No se pudo reservar memoria para los envíos");
+    if (transport->gso) {
+        transport->groups = (struct mmsghdr *) calloc(2 * window, sizeof(struct mmsghdr));
+        transport->group_iovs = (struct iovec *) calloc(8 * window, sizeof(struct iovec));
+        transport->group_controls = (char *) calloc(2 * window, GSO_CONTROL_LEN);
+        transport->segments = (unsigned int *) calloc(2 * window, sizeof(unsigned int));
+        if (!transport->groups || !transport->group_iovs || !transport->group_controls || !transport->segments) fail("No se pudo reservar memoria para los envíos");
+    }
+}
+
+
+static void transport_send(Transport* transport, unsigned int index, const WindowSlot* slot) {
+    struct iovec iov[4] = {
+        { .iov_base = (char *) slot->header, .iov_len = PROTOCOL_HEADER_LEN },
+        { .iov_base = (char *) slot->payload, .iov_len = slot->payload_len },
+        { .iov_base = (char *) padding, .iov_len = slot->pad ? slot->pad - PROTOCOL_PAD_TRAILER : 0 },
+        { .iov_base = (char *) slot->trailer, .iov_len = PROTOCOL_PAD_TRAILER }
+    };
+    struct msghdr msg = {
+        .msg_name = &transport->sender->remote_address,
+        .msg_namelen = sizeof(struct sockaddr_in),
+        .msg_iov = iov,
+        .msg_iovlen = slot->pad ? 4 : 2
+    };
+
+    Metrics* metrics = &transport->sender->metrics;
+    int64_t started;
+
+    if (!transport->use_uring && !transport->gso) {
+        started = now_ns();
+        if (sendmsg(transport->sender->socket, &msg, 0) < 0) {
+            metrics_add(metrics->send_errors, 1);
+            fail("No se pudo enviar el mensaje");
+        }
+        metrics_record(&metrics->stages[METRICS_STAGE_SEND], now_ns() - started);
+        metrics_add(metrics->datagrams_out, 1);
+        metrics_add(metrics->bytes_out, PROTOCOL_HEADER_LEN + slot->payload_len + slot->pad);
+        return;
+    }
+
+    /* Si se encola, la cabecera del mensaje debe existir hasta el envío: se guarda en el hueco */
+    memcpy(&transport->send_iovs[4 * index], iov, sizeof(iov));
+    msg.msg_iov = &transport->send_iovs[4 * index];
+    transport->send_msgs[index] = msg;
+    transport->pending[transport->n_pending++] = index;
+}
+
+
+/**
+ * @brief   Longitud de un datagrama a partir de sus iovec.
+ *
+ * @param msg   Cabecera del envío.
+ *
+ * @return  Suma de las longitudes de los iovec.
+ */
+static size_t datagram_len(const struct msghdr* msg) {
+    size_t len = 0, i;
+
+    for (i = 0; i < msg->msg_iovlen; i++) len += msg->msg_iov[i].iov_len;
+    return len;
+}
+
+
+static void transport_flush(Transport* transport) {
+    Metrics* metrics = &transport->sender->metrics;
+    struct msghdr *group, *msg;
+    size_t segment, len, total;
+    unsigned int i, first, n_groups, n_iovs;
+    int64_t started;
+    int sent;
+
+    /* Juntar los iovec de cada grupo de datagramas seguidos en group_iovs */
+    for (i = 0, n_groups = 0, n_iovs = 0; i < transport->n_pending; n_groups++) {
+        group = &transport->groups[n_groups].msg_hdr;
+        *group = transport->send_msgs[transport->pending[i]];
+        group->msg_iov = &transport->group_iovs[n_iovs];
+        group->msg_iovlen = 0;
+        segment = len = datagram_len(&transport->send_msgs[transport->pending[i]]);
+        for (first = i, total = 0; i < transport->n_pending && i - first < GSO_MAX_SEGMENTS && len == segment; i++) {
+            msg = &transport->send_msgs[transport->pending[i]];
+            len = datagram_len(msg);
+            if (len > segment || total + len > GSO_MAX_BYTES) break;
+            memcpy(&transport->group_iovs[n_iovs], msg->msg_iov, msg->msg_iovlen * sizeof(struct iovec));
+            n_iovs += msg->msg_iovlen;
+            group->msg_iovlen += msg->msg_iovlen;
+            total += len;
+        }
+        transport->segments[n_groups] = i - first;
+        if (i - first > 1) gso_set_segment(group, transport->group_controls + n_groups * GSO_CONTROL_LEN, segment);
+    }
+    transport->n_pending = 0;
+
+    /* Con io_uring se encolan encadenados, para que salgan en orden */
+    if (transport->use_uring) {
+        for (i = 0; i < n_groups; i++) {
+            uring_prep_sendmsg(&transport->ring, transport->sender->socket, &transport->groups[i].msg_hdr,
+                    uring_user_data(URING_SEND, transport->segments[i] << URING_SEGMENTS_SHIFT | i), i + 1 < n_groups);
+        }
+        return;
+    }
+
+    started = now_ns();
+    for (i = 0; i < n_groups; ) {
+        if ( (sent = sendmmsg(transport->sender->socket, transport->groups + i, n_groups - i, 0)) < 0 ) {
+            if (errno == EINTR) continue;
+            /* Si la interfaz de salida no calcula las sumas de comprobación, el kernel rechaza los envíos
+             * segmentados: ese grupo se pierde (se retransmitirá) y se deja de segmentar */
+            if (errno == EIO && transport->segments[i] > 1) {
+                fprintf(stderr, "La interfaz no admite envíos segmentados, se envía datagrama a datagrama\n");
+                metrics_add(metrics->send_errors, transport->segments[i]);
+                transport->gso = 0;
+                i++;
+                continue;
+            }
+            metrics_add(metrics->send_errors, 1);
+            fail("No se pudo enviar el mensaje");
+        }
+        for (; sent > 0; sent--, i++) {
+            metrics_add(metrics->datagrams_out, transport->segments[i]);
+            metrics_add(metrics->bytes_out, transport->groups[i].msg_len);
+        }
+    }
+    metrics_record(&metrics->stages[METRICS_STAGE_SEND], now_ns() - started);
+}
+
+
+/**
+ * @brief   Comprueba el resultado de un envío hecho con io_uring.
+ *
+ * Un envío que no cupo en el buffer del socket (o cancelado por ir encadenado detrás de uno de esos)
+ * es como un datagrama perdido: se recupera con la retransmisión. Lo mismo un envío segmentado que la
+ * interfaz no admite, tras el que se deja de segmentar. Cualquier otro error es fatal.
+ *
+ * @param transport Transporte, en cuyo Sender se cuenta el envío.
+ * @param cqe       Respuesta del envío.
+ */
+static void check_send(Transport* transport, const struct io_uring_cqe* cqe) {
+    Metrics* metrics = &transport->sender->metrics;
+    unsigned int segments = uring_user_index(cqe->user_data) >> URING_SEGMENTS_SHIFT;
+
+    if (cqe->res >= 0) {
+        metrics_add(metrics->datagrams_out, segments);
+        metrics_add(metrics->bytes_out, cqe->res);
+        return;
+    }
+    metrics_add(metrics->send_errors, segments);
+    if (cqe->res == -EAGAIN || cqe->res == -ECANCELED) return;
+    if (cqe->res == -EIO && segments > 1) {
+        if (transport->gso) fprintf(stderr, "La interfaz no admite envíos segmentados, se envía datagrama a datagrama\n");
+        transport->gso = 0;
+        return;
+    }
+    errno = -cqe->res;
+    fail("No se pudo enviar el mensaje");
+}
+
+
+static int transport_wait(Transport* transport, int64_t deadline) {
+    struct io_uring_cqe* cqe;
+    int64_t remaining;
+    unsigned int i;
+
+    if (transport->gso) transport_flush(transport);
+    if (!transport->use_uring) return wait_readable(transport->sender->socket, deadline);
+
+    /* Encolar todos los envíos pendientes (sin segmentar) encadenados, y la recepción si no está activa */
+    for (i = 0; i < transport->n_pending; i++) {
+        uring_prep_sendmsg(&transport->ring, transport->sender->socket, &transport->send_msgs[transport->pending[i]],
+                uring_user_data(URING_SEND, 1 << URING_SEGMENTS_SHIFT | transport->pending[i]), i + 1 < transport->n_pending);
+    }
+    transport->n_pending = 0;
+    if (!transport->recv_armed) {
+        uring_prep_recvmsg_multishot(&transport->ring, transport->sender->socket, &transport->recv_msg, uring_user_data(URING_RECV, 0));
+        transport->recv_armed = 1;
+    }
+
+    for (;;) {
+        /* Las respuestas de los envíos solo se comprueban; se espera a la de una recepción */
+        while ( (cqe = uring_peek(&transport->ring)) ) {
+            if (uring_user_op(cqe->user_data) != URING_SEND) {
+                /* Los envíos segmentados apuntan a groups, que se reescribe en cada llamada: no pueden esperar a la siguiente */
+                if (transport->gso && transport->ring.to_submit && uring_submit(&transport->ring, 0, -1) < 0) fail("Error al enviar los datagramas");
+                return 1;
+            }
+            check_send(transport, cqe);
+            uring_seen(&transport->ring);
+        }
+
+        /* Una sola llamada envía los datagramas encolados y espera hasta el plazo */
+        remaining = deadline - now_ns();
+        if (uring_submit(&transport->ring, remaining > 0, remaining > 0 ? remaining : -1) < 0) fail("Error al esperar la respuesta del servidor");
+        if (remaining <= 0 && !uring_peek(&transport->ring)) return 0;
+    }
+}
+
+
+static ssize_t transport_next_segment(Transport* transport, char* buffer, size_t size) {
+    size_t len = transport->coalesced_len - transport->coalesced_offset;
+
+    if (len > transport->segment) len = transport->segment;
+    memcpy(buffer, transport->coalesced + transport->coalesced_offset, len < size ? len : size);
+    transport->coalesced_offset += len;
+
+    return len < size ? len : size;
+}
+
+
+static ssize_t transport_recv(Transport* transport, char* buffer, size_t size) {
+    Metrics* metrics = &transport->sender->metrics;
+    struct io_uring_cqe* cqe;
+    struct iovec iov = { .iov_base = buffer, .iov_len = size };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = transport->control,
+        .msg_controllen = CONTROL_LEN
+    };
+    char* payload;
+    size_t len;
+    ssize_t recv_bytes;
+
+    if (!transport->use_uring) {
+        /* Con agregación, primero se entregan los datagramas que queden de la última recepción */
+        if (transport->coalesced_offset < transport->coalesced_len) return transport_next_segment(transport, buffer, size);
+        if (transport->coalesced) {
+            iov.iov_base = transport->coalesced;
+            iov.iov_len = GSO_MAX_BYTES;
+        }
+        if ( (recv_bytes = recvmsg(transport->sender->socket, &msg, MSG_DONTWAIT)) < 0 ) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return recv_bytes;
+            metrics_add(metrics->recv_errors, 1);
+            fail("No se pudo recibir el mensaje");
+        }
+        metrics_add(metrics->bytes_in, recv_bytes);
+        if (msg.msg_flags & MSG_TRUNC) metrics_add(metrics->truncated, 1);
+        metrics_read_control(metrics, &msg);
+        adapt_rcvbuf(transport->sender);
+        if (!transport->coalesced || !recv_bytes) {
+            metrics_add(metrics->datagrams_in, 1);
+            return recv_bytes;
+        }
+
+        /* Todos los datagramas agregados miden segment bytes, salvo el último */
+        if ( !(transport->segment = gso_read_segment(&msg)) ) transport->segment = recv_bytes;
+        transport->coalesced_len = recv_bytes;
+        transport->coalesced_offset = 0;
+        metrics_add(metrics->datagrams_in, (recv_bytes + transport->segment - 1) / transport->segment);
+        return transport_next_segment(transport, buffer, size);
+    }
+
+    for (; (cqe = uring_peek(&transport->ring)); uring_seen(&transport->ring)) {
+        if (uring_user_op(cqe->user_data) == URING_SEND) {
+            check_send(transport, cqe);
+            continue;
+        }
+
+        /* Si el kernel dio por terminada la recepción (por ejemplo, sin buffers libres), se vuelve a pedir */
+        if (!(cqe->flags & IORING_CQE_F_MORE)) transport->recv_armed = 0;
+        if (cqe->res == -ENOBUFS) continue;
+        if (cqe->res < 0) {
+            metrics_add(metrics->recv_errors, 1);
+            errno = -cqe->res;
+            fail("No se pudo recibir el mensaje");
+        }
+        if (!(cqe->flags & IORING_CQE_F_BUFFER)) continue;
+
+        /* Copiar la respuesta y devolver el buffer al kernel */
+        payload = uring_recvmsg_payload(&transport->ring, cqe, &transport->recv_msg, &msg, &len);
+        if (msg.msg_control) metrics_read_control(metrics, &msg);
+        adapt_rcvbuf(transport->sender);
+        if (payload) {
+            memcpy(buffer, payload, len < size ? len : size);
+            metrics_add(metrics->datagrams_in, 1);
+            metrics_add(metrics->bytes_in, len);
+        } else {
+            metrics_add(metrics->truncated, 1);
+        }
+        uring_recycle_buffer(&transport->ring, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        uring_seen(&transport->ring);
+        if (payload) return len < size ? len : size;
+    }
+
+    return -1;
+}
+
+
+static void transport_free(Transport* transport) {
+    if (transport->use_uring) uring_free(&transport->ring);
+    free(transport->send_msgs);
+    free(transport->send_iovs);
+    free(transport->pending);
+    free(transport->groups);
+    free(transport->group_iovs);
+    free(transport->group_controls);
+    free(transport->segments);
+    free(transport->coalesced);
+}
+
+
+static void send_window(Transport* transport, FILE* fp_input, OutputWriter* output, const struct transfer_options* options, RttEstimator* rtt,
+        TransferReport* report) {
+    WindowSlot* slots;
+    WindowSlot* slot;
+    ProtocolHeader header;
+    LineReader reader;
+    char* recv_buffer;
+    const char* line = NULL;
+    size_t lines_in_datagram;
+    ssize_t line_len = 0, recv_bytes;
+    unsigned int window = options->window;
+    uint32_t base = 0, next_seq = 0;    /* Secuencia más antigua sin escribir y siguiente secuencia a enviar */
+    uint32_t seq;
+    unsigned long out_of_order = 0;     /* Respuestas que llegaron antes que alguna anterior */
+    unsigned long lines = 0;            /* Líneas enviadas en total */
+    unsigned long split_lines = 0, fragments = 0;   /* Líneas partidas en fragmentos, y fragmentos enviados */
+    unsigned long long raw_out = 0, packed_out = 0, raw_in = 0, packed_in = 0;  /* Bytes de las cargas útiles comprimidas */
+    int64_t now, measured, started, codec_ns = 0;
+    size_t packed_len;
+    ssize_t unpacked_len;
+    int eof = 0, pending = 0, compressed, i;    /* pending: la última línea leída no cupo y va en el siguiente datagrama */
+    uint16_t fragment_flags;
+    size_t line_offset = 0, chunk;      /* Parte ya enviada de la línea pendiente, si se está partiendo */
+    /* Al segmentar, los datagramas se rellenan hasta options->payload bytes, y el final del relleno debe caber */
+    size_t fill = options->use_gso && options->payload > PROTOCOL_PAD_TRAILER ? options->payload - PROTOCOL_PAD_TRAILER : options->payload;
+    /* Las líneas más largas que esto se parten: al segmentar, para que los fragmentos también se puedan segmentar juntos */
+    size_t max_line = options->use_gso && fill ? fill : MAX_PAYLOAD;
+    size_t in_flight = 0, flight_limit;     /* Bytes de los datagramas sin respuesta, y su máximo */
+    unsigned int resent;
+    uint32_t newest = 0, lost_scan = 0;     /* Secuencia más alta con respuesta, y siguiente a comprobar si se perdió */
+    unsigned long fast_resends = 0;         /* Retransmisiones sin esperar al temporizador */
+    int rcvbuf;
+    socklen_t rcvbuf_len = sizeof(rcvbuf);
+
+    /* Cada respuesta ocupa en el buffer de recepción al menos lo que su petición; la otra mitad queda de margen */
+    if (getsockopt(transport->sender->socket, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &rcvbuf_len) < 0) fail("No se pudo consultar el buffer de recepción");
+    flight_limit = rcvbuf / 2;
+
+    if ( !(slots = (WindowSlot *) calloc(window, sizeof(WindowSlot))) ) fail("No se pudo reservar memoria para la ventana");
+    for (i = 0; i < window; i++) {
+        slots[i].reply_len = -1;
+        if ( !(slots[i].reply = (char *) malloc(MAX_BYTES_REPLY)) ) fail("No se pudo reservar memoria para la ventana");
+        if (options->compress && !(slots[i].packed = (char *) malloc(MAX_PAYLOAD))) fail("No se pudo reservar memoria para la ventana");
+    }
+    if ( !(recv_buffer = (char *) malloc(PROTOCOL_HEADER_LEN + MAX_BYTES_REPLY)) ) fail("No se pudo reservar memoria para la ventana");
+    line_reader_open(&reader, fp_input);
+
+    while (!eof || pending || base != next_seq) {
+        /* Llenar la ventana con datagramas nuevos */
+        while ((!eof || pending) && next_seq - base < window && (base == next_seq || in_flight < flight_limit)) {
+            slot = &slots[next_seq % window];
+            slot->payload_len = 0;
+            lines_in_datagram = 0;
+            fragment_flags = 0;
+
+            /* Agrupar líneas completas mientras quepan en la carga útil (al menos una por datagrama) */
+            do {
+                if (!pending) {
+                    if ( (line_len = line_reader_next(&reader, &line)) < 0 ) {
+                        eof = 1;
+                        break;
+                    }
+                    pending = 1;
+                    line_offset = 0;
+                }
+                if (lines_in_datagram && slot->payload_len + line_len > fill) break;
+
+                /* Una línea que no cabe en un datagrama va sola, partida en fragmentos de hasta max_line bytes. Se
+                 * cortan entre caracteres (si caben), para que el servidor los pueda transformar en cualquier orden */
+                if (line_len > max_line) {
+                    if (lines_in_datagram) break;
+                    chunk = line_len - line_offset;
+                    if (chunk > max_line && !(chunk = utf8_complete_len(line + line_offset, max_line))) chunk = max_line;
+                    fragment_flags = PROTOCOL_FLAG_FRAGMENT | (line_offset ? 0 : PROTOCOL_FLAG_FIRST_FRAGMENT)
+                            | (line_offset + chunk == line_len ? PROTOCOL_FLAG_LAST_FRAGMENT : 0);
+                } else {
+                    chunk = line_len;
+                }
+
+                if (reader.mapped) {
+                    /* Las líneas consecutivas están seguidas en la proyección: basta con ampliar la longitud */
+                    if (!lines_in_datagram) slot->payload = line + line_offset;
+                } else {
+                    if (slot->capacity < slot->payload_len + chunk) {
+                        slot->capacity = slot->payload_len + chunk;
+                        if ( !(slot->copy = (char *) realloc(slot->copy, slot->capacity)) ) fail("No se pudo reservar memoria para la ventana");
+                    }
+                    memcpy(slot->copy + slot->payload_len, line + line_offset, chunk);
+                    slot->payload = slot->copy;
+                }
+                slot->payload_len += chunk;
+                line_offset += chunk;
+                if (fragment_flags) {
+                    fragments++;
+                    if (fragment_flags & PROTOCOL_FLAG_FIRST_FRAGMENT) split_lines++;
+                    if (!(fragment_flags & PROTOCOL_FLAG_LAST_FRAGMENT)) break;   /* La línea sigue pendiente */
+                }
+                lines_in_datagram++;
+                pending = 0;
+            } while (!fragment_flags && slot->payload_len < fill);
+            if (!lines_in_datagram && !fragment_flags) break;
+            report->bytes_in += slot->payload_len;
+
+            /* Comprimir las líneas si así ocupan menos. El servidor no descomprime más de MAX_PAYLOAD bytes, como
+             * los que recibe sin comprimir. Las retransmisiones reenvían las líneas ya comprimidas */
+            compressed = 0;
+            if (options->compress && slot->payload_len <= MAX_PAYLOAD) {
+                started = now_ns();
+                if ( (packed_len = lz_compress(slot->payload, slot->payload_len, slot->packed, slot->payload_len - 1)) ) {
+                    raw_out += slot->payload_len;
+                    packed_out += packed_len;
+                    slot->payload = slot->packed;
+                    slot->payload_len = packed_len;
+                    compressed = 1;
+                }
+                codec_ns += now_ns() - started;
+            }
+
+            /* Rellenar para que todos los datagramas midan lo mismo y se puedan segmentar juntos (no los comprimidos,
+             * que perderían lo ganado) */
+            slot->pad = options->use_gso && !compressed && slot->payload_len + PROTOCOL_PAD_TRAILER <= options->payload ? options->payload - slot->payload_len : 0;
+            if (slot->pad) protocol_write_padding(slot->trailer, slot->pad);
+            protocol_write_header(slot->header, PROTOCOL_TYPE_DATA, (lines_in_datagram > 1 ? PROTOCOL_FLAG_BATCH : 0) | (slot->pad ? PROTOCOL_FLAG_PADDED : 0)
+                    | (compressed ? PROTOCOL_FLAG_COMPRESSED : 0) | fragment_flags, next_seq, slot->payload_len + slot->pad);
+            transport_send(transport, next_seq % window, slot);
+            slot->sent_at = now_ns();
+            slot->deadline = slot->sent_at + rtt->rto;
+            slot->retries = 0;
+            in_flight += PROTOCOL_HEADER_LEN + slot->payload_len + slot->pad + DATAGRAM_OVERHEAD;
+            lines += lines_in_datagram;
+            next_seq++;
+        }
+        if (base == next_seq) break;    /* No queda nada en vuelo */
+
+        /* El temporizador es el del datagrama más antiguo sin respuesta */
+        if (!transport_wait(transport, slots[base % window].deadline)) {
+            /* Venció: se retransmiten los datagramas más antiguos cuyo plazo ya pasó, pero no todos de golpe, porque
+             * si la causa es una cola llena, una ráfaga la volvería a llenar. Los demás esperan a ser los más antiguos.
+             * El RTO se duplica una vez por pérdida: no si el que vence se envió antes de la última duplicación, porque
+             * su plazo se calculó con el RTO anterior y esa pérdida ya se tuvo en cuenta */
+            if (slots[base % window].retries || slots[base % window].sent_at >= rtt->backoff_at) rtt_backoff(rtt);
+            now = now_ns();
+            for (seq = base, resent = 0; seq != next_seq && resent < MAX_RESEND_BURST; seq++) {
+                slot = &slots[seq % window];
+                if (slot->reply_len >= 0 || slot->deadline > now) continue;
+                if (slot->retries == options->retries) {
+                    fprintf(stderr, "El servidor no respondió tras %u retransmisiones del datagrama %u\n", options->retries, seq);
+                    exit(EXIT_FAILURE);
+                }
+                transport_send(transport, seq % window, slot);
+                slot->retries++;
+                slot->deadline = now + rtt->rto;
+                report->resends++;
+                resent++;
+            }
+            continue;
+        }
+
+        /* Leer todas las respuestas que ya estén en cola, que pueden ser de cualquier datagrama en vuelo */
+        while ( (recv_bytes = transport_recv(transport, recv_buffer, PROTOCOL_HEADER_LEN + MAX_BYTES_REPLY)) >= 0 ) {
+            /* Datagrama ajeno al protocolo, o respuesta retrasada al nombre del fichero */
+            if (protocol_read_header(recv_buffer, recv_bytes, &header) != PROTOCOL_FRAMED || header.type != PROTOCOL_TYPE_DATA) continue;
+            if (header.seq - base >= next_seq - base) continue;                      /* Fuera de la ventana: duplicado o antiguo */
+
+            slot = &slots[header.seq % window];
+            if (slot->reply_len >= 0) continue;     /* Respuesta duplicada por una retransmisión */
+
+            recv_bytes = header.length;
+            if (header.flags & PROTOCOL_FLAG_PADDED) recv_bytes = protocol_strip_padding(recv_buffer + PROTOCOL_HEADER_LEN, recv_bytes);
+            if (header.flags & PROTOCOL_FLAG_COMPRESSED) {
+                /* Una respuesta comprimida que no se puede descomprimir se trata como perdida: se retransmite la petición */
+                started = now_ns();
+                unpacked_len = lz_decompress(recv_buffer + PROTOCOL_HEADER_LEN, recv_bytes, slot->reply, MAX_BYTES_REPLY);
+                codec_ns += now_ns() - started;
+                if (unpacked_len < 0) {
+                    metrics_add(transport->sender->metrics.recv_errors, 1);
+                    continue;
+                }
+                raw_in += unpacked_len;
+                packed_in += recv_bytes;
+                slot->reply_len = unpacked_len;
+            } else {
+                memcpy(slot->reply, recv_buffer + PROTOCOL_HEADER_LEN, recv_bytes);
+                slot->reply_len = recv_bytes;
+            }
+
+            in_flight -= PROTOCOL_HEADER_LEN + slot->payload_len + slot->pad + DATAGRAM_OVERHEAD;
+            if ((int32_t) (header.seq - newest) > 0) newest = header.seq;
+            if (header.seq != base) out_of_order++;
+            if (!slot->retries && slot->sent_at >= rtt->backoff_at) {   /* Algoritmo de Karn */
+                measured = now_ns() - slot->sent_at;
+                rtt_sample(rtt, measured);
+                metrics_record(&transport->sender->metrics.stages[METRICS_STAGE_RTT], measured);
+            }
+        }
+
+        /* Retransmisión rápida: los datagramas se envían en orden, así que si ya contestó a REORDER_THRESHOLD posteriores,
+         * el que no tiene respuesta se perdió. Solo la primera vez; si se vuelve a perder, lo recupera el temporizador */
+        if ((int32_t) (lost_scan - base) < 0) lost_scan = base;
+        for (now = now_ns(); (int32_t) (newest - lost_scan) >= REORDER_THRESHOLD; lost_scan++) {
+            slot = &slots[lost_scan % window];
+            if (slot->reply_len >= 0 || slot->retries) continue;
+            transport_send(transport, lost_scan % window, slot);
+            slot->retries++;
+            slot->deadline = now + rtt->rto;
+            report->resends++;
+            fast_resends++;
+        }
+
+        /* Escribir en orden todas las respuestas consecutivas disponibles desde la más antigua. Las líneas
+         * de un datagrama agrupado vuelven separadas por sus '\n', así que basta con escribirlas seguidas */
+        while (base != next_seq && slots[base % window].reply_len >= 0) {
+            slot = &slots[base % window];
+            output_append(output, slot->reply, slot->reply_len);
+            slot->reply_len = -1;
+            base++;
+        }
+    }
+
+    if (options->verbose) {
+        printf("Líneas enviadas: %lu en %u datagramas (%.2f líneas por datagrama); respuestas recibidas fuera de orden: %lu\n",
+                lines, next_seq, next_seq ? (double) lines / next_seq : 0.0, out_of_order);
+    }
+    if (options->verbose && fast_resends) printf("Retransmisiones rápidas (por respuestas posteriores, sin esperar al RTO): %lu\n", fast_resends);
+    if (options->verbose && split_lines) printf("Líneas partidas por no caber en un datagrama: %lu, en %lu fragmentos\n", split_lines, fragments);
+    if (options->verbose && (raw_out || raw_in)) {
+        printf("Compresión: líneas enviadas %llu -> %llu bytes (%.1f%%); respuestas %llu -> %llu bytes (%.1f%%); %.1f ns de códec por byte de texto\n",
+                raw_out, packed_out, raw_out ? 100.0 * packed_out / raw_out : 0.0, raw_in, packed_in, raw_in ? 100.0 * packed_in / raw_in : 0.0,
+                (double) codec_ns / (raw_out + raw_in));
+    }
+
+    for (i = 0; i < window; i++) {
+        free(slots[i].copy);
+        free(slots[i].reply);
+        free(slots[i].packed);
+    }
+    free(slots);
+    free(recv_buffer);
+    line_reader_close(&reader);
+}
+
+
 static void print_help(char* exe_name){
     /** Cabecera y modo de ejecución **/
-    printf("Uso: %s [[-p] <port>] [[-a] <address>] [-r <remote port>] [-f <file>] [-h]\n\n", exe_name);
+    printf("Uso: %s [[-p] <port>] [[-a] <address>] [-r <remote port>] [-f <file|dir>]... [-j <jobs>] [-w <window>] [-b [<bytes>]] [-t <retries>] [-u] [-g] [-z] [-o] [-m <file>] [-O <profile>] [-h]\n\n", exe_name);
 
     /** Lista de opciones de uso **/
     printf(" Opción\t\tOpción larga\t\tSignificado\n");
     printf(" -p <port>\t--own_port <port>\t\tPuerto en el que escuchará/enviará el cliente.\n");
     printf(" -a <address>\t--address <address>\tDirección en la que se encuentra el servidor.\n");
     printf(" -r <remote port>\t--remote_port <remote_port>\t\tPuerto por el que escucha el servidor.\n");
-    printf(" -f <file>\t--file <file>\t\tArchivo de texto a pasar a mayúsculas.\n");    
+    printf(" -f <file|dir>\t--file <file|dir>\tArchivo de texto a pasar a mayúsculas, o directorio con varios (sus archivos regulares, salvo los que ya\n"
+           "\t\t\t\t\ttienen el nombre en mayúsculas). Puede repetirse. Cada salida se crea junto a su archivo de entrada.\n");
+    printf(" -j <jobs>\t--jobs <jobs>\t\tTransferir hasta <jobs> archivos a la vez (1-%d, por defecto 1), cada uno con su socket en puertos\n"
+           "\t\t\t\t\tconsecutivos a partir de <port>. Con varios archivos se informa del progreso y del rendimiento conjunto.\n", MAX_JOBS);
+    printf(" -w <window>\t--window <window>\tNúmero de datagramas en vuelo a la vez (1-%d). Por defecto 1: se espera cada respuesta antes de enviar la siguiente línea.\n", MAX_WINDOW);
+    printf(" -b [<bytes>]\t--batch [<bytes>]\tAgrupar en cada datagrama tantas líneas completas como quepan en <bytes> (1-%d, por defecto %d).\n", MAX_PAYLOAD, DEFAULT_PAYLOAD);
+    printf(" -t <retries>\t--retries <retries>\tRetransmisiones de un mismo datagrama antes de abandonar (0-%d, por defecto %d).\n", MAX_RETRIES, DEFAULT_RETRIES);
+    printf(" -u\t\t--uring\t\t\tUsar io_uring para enviar y recibir los datagramas si el kernel lo permite.\n");
+    printf(" -g\t\t--gso\t\t\tSegmentar los envíos (UDP_SEGMENT) y, sin -u, recibir agregadas las respuestas (UDP_GRO) si el kernel lo permite.\n"
+           "\t\t\t\t\tImplica -b: los datagramas se rellenan hasta <bytes> para que midan todos lo mismo.\n");
+    printf(" -z\t\t--compress\t\tComprimir las líneas de cada datagrama (y sus respuestas) con LZ77 si el servidor lo admite.\n"
+           "\t\t\t\t\tLos datagramas comprimidos no se rellenan con -g.\n");
+    printf(" -o\t\t--offline\t\tNo acceder a la red para obtener la IP externa: usar la de una interfaz local.\n");
+    printf(" -m <file>\t--metrics <file>\tReescribir cada %d ms en <file> las métricas del socket (formato de texto de Prometheus).\n", METRICS_INTERVAL);
+    printf(" -O <profile>\t--sockopt <profile>\tOpciones del socket (ver abajo).\n");
     printf(" -h\t\t--help\t\t\tMostrar este texto de ayuda y salir.\n");
 
+    printf("\n" SOCKOPTS_HELP);
+
     /** Consideraciones adicionales **/
     printf("\nPuede especificarse el parámetro <port> para el puerto en el que escucha/envia el cliente sin escribir la opción '-p', siempre y cuando este sea el primer parámetro que se pasa a la función.\n");
 }
@@ -171,9 +1442,21 @@ static void print_help(char* exe_name){
 static void process_args(struct arguments args) {
     int i;
     char* current_arg;
+    char* end;
+    long value;
     uint8_t set_file = 0, set_ip = 0, set_port = 0;   /* Flags para saber si se setearon el fichero a convertir, la IP y puerto */
     /* Inicializar los valores de puerto a sus valores por defecto */
     *args.own_port = DEFAULT_PORT;
+    *args.remote_port = 0;
+    args.options->window = 1;
+    args.options->payload = 0;
+    args.options->retries = DEFAULT_RETRIES;
+    args.options->use_uring = 0;
+    args.options->use_gso = 0;
+    args.options->compress = 0;
+    *args.jobs = 1;
+    memset(args.sender_options, 0, sizeof(SenderOptions));
+    *args.metrics_path = NULL;
 
     for (i = 1; i < args.argc; i++) { /* Procesamos los argumentos (sin contar el nombre del ejecutable) */
         current_arg = args.argv[i];
@@ -183,6 +1466,17 @@ static void process_args(struct arguments args) {
                 if (!strcmp(current_arg, "--own_port")) current_arg = "-p";
                 else if( (!strcmp(current_arg, "--remote_port"))) current_arg = "-r";               
                 else if (!strcmp(current_arg, "--address")) current_arg = "-a";             
+                else if (!strcmp(current_arg, "--file")) current_arg = "-f";
+                else if (!strcmp(current_arg, "--jobs")) current_arg = "-j";
+                else if (!strcmp(current_arg, "--window")) current_arg = "-w";
+                else if (!strcmp(current_arg, "--batch")) current_arg = "-b";
+                else if (!strcmp(current_arg, "--retries")) current_arg = "-t";
+                else if (!strcmp(current_arg, "--uring")) current_arg = "-u";
+                else if (!strcmp(current_arg, "--gso")) current_arg = "-g";
+                else if (!strcmp(current_arg, "--compress")) current_arg = "-z";
+                else if (!strcmp(current_arg, "--offline")) current_arg = "-o";
+                else if (!strcmp(current_arg, "--metrics")) current_arg = "-m";
+                else if (!strcmp(current_arg, "--sockopt")) current_arg = "-O";
                 else if (!strcmp(current_arg, "--help")) current_arg = "-h";
             } 
             switch(current_arg[1]) {
@@ -227,7 +1521,7 @@ static void process_args(struct arguments args) {
                     break;
                     case 'f':   /* Fichero */
                     if (++i < args.argc) {
-                        strncpy(args.input_file_name, args.argv[i], FILENAME_LEN);
+                        add_input(args.files, args.argv[i]);
                         set_file = 1;
                     } else {
                         fprintf(stderr, "Fichero no especificado tras la opción '-f'\n\n");
@@ -235,6 +1529,86 @@ static void process_args(struct arguments args) {
                         exit(EXIT_FAILURE);
                     }
                     break;    
+                case 'j':   /* Transferencias simultáneas */
+                    if (++i < args.argc) {
+                        *args.jobs = atoi(args.argv[i]);
+                        if (*args.jobs < 1 || *args.jobs > MAX_JOBS) {
+                            fprintf(stderr, "El número de transferencias simultáneas especificado (%s) no es válido.\n\n", args.argv[i]);
+                            print_help(args.argv[0]);
+                            exit(EXIT_FAILURE);
+                        }
+                    } else {
+                        fprintf(stderr, "Número de transferencias simultáneas no especificado tras la opción '-j'.\n\n");
+                        print_help(args.argv[0]);
+                        exit(EXIT_FAILURE);
+                    }
+                    break;
+                case 'w':   /* Tamaño de la ventana */
+                    if (++i < args.argc) {
+                        args.options->window = atoi(args.argv[i]);
+                        if (args.options->window < 1 || args.options->window > MAX_WINDOW) {
+                            fprintf(stderr, "El tamaño de ventana especificado (%s) no es válido.\n\n", args.argv[i]);
+                            print_help(args.argv[0]);
+                            exit(EXIT_FAILURE);
+                        }
+                    } else {
+                        fprintf(stderr, "Tamaño de ventana no especificado tras la opción '-w'.\n\n");
+                        print_help(args.argv[0]);
+                        exit(EXIT_FAILURE);
+                    }
+                    break;
+                case 't':   /* Número de retransmisiones */
+                    if (++i < args.argc) {
+                        value = strtol(args.argv[i], &end, 10);
+                        if (*end || end == args.argv[i] || value < 0 || value > MAX_RETRIES) {
+                            fprintf(stderr, "El número de retransmisiones especificado (%s) no es válido.\n\n", args.argv[i]);
+                            print_help(args.argv[0]);
+                            exit(EXIT_FAILURE);
+                        }
+                        args.options->retries = value;
+                    } else {
+                        fprintf(stderr, "Número de retransmisiones no especificado tras la opción '-t'.\n\n");
+                        print_help(args.argv[0]);
+                        exit(EXIT_FAILURE);
+                    }
+                    break;
+                case 'b':   /* Agrupar líneas; el tamaño es opcional */
+                    args.options->payload = DEFAULT_PAYLOAD;
+                    if (i + 1 < args.argc && args.argv[i + 1][0] != '-') {
+                        args.options->payload = atoi(args.argv[++i]);
+                        if (args.options->payload < 1 || args.options->payload > MAX_PAYLOAD) {
+                            fprintf(stderr, "El tamaño de agrupación especificado (%s) no es válido.\n\n", args.argv[i]);
+                            print_help(args.argv[0]);
+                            exit(EXIT_FAILURE);
+                        }
+                    }
+                    break;
+                case 'u':   /* io_uring */
+                    args.options->use_uring = 1;
+                    break;
+                case 'g':   /* Segmentación y agregación UDP */
+                    args.options->use_gso = 1;
+                    break;
+                case 'z':   /* Compresión */
+                    args.options->compress = 1;
+                    break;
+                case 'o':   /* Sin conexión */
+                    args.sender_options->offline = 1;
+                    break;
+                case 'm':   /* Fichero de métricas */
+                    if (++i < args.argc) {
+                        *args.metrics_path = args.argv[i];
+                    } else {
+                        fprintf(stderr, "Fichero de métricas no especificado tras la opción '-m'.\n\n");
+                        print_help(args.argv[0]);
+                        exit(EXIT_FAILURE);
+                    }
+                    break;
+                case 'O':   /* Perfil de opciones del socket */
+                    if (++i < args.argc && sockopts_parse(&args.sender_options->socket, args.argv[i]) == 0) break;
+                    fprintf(stderr, "Perfil de opciones de socket no válido o no especificado tras la opción '-O'.\n\n");
+                    print_help(args.argv[0]);
+                    exit(EXIT_FAILURE);
                 case 'h':   /* Ayuda */
                     print_help(args.argv[0]);
                     exit(EXIT_SUCCESS);
@@ -252,6 +1626,8 @@ static void process_args(struct arguments args) {
             }
         }
     }
+    /* Segmentar solo tiene sentido con datagramas que agrupen líneas hasta un tamaño fijo */
+    if (args.options->use_gso && !args.options->payload) args.options->payload = DEFAULT_PAYLOAD;
         if (!set_file || !set_ip || !set_port) { 
         fprintf(stderr, "%s%s%s\n", (set_file ? "" : "No se especificó fichero para convertir a mayúsculas.\n"),
                                     (set_ip ? "" : "No se especificó la IP del servidor al que conectarse.\n"), 
@@ -259,4 +1635,14 @@ static void process_args(struct arguments args) {
         print_help(args.argv[0]);
         exit(EXIT_FAILURE);
     }
+    if (!args.files->count) {
+        fprintf(stderr, "Los directorios especificados no tienen archivos que convertir a mayúsculas.\n");
+        exit(EXIT_FAILURE);
+    }
+    /* Cada transferencia simultánea usa el puerto siguiente al de la anterior */
+    if (*args.own_port && *args.own_port + *args.jobs - 1 > UINT16_MAX) {
+        fprintf(stderr, "No hay %u puertos consecutivos a partir del %u para las transferencias simultáneas.\n\n", *args.jobs, *args.own_port);
+        print_help(args.argv[0]);
+        exit(EXIT_FAILURE);
+    }
 }
@@ -0,0 +1,156 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LINES_X86
+#endif
+
+#include "lines.h"
+#include "loging.h"
+
+
+/* Escáner de saltos de línea: devuelve el primer '\n' en [start, end) o end si no hay ninguno */
+typedef const char* (*NewlineScanner)(const char* start, const char* end);
+
+
+/**
+ * @brief   Escáner de saltos de línea escalar, para cualquier CPU.
+ *
+ * @param start     Principio de la zona a buscar.
+ * @param end       Fin de la zona a buscar.
+ *
+ * @return  Puntero al primer '\n', o end si no hay ninguno.
+ */
+static const char* find_newline_scalar(const char* start, const char* end) {
+    const char* newline = memchr(start, '\n', end - start);
+
+    return newline ? newline : end;
+}
+
+
+#ifdef LINES_X86
+/**
+ * @brief   Escáner de saltos de línea con SSE2.
+ *
+ * Compara 16 bytes a la vez con '\n' y deja el resto al escáner escalar.
+ *
+ * @param start     Principio de la zona a buscar.
+ * @param end       Fin de la zona a buscar.
+ *
+ * @return  Puntero al primer '\n', o end si no hay ninguno.
+ */
+__attribute__((target("sse2")))
+static const char* find_newline_sse2(const char* start, const char* end) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    int mask;
+
+    for (; end - start >= 16; start += 16) {
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) start), newline));
+        if (mask) return start + __builtin_ctz(mask);
+    }
+
+    return find_newline_scalar(start, end);
+}
+
+
+/**
+ * @brief   Escáner de saltos de línea con AVX2.
+ *
+ * Compara 32 bytes a la vez con '\n' y deja el resto al escáner SSE2.
+ *
+ * @param start     Principio de la zona a buscar.
+ * @param end       Fin de la zona a buscar.
+ *
+ * @return  Puntero al primer '\n', o end si no hay ninguno.
+ */
+__attribute__((target("avx2")))
+static const char* find_newline_avx2(const char* start, const char* end) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    unsigned int mask;
+
+    for (; end - start >= 32; start += 32) {
+        mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) start), newline));
+        if (mask) return start + __builtin_ctz(mask);
+    }
+
+    return find_newline_sse2(start, end);
+}
+#endif
+
+
+/* Escáner usado por line_reader_next: el más rápido que soporte la CPU */
+static NewlineScanner find_newline = find_newline_scalar;
+
+
+/**
+ * @brief   Elige el escáner de saltos de línea según la CPU.
+ *
+ * Se ejecuta automáticamente antes de main.
+ */
+__attribute__((constructor))
+static void select_newline_scanner(void) {
+#ifdef LINES_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) find_newline = find_newline_sse2;
+    if (__builtin_cpu_supports("avx2")) find_newline = find_newline_avx2;
+#endif
+}
+
+
+void line_reader_open(LineReader* reader, FILE* fp) {
+    struct stat info;
+    void* data;
+
+    memset(reader, 0, sizeof(LineReader));
+    reader->fp = fp;
+
+    /* Solo se proyectan los ficheros regulares no vacíos; el resto se lee con getline */
+    if (fstat(fileno(fp), &info) < 0 || !S_ISREG(info.st_mode) || info.st_size <= 0 || (off_t) (size_t) info.st_size != info.st_size) return;
+    if ( (data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0)) == MAP_FAILED ) return;
+
+    /* Se recorre de principio a fin una sola vez: el kernel puede leer por delante y liberar lo ya leído */
+    if (madvise(data, info.st_size, MADV_SEQUENTIAL) < 0) perror("No se pudo indicar el acceso secuencial al fichero");
+
+    reader->mapped = 1;
+    reader->data = data;
+    reader->size = info.st_size;
+}
+
+
+ssize_t line_reader_next(LineReader* reader, const char** line) {
+    const char *start, *end;
+    ssize_t len;
+
+    if (!reader->mapped) {
+        if ( (len = getline(&reader->line, &reader->line_size, reader->fp)) < 0 ) {
+            if (ferror(reader->fp)) fail("Error al leer el archivo de entrada");
+            return -1;
+        }
+        *line = reader->line;
+        return len;
+    }
+
+    if (reader->offset == reader->size) return -1;
+
+    /* La línea termina en su '\n' (incluido) o en el final del fichero */
+    start = reader->data + reader->offset;
+    end = find_newline(start, reader->data + reader->size);
+    if (end < reader->data + reader->size) end++;
+
+    *line = start;
+    reader->offset = end - reader->data;
+    return end - start;
+}
+
+
+void line_reader_close(LineReader* reader) {
+    if (reader->mapped && munmap((void *) reader->data, reader->size) < 0) fail("No se pudo deshacer la proyección del archivo de entrada");
+    free(reader->line);
+
+    memset(reader, 0, sizeof(LineReader));
+}
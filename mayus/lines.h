@@ -0,0 +1,56 @@
+#ifndef LINES_H
+#define LINES_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * Lector de las líneas del fichero de entrada del cliente.
+ *
+ * Si el fichero es regular, se proyecta entero en memoria con mmap y las líneas se devuelven como
+ * punteros a la propia proyección, sin copiarlas: dos líneas consecutivas están seguidas en memoria,
+ * de modo que un datagrama con varias líneas se puede enviar directamente desde las páginas proyectadas.
+ * Los saltos de línea se buscan con un escáner vectorial (AVX2 o SSE2, elegido según la CPU).
+ * Para tuberías y otros ficheros que no se pueden proyectar se usa getline, y cada línea devuelta
+ * solo es válida hasta la siguiente llamada.
+ */
+typedef struct {
+    int mapped;         /* Distinto de 0 si el fichero está proyectado en memoria */
+    const char* data;   /* Contenido del fichero proyectado */
+    size_t size;        /* Tamaño del fichero proyectado */
+    size_t offset;      /* Posición de la siguiente línea en la proyección */
+    FILE* fp;           /* Fichero, para la lectura con getline */
+    char* line;         /* Buffer de getline */
+    size_t line_size;   /* Tamaño del buffer de getline */
+} LineReader;
+
+
+/**
+ * @brief   Prepara la lectura por líneas de un fichero abierto.
+ *
+ * @param reader    Lector a inicializar.
+ * @param fp        Fichero abierto para lectura, que sigue siendo del llamante.
+ */
+void line_reader_open(LineReader* reader, FILE* fp);
+
+/**
+ * @brief   Devuelve la siguiente línea del fichero.
+ *
+ * @param reader    Lector.
+ * @param line      Se guarda el principio de la línea, que incluye su '\n' (salvo la última
+ *                  línea, si el fichero no termina en salto de línea). No termina en '\0'.
+ *
+ * @return  Longitud de la línea, o -1 si se llegó al final del fichero.
+ */
+ssize_t line_reader_next(LineReader* reader, const char** line);
+
+/**
+ * @brief   Deshace la proyección y libera la memoria del lector (el fichero no se cierra).
+ *
+ * @param reader    Lector.
+ */
+void line_reader_close(LineReader* reader);
+
+
+#endif  /* LINES_H */
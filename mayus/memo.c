@@ -0,0 +1,232 @@
+#define _GNU_SOURCE     /* memrchr */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "memo.h"
+#include "loging.h"
+#include "upper.h"
+
+#define HASH_MULTIPLIER 0x9E3779B97F4A7C15ULL   /* Parte fraccionaria de la razón áurea en 64 bits */
+
+
+/**
+ * @brief   Calcula el hash de una línea, de 8 en 8 bytes.
+ *
+ * @param line  Línea.
+ * @param len   Longitud de la línea.
+ *
+ * @return  Hash de 64 bits.
+ */
+static uint64_t hash_line(const char* line, size_t len) {
+    uint64_t hash = len * HASH_MULTIPLIER, word;
+
+    for (; len >= sizeof(word); line += sizeof(word), len -= sizeof(word)) {
+        memcpy(&word, line, sizeof(word));
+        hash = (hash ^ word) * HASH_MULTIPLIER;
+        hash ^= hash >> 32;
+    }
+    word = 0;
+    memcpy(&word, line, len);
+    hash = (hash ^ word) * HASH_MULTIPLIER;
+
+    /* Mezcla final (splitmix64), para que los bits bajos, que eligen la zona, dependan de todos los bytes */
+    hash ^= hash >> 30;
+    hash *= 0xBF58476D1CE4E5B9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94D049BB133111EBULL;
+    hash ^= hash >> 31;
+
+    return hash;
+}
+
+
+/**
+ * @brief   Inicializa una caché de líneas transformadas.
+ *
+ * @param memo      Caché a inicializar.
+ * @param budget    Memoria a ocupar, en bytes. Se usa la mayor potencia de 2 de entradas que cabe, con
+ *                  un mínimo de MEMO_WAYS entradas.
+ */
+void memo_init(MemoCache* memo, size_t budget) {
+    memset(memo, 0, sizeof(MemoCache));
+    for (memo->capacity = MEMO_WAYS; 2 * memo->capacity * (sizeof(MemoEntry) + MEMO_SLOT_SIZE) <= budget; memo->capacity *= 2);
+
+    if ( !(memo->entries = (MemoEntry *) calloc(memo->capacity, sizeof(MemoEntry))) || !(memo->data = (char *) malloc(memo->capacity * MEMO_SLOT_SIZE)) ) {
+        fail("No se pudo reservar memoria para la caché de líneas");
+    }
+}
+
+
+/**
+ * @brief   Pasa a mayúsculas una línea sin la caché, dejando siempre el resultado en destiny.
+ *
+ * @param line      Línea. Su prefijo ASCII se modifica in situ.
+ * @param len       Longitud de la línea.
+ * @param destiny   Buffer en el que escribir el resultado.
+ * @param capacity  Tamaño de destiny.
+ *
+ * @return  Longitud del resultado, o -1 si no cabe en capacity bytes.
+ */
+static ssize_t transform_line(char* line, size_t len, char* destiny, size_t capacity) {
+    char* output;
+    ssize_t output_len;
+
+    if ( (output_len = toupper_buffer(line, len, destiny, capacity, &output)) < 0 ) return -1;
+    if (output == line) {   /* Era ASCII y se transformó in situ */
+        if ((size_t) output_len > capacity) return -1;
+        memcpy(destiny, line, output_len);
+    }
+
+    return output_len;
+}
+
+
+/**
+ * @brief   Pasa a mayúsculas una línea, copiándola de la caché si ya está o guardándola si no.
+ *
+ * Las líneas ASCII no se buscan: el núcleo vectorial las transforma antes de lo que se tarda en calcular
+ * el hash y comparar. Como lo que se guarda es la línea tras esa primera pasada (con su prefijo ASCII ya
+ * en mayúsculas), cada línea se guarda siempre igual y su transformación sigue siendo la misma.
+ *
+ * @param memo      Caché.
+ * @param line      Línea, sin '\n'. Su prefijo ASCII se modifica in situ.
+ * @param len       Longitud de la línea.
+ * @param destiny   Buffer en el que escribir el resultado.
+ * @param capacity  Tamaño de destiny.
+ *
+ * @return  Longitud del resultado, o -1 si no cabe en capacity bytes.
+ */
+static ssize_t memo_line(MemoCache* memo, char* line, size_t len, char* destiny, size_t capacity) {
+    size_t mask = memo->capacity - 1, start, i;
+    uint64_t hash;
+    uint32_t tag;
+    MemoEntry* entry, *free_entry = NULL;
+    char* slot;
+    ssize_t output_len;
+
+    if (toupper_ascii(line, len) == len) {
+        if (len > capacity) return -1;
+        memcpy(destiny, line, len);
+        return len;
+    }
+
+    /* Las líneas que no caben en una entrada ni siquiera se buscan */
+    if (len >= MEMO_SLOT_SIZE) {
+        memo->bypassed++;
+        return transform_line(line, len, destiny, capacity);
+    }
+
+    hash = hash_line(line, len);
+    tag = (uint32_t) (hash >> 32) | 1;
+    start = hash & mask;
+
+    for (i = 0; i < MEMO_WAYS; i++) {
+        entry = &memo->entries[(start + i) & mask];
+        if (!entry->tag) {
+            if (!free_entry) free_entry = entry;
+            continue;
+        }
+        slot = memo->data + ((start + i) & mask) * MEMO_SLOT_SIZE;
+        if (entry->tag == tag && entry->input_len == len && !memcmp(slot, line, len)) {
+            if (entry->output_len > capacity) return -1;
+            memcpy(destiny, slot + len, entry->output_len);
+            entry->referenced = 1;
+            memo->hits++;
+            return entry->output_len;
+        }
+    }
+
+    /* Línea nueva: un hueco libre de su zona o, si no hay, la primera entrada que no se usó desde que pasó la
+     * manecilla. Las que sí se usaron pierden su bit y se salvan hasta la siguiente pasada */
+    if ( !(entry = free_entry) ) {
+        for (;;) {
+            entry = &memo->entries[(start + memo->hand++ % MEMO_WAYS) & mask];
+            if (!entry->referenced) break;
+            entry->referenced = 0;
+        }
+        memo->evictions++;
+    }
+    memo->misses++;
+
+    slot = memo->data + (entry - memo->entries) * MEMO_SLOT_SIZE;
+    memcpy(slot, line, len);
+    entry->tag = 0;
+    if ( (output_len = transform_line(line, len, destiny, capacity)) < 0 ) return -1;
+
+    if (len + output_len <= MEMO_SLOT_SIZE) {
+        memcpy(slot + len, destiny, output_len);
+        entry->tag = tag;
+        entry->input_len = len;
+        entry->output_len = output_len;
+        entry->referenced = 0;  /* Hasta que se repita, es la primera candidata a desalojarse */
+    }
+
+    return output_len;
+}
+
+
+/**
+ * @brief   Pasa a mayúsculas una o varias líneas, copiando de la caché las que ya se transformaron antes.
+ *
+ * Si todo el texto es ASCII se transforma in situ, como en toupper_buffer, sin pasar por la caché. Si no,
+ * cada línea (separada por '\n', que se copia tal cual) desde la primera que no es ASCII se busca por
+ * separado, así que las respuestas que agrupan varias líneas también aprovechan la caché. Las líneas que
+ * no están se transforman y se guardan, desalojando si hace falta la primera de su zona de la tabla que
+ * no se haya usado desde la última pasada de la manecilla.
+ *
+ * @param memo      Caché.
+ * @param source    Texto a transformar. Su parte ASCII se modifica in situ.
+ * @param len       Número de bytes de source.
+ * @param destiny   Buffer para el resultado cuando el texto no es ASCII.
+ * @param capacity  Tamaño de destiny. Con UPPER_MAX_EXPANSION * len bytes siempre cabe el resultado.
+ * @param output    Variable en la que guardar dónde está el resultado (source o destiny).
+ *
+ * @return  Longitud del resultado, o -1 si no cabe en capacity bytes.
+ */
+ssize_t memo_toupper(MemoCache* memo, char* source, size_t len, char* destiny, size_t capacity, char** output) {
+    char* end = source + len;
+    char* newline;
+    size_t written, line_len, ascii;
+    ssize_t output_len;
+
+    if ( (ascii = toupper_ascii(source, len)) == len ) {
+        *output = source;
+        return len;
+    }
+
+    /* Las líneas anteriores a la primera que no es ASCII ya están transformadas */
+    *output = destiny;
+    newline = (char *) memrchr(source, '\n', ascii);
+    written = newline ? newline + 1 - source : 0;
+    if (written > capacity) return -1;
+    memcpy(destiny, source, written);
+    source += written;
+
+    while (source < end) {
+        newline = (char *) memchr(source, '\n', end - source);
+        line_len = (newline ? newline : end) - source;
+        if ( (output_len = memo_line(memo, source, line_len, destiny + written, capacity - written)) < 0 ) return -1;
+        written += output_len;
+        if (!newline) break;
+        if (written == capacity) return -1;
+        destiny[written++] = '\n';
+        source = newline + 1;
+    }
+
+    return written;
+}
+
+
+/**
+ * @brief   Libera la memoria de una caché.
+ *
+ * @param memo  Caché a liberar.
+ */
+void memo_free(MemoCache* memo) {
+    free(memo->entries);
+    free(memo->data);
+    memo->entries = NULL;
+    memo->data = NULL;
+    memo->capacity = 0;
+}
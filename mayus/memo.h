@@ -0,0 +1,81 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Bytes de cada entrada de la caché, para la línea y su transformación: las líneas que no caben se transforman sin guardarse */
+#define MEMO_SLOT_SIZE 256
+
+/* Número de entradas consecutivas en las que se busca cada línea (sondeo lineal acotado) */
+#define MEMO_WAYS 8
+
+/**
+ * Entrada de la caché de líneas transformadas. Los datos van aparte, en MemoCache.data, para que la
+ * búsqueda solo recorra estas cabeceras hasta dar con la etiqueta.
+ */
+typedef struct {
+    uint32_t tag;           /* 32 bits altos del hash de la línea (nunca 0), o 0 si la entrada está libre */
+    uint16_t input_len;     /* Longitud de la línea */
+    uint16_t output_len;    /* Longitud de la línea transformada, que se guarda detrás de ella */
+    uint8_t referenced;     /* Bit de referencia de CLOCK: la línea se usó desde que pasó la manecilla */
+} MemoEntry;
+
+/**
+ * Caché de líneas ya transformadas, con direccionamiento abierto y desalojo CLOCK. Cada hilo trabajador
+ * tiene la suya, así que no necesita cerrojos. Sirve para el tráfico en el que se repiten las mismas
+ * líneas (plantillas de registros, por ejemplo): una línea repetida se copia de la caché en lugar de
+ * transformarse otra vez con las tablas de Unicode. Las líneas ASCII no pasan por ella, porque el
+ * núcleo vectorial las transforma antes de lo que se tarda en buscarlas.
+ */
+typedef struct {
+    MemoEntry* entries;     /* capacity entradas */
+    char* data;             /* MEMO_SLOT_SIZE bytes por entrada: la línea original y, detrás, la transformada */
+    size_t capacity;        /* Número de entradas (potencia de 2) */
+    unsigned int hand;      /* Manecilla de CLOCK: posición de la zona por la que empieza a buscar a quién desalojar */
+    unsigned long hits;     /* Líneas copiadas de la caché */
+    unsigned long misses;   /* Líneas transformadas y guardadas */
+    unsigned long evictions;    /* Líneas desalojadas para guardar otra */
+    unsigned long bypassed;     /* Líneas no ASCII transformadas sin guardar, por no caber en una entrada */
+} MemoCache;
+
+
+/**
+ * @brief   Inicializa una caché de líneas transformadas.
+ *
+ * @param memo      Caché a inicializar.
+ * @param budget    Memoria a ocupar, en bytes. Se usa la mayor potencia de 2 de entradas que cabe, con
+ *                  un mínimo de MEMO_WAYS entradas.
+ */
+void memo_init(MemoCache* memo, size_t budget);
+
+/**
+ * @brief   Pasa a mayúsculas una o varias líneas, copiando de la caché las que ya se transformaron antes.
+ *
+ * Si todo el texto es ASCII se transforma in situ, como en toupper_buffer, sin pasar por la caché. Si no,
+ * cada línea (separada por '\n', que se copia tal cual) desde la primera que no es ASCII se busca por
+ * separado, así que las respuestas que agrupan varias líneas también aprovechan la caché. Las líneas que
+ * no están se transforman y se guardan, desalojando si hace falta la primera de su zona de la tabla que
+ * no se haya usado desde la última pasada de la manecilla.
+ *
+ * @param memo      Caché.
+ * @param source    Texto a transformar. Su parte ASCII se modifica in situ.
+ * @param len       Número de bytes de source.
+ * @param destiny   Buffer para el resultado cuando el texto no es ASCII.
+ * @param capacity  Tamaño de destiny. Con UPPER_MAX_EXPANSION * len bytes siempre cabe el resultado.
+ * @param output    Variable en la que guardar dónde está el resultado (source o destiny).
+ *
+ * @return  Longitud del resultado, o -1 si no cabe en capacity bytes.
+ */
+ssize_t memo_toupper(MemoCache* memo, char* source, size_t len, char* destiny, size_t capacity, char** output);
+
+/**
+ * @brief   Libera la memoria de una caché.
+ *
+ * @param memo  Caché a liberar.
+ */
+void memo_free(MemoCache* memo);
+
+
+#endif  /* MEMO_H */
@@ -0,0 +1,288 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "peers.h"
+#include "loging.h"
+#include "protocol.h"
+#include "upper.h"
+
+#define PROBE_LIMIT 8   /* Número de entradas consecutivas en las que se busca a un cliente */
+
+
+/**
+ * @brief   Calcula el hash de la dirección de un cliente.
+ *
+ * @param address   Dirección del cliente.
+ *
+ * @return  Hash de la IP y el puerto.
+ */
+static uint64_t hash_address(const struct sockaddr_in* address) {
+    uint64_t key = ((uint64_t) address->sin_addr.s_addr << 16) | address->sin_port;
+
+    /* Mezcla de 64 bits (splitmix64) */
+    key ^= key >> 30;
+    key *= 0xBF58476D1CE4E5B9ULL;
+    key ^= key >> 27;
+    key *= 0x94D049BB133111EBULL;
+    key ^= key >> 31;
+
+    return key;
+}
+
+
+/**
+ * @brief   Cambia el número de respuestas que se recuerdan de un cliente, olvidando las guardadas.
+ *
+ * Si todavía no se ha reservado memoria para ellas, solo se cambia el número: se reservará con la primera.
+ *
+ * @param peer      Cliente.
+ * @param window    Nuevo número de respuestas.
+ */
+static void resize_replies(Peer* peer, unsigned int window) {
+    unsigned int i;
+
+    if (peer->replies && window != peer->window) {
+        for (i = window; i < peer->window; i++) free(peer->replies[i].data);
+        if ( !(peer->replies = (CachedReply *) realloc(peer->replies, window * sizeof(CachedReply))) ) {
+            fail("No se pudo reservar memoria para el cliente");
+        }
+        if (window > peer->window) memset(peer->replies + peer->window, 0, (window - peer->window) * sizeof(CachedReply));
+    }
+    peer->window = window;
+    peer_forget_replies(peer);
+}
+
+
+/**
+ * @brief   Vacía una entrada de la tabla, conservando la memoria de sus respuestas para reutilizarla.
+ *
+ * Un cliente nuevo no ha anunciado su ventana, así que se queda con PEER_DEFAULT_WINDOW respuestas.
+ *
+ * @param peer      Entrada a vaciar.
+ * @param address   Dirección del nuevo cliente de la entrada.
+ * @param now       Instante actual.
+ */
+static void reset_peer(Peer* peer, const struct sockaddr_in* address, uint64_t now) {
+    resize_replies(peer, PEER_DEFAULT_WINDOW);
+
+    peer->address = *address;
+    peer->in_use = 1;
+    peer->last_seen = now;
+    peer->rate_start = now;
+    peer->rate_count = 0;
+}
+
+
+/**
+ * @brief   Inicializa una tabla de clientes.
+ *
+ * @param table     Tabla a inicializar.
+ * @param capacity  Número máximo de clientes (se redondea a potencia de 2).
+ */
+void peers_init(PeerTable* table, size_t capacity) {
+    table->capacity = PROBE_LIMIT;
+    while (table->capacity < capacity) table->capacity <<= 1;
+    table->count = 0;
+    if ( !(table->peers = (Peer *) calloc(table->capacity, sizeof(Peer))) ) fail("No se pudo reservar memoria para la tabla de clientes");
+}
+
+
+/**
+ * @brief   Busca un cliente en la tabla, y lo añade si no está.
+ *
+ * Si la tabla está llena, el nuevo cliente reemplaza al que lleva más tiempo
+ * inactivo entre los de su zona de la tabla.
+ *
+ * @param table     Tabla de clientes.
+ * @param address   Dirección del cliente.
+ * @param now       Instante actual (ns, reloj monótono).
+ *
+ * @return  Estado del cliente.
+ */
+Peer* peers_lookup(PeerTable* table, const struct sockaddr_in* address, uint64_t now) {
+    size_t mask = table->capacity - 1, start = hash_address(address) & mask, i;
+    Peer* peer, *free_peer = NULL, *oldest = NULL;
+
+    for (i = 0; i < PROBE_LIMIT; i++) {
+        peer = &table->peers[(start + i) & mask];
+        if (!peer->in_use) {
+            if (!free_peer) free_peer = peer;
+            continue;
+        }
+        if (peer->address.sin_addr.s_addr == address->sin_addr.s_addr && peer->address.sin_port == address->sin_port) {
+            peer->last_seen = now;
+            return peer;
+        }
+        if (!oldest || peer->last_seen < oldest->last_seen) oldest = peer;
+    }
+
+    /* Cliente nuevo: se usa un hueco libre o se desaloja al más inactivo de la zona */
+    if (free_peer) {
+        table->count++;
+        peer = free_peer;
+    } else {
+        peer = oldest;
+    }
+    reset_peer(peer, address, now);
+
+    return peer;
+}
+
+
+/**
+ * @brief   Busca una respuesta ya enviada a un cliente.
+ *
+ * @param peer  Cliente.
+ * @param seq   Número de secuencia de la petición.
+ *
+ * @return  Respuesta guardada, o NULL si la petición no se había contestado ya (o es demasiado antigua).
+ */
+const CachedReply* peer_cached_reply(const Peer* peer, uint32_t seq) {
+    const CachedReply* reply;
+
+    if (!peer->replies) return NULL;
+    reply = &peer->replies[seq % peer->window];
+
+    return (reply->valid && reply->seq == seq) ? reply : NULL;
+}
+
+
+/**
+ * @brief   Guarda la respuesta enviada a un cliente.
+ *
+ * @param peer  Cliente.
+ * @param seq   Número de secuencia de la petición.
+ * @param flags Flags de la cabecera de la respuesta.
+ * @param data  Respuesta (sin cabecera).
+ * @param len   Longitud de la respuesta.
+ * @param tail  Final de la petición que no completa un carácter (ver peer_reassemble).
+ * @param tail_len  Longitud de tail (como mucho PEER_FRAGMENT_TAIL).
+ */
+void peer_store_reply(Peer* peer, uint32_t seq, uint16_t flags, const char* data, size_t len, const char* tail, size_t tail_len) {
+    CachedReply* reply;
+
+    if (!peer->replies && !(peer->replies = (CachedReply *) calloc(peer->window, sizeof(CachedReply)))) {
+        fail("No se pudo reservar memoria para el cliente");
+    }
+    reply = &peer->replies[seq % peer->window];
+    if (reply->capacity < len) {
+        if ( !(reply->data = (char *) realloc(reply->data, len)) ) fail("No se pudo reservar memoria para la respuesta");
+        reply->capacity = len;
+    }
+    memcpy(reply->data, data, len);
+    reply->len = len;
+    reply->seq = seq;
+    reply->flags = flags;
+    memcpy(reply->tail, tail, tail_len);
+    reply->tail_len = tail_len;
+    reply->valid = 1;
+}
+
+
+/**
+ * @brief   Olvida todas las respuestas guardadas de un cliente.
+ *
+ * @param peer  Cliente.
+ */
+void peer_forget_replies(Peer* peer) {
+    unsigned int i;
+
+    if (!peer->replies) return;
+    for (i = 0; i < peer->window; i++) peer->replies[i].valid = 0;
+}
+
+
+/**
+ * @brief   Ajusta el número de respuestas que se recuerdan de un cliente a la ventana que anuncia.
+ *
+ * @param peer      Cliente.
+ * @param window    Ventana anunciada (se limita a PROTOCOL_MAX_WINDOW), o 0 para PEER_DEFAULT_WINDOW.
+ */
+void peer_set_window(Peer* peer, unsigned int window) {
+    if (!window) window = PEER_DEFAULT_WINDOW;
+    if (window > PROTOCOL_MAX_WINDOW) window = PROTOCOL_MAX_WINDOW;
+    resize_replies(peer, window);
+}
+
+
+/**
+ * @brief   Prepara un fragmento de una línea partida para transformarlo.
+ *
+ * Como el paso a mayúsculas va carácter a carácter, cada fragmento (PROTOCOL_FLAG_FRAGMENT) se transforma
+ * en cuanto llega, sin esperar al resto de la línea. Lo único que hay que reensamblar es un carácter UTF-8
+ * partido entre dos fragmentos: sus primeros bytes se guardan con la respuesta del fragmento anterior, y se
+ * anteponen al siguiente. Un fragmento que empieza a mitad de un carácter cuyo principio no ha llegado
+ * todavía se descarta, y el cliente lo retransmitirá. Los de nuestro cliente siempre empiezan en un carácter
+ * completo, así que pueden llegar en cualquier orden.
+ *
+ * @param peer      Cliente.
+ * @param seq       Número de secuencia del fragmento.
+ * @param flags     Flags de la cabecera del fragmento.
+ * @param data      Fragmento, con PEER_FRAGMENT_TAIL bytes libres delante; se retrasa para anteponer el
+ *                  principio del carácter partido, si lo hay.
+ * @param len       Longitud del fragmento; se actualiza a la de los caracteres completos.
+ * @param tail_len  Donde guardar cuántos bytes quedan detrás de los caracteres completos, en *data + *len,
+ *                  que hay que guardar con la respuesta.
+ *
+ * @return  0 si se puede transformar, o -1 si hay que descartarlo.
+ */
+int peer_reassemble(const Peer* peer, uint32_t seq, uint16_t flags, char** data, size_t* len, size_t* tail_len) {
+    const CachedReply* previous;
+    size_t complete;
+
+    /* Si empieza por un byte de continuación, el principio del carácter va al final del fragmento anterior */
+    if (!(flags & PROTOCOL_FLAG_FIRST_FRAGMENT) && *len && ((unsigned char) **data & 0xC0) == 0x80) {
+        if ( !(previous = peer_cached_reply(peer, seq - 1)) ) return -1;
+        *data -= previous->tail_len;
+        memcpy(*data, previous->tail, previous->tail_len);
+        *len += previous->tail_len;
+    }
+
+    /* El último fragmento se transforma entero, aunque termine en un carácter incompleto (no válido) */
+    complete = flags & PROTOCOL_FLAG_LAST_FRAGMENT ? *len : utf8_complete_len(*data, *len);
+    *tail_len = *len - complete;
+    *len = complete;
+
+    return 0;
+}
+
+
+/**
+ * @brief   Cuenta datagramas recibidos de un cliente para medir su actividad.
+ *
+ * La cuenta vuelve a empezar en cada intervalo de PEER_RATE_INTERVAL ns.
+ *
+ * @param peer      Cliente.
+ * @param datagrams Número de datagramas recibidos.
+ * @param now       Instante de recepción (ns, reloj monótono).
+ *
+ * @return  Datagramas recibidos del cliente en el intervalo actual, incluidos estos.
+ */
+unsigned int peer_count_datagrams(Peer* peer, unsigned int datagrams, uint64_t now) {
+    if (now - peer->rate_start >= PEER_RATE_INTERVAL) {
+        peer->rate_start = now;
+        peer->rate_count = 0;
+    }
+
+    return peer->rate_count += datagrams;
+}
+
+
+/**
+ * @brief   Libera toda la memoria de una tabla de clientes.
+ *
+ * @param table     Tabla a liberar.
+ */
+void peers_free(PeerTable* table) {
+    size_t i;
+    unsigned int j;
+
+    for (i = 0; i < table->capacity; i++) {
+        if (!table->peers[i].replies) continue;
+        for (j = 0; j < table->peers[i].window; j++) free(table->peers[i].replies[j].data);
+        free(table->peers[i].replies);
+    }
+    free(table->peers);
+    memset(table, 0, sizeof(PeerTable));
+}
@@ -0,0 +1,169 @@
+#ifndef PEERS_H
+#define PEERS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/in.h>
+
+#include "protocol.h"
+
+/* Número de respuestas recientes que se recuerdan por cliente para contestar a las retransmisiones si no anuncia
+ * su ventana. Los que la anuncian recuerdan tantas como datagramas pueden tener en vuelo (hasta PROTOCOL_MAX_WINDOW),
+ * para que dos de ellos no compartan entrada */
+#define PEER_DEFAULT_WINDOW 64
+
+/* Bytes de un carácter UTF-8 partido entre dos fragmentos que se guardan de un fragmento para el siguiente */
+#define PEER_FRAGMENT_TAIL 3
+
+/* Intervalo en el que se cuentan los datagramas de cada cliente para medir su actividad (ns) */
+#define PEER_RATE_INTERVAL (100 * 1000000ULL)
+
+/**
+ * Respuesta ya enviada a un cliente, guardada para poder reenviarla sin volver a
+ * transformar la línea si el cliente retransmite la petición.
+ */
+typedef struct {
+    uint32_t seq;       /* Número de secuencia de la petición a la que contesta */
+    uint16_t flags;     /* Flags de la cabecera de la respuesta */
+    int valid;          /* Distinto de 0 si la entrada contiene una respuesta */
+    size_t len;         /* Longitud de la respuesta (sin cabecera) */
+    size_t capacity;    /* Tamaño reservado para data */
+    char* data;         /* Respuesta (sin cabecera) */
+    size_t tail_len;    /* Bytes guardados en tail */
+    char tail[PEER_FRAGMENT_TAIL];  /* Final de la petición (un fragmento) que no completa un carácter, y no se transformó */
+} CachedReply;
+
+/**
+ * Estado que guarda el servidor de cada cliente (dirección IP y puerto) que usa el protocolo con cabecera.
+ */
+typedef struct {
+    struct sockaddr_in address;     /* Dirección del cliente */
+    int in_use;                     /* Distinto de 0 si la entrada está ocupada */
+    uint64_t last_seen;             /* Instante (ns, reloj monótono) del último datagrama recibido */
+    uint64_t rate_start;            /* Inicio del intervalo en el que se cuentan sus datagramas (ns, reloj monótono) */
+    unsigned int rate_count;        /* Datagramas recibidos en ese intervalo */
+    unsigned int window;            /* Número de respuestas que se recuerdan */
+    CachedReply* replies;           /* Últimas window respuestas, indexadas por seq % window; se reserva con la primera */
+} Peer;
+
+/**
+ * Tabla de clientes con direccionamiento abierto. Cada hilo trabajador tiene la suya,
+ * porque SO_REUSEPORT lleva siempre a un cliente al mismo socket.
+ */
+typedef struct {
+    Peer* peers;        /* Array de capacity entradas */
+    size_t capacity;    /* Número de entradas (potencia de 2) */
+    size_t count;       /* Número de entradas ocupadas */
+} PeerTable;
+
+
+/**
+ * @brief   Inicializa una tabla de clientes.
+ *
+ * @param table     Tabla a inicializar.
+ * @param capacity  Número máximo de clientes (se redondea a potencia de 2).
+ */
+void peers_init(PeerTable* table, size_t capacity);
+
+/**
+ * @brief   Busca un cliente en la tabla, y lo añade si no está.
+ *
+ * Si la tabla está llena, el nuevo cliente reemplaza al que lleva más tiempo
+ * inactivo entre los de su zona de la tabla.
+ *
+ * @param table     Tabla de clientes.
+ * @param address   Dirección del cliente.
+ * @param now       Instante actual (ns, reloj monótono).
+ *
+ * @return  Estado del cliente.
+ */
+Peer* peers_lookup(PeerTable* table, const struct sockaddr_in* address, uint64_t now);
+
+/**
+ * @brief   Busca una respuesta ya enviada a un cliente.
+ *
+ * @param peer  Cliente.
+ * @param seq   Número de secuencia de la petición.
+ *
+ * @return  Respuesta guardada, o NULL si la petición no se había contestado ya (o es demasiado antigua).
+ */
+const CachedReply* peer_cached_reply(const Peer* peer, uint32_t seq);
+
+/**
+ * @brief   Guarda la respuesta enviada a un cliente.
+ *
+ * @param peer  Cliente.
+ * @param seq   Número de secuencia de la petición.
+ * @param flags Flags de la cabecera de la respuesta.
+ * @param data  Respuesta (sin cabecera).
+ * @param len   Longitud de la respuesta.
+ * @param tail  Final de la petición que no completa un carácter (ver peer_reassemble).
+ * @param tail_len  Longitud de tail (como mucho PEER_FRAGMENT_TAIL).
+ */
+void peer_store_reply(Peer* peer, uint32_t seq, uint16_t flags, const char* data, size_t len, const char* tail, size_t tail_len);
+
+/**
+ * @brief   Olvida todas las respuestas guardadas de un cliente.
+ *
+ * Se usa cuando el cliente empieza una transferencia nueva, en la que los números de secuencia
+ * vuelven a empezar y no deben contestarse con respuestas de la anterior.
+ *
+ * @param peer  Cliente.
+ */
+void peer_forget_replies(Peer* peer);
+
+/**
+ * @brief   Ajusta el número de respuestas que se recuerdan de un cliente a la ventana que anuncia.
+ *
+ * Las respuestas guardadas se olvidan, porque cambia la entrada que corresponde a cada una.
+ *
+ * @param peer      Cliente.
+ * @param window    Ventana anunciada (se limita a PROTOCOL_MAX_WINDOW), o 0 para PEER_DEFAULT_WINDOW.
+ */
+void peer_set_window(Peer* peer, unsigned int window);
+
+/**
+ * @brief   Prepara un fragmento de una línea partida para transformarlo.
+ *
+ * Como el paso a mayúsculas va carácter a carácter, cada fragmento (PROTOCOL_FLAG_FRAGMENT) se transforma
+ * en cuanto llega, sin esperar al resto de la línea. Lo único que hay que reensamblar es un carácter UTF-8
+ * partido entre dos fragmentos: sus primeros bytes se guardan con la respuesta del fragmento anterior, y se
+ * anteponen al siguiente. Un fragmento que empieza a mitad de un carácter cuyo principio no ha llegado
+ * todavía se descarta, y el cliente lo retransmitirá. Los de nuestro cliente siempre empiezan en un carácter
+ * completo, así que pueden llegar en cualquier orden.
+ *
+ * @param peer      Cliente.
+ * @param seq       Número de secuencia del fragmento.
+ * @param flags     Flags de la cabecera del fragmento.
+ * @param data      Fragmento, con PEER_FRAGMENT_TAIL bytes libres delante; se retrasa para anteponer el
+ *                  principio del carácter partido, si lo hay.
+ * @param len       Longitud del fragmento; se actualiza a la de los caracteres completos.
+ * @param tail_len  Donde guardar cuántos bytes quedan detrás de los caracteres completos, en *data + *len,
+ *                  que hay que guardar con la respuesta.
+ *
+ * @return  0 si se puede transformar, o -1 si hay que descartarlo.
+ */
+int peer_reassemble(const Peer* peer, uint32_t seq, uint16_t flags, char** data, size_t* len, size_t* tail_len);
+
+/**
+ * @brief   Cuenta datagramas recibidos de un cliente para medir su actividad.
+ *
+ * La cuenta vuelve a empezar en cada intervalo de PEER_RATE_INTERVAL ns.
+ *
+ * @param peer      Cliente.
+ * @param datagrams Número de datagramas recibidos.
+ * @param now       Instante de recepción (ns, reloj monótono).
+ *
+ * @return  Datagramas recibidos del cliente en el intervalo actual, incluidos estos.
+ */
+unsigned int peer_count_datagrams(Peer* peer, unsigned int datagrams, uint64_t now);
+
+/**
+ * @brief   Libera toda la memoria de una tabla de clientes.
+ *
+ * @param table     Tabla a liberar.
+ */
+void peers_free(PeerTable* table);
+
+
+#endif  /* PEERS_H */
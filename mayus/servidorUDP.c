@@ -1,3 +1,5 @@
+#define _GNU_SOURCE     /* recvmmsg y sendmmsg */
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/types.h>
@@ -6,14 +8,57 @@
 #include <unistd.h>
 #include <string.h>
 #include <arpa/inet.h>
-#include <wctype.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <poll.h>
 
 
 #include "receiver.h"
 #include "loging.h"
+#include "protocol.h"
+#include "upper.h"
+#include "peers.h"
+#include "memo.h"
+#include "uring.h"
+#include "gso.h"
+#include "lz.h"
 
 #define MAX_BYTES_RECV 2056
+#define MAX_BYTES_REPLY (UPPER_MAX_EXPANSION * MAX_BYTES_RECV + 1)  /* Respuesta más larga posible, con el '\0' final */
 #define DEFAULT_PORT 8500
+#define DEFAULT_BATCH 32    /* Número de datagramas que se intentan recibir en cada llamada a recvmmsg */
+#define MAX_BATCH 1024      /* Límite superior del tamaño de lote (UIO_MAXIOV) */
+#define MAX_WORKERS 256     /* Número máximo de hilos trabajadores */
+#define MAX_PEERS 1024      /* Número de clientes de los que cada socket recuerda las últimas respuestas */
+#define MAX_ENDPOINTS 64    /* Número máximo de direcciones y puertos de escucha */
+#define MAX_CONNECTIONS 64  /* Número máximo de sockets conectados a clientes por socket de escucha */
+#define DEFAULT_CONNECT_RATE 1000   /* Datagramas por segundo a partir de los que un cliente recibe un socket conectado */
+#define CONNECTION_IDLE (2000 * 1000000ULL) /* Inactividad tras la que se cierra el socket conectado a un cliente (ns) */
+#define MAX_DRAIN 8         /* Lotes que se leen como máximo de un socket listo antes de atender a los demás */
+#define MAX_URING_BUFFERS 32768     /* Límite de buffers proporcionados a io_uring por trabajador */
+#define CONTROL_LEN (METRICS_CONTROL_LEN + GRO_CONTROL_LEN)   /* Mensajes de control de cada recepción */
+#define CODEC_LEN (MAX_BYTES_RECV + MAX_BYTES_REPLY)    /* Petición descomprimida y respuesta sin comprimir */
+#define DEFAULT_LOG_LEVEL LOG_LEVEL_INFO    /* Las líneas recibidas y enviadas solo se registran en el nivel de depuración */
+
+/* Tipos de petición a io_uring */
+#define URING_RECV 1        /* Recepción multishot de un socket (el índice es el del socket) */
+#define URING_SEND 2        /* Envío de una respuesta (el índice es el del buffer del datagrama, más el del socket desplazado 16 bits) */
+#define URING_HANGUP 3      /* Espera del shutdown de un socket (el índice es el del socket) */
+
+/* Identificador en epoll de un socket conectado: índice de su socket de escucha y de su hueco */
+#define CONNECTION_EVENT 0x80000000u
+#define connection_event(listener, slot) (CONNECTION_EVENT | (listener) << 16 | (slot))
+
+/**
+ * Dirección y puerto en los que escucha el servidor.
+ */
+typedef struct {
+    char address[INET_ADDRSTRLEN];  /* IP en formato textual, o cadena vacía para escuchar en todas */
+    uint16_t port;                  /* Puerto (en orden de host) */
+} Endpoint;
 
 /**
  * Estructura de datos para pasar a la función process_args.
@@ -25,8 +70,130 @@ struct arguments {
     int argc;
     char** argv;
     uint16_t* receiver_port;
+    Endpoint* endpoints;
+    unsigned int* n_endpoints;
+    unsigned int* batch_size;
+    unsigned int* workers;
+    int* use_uring;
+    int* use_gso;
+    unsigned int* connect_rate;
+    int* log_level;
+    unsigned int* log_sample;
+    char** metrics_path;
+    unsigned int* memo_kib;
+    SocketOptions* socket_options;
 };
 
+/**
+ * Estadísticas de funcionamiento del servidor, que se imprimen al salir.
+ * Permiten comprobar si el procesamiento por lotes está siendo efectivo.
+ */
+typedef struct {
+    unsigned long batches;      /* Número de llamadas a recvmmsg que devolvieron datagramas */
+    unsigned long datagrams;    /* Número total de datagramas recibidos */
+    unsigned long replies;      /* Número total de respuestas enviadas */
+    unsigned long duplicates;   /* Peticiones retransmitidas contestadas con la respuesta guardada, sin transformarlas */
+    unsigned long connections;  /* Clientes a los que se conectó un socket propio */
+    unsigned long compressed;   /* Peticiones recibidas comprimidas */
+    unsigned long long codec_raw;       /* Bytes sin comprimir de las peticiones y respuestas comprimidas */
+    unsigned long long codec_packed;    /* Bytes que ocupaban comprimidas */
+    unsigned long long codec_ns;        /* Tiempo dedicado a descomprimir y comprimir (ns) */
+    unsigned long fragments;    /* Fragmentos de líneas partidas transformados */
+    unsigned long unordered;    /* Fragmentos descartados por llegar antes que el fragmento del que dependen */
+    unsigned long truncated;    /* Datagramas descartados por no caber en el buffer de recepción */
+    unsigned long kernel_drops; /* Datagramas descartados por el kernel, en los sockets de escucha y en los conectados */
+    unsigned long memo_hits;    /* Líneas copiadas de la caché de líneas transformadas */
+    unsigned long memo_misses;  /* Líneas transformadas y guardadas en la caché */
+    unsigned long memo_evictions;   /* Líneas desalojadas de la caché */
+    unsigned long memo_bypassed;    /* Líneas no ASCII demasiado largas para la caché */
+    unsigned int batch_size;    /* Tamaño máximo de lote configurado */
+} ServerStats;
+
+/**
+ * Socket conectado a un cliente muy activo. Está asociado a la misma dirección y puerto que su socket de
+ * escucha (SO_REUSEPORT) y, al estar conectado, el kernel le entrega directamente los datagramas de ese
+ * cliente; sus respuestas salen sin dirección, sin buscar la ruta ni el vecino en cada envío.
+ */
+typedef struct {
+    int socket;                     /* Socket conectado, o -1 si el hueco está libre */
+    struct sockaddr_in address;     /* Dirección del cliente */
+    uint64_t last_seen;             /* Instante del último lote recibido (ns, reloj monótono) */
+    Metrics metrics;                /* Solo los descartes del kernel de este socket, que también se suman a los del de escucha;
+                                     * el resto se cuenta directamente en el de escucha */
+    RcvbufAdapter rcvbuf;           /* Crecimiento adaptativo del buffer de recepción */
+} Connection;
+
+/**
+ * Socket en el que escucha un trabajador, junto con los clientes que le han escrito. Cada socket
+ * tiene su propia tabla de clientes para que un mismo cliente que escriba a dos puertos distintos
+ * no mezcle sus números de secuencia.
+ */
+typedef struct {
+    Receiver receiver;          /* Receiver asociado a una de las direcciones de escucha */
+    PeerTable peers;            /* Últimas respuestas enviadas a cada cliente de este socket */
+    Connection* connections;    /* MAX_CONNECTIONS sockets conectados a sus clientes más activos, o NULL */
+    MemoCache* memo;            /* Caché de líneas transformadas del trabajador (común a sus sockets), o NULL sin caché */
+} Listener;
+
+/**
+ * Buffers de un lote de recvmmsg y sendmmsg. Se reservan una vez por trabajador y se
+ * reutilizan en todos los lotes de todos sus sockets.
+ */
+typedef struct {
+    unsigned int batch_size;        /* Número máximo de recepciones por lote */
+    unsigned int max_replies;       /* Número máximo de respuestas por lote (con agregación, cada recepción trae varios datagramas) */
+    size_t input_size;              /* Tamaño del buffer de cada recepción */
+    int gso;                        /* Distinto de 0 si el socket agrega al recibir (UDP_GRO) y se segmenta al enviar (UDP_SEGMENT) */
+    struct mmsghdr* recv_msgs;      /* Cabeceras de las recepciones */
+    struct mmsghdr* send_msgs;      /* Cabeceras de los envíos: una por respuesta, o por grupo de respuestas segmentado */
+    struct iovec* recv_iovs;        /* Buffer de datos de cada recepción */
+    struct iovec* send_iovs;        /* Buffers de cada respuesta (dos por respuesta: cabecera y datos, o texto y '\0') */
+    struct sockaddr_in* addresses;  /* Dirección del emisor de cada recepción del lote */
+    char* inputs;                   /* batch_size buffers consecutivos de input_size bytes */
+    char* transformed;              /* max_replies buffers de MAX_BYTES_REPLY bytes para las líneas no ASCII */
+    char* codec;                    /* CODEC_LEN bytes para descomprimir cada petición y transformarla */
+    char* headers;                  /* Cabeceras de las respuestas, PROTOCOL_HEADER_LEN bytes por respuesta */
+    char* controls;                 /* Mensajes de control de cada recepción, CONTROL_LEN bytes por recepción */
+    char* send_controls;            /* Tamaño de segmento de cada envío, GSO_CONTROL_LEN bytes por envío */
+    unsigned int* segments;         /* Número de respuestas de cada envío */
+    unsigned int promote_after;     /* Datagramas por PEER_RATE_INTERVAL a partir de los que se conecta un socket a un cliente, o 0 */
+    struct sockaddr_in* promotions; /* Clientes que superaron el umbral en el último lote */
+    unsigned int n_promotions;      /* Número de clientes en promotions */
+    int announced;                  /* Distinto de 0 si ya se anunció el primer cliente atendido */
+} Batch;
+
+/**
+ * Hilo trabajador del servidor. Cada uno tiene su propio socket en cada dirección de escucha,
+ * asociado con SO_REUSEPORT si hay varios trabajadores, de modo que el kernel reparte los
+ * clientes entre ellos.
+ */
+typedef struct {
+    pthread_t thread;           /* Hilo que ejecuta el bucle del trabajador */
+    unsigned int id;            /* Índice del trabajador, para identificar sus estadísticas */
+    Listener* listeners;        /* Un socket por dirección de escucha */
+    unsigned int n_listeners;   /* Número de sockets */
+    unsigned int batch_size;    /* Tamaño máximo de lote */
+    int use_uring;              /* Si es distinto de 0, se intenta usar io_uring en lugar de recvmmsg/sendmmsg */
+    int use_gso;                /* Si es distinto de 0, se intenta usar la agregación y la segmentación UDP con recvmmsg/sendmmsg */
+    unsigned int connect_rate;  /* Datagramas por segundo a partir de los que un cliente recibe un socket conectado, o 0 */
+    const SocketOptions* socket_options;    /* Opciones de los sockets de escucha, que también se aplican a los conectados */
+    MemoCache memo;             /* Caché de líneas transformadas, si se pidió */
+    ServerStats stats;          /* Estadísticas propias del trabajador (solo las modifica su hilo) */
+} Worker;
+
+/**
+ * Respuesta en curso del bucle de io_uring. Hay una por cada buffer proporcionado, con su mismo
+ * índice: el datagrama recibido en un buffer se contesta con la respuesta de ese índice, y el
+ * buffer no se devuelve al kernel hasta que termina el envío (la respuesta puede apuntar a él).
+ */
+typedef struct {
+    struct msghdr msg;                  /* Cabecera del envío */
+    struct iovec iov[2];                /* Cabecera del protocolo y línea transformada, o texto plano y su '\0' */
+    struct sockaddr_in address;         /* Dirección del cliente */
+    char header[PROTOCOL_HEADER_LEN];   /* Cabecera del protocolo de la respuesta */
+    char* transformed;                  /* MAX_BYTES_REPLY bytes para las líneas que no se transforman in situ */
+} UringReply;
+
 /**
  * @brief   Procesa los argumentos del main.
  *
@@ -45,129 +212,1280 @@ static void process_args(struct arguments args);
  */
 static void print_help(char* exe_name);
 
+/**
+ * @brief   Añade direcciones de escucha a la lista.
+ *
+ * @param list          Lista separada por comas de puertos o de pares dirección:puerto.
+ * @param endpoints     Array de MAX_ENDPOINTS direcciones.
+ * @param n_endpoints   Número de direcciones ya en el array, que se actualiza.
+ *
+ * @return  0 si la lista es válida, -1 si no.
+ */
+static int parse_endpoints(const char* list, Endpoint* endpoints, unsigned int* n_endpoints);
+
 
 /**
- * @brief   Maneja los datos que envía el cliente.
+ * @brief   Función que ejecuta cada hilo trabajador.
+ *
+ * Ejecuta el bucle handle_data sobre el receiver del trabajador. Cuando el bucle termina por
+ * recibir una orden de cierre, avisa al hilo principal con SIGTERM para que pare al resto.
+ *
+ * @param arg   Puntero al Worker del hilo.
  *
- * Recibe mensajes del cliente de forma indefinida. El bucle no termina por lo caul queda bloqueado.
+ * @return  NULL.
+ */
+static void* worker_main(void* arg);
+
+/**
+ * @brief   Imprime las estadísticas del servidor.
  *
- * @param receiver    Receiver que recibe los datos.
+ * @param label     Etiqueta que identifica de quién son las estadísticas.
+ * @param stats     Estadísticas a imprimir.
  */
-void handle_data(Receiver receiver);
+static void print_stats(const char* label, const ServerStats* stats);
 
 /**
- * @brief   Transforma una string a mayúsculas
+ * @brief   Imprime los percentiles de la espera en cola y del tiempo de servicio.
  *
- * Transforma la string source a mayúsculas, utilizando para ello wstrings para poder transformar
- * caracteres especiales que ocupen más de un byte. Por tanto, permite pasar a mayúsculas strings en
- * el idioma definido en locale.
+ * @param label     Etiqueta que identifica de quién son las latencias.
+ * @param queue     Histograma de la espera en la cola del socket.
+ * @param service   Histograma del tiempo de servicio.
+ */
+static void print_latencies(const char* label, const Histogram* queue, const Histogram* service);
+
+/**
+ * @brief   Reserva los buffers de un lote.
  *
- * @param source    String fuente a transformar en mayúsculas.
+ * Con agregación, cada recepción puede traer hasta GSO_MAX_BYTES bytes en GSO_MAX_SEGMENTS datagramas,
+ * así que los buffers son mucho mayores (las páginas que no se llegan a usar no ocupan memoria).
  *
- * @return  String dinámicamente alojada (por tanto, debe liberarse con un free) que contiene los mismos
- *          caractereres que source pero en mayúsculas.
+ * @param batch         Lote a inicializar.
+ * @param batch_size    Número máximo de recepciones por lote.
+ * @param gso           Distinto de 0 si los sockets tienen activadas la agregación y la segmentación.
  */
-static char* toupper_string(const char* source);
+static void batch_init(Batch* batch, unsigned int batch_size, int gso);
 
+/**
+ * @brief   Activa la agregación al recibir y la segmentación al enviar en varios sockets.
+ *
+ * @param listeners     Sockets.
+ * @param n_listeners   Número de sockets.
+ *
+ * @return  Distinto de 0 si se activaron en todos, 0 si el kernel no las admite.
+ */
+static int enable_gso(Listener* listeners, unsigned int n_listeners);
 
+/**
+ * @brief   Comprueba si dos respuestas van al mismo destino.
+ *
+ * @param a     Dirección de una respuesta, o NULL si sale por un socket conectado.
+ * @param b     Dirección de la otra.
+ *
+ * @return  Distinto de 0 si el destino es el mismo.
+ */
+static int same_destination(const struct sockaddr_in* a, const struct sockaddr_in* b);
+
+/**
+ * @brief   Agrupa las respuestas de un lote que se pueden enviar segmentadas.
+ *
+ * Las respuestas consecutivas al mismo cliente que miden lo mismo (la última del grupo puede ser más
+ * corta) se juntan en un solo envío, y el kernel las separa en datagramas (UDP_SEGMENT). Como cada
+ * respuesta ocupa dos iovec seguidos, un grupo son los iovec de todas sus respuestas. Sin segmentación,
+ * cada respuesta es un envío.
+ *
+ * @param batch     Lote con las respuestas en send_msgs, que se reescribe con los envíos.
+ * @param replies   Número de respuestas.
+ *
+ * @return  Número de envíos; batch->segments guarda cuántas respuestas lleva cada uno.
+ */
+static int group_replies(Batch* batch, int replies);
+
+/**
+ * @brief   Conecta un socket propio a un cliente del socket de escucha.
+ *
+ * El socket se asocia a la misma dirección y puerto que el de escucha (SO_REUSEPORT) y se conecta al
+ * cliente. Entre bind y connect el kernel puede entregarle datagramas de otros clientes: se contestan
+ * igual, con su dirección. Con varios trabajadores, cada socket que entra o sale del grupo de SO_REUSEPORT
+ * cambia el reparto de los demás clientes entre los trabajadores (solo se pierden sus respuestas guardadas).
+ *
+ * @param listener  Socket de escucha.
+ * @param address   Dirección del cliente.
+ * @param options   Opciones de los sockets de escucha, que se aplican también al nuevo.
+ * @param gso       Distinto de 0 para activar la agregación al recibir.
+ * @param now       Instante actual (ns, reloj monótono).
+ *
+ * @return  Hueco del nuevo socket en listener->connections, o -1 si el cliente ya tenía uno, no quedan
+ *          huecos o el kernel no lo permite.
+ */
+static int connect_peer(Listener* listener, const struct sockaddr_in* address, const SocketOptions* options, int gso, uint64_t now);
+
+/**
+ * @brief   Cierra el socket conectado a un cliente; sus datagramas vuelven al socket de escucha.
+ *
+ * @param connection    Socket a cerrar.
+ */
+static void close_connection(Connection* connection);
+
+/**
+ * @brief   Libera los buffers de un lote.
+ *
+ * @param batch     Lote a liberar.
+ */
+static void batch_free(Batch* batch);
+
+/**
+ * @brief   Transforma la línea de un datagrama recibido y prepara su respuesta.
+ *
+ * Los datagramas con cabecera (modo ventana del cliente) se contestan con la misma cabecera, para que el
+ * cliente pueda asociar cada respuesta a su petición; los de texto plano se contestan con texto plano.
+ * Las últimas respuestas de cada cliente se guardan, de modo que si el cliente retransmite una petición
+ * se le reenvía la misma respuesta sin volver a transformar la línea.
+ *
+ * @param listener      Socket por el que llegó el datagrama.
+ * @param peer          Emisor del datagrama, en la tabla de clientes del socket.
+ * @param input         Datos del datagrama. Si la línea es ASCII se transforma in situ y la respuesta
+ *                      apunta a este buffer; no se escribe fuera de los input_len bytes.
+ * @param input_len     Longitud del datagrama.
+ * @param scratch       Buffer de MAX_BYTES_REPLY bytes para las líneas que no se transforman in situ
+ *                      y las respuestas comprimidas.
+ * @param codec         Buffer de CODEC_LEN bytes para descomprimir la petición y transformarla; no hace
+ *                      falta que dure más que la llamada.
+ * @param header_buffer Buffer de PROTOCOL_HEADER_LEN bytes para la cabecera de la respuesta.
+ * @param iov           Dos iovec que se rellenan con la respuesta.
+ * @param announced     Distinto de 0 si ya se anunció el primer cliente atendido; se actualiza.
+ * @param stats         Estadísticas a actualizar.
+ *
+ * Si la petición trae relleno (PROTOCOL_FLAG_PADDED), la respuesta se rellena hasta la misma longitud
+ * siempre que quepa, de modo que las respuestas a un cliente que segmenta también se puedan segmentar.
+ * Si viene comprimida (PROTOCOL_FLAG_COMPRESSED), se descomprime y la respuesta se comprime también,
+ * salvo que así no ocupe menos. El nombre del fichero (PROTOCOL_TYPE_NAME) se contesta con
+ * PROTOCOL_FLAG_ACCEPTS_LZ si el cliente lo anuncia. Los datagramas con cabecera no válida o de otro
+ * tipo se descartan. Si el socket tiene caché de líneas, las líneas no ASCII repetidas se copian de ella en
+ * lugar de transformarse.
+ *
+ * @return  Número de iovec que ocupa la respuesta (2), o 0 si no hay que contestar.
+ */
+static int prepare_reply(Listener* listener, Peer* peer, char* input, size_t input_len,
+        char* scratch, char* codec, char* header_buffer, struct iovec* iov, int* announced, ServerStats* stats);
+
+/**
+ * @brief   Recibe un lote de datagramas de un socket y envía sus respuestas.
+ *
+ * Recibe hasta batch_size datagramas con una sola llamada a recvmmsg, transforma todos los datagramas
+ * del lote con prepare_reply y envía todas las respuestas con una sola llamada a sendmmsg. Con
+ * agregación, cada recepción se divide en sus datagramas, y las respuestas se agrupan con group_replies.
+ *
+ * Si batch->promote_after no es 0, los clientes del socket de escucha que superan ese número de datagramas
+ * en un intervalo se apuntan en batch->promotions, para que se les conecte un socket propio.
+ *
+ * @param listener      Socket de escucha y sus clientes.
+ * @param connection    Socket conectado del que recibir, o NULL para recibir del socket de escucha.
+ * @param batch     Buffers del lote.
+ * @param flags     Flags de recvmmsg: MSG_WAITFORONE para bloquear hasta el primer datagrama,
+ *                  o MSG_DONTWAIT para no bloquear.
+ * @param stats     Estadísticas a actualizar con el lote.
+ *
+ * @return  Número de recepciones (0 si no había ninguna en cola), o -1 si se recibió un
+ *          datagrama vacío, ya sea una orden de cerrar la conexión o el resultado de hacer shutdown
+ *          sobre el socket.
+ */
+static int serve_batch(Listener* listener, Connection* connection, Batch* batch, int flags, ServerStats* stats);
+
+/**
+ * @brief   Maneja los datos que envía el cliente por un único socket.
+ *
+ * Bloquea en recvmmsg y contesta lote a lote hasta recibir una orden de cierre.
+ *
+ * @param listener      Socket que recibe los datos.
+ * @param batch_size    Número máximo de datagramas a recibir por llamada.
+ * @param use_gso       Distinto de 0 para intentar usar la agregación y la segmentación UDP.
+ * @param stats         Estadísticas a actualizar con cada lote recibido.
+ */
+void handle_data(Listener* listener, unsigned int batch_size, int use_gso, ServerStats* stats);
+
+/**
+ * @brief   Maneja los datos que envían los clientes por varios sockets a la vez.
+ *
+ * Registra todos los sockets en una única instancia de epoll y, cada vez que alguno está listo,
+ * lee sin bloquear sus datagramas en cola (hasta MAX_DRAIN lotes, para no dejar sin atender al resto)
+ * y los contesta. Termina al recibir una orden de cierre o al hacer shutdown sobre cualquiera de los sockets.
+ *
+ * Si connect_rate no es 0, a cada cliente que supera esos datagramas por segundo se le conecta un socket
+ * propio (connect_peer), que se registra también en epoll, y se cierra tras CONNECTION_IDLE ns sin recibir nada.
+ *
+ * @param listeners     Sockets que reciben los datos.
+ * @param n_listeners   Número de sockets.
+ * @param batch_size    Número máximo de datagramas a recibir por llamada.
+ * @param use_gso       Distinto de 0 para intentar usar la agregación y la segmentación UDP.
+ * @param connect_rate  Datagramas por segundo a partir de los que un cliente recibe un socket conectado, o 0.
+ * @param socket_options    Opciones de los sockets de escucha, para los sockets conectados.
+ * @param stats         Estadísticas a actualizar con cada lote recibido.
+ */
+void handle_events(Listener* listeners, unsigned int n_listeners, unsigned int batch_size, int use_gso,
+        unsigned int connect_rate, const SocketOptions* socket_options, ServerStats* stats);
+
+/**
+ * @brief   Contabiliza un envío de io_uring terminado y devuelve su buffer al anillo.
+ *
+ * Si la respuesta no cabía en el buffer del socket se descarta, como una respuesta perdida.
+ *
+ * @param ring          Anillo del envío.
+ * @param listeners     Sockets que reciben los datos.
+ * @param index         Buffer de la respuesta, con el índice de su socket en los 16 bits altos.
+ * @param res           Resultado del envío.
+ * @param stats         Estadísticas a actualizar.
+ */
+static void complete_send(IoUring* ring, Listener* listeners, unsigned int index, int32_t res, ServerStats* stats);
+
+/**
+ * @brief   Maneja los datos que envían los clientes con io_uring.
+ *
+ * Pide una recepción multishot por socket sobre un anillo de 4 * batch_size buffers proporcionados,
+ * de modo que cada io_uring_enter recoge todos los datagramas que hayan llegado a cualquier socket
+ * y envía a la vez todas las respuestas pendientes, encadenadas (IOSQE_IO_LINK) para que salgan en
+ * orden. Las respuestas que no caben en el buffer del socket se descartan y el cliente las recupera
+ * retransmitiendo. Termina al recibir una orden de cierre o al hacer shutdown sobre cualquiera de los sockets.
+ *
+ * @param listeners     Sockets que reciben los datos.
+ * @param n_listeners   Número de sockets.
+ * @param batch_size    Tamaño de lote, que determina el número de buffers.
+ * @param stats         Estadísticas a actualizar con cada tanda de datagramas recibidos.
+ *
+ * @return  0 al terminar, o -1 sin haber atendido nada si io_uring no está disponible.
+ */
+int handle_uring(Listener* listeners, unsigned int n_listeners, unsigned int batch_size, ServerStats* stats);
 
 int main(int argc, char** argv){
-	Receiver receiver;
+    Worker* workers;
+    ServerStats total = {0};
+    Histogram queue, service, total_queue = {0}, total_service = {0};
     uint16_t receiver_port;
+    Endpoint endpoints[MAX_ENDPOINTS];
+    unsigned int n_endpoints = 0;
+    unsigned int batch_size, n_workers, i, j;
+    int use_uring;
+    int use_gso;
+    unsigned int connect_rate;
+    int log_level;
+    unsigned int log_sample;
+    sigset_t signals;
+    int signum;
+    ReceiverOptions options = {0};
+    MetricsSource* sources;
+    char* metrics_path;
+    unsigned int memo_kib;
+    char label[32];
     struct arguments args = {
         .argc = argc,
         .argv = argv,
-        .receiver_port = &receiver_port
+        .receiver_port = &receiver_port,
+        .endpoints = endpoints,
+        .n_endpoints = &n_endpoints,
+        .batch_size = &batch_size,
+        .workers = &n_workers,
+        .use_uring = &use_uring,
+        .use_gso = &use_gso,
+        .connect_rate = &connect_rate,
+        .log_level = &log_level,
+        .log_sample = &log_sample,
+        .metrics_path = &metrics_path,
+        .memo_kib = &memo_kib,
+        .socket_options = &options.socket
     };
 
     set_colors();
 	
     process_args(args);
 
-	receiver = create_receiver(AF_INET, SOCK_DGRAM, 0, receiver_port);
-    
-	handle_data(receiver);
-	
-	close_receiver(&receiver);
+    /* Sin lista de direcciones, se escucha en todas las IPs en el puerto indicado */
+    if (!n_endpoints) endpoints[n_endpoints++] = (Endpoint) { .address = "", .port = receiver_port };
+
+    /* Bloquear las señales de terminación en todos los hilos (la máscara se hereda);
+     * el hilo principal las espera de forma síncrona con sigwait */
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    if (pthread_sigmask(SIG_BLOCK, &signals, NULL)) fail("No se pudieron bloquear las señales");
+
+    /* Los eventos se escriben desde un hilo de fondo, que hereda la máscara de señales */
+    log_init(stdout, log_level, log_sample);
+
+    if ( !(workers = (Worker *) calloc(n_workers, sizeof(Worker))) ) fail("No se pudo reservar memoria para los trabajadores");
+
+    /* Con varios trabajadores, cada uno abre su propio socket en cada dirección de escucha; los sockets
+     * conectados a los clientes también se asocian a la misma dirección */
+    if (n_workers > 1 || connect_rate) options.socket.reuse_port = 1;
+    for (i = 0; i < n_workers; i++) {
+        workers[i].id = i;
+        workers[i].batch_size = batch_size;
+        workers[i].stats.batch_size = batch_size;
+        workers[i].use_uring = use_uring;
+        workers[i].use_gso = use_gso;
+        workers[i].connect_rate = connect_rate;
+        workers[i].socket_options = &options.socket;
+        workers[i].n_listeners = n_endpoints;
+        if ( !(workers[i].listeners = (Listener *) calloc(n_endpoints, sizeof(Listener))) ) fail("No se pudo reservar memoria para los sockets");
+        /* La memoria de la caché de líneas se reparte entre los trabajadores */
+        if (memo_kib) memo_init(&workers[i].memo, (size_t) memo_kib * 1024 / n_workers);
+        for (j = 0; j < n_endpoints; j++) {
+            options.bind_address = endpoints[j].address[0] ? endpoints[j].address : NULL;
+            workers[i].listeners[j].receiver = create_receiver(AF_INET, SOCK_DGRAM, 0, endpoints[j].port, &options);
+            peers_init(&workers[i].listeners[j].peers, MAX_PEERS);
+            workers[i].listeners[j].memo = memo_kib ? &workers[i].memo : NULL;
+        }
+    }
+
+    /* Exportar las métricas de cada socket de cada trabajador */
+    if (metrics_path) {
+        if ( !(sources = (MetricsSource *) calloc(n_workers * n_endpoints, sizeof(MetricsSource))) ) fail("No se pudo reservar memoria para las métricas");
+        for (i = 0; i < n_workers; i++) {
+            for (j = 0; j < n_endpoints; j++) {
+                snprintf(sources[i * n_endpoints + j].name, sizeof(sources[0].name), "w%u/%.*s:%u", i, INET_ADDRSTRLEN,
+                        endpoints[j].address[0] ? endpoints[j].address : "*", endpoints[j].port);
+                sources[i * n_endpoints + j].metrics = &workers[i].listeners[j].receiver.metrics;
+            }
+        }
+        metrics_export_start(metrics_path, sources, n_workers * n_endpoints);
+        free(sources);
+    }
+
+    for (i = 0; i < n_workers; i++) {
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i])) fail("No se pudo crear el hilo trabajador");
+    }
+    for (j = 0; j < n_endpoints; j++) {
+        printf("Servidor escuchando en %s:%u\n", endpoints[j].address[0] ? endpoints[j].address : "*", endpoints[j].port);
+    }
+    printf("%u dirección(es) de escucha con %u trabajador(es).\n", n_endpoints, n_workers);
+    if (memo_kib) {
+        printf("Caché de líneas transformadas: %zu entradas de %d bytes por trabajador.\n", workers[0].memo.capacity, MEMO_SLOT_SIZE);
+    }
+
+    if (sigwait(&signals, &signum)) fail("Error al esperar por las señales de terminación");
+
+    /* Despertar a los trabajadores: tras el shutdown, recvmmsg devuelve un datagrama vacío
+     * (y el socket queda listo para lectura en epoll) */
+    for (i = 0; i < n_workers; i++) {
+        for (j = 0; j < workers[i].n_listeners; j++) shutdown(workers[i].listeners[j].receiver.socket, SHUT_RD);
+    }
+
+    for (i = 0; i < n_workers; i++) {
+        if (pthread_join(workers[i].thread, NULL)) fail("No se pudo esperar al hilo trabajador");
+    }
+    log_shutdown();     /* Escribir los eventos pendientes antes que las estadísticas */
+    metrics_export_stop();  /* Últimos valores de las métricas, antes de cerrar los sockets */
+
+    total.batch_size = workers[0].stats.batch_size;
+    for (i = 0; i < n_workers; i++) {
+        snprintf(label, sizeof(label), "Trabajador %u", i);
+        workers[i].stats.memo_hits = workers[i].memo.hits;
+        workers[i].stats.memo_misses = workers[i].memo.misses;
+        workers[i].stats.memo_evictions = workers[i].memo.evictions;
+        workers[i].stats.memo_bypassed = workers[i].memo.bypassed;
+        /* Los hilos ya terminaron: los contadores se leen directamente */
+        for (j = 0; j < workers[i].n_listeners; j++) workers[i].stats.kernel_drops += workers[i].listeners[j].receiver.metrics.kernel_drops;
+        print_stats(label, &workers[i].stats);
+        memset(&queue, 0, sizeof(Histogram));
+        memset(&service, 0, sizeof(Histogram));
+        for (j = 0; j < workers[i].n_listeners; j++) {
+            metrics_merge(&queue, &workers[i].listeners[j].receiver.metrics.stages[METRICS_STAGE_QUEUE]);
+            metrics_merge(&service, &workers[i].listeners[j].receiver.metrics.stages[METRICS_STAGE_SERVICE]);
+        }
+        print_latencies(label, &queue, &service);
+        metrics_merge(&total_queue, &queue);
+        metrics_merge(&total_service, &service);
+        total.batches += workers[i].stats.batches;
+        total.datagrams += workers[i].stats.datagrams;
+        total.replies += workers[i].stats.replies;
+        total.duplicates += workers[i].stats.duplicates;
+        total.connections += workers[i].stats.connections;
+        total.compressed += workers[i].stats.compressed;
+        total.codec_raw += workers[i].stats.codec_raw;
+        total.codec_packed += workers[i].stats.codec_packed;
+        total.codec_ns += workers[i].stats.codec_ns;
+        total.fragments += workers[i].stats.fragments;
+        total.unordered += workers[i].stats.unordered;
+        total.truncated += workers[i].stats.truncated;
+        total.kernel_drops += workers[i].stats.kernel_drops;
+        total.memo_hits += workers[i].stats.memo_hits;
+        total.memo_misses += workers[i].stats.memo_misses;
+        total.memo_evictions += workers[i].stats.memo_evictions;
+        total.memo_bypassed += workers[i].stats.memo_bypassed;
+        for (j = 0; j < workers[i].n_listeners; j++) {
+            close_receiver(&workers[i].listeners[j].receiver);
+            peers_free(&workers[i].listeners[j].peers);
+        }
+        free(workers[i].listeners);
+        if (memo_kib) memo_free(&workers[i].memo);
+    }
+    if (n_workers > 1) {
+        print_stats("Total", &total);
+        print_latencies("Total", &total_queue, &total_service);
+    }
+
+    free(workers);
     printf("Saliendo\n");
     exit(EXIT_SUCCESS);
 }
 
 
-void handle_data(Receiver receiver){
+static void* worker_main(void* arg) {
+    Worker* worker = (Worker *) arg;
+
+    /* Sin io_uring (o si el kernel no lo permite): con un solo socket basta con bloquear en recvmmsg; con varios
+     * (o con sockets conectados) se espera a todos con epoll */
+    if (!worker->use_uring || handle_uring(worker->listeners, worker->n_listeners, worker->batch_size, &worker->stats)) {
+        if (worker->n_listeners == 1 && !worker->connect_rate) {
+            handle_data(&worker->listeners[0], worker->batch_size, worker->use_gso, &worker->stats);
+        } else {
+            handle_events(worker->listeners, worker->n_listeners, worker->batch_size, worker->use_gso, worker->connect_rate, worker->socket_options, &worker->stats);
+        }
+    }
+    kill(getpid(), SIGTERM);    /* Si ya se estaba cerrando, la señal queda pendiente y bloqueada */
+
+    return NULL;
+}
+
+
+static void print_latencies(const char* label, const Histogram* queue, const Histogram* service) {
+    const Histogram* histograms[] = { queue, service };
+    const char* names[] = { "espera en cola", "tiempo de servicio" };
+    unsigned int i;
+
+    for (i = 0; i < 2; i++) {
+        if (!histograms[i]->count) continue;
+        printf("%s: %s (µs): media %.1f; p50 %.1f; p90 %.1f; p99 %.1f; p99.9 %.1f\n", label, names[i],
+                (double) histograms[i]->sum / histograms[i]->count / 1e3,
+                metrics_percentile(histograms[i], 50) / 1e3, metrics_percentile(histograms[i], 90) / 1e3,
+                metrics_percentile(histograms[i], 99) / 1e3, metrics_percentile(histograms[i], 99.9) / 1e3);
+    }
+}
+
+
+static void print_stats(const char* label, const ServerStats* stats) {
+    unsigned long lookups = stats->memo_hits + stats->memo_misses;
+
+    printf("\n%s: lotes recibidos: %lu; datagramas recibidos: %lu; respuestas enviadas: %lu; retransmisiones contestadas sin transformar: %lu\n",
+            label, stats->batches, stats->datagrams, stats->replies, stats->duplicates);
+    if (stats->batches) {
+        printf("%s: llenado medio de lote: %.2f/%u (%.1f%%)\n", label, (double) stats->datagrams / stats->batches, stats->batch_size,
+                100.0 * stats->datagrams / stats->batches / stats->batch_size);
+    }
+    if (stats->connections) printf("%s: clientes con socket conectado: %lu\n", label, stats->connections);
+    if (stats->codec_raw) {
+        printf("%s: peticiones comprimidas: %lu; %llu bytes de texto en %llu comprimidos (%.1f%%); %.1f ns de códec por byte de texto\n",
+                label, stats->compressed, stats->codec_raw, stats->codec_packed, 100.0 * stats->codec_packed / stats->codec_raw,
+                (double) stats->codec_ns / stats->codec_raw);
+    }
+    if (stats->fragments || stats->unordered) {
+        printf("%s: fragmentos de líneas partidas: %lu; descartados por llegar antes que el anterior: %lu\n", label, stats->fragments, stats->unordered);
+    }
+    if (stats->truncated) printf("%s: datagramas descartados por ser demasiado largos: %lu\n", label, stats->truncated);
+    if (stats->kernel_drops) printf("%s: datagramas descartados por el kernel por tener lleno el buffer de recepción: %lu\n", label, stats->kernel_drops);
+    if (lookups || stats->memo_bypassed) {
+        printf("%s: caché de líneas: aciertos: %lu; fallos: %lu (%.1f%% de aciertos); desalojos: %lu; líneas demasiado largas: %lu\n",
+                label, stats->memo_hits, stats->memo_misses, lookups ? 100.0 * stats->memo_hits / lookups : 0.0, stats->memo_evictions, stats->memo_bypassed);
+    }
+}
+
+
+static void batch_init(Batch* batch, unsigned int batch_size, int gso) {
+    int i;
+
+    /* Reservar todas las estructuras del lote una sola vez */
+    batch->batch_size = batch_size;
+    batch->max_replies = gso ? batch_size * GSO_MAX_SEGMENTS : batch_size;
+    batch->input_size = gso ? GSO_MAX_BYTES : MAX_BYTES_RECV;
+    batch->gso = gso;
+    batch->recv_msgs = (struct mmsghdr *) calloc(batch_size, sizeof(struct mmsghdr));
+    batch->send_msgs = (struct mmsghdr *) calloc(batch->max_replies, sizeof(struct mmsghdr));
+    batch->recv_iovs = (struct iovec *) calloc(batch_size, sizeof(struct iovec));
+    batch->send_iovs = (struct iovec *) calloc(2 * batch->max_replies, sizeof(struct iovec));
+    batch->addresses = (struct sockaddr_in *) calloc(batch_size, sizeof(struct sockaddr_in));
+    batch->inputs = (char *) malloc(batch_size * batch->input_size);
+    batch->transformed = (char *) malloc(batch->max_replies * MAX_BYTES_REPLY);
+    batch->codec = (char *) malloc(CODEC_LEN);
+    batch->headers = (char *) calloc(batch->max_replies, PROTOCOL_HEADER_LEN);
+    batch->controls = (char *) calloc(batch_size, CONTROL_LEN);
+    batch->send_controls = (char *) calloc(batch->max_replies, GSO_CONTROL_LEN);
+    batch->segments = (unsigned int *) calloc(batch->max_replies, sizeof(unsigned int));
+    batch->promotions = (struct sockaddr_in *) calloc(batch_size, sizeof(struct sockaddr_in));
+    batch->promote_after = 0;
+    batch->n_promotions = 0;
+    batch->announced = 0;
+    if (!batch->recv_msgs || !batch->send_msgs || !batch->recv_iovs || !batch->send_iovs || !batch->addresses || !batch->inputs
+            || !batch->transformed || !batch->codec || !batch->headers || !batch->controls || !batch->send_controls || !batch->segments || !batch->promotions) {
+        fail("No se pudo reservar memoria para el lote");
+    }
+
+    /* Los buffers de recepción no cambian entre lotes, se asocian a cada cabecera una sola vez */
+    for (i = 0; i < batch_size; i++) {
+        batch->recv_iovs[i].iov_base = batch->inputs + i * batch->input_size;
+        batch->recv_iovs[i].iov_len = batch->input_size;
+        batch->recv_msgs[i].msg_hdr.msg_iov = &batch->recv_iovs[i];
+        batch->recv_msgs[i].msg_hdr.msg_iovlen = 1;
+        batch->recv_msgs[i].msg_hdr.msg_name = &batch->addresses[i];
+        batch->recv_msgs[i].msg_hdr.msg_control = batch->controls + i * CONTROL_LEN;
+    }
+}
+
+
+static void batch_free(Batch* batch) {
+    free(batch->recv_msgs);
+    free(batch->send_msgs);
+    free(batch->recv_iovs);
+    free(batch->send_iovs);
+    free(batch->addresses);
+    free(batch->inputs);
+    free(batch->transformed);
+    free(batch->codec);
+    free(batch->headers);
+    free(batch->controls);
+    free(batch->send_controls);
+    free(batch->segments);
+    free(batch->promotions);
+}
+
+
+static int enable_gso(Listener* listeners, unsigned int n_listeners) {
+    unsigned int i;
+
+    for (i = 0; i < n_listeners; i++) {
+        if (gso_enable(listeners[i].receiver.socket, 1) < 0) {
+            perror("El kernel no admite la agregación y la segmentación UDP, se envía y recibe datagrama a datagrama");
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+static int same_destination(const struct sockaddr_in* a, const struct sockaddr_in* b) {
+    if (!a || !b) return a == b;
+
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+
+static int group_replies(Batch* batch, int replies) {
+    struct msghdr group, *candidate;
+    const struct sockaddr_in *to, *candidate_to;
+    size_t segment, len, total;
+    int messages, reply, next;
+
+    /* Los envíos se escriben sobre las mismas cabeceras: el envío messages nunca va por delante de la respuesta reply */
+    for (messages = 0, reply = 0; reply < replies; reply = next, messages++) {
+        group = batch->send_msgs[reply].msg_hdr;
+        next = reply + 1;
+        if (batch->gso) {
+            to = group.msg_name;
+            segment = total = len = group.msg_iov[0].iov_len + group.msg_iov[1].iov_len;
+            while (next < replies && next - reply < GSO_MAX_SEGMENTS && len == segment) {
+                candidate = &batch->send_msgs[next].msg_hdr;
+                candidate_to = candidate->msg_name;
+                len = candidate->msg_iov[0].iov_len + candidate->msg_iov[1].iov_len;
+                if (!same_destination(candidate_to, to) || len > segment || total + len > GSO_MAX_BYTES) break;
+                total += len;
+                next++;
+            }
+            if (next - reply > 1) {
+                group.msg_iovlen = 2 * (next - reply);
+                gso_set_segment(&group, batch->send_controls + messages * GSO_CONTROL_LEN, segment);
+            }
+        }
+        batch->send_msgs[messages].msg_hdr = group;
+        batch->segments[messages] = next - reply;
+    }
+
+    return messages;
+}
+
+
+static int prepare_reply(Listener* listener, Peer* peer, char* input, size_t input_len,
+        char* scratch, char* codec, char* header_buffer, struct iovec* iov, int* announced, ServerStats* stats) {
+    Receiver* receiver = &listener->receiver;
+    ProtocolHeader header;
+    const CachedReply* cached = NULL;
+    static const char terminator = '\0';
+    struct timespec start, end;
     char* output;
-    char input[MAX_BYTES_RECV];
-    ssize_t recv_bytes, sent_bytes;
-    int flag=0;
-    socklen_t address_size = sizeof(struct sockaddr_in);
-
-    
-    
-
-    while (1) {
-        if ( (recv_bytes = recvfrom(receiver.socket, input, MAX_BYTES_RECV, 0, (struct sockaddr *) &(receiver.sender_address), &address_size)) < 0) fail("Error al recibir la línea de texto");
-        if (!recv_bytes) return;    /* Se recibió una orden de cerrar la conexión */
-        printf("Linea recibida:\t%s\n", input);
-        /* Guardamos la ip del clienteUDP en formato textual*/
-        inet_ntop(receiver.domain, &receiver.sender_address.sin_addr, receiver.sender_ip, INET_ADDRSTRLEN);
-        
-        if(flag == 0){
-            printf("\nManejando al cliente %s:%u...\n", receiver.sender_ip, ntohs(receiver.sender_address.sin_port));
-            flag++;
-        }
-
-        output = toupper_string(input); 
-        printf("Linea a ser enviada:\t %s \n", output);
-        if ( (sent_bytes = sendto(receiver.socket, output, strlen(output) + 1, 0, (struct sockaddr *) &receiver.sender_address, address_size)) < 0) {
-            
+    char* work = scratch;       /* Donde se transforman las líneas no ASCII y se copian las respuestas guardadas */
+    ssize_t output_len;
+    size_t padded_len = 0, packed_len, tail_len = 0;
+    uint16_t flags;
+    int framed, compressed = 0, starts_transfer;
+
+    /* Si el datagrama trae cabecera, la línea empieza justo detrás y su longitud la da la cabecera. Con
+     * agregación, detrás del datagrama viene el siguiente, así que no se escribe nada fuera de él */
+    if ( (framed = protocol_read_header(input, input_len, &header)) == PROTOCOL_INVALID
+            || (framed && header.type != PROTOCOL_TYPE_DATA && header.type != PROTOCOL_TYPE_NAME) ) {
+        log_sampled(LOG_LEVEL_WARN, NULL, 0, "Datagrama con cabecera no válida o de tipo desconocido, se descarta");
+        return 0;
+    }
+    if (framed) {
+        input += PROTOCOL_HEADER_LEN;
+        input_len = header.length;
+        if (header.flags & PROTOCOL_FLAG_PADDED) {
+            padded_len = input_len;
+            input_len = protocol_strip_padding(input, input_len);
+        }
+        /* Una petición comprimida se descomprime al buffer del códec, y se transforma ahí */
+        if ( (compressed = header.flags & PROTOCOL_FLAG_COMPRESSED) ) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if ( (output_len = lz_decompress(input, input_len, codec + PEER_FRAGMENT_TAIL, MAX_BYTES_RECV - PEER_FRAGMENT_TAIL)) < 0 ) {
+                log_sampled(LOG_LEVEL_WARN, NULL, 0, "Datagrama comprimido no válido (secuencia %u), se descarta", header.seq);
+                return 0;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            stats->compressed++;
+            stats->codec_packed += input_len;
+            stats->codec_raw += output_len;
+            stats->codec_ns += (end.tv_sec - start.tv_sec) * 1000000000LL + end.tv_nsec - start.tv_nsec;
+            input = codec + PEER_FRAGMENT_TAIL;     /* Delante queda sitio para reensamblar un fragmento */
+            input_len = output_len;
+            work = codec + MAX_BYTES_RECV;
+        }
+    } else {
+        input_len = strnlen(input, input_len);      /* El texto plano trae su propio '\0' */
+    }
+    log_sampled(LOG_LEVEL_DEBUG, input, input_len, "Linea recibida:\t%s");
+
+    /* Solo se guardan la dirección y la ip en formato textual del primer cliente atendido, para anunciarlo:
+     * el receiver es común a todas las respuestas del socket */
+    if (!*announced) {
+        receiver->sender_address = peer->address;
+        inet_ntop(receiver->domain, &receiver->sender_address.sin_addr, receiver->sender_ip, INET_ADDRSTRLEN);
+        log_event(LOG_LEVEL_INFO, receiver->sender_ip, strlen(receiver->sender_ip), "Manejando al cliente %s:%u...", ntohs(receiver->sender_address.sin_port));
+        (*announced)++;
+    }
+
+    /* El nombre del fichero (sin cabecera en los clientes antiguos) empieza una transferencia nueva, cuyos
+     * números de secuencia vuelven a empezar: las respuestas guardadas de la anterior ya no sirven. Con cabecera,
+     * anuncia además cuántas respuestas hay que recordar */
+    starts_transfer = !framed || header.type == PROTOCOL_TYPE_NAME;
+    if (framed && starts_transfer) peer_set_window(peer, header.seq);
+    else if (starts_transfer) peer_forget_replies(peer);
+
+    /* Retransmisión de una petición ya contestada: se copia la respuesta guardada al buffer auxiliar */
+    if (!starts_transfer) {
+        if ( (cached = peer_cached_reply(peer, header.seq)) ) {
+            output = work;
+            memcpy(output, cached->data, cached->len);
+            output_len = cached->len;
+            stats->duplicates++;
+        }
+    }
+
+    if (!cached) {
+        /* Un fragmento de una línea partida puede necesitar el final del anterior, y delante siempre hay sitio para
+         * él: la cabecera ya leída, o el principio del buffer del códec */
+        if (!starts_transfer && (header.flags & PROTOCOL_FLAG_FRAGMENT)) {
+            if (peer_reassemble(peer, header.seq, header.flags, &input, &input_len, &tail_len) < 0) {
+                log_sampled(LOG_LEVEL_DEBUG, NULL, 0, "Fragmento adelantado al anterior (secuencia %u), se descarta", header.seq);
+                stats->unordered++;
+                return 0;
+            }
+            stats->fragments++;
+        }
+        /* Si la línea es ASCII se transforma in situ; si no, se escribe en el buffer auxiliar (con caché, copiando
+         * de ella las líneas repetidas) */
+        if (listener->memo) output_len = memo_toupper(listener->memo, input, input_len, work, MAX_BYTES_REPLY - 1, &output);
+        else output_len = toupper_buffer(input, input_len, work, MAX_BYTES_REPLY - 1, &output);
+        if (output_len < 0) return 0;   /* No puede pasar: el buffer tiene el tamaño máximo posible */
+        if (!starts_transfer) peer_store_reply(peer, header.seq, header.flags, output, output_len, input + input_len, tail_len);
+    }
+    log_sampled(LOG_LEVEL_DEBUG, output, output_len, "Linea a ser enviada:\t%s");
+
+    if (framed) {   /* Cabecera con el mismo tipo y número de secuencia, y la línea sin '\0' */
+        /* Se repiten los demás flags, así que el nombre del fichero confirma PROTOCOL_FLAG_ACCEPTS_LZ si lo trae */
+        flags = header.flags & ~(PROTOCOL_FLAG_PADDED | PROTOCOL_FLAG_COMPRESSED);
+        /* La respuesta a una petición comprimida se comprime al buffer auxiliar, o se copia si así no ocupa menos:
+         * el buffer del códec no dura hasta el envío */
+        if (compressed) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if ( (packed_len = lz_compress(output, output_len, scratch, output_len ? output_len - 1 : 0)) ) {
+                stats->codec_raw += output_len;
+                stats->codec_packed += packed_len;
+                output_len = packed_len;
+                flags |= PROTOCOL_FLAG_COMPRESSED;
+            } else {
+                memcpy(scratch, output, output_len);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            stats->codec_ns += (end.tv_sec - start.tv_sec) * 1000000000LL + end.tv_nsec - start.tv_nsec;
+            output = scratch;
+        }
+        /* Rellenar hasta la longitud de la petición (el buffer de la salida siempre tiene sitio) */
+        if (padded_len >= output_len + PROTOCOL_PAD_TRAILER) {
+            memset(output + output_len, 0, padded_len - output_len - PROTOCOL_PAD_TRAILER);
+            protocol_write_padding(output + padded_len - PROTOCOL_PAD_TRAILER, padded_len - output_len);
+            output_len = padded_len;
+            flags |= PROTOCOL_FLAG_PADDED;
+        }
+        iov[0].iov_base = header_buffer;
+        iov[0].iov_len = protocol_write_header(header_buffer, header.type, flags, header.seq, output_len);
+        iov[1].iov_base = output;
+        iov[1].iov_len = output_len;
+        return 2;
+    }
+    /* Texto plano: la respuesta acaba en '\0', que va aparte para no escribirlo detrás del datagrama */
+    iov[0].iov_base = output;
+    iov[0].iov_len = output_len;
+    iov[1].iov_base = (char *) &terminator;
+    iov[1].iov_len = 1;
+    return 2;
+}
+
+
+static int serve_batch(Listener* listener, Connection* connection, Batch* batch, int flags, ServerStats* stats) {
+    Metrics* metrics = &listener->receiver.metrics;
+    int socket = connection ? connection->socket : listener->receiver.socket;
+    RcvbufAdapter* rcvbuf = connection ? &connection->rcvbuf : &listener->receiver.rcvbuf;
+    Metrics* control_metrics = connection ? &connection->metrics : metrics;
+    Peer* peer;
+    struct sockaddr_in* to;
+    struct msghdr* msg;
+    struct iovec* iov;
+    struct timespec now, wall;
+    uint64_t received_at, processed_at, arrival, bytes, datagrams;
+    uint64_t drops = control_metrics->kernel_drops;
+    size_t segment, offset, len;
+    unsigned int pieces, count;
+    int received, served, replies, messages, sent, iovlen, grown, i;
+    int closing = 0;
+
+    /* recvmmsg sobrescribe la longitud de la dirección y del control, hay que restaurarlas en cada lote */
+    for (i = 0; i < batch->batch_size; i++) {
+        batch->recv_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        batch->recv_msgs[i].msg_hdr.msg_controllen = CONTROL_LEN;
+    }
+
+    /* Con MSG_WAITFORONE bloquea hasta el primer datagrama y recoge sin bloquear los que ya estén en cola */
+    batch->n_promotions = 0;
+    if ( (received = recvmmsg(socket, batch->recv_msgs, batch->batch_size, flags, NULL)) < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        /* Un socket conectado recibe los ICMP de puerto inalcanzable de su cliente: el aviso se descarta al leerlo */
+        if (connection && errno == ECONNREFUSED) {
+            metrics_add(metrics->recv_errors, 1);
+            return 0;
+        }
+        metrics_add(metrics->recv_errors, 1);
+        fail("Error al recibir la línea de texto");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    received_at = now.tv_sec * 1000000000ULL + now.tv_nsec;
+    clock_gettime(CLOCK_REALTIME, &wall);   /* Mismo reloj que los instantes de llegada del kernel */
+
+    for (i = 0, served = 0, replies = 0, bytes = 0; i < received; i++) {
+        if (!batch->recv_msgs[i].msg_len) {    /* Se recibió una orden de cerrar la conexión */
+            closing = 1;
+            break;
+        }
+        msg = &batch->recv_msgs[i].msg_hdr;
+        bytes += batch->recv_msgs[i].msg_len;
+        arrival = metrics_read_control(control_metrics, msg);
+
+        /* Con agregación, una recepción trae varios datagramas seguidos del mismo cliente, todos de
+         * segment bytes salvo el último */
+        if ( !(segment = gso_read_segment(msg)) ) segment = batch->recv_msgs[i].msg_len;
+        pieces = (batch->recv_msgs[i].msg_len + segment - 1) / segment;
+        peer = peers_lookup(&listener->peers, &batch->addresses[i], received_at);
+
+        /* Un cliente del socket de escucha que acaba de superar el umbral se apunta para conectarle un socket */
+        if (batch->promote_after && !connection) {
+            count = peer_count_datagrams(peer, pieces, received_at);
+            if (count >= batch->promote_after && count - pieces < batch->promote_after) {
+                batch->promotions[batch->n_promotions++] = batch->addresses[i];
+            }
+        }
+
+        /* Por un socket conectado, las respuestas a su cliente salen sin dirección (como con send): el kernel
+         * usa la ruta guardada al conectar. Las de otros clientes que llegaron antes del connect llevan la suya */
+        to = connection && same_destination(&batch->addresses[i], &connection->address) ? NULL : &batch->addresses[i];
+
+        for (offset = 0; offset < batch->recv_msgs[i].msg_len; offset += segment, served++) {
+            len = batch->recv_msgs[i].msg_len - offset < segment ? batch->recv_msgs[i].msg_len - offset : segment;
+            /* Un datagrama que no cupo entero (MSG_TRUNC: el último de la recepción) no se contesta, porque su línea
+             * llegó recortada. Con los buffers de la agregación cabe uno mayor de lo que se admite sin ella: tampoco */
+            if (len > MAX_BYTES_RECV || ((msg->msg_flags & MSG_TRUNC) && offset + len == batch->recv_msgs[i].msg_len)) {
+                log_sampled(LOG_LEVEL_WARN, NULL, 0, "Datagrama demasiado largo, se descarta");
+                metrics_add(metrics->truncated, 1);
+                stats->truncated++;
+                continue;
+            }
+            if (arrival && arrival <= wall.tv_sec * 1000000000ULL + wall.tv_nsec) {
+                metrics_record(&metrics->stages[METRICS_STAGE_QUEUE], wall.tv_sec * 1000000000ULL + wall.tv_nsec - arrival);
+            }
+
+            /* Preparar la respuesta hacia el emisor del datagrama */
+            iov = &batch->send_iovs[2 * replies];
+            iovlen = prepare_reply(listener, peer, (char *) batch->recv_iovs[i].iov_base + offset, len,
+                    batch->transformed + replies * MAX_BYTES_REPLY, batch->codec,
+                    batch->headers + replies * PROTOCOL_HEADER_LEN, iov, &batch->announced, stats);
+            if (!iovlen) continue;
+            batch->send_msgs[replies].msg_hdr = (struct msghdr) {
+                .msg_name = to,
+                .msg_namelen = to ? sizeof(struct sockaddr_in) : 0,
+                .msg_iov = iov,
+                .msg_iovlen = iovlen
+            };
+            replies++;
+        }
+    }
+    /* Los descartes de un socket conectado cuentan como los del de escucha, que es el que se exporta */
+    if (connection && control_metrics->kernel_drops != drops) metrics_add(metrics->kernel_drops, control_metrics->kernel_drops - drops);
+
+    /* Si el kernel descartó datagramas en este socket desde el último lote, ampliar su buffer de recepción */
+    if ( (grown = sockopts_adapt(socket, rcvbuf, control_metrics->socket_drops, received_at)) ) {
+        log_event(LOG_LEVEL_INFO, NULL, 0, "Buffer de recepción ampliado a %d bytes", grown);
+    }
+
+    /* No se cuentan los datagramas vacíos de cierre */
+    if (served) {
+        if (connection) connection->last_seen = received_at;
+        stats->batches++;
+        stats->datagrams += served;
+        metrics_add(metrics->datagrams_in, served);
+        metrics_add(metrics->bytes_in, bytes);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    processed_at = now.tv_sec * 1000000000ULL + now.tv_nsec;
+    if (served) metrics_record(&metrics->stages[METRICS_STAGE_PROCESS], processed_at - received_at);
+
+    /* Enviar todas las respuestas del lote; sendmmsg puede enviar menos de las pedidas */
+    messages = group_replies(batch, replies);
+    for (sent = 0, datagrams = 0, bytes = 0; sent < messages; ) {
+        if ( (i = sendmmsg(socket, batch->send_msgs + sent, messages - sent, 0)) < 0) {
+            if (errno == EINTR) continue;
+            /* Si la interfaz de salida no calcula las sumas de comprobación, el kernel rechaza los envíos
+             * segmentados: ese grupo se pierde (el cliente lo retransmite) y se deja de segmentar */
+            if (errno == EIO && batch->segments[sent] > 1) {
+                log_event(LOG_LEVEL_WARN, NULL, 0, "La interfaz no admite envíos segmentados, se envía datagrama a datagrama");
+                metrics_add(metrics->send_errors, batch->segments[sent]);
+                batch->gso = 0;
+                sent++;
+                continue;
+            }
+            /* El aviso de un ICMP pendiente en un socket conectado se entrega en este envío, que no llegó a salir */
+            if (connection && errno == ECONNREFUSED) {
+                metrics_add(metrics->send_errors, 1);
+                continue;
+            }
+            metrics_add(metrics->send_errors, 1);
             fail("Error al enviar la línea de texto al cliente");
+        }
+        for (; i > 0; i--, sent++) {
+            datagrams += batch->segments[sent];
+            bytes += batch->send_msgs[sent].msg_len;
+        }
+    }
+    stats->replies += datagrams;
+    if (datagrams) {
+        metrics_add(metrics->datagrams_out, datagrams);
+        metrics_add(metrics->bytes_out, bytes);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        metrics_record(&metrics->stages[METRICS_STAGE_SEND], now.tv_sec * 1000000000ULL + now.tv_nsec - processed_at);
+    }
+
+    /* Todos los datagramas del lote se recogieron y se contestaron juntos: comparten tiempo de servicio */
+    if (served) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        for (i = 0; i < served; i++) metrics_record(&metrics->stages[METRICS_STAGE_SERVICE], now.tv_sec * 1000000000ULL + now.tv_nsec - received_at);
+    }
+
+    return closing ? -1 : received;
+}
+
+
+void handle_data(Listener* listener, unsigned int batch_size, int use_gso, ServerStats* stats){
+    Batch batch;
+
+    batch_init(&batch, batch_size, use_gso && enable_gso(listener, 1));
+    while (serve_batch(listener, NULL, &batch, MSG_WAITFORONE, stats) >= 0);
+    batch_free(&batch);
+}
+
+
+static int connect_peer(Listener* listener, const struct sockaddr_in* address, const SocketOptions* options, int gso, uint64_t now) {
+    Connection* connection = NULL;
+    SocketOptions connected = *options;
+    int slot = -1, i;
 
+    for (i = 0; i < MAX_CONNECTIONS; i++) {
+        if (listener->connections[i].socket < 0) {
+            if (!connection) slot = i, connection = &listener->connections[i];
+        } else if (same_destination(&listener->connections[i].address, address)) {
+            return -1;  /* Ya tiene uno: son datagramas que quedaban en el socket de escucha */
         }
+    }
+    if (!connection) return -1;
+
+    memset(connection, 0, sizeof(Connection));
+    if ( (connection->socket = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ) {
+        perror("No se pudo crear el socket conectado");
+        connection->socket = -1;
+        return -1;
+    }
 
-        if (output) free(output);
+    /* Mismas opciones que el de escucha, para compartir su dirección; los avisos ya se dieron con él */
+    connected.reuse_port = 1;
+    sockopts_apply(connection->socket, &connected, &connection->rcvbuf);
+    metrics_enable_drops(connection->socket);
+    metrics_enable_timestamps(connection->socket);
+    if (gso) gso_enable(connection->socket, 1);
+
+    if (bind(connection->socket, (struct sockaddr *) &listener->receiver.receiver_address, sizeof(struct sockaddr_in)) < 0
+            || connect(connection->socket, (const struct sockaddr *) address, sizeof(struct sockaddr_in)) < 0) {
+        perror("No se pudo conectar un socket al cliente");
+        close_connection(connection);
+        return -1;
     }
+    connection->address = *address;
+    connection->last_seen = now;
+
+    return slot;
 }
 
 
-static char* toupper_string(const char* source) {
-    wchar_t* wide_source;
-    wchar_t* wide_destiny;
-    ssize_t wide_size, size;
-    char* destiny;
-    int i;
+static void close_connection(Connection* connection) {
+    if (close(connection->socket)) perror("No se pudo cerrar el socket conectado");
+    connection->socket = -1;
+}
+
+
+void handle_events(Listener* listeners, unsigned int n_listeners, unsigned int batch_size, int use_gso,
+        unsigned int connect_rate, const SocketOptions* socket_options, ServerStats* stats){
+    Batch batch;
+    struct epoll_event event, *events;
+    struct timespec now;
+    Listener* listener;
+    Connection* connection;
+    char ip[INET_ADDRSTRLEN];
+    uint64_t now_ns, swept_at = 0;
+    unsigned int n_events, n_connected = 0, index, j, k;
+    int epoll_fd, ready, received, drained, slot, i;
+    int closing = 0;
+
+    batch_init(&batch, batch_size, use_gso && enable_gso(listeners, n_listeners));
+    /* Umbral por intervalo de medida, redondeado hacia arriba */
+    batch.promote_after = (connect_rate * PEER_RATE_INTERVAL + 999999999ULL) / 1000000000ULL;
+
+    /* Cada socket de escucha puede tener hasta MAX_CONNECTIONS sockets conectados, todos en la misma instancia de epoll */
+    n_events = connect_rate ? n_listeners * (1 + MAX_CONNECTIONS) : n_listeners;
+    if ( !(events = (struct epoll_event *) calloc(n_events, sizeof(struct epoll_event))) ) fail("No se pudo reservar memoria para los eventos");
+    for (j = 0; connect_rate && j < n_listeners; j++) {
+        if ( !(listeners[j].connections = (Connection *) calloc(MAX_CONNECTIONS, sizeof(Connection))) ) fail("No se pudo reservar memoria para los sockets conectados");
+        for (k = 0; k < MAX_CONNECTIONS; k++) listeners[j].connections[k].socket = -1;
+    }
+
+    /* Registrar todos los sockets; cada evento lleva el índice de su socket */
+    if ( (epoll_fd = epoll_create1(0)) < 0) fail("No se pudo crear la instancia de epoll");
+    for (i = 0; i < n_listeners; i++) {
+        event = (struct epoll_event) { .events = EPOLLIN | EPOLLRDHUP, .data.u32 = i };
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listeners[i].receiver.socket, &event) < 0) fail("No se pudo registrar el socket en epoll");
+    }
+
+    while (!closing) {
+        /* Con sockets conectados hay que despertar de vez en cuando para cerrar los inactivos */
+        if ( (ready = epoll_wait(epoll_fd, events, n_events, n_connected ? CONNECTION_IDLE / 2000000 : -1)) < 0) {
+            if (errno == EINTR) continue;
+            fail("Error al esperar por los sockets");
+        }
+
+        /* Vaciar cada socket listo sin bloquear. Si tras MAX_DRAIN lotes sigue habiendo datos, se pasa
+         * al siguiente: epoll (por nivel) lo volverá a dar como listo en la próxima espera */
+        for (i = 0; i < ready && !closing; i++) {
+            /* Tras el shutdown, recvmmsg sin bloquear no devuelve el datagrama vacío sino EAGAIN:
+             * el cierre se detecta por el evento */
+            if (events[i].events & EPOLLRDHUP) {
+                closing = 1;
+                break;
+            }
+            if (events[i].data.u32 & CONNECTION_EVENT) {
+                index = (events[i].data.u32 & ~CONNECTION_EVENT) >> 16;
+                listener = &listeners[index];
+                connection = &listener->connections[events[i].data.u32 & 0xFFFF];
+            } else {
+                index = events[i].data.u32;
+                listener = &listeners[index];
+                connection = NULL;
+            }
+            drained = 0;
+            do {
+                received = serve_batch(listener, connection, &batch, MSG_DONTWAIT, stats);
+                if (received < 0) closing = 1;
+
+                /* Conectar un socket propio a cada cliente que superó el umbral en este lote */
+                for (j = 0; j < batch.n_promotions; j++) {
+                    clock_gettime(CLOCK_MONOTONIC, &now);
+                    if ( (slot = connect_peer(listener, &batch.promotions[j], socket_options, batch.gso, now.tv_sec * 1000000000ULL + now.tv_nsec)) < 0 ) continue;
+                    event = (struct epoll_event) { .events = EPOLLIN, .data.u32 = connection_event(index, slot) };
+                    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listener->connections[slot].socket, &event) < 0) fail("No se pudo registrar el socket conectado en epoll");
+                    n_connected++;
+                    stats->connections++;
+                    inet_ntop(AF_INET, &batch.promotions[j].sin_addr, ip, INET_ADDRSTRLEN);
+                    log_event(LOG_LEVEL_INFO, ip, strlen(ip), "Socket conectado al cliente %s:%u", ntohs(batch.promotions[j].sin_port));
+                }
+            } while (received == batch_size && ++drained < MAX_DRAIN);
+        }
+
+        /* Devolver al socket de escucha los clientes inactivos, contestando antes lo que quedara en su socket.
+         * Lo que llegue entre el último lote y el cierre se pierde, y el cliente lo retransmite */
+        if (!n_connected || closing) continue;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        now_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+        if (now_ns - swept_at < CONNECTION_IDLE / 2) continue;
+        swept_at = now_ns;
+        for (j = 0; j < n_listeners; j++) {
+            for (k = 0; k < MAX_CONNECTIONS; k++) {
+                connection = &listeners[j].connections[k];
+                if (connection->socket < 0 || now_ns - connection->last_seen < CONNECTION_IDLE) continue;
+                while ( (received = serve_batch(&listeners[j], connection, &batch, MSG_DONTWAIT, stats)) > 0 );
+                if (received < 0) closing = 1;
+                if (connection->last_seen > now_ns) continue;   /* Quedaba algo: sigue activo */
+                inet_ntop(AF_INET, &connection->address.sin_addr, ip, INET_ADDRSTRLEN);
+                log_event(LOG_LEVEL_INFO, ip, strlen(ip), "Cliente %s:%u inactivo, vuelve al socket de escucha", ntohs(connection->address.sin_port));
+                close_connection(connection);
+                n_connected--;
+            }
+        }
+    }
+
+    for (j = 0; connect_rate && j < n_listeners; j++) {
+        for (k = 0; k < MAX_CONNECTIONS; k++) {
+            if (listeners[j].connections[k].socket >= 0) close_connection(&listeners[j].connections[k]);
+        }
+        free(listeners[j].connections);
+        listeners[j].connections = NULL;
+    }
+    if (close(epoll_fd)) fail("No se pudo cerrar la instancia de epoll");
+    free(events);
+    batch_free(&batch);
+}
+
+
+static void complete_send(IoUring* ring, Listener* listeners, unsigned int index, int32_t res, ServerStats* stats) {
+    Metrics* metrics = &listeners[index >> 16].receiver.metrics;
+
+    if (res >= 0) {
+        stats->replies++;
+        metrics_add(metrics->datagrams_out, 1);
+        metrics_add(metrics->bytes_out, res);
+    } else {
+        metrics_add(metrics->send_errors, 1);
+        if (res != -EAGAIN && res != -ECANCELED) {
+            errno = -res;
+            perror("Error al enviar la línea de texto al cliente");
+        }
+    }
+    uring_recycle_buffer(ring, index & 0xFFFF);
+}
+
+
+int handle_uring(Listener* listeners, unsigned int n_listeners, unsigned int batch_size, ServerStats* stats){
+    IoUring ring;
+    struct io_uring_cqe* cqe;
+    struct msghdr* recv_msgs;       /* Cabecera de la recepción multishot de cada socket */
+    UringReply* replies;
+    unsigned int* pending;          /* Respuestas preparadas en esta vuelta, pendientes de encolar */
+    unsigned int n_buffers, n_pending, received, bid, index, op, i;
+    unsigned int in_flight = 0;     /* Envíos encolados cuya finalización aún no se ha recogido */
+    uint64_t user_data;
+    int32_t res;
+    uint32_t cqe_flags;
+    struct timespec now, mark, done;    /* mark: fin del datagrama anterior, o el despertar */
+    struct timespec wall;           /* Despertar, en el reloj de los instantes de llegada del kernel */
+    uint64_t arrival;
+    int grown;
+    struct msghdr result;           /* Dirección y control de cada datagrama recibido */
+    Metrics* metrics;
+    char* input;
+    char* codec;                    /* Buffer para descomprimir y transformar las peticiones comprimidas */
+    size_t input_len;
+    int iovlen, announced = 0, closing = 0;
+
+    /* Buffers suficientes para varios lotes en vuelo; el anillo exige una potencia de 2 */
+    for (n_buffers = 1; n_buffers < 4 * batch_size && n_buffers < MAX_URING_BUFFERS; n_buffers *= 2);
+    stats->batch_size = n_buffers;     /* Cada vuelta puede recoger tantos datagramas como buffers */
+
+    /* Caben dos peticiones por socket y una por buffer (cada datagrama genera como mucho un envío) */
+    if (uring_init(&ring, n_buffers + 2 * n_listeners) < 0) {
+        perror("io_uring no está disponible, se usa recvmmsg/sendmmsg");
+        return -1;
+    }
+    if (uring_setup_buffers(&ring, n_buffers, sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + METRICS_CONTROL_LEN + MAX_BYTES_RECV + 1) < 0) {
+        perror("El kernel no soporta buffers proporcionados para io_uring, se usa recvmmsg/sendmmsg");
+        uring_free(&ring);
+        return -1;
+    }
+
+    recv_msgs = (struct msghdr *) calloc(n_listeners, sizeof(struct msghdr));
+    replies = (UringReply *) calloc(n_buffers, sizeof(UringReply));
+    pending = (unsigned int *) calloc(n_buffers, sizeof(unsigned int));
+    codec = (char *) malloc(CODEC_LEN);
+    if (!recv_msgs || !replies || !pending || !codec) fail("No se pudo reservar memoria para io_uring");
+    for (i = 0; i < n_buffers; i++) {
+        if ( !(replies[i].transformed = (char *) malloc(MAX_BYTES_REPLY)) ) fail("No se pudo reservar memoria para io_uring");
+    }
+
+    /* Una única recepción multishot por socket. Tras el shutdown, la recepción sin bloquear que hace
+     * io_uring no devuelve el datagrama vacío sino EAGAIN: el cierre se detecta con POLLRDHUP */
+    for (i = 0; i < n_listeners; i++) {
+        recv_msgs[i].msg_namelen = sizeof(struct sockaddr_in);
+        recv_msgs[i].msg_controllen = METRICS_CONTROL_LEN;
+        uring_prep_recvmsg_multishot(&ring, listeners[i].receiver.socket, &recv_msgs[i], uring_user_data(URING_RECV, i));
+        uring_prep_poll(&ring, listeners[i].receiver.socket, POLLRDHUP, uring_user_data(URING_HANGUP, i));
+    }
+
+    while (!closing) {
+        /* Enviar las peticiones pendientes y esperar al menos una respuesta, todo en una llamada */
+        if (uring_submit(&ring, 1, -1) < 0) fail("Error al esperar por io_uring");
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        clock_gettime(CLOCK_REALTIME, &wall);
+        mark = now;
+
+        for (n_pending = 0, received = 0; (cqe = uring_peek(&ring)); uring_seen(&ring)) {
+            user_data = cqe->user_data;
+            res = cqe->res;
+            cqe_flags = cqe->flags;
+            op = uring_user_op(user_data);
+            index = uring_user_index(user_data);
+
+            if (op == URING_SEND) {     /* Terminó un envío: su buffer vuelve al kernel */
+                complete_send(&ring, listeners, index, res, stats);
+                in_flight--;
+                continue;
+            }
+            if (op == URING_HANGUP) {
+                closing = 1;
+                continue;
+            }
+
+            /* Recepción: si el kernel la dio por terminada, se vuelve a pedir (salvo al cerrar) */
+            if (!(cqe_flags & IORING_CQE_F_MORE) && !closing && (res >= 0 || res == -ENOBUFS)) {
+                uring_prep_recvmsg_multishot(&ring, listeners[index].receiver.socket, &recv_msgs[index], uring_user_data(URING_RECV, index));
+            }
+            if (res == -ENOBUFS) continue;  /* Todos los buffers están ocupados con respuestas en curso */
+            metrics = &listeners[index].receiver.metrics;
+            if (res < 0) {
+                metrics_add(metrics->recv_errors, 1);
+                errno = -res;
+                fail("Error al recibir la línea de texto");
+            }
+            if (!(cqe_flags & IORING_CQE_F_BUFFER)) {   /* Sin datos: se hizo shutdown sobre el socket */
+                closing = 1;
+                continue;
+            }
 
-    wide_size = mbstowcs(NULL, source, 0); /* Calcular el número de wchar_t que ocupa el string source */
-    /* Alojar espacio para wide_source y wide_destiny */
-    wide_source = (wchar_t *) calloc(wide_size + 1, sizeof(wchar_t));
-    wide_destiny = (wchar_t *) calloc(wide_size + 1, sizeof(wchar_t));
+            bid = cqe_flags >> IORING_CQE_BUFFER_SHIFT;
+            input = uring_recvmsg_payload(&ring, cqe, &recv_msgs[index], &result, &input_len);
+            arrival = result.msg_control ? metrics_read_control(metrics, &result) : 0;
+            if (!input) {
+                log_sampled(LOG_LEVEL_WARN, NULL, 0, "Datagrama demasiado largo, se descarta");
+                metrics_add(metrics->truncated, 1);
+                stats->truncated++;
+                uring_recycle_buffer(&ring, bid);   /* Datagrama demasiado largo */
+                continue;
+            }
+            memcpy(&replies[bid].address, result.msg_name, result.msg_namelen);
+            if (!input_len) {   /* Se recibió una orden de cerrar la conexión */
+                uring_recycle_buffer(&ring, bid);
+                closing = 1;
+                continue;
+            }
+            received++;
+            metrics_add(metrics->datagrams_in, 1);
+            metrics_add(metrics->bytes_in, input_len);
+            if (arrival && arrival <= wall.tv_sec * 1000000000ULL + wall.tv_nsec) {
+                metrics_record(&metrics->stages[METRICS_STAGE_QUEUE], wall.tv_sec * 1000000000ULL + wall.tv_nsec - arrival);
+            }
+            if ( (grown = sockopts_adapt(listeners[index].receiver.socket, &listeners[index].receiver.rcvbuf, metrics->socket_drops,
+                    now.tv_sec * 1000000000ULL + now.tv_nsec)) ) {
+                log_event(LOG_LEVEL_INFO, NULL, 0, "Buffer de recepción ampliado a %d bytes", grown);
+            }
+
+            iovlen = prepare_reply(&listeners[index], peers_lookup(&listeners[index].peers, &replies[bid].address, now.tv_sec * 1000000000ULL + now.tv_nsec),
+                    input, input_len, replies[bid].transformed, codec, replies[bid].header, replies[bid].iov, &announced, stats);
+            clock_gettime(CLOCK_MONOTONIC, &done);
+            metrics_record(&metrics->stages[METRICS_STAGE_PROCESS], (done.tv_sec - mark.tv_sec) * 1000000000LL + done.tv_nsec - mark.tv_nsec);
+            /* El servicio acaba al preparar la respuesta: se envía con las del resto de la tanda en la siguiente llamada */
+            metrics_record(&metrics->stages[METRICS_STAGE_SERVICE], (done.tv_sec - now.tv_sec) * 1000000000LL + done.tv_nsec - now.tv_nsec);
+            mark = done;
+            if (!iovlen) {
+                uring_recycle_buffer(&ring, bid);
+                continue;
+            }
+            replies[bid].msg = (struct msghdr) {
+                .msg_name = &replies[bid].address,
+                .msg_namelen = sizeof(struct sockaddr_in),
+                .msg_iov = replies[bid].iov,
+                .msg_iovlen = iovlen
+            };
+            pending[n_pending++] = bid | (index << 16);
+        }
 
-    /* Transformar la fuente en un wstring */
-    mbstowcs(wide_source, source, wide_size + 1);
-    /* Transformar wide_source a mayúsculas y guardarlo en wide_destiny */
-    for (i = 0; wide_source[i]; i++) {
-        wide_destiny[i] = towupper(wide_source[i]);
+        /* Encolar los envíos encadenados: cada uno empieza cuando termina el anterior, así que salen
+         * en el mismo orden en el que llegaron las peticiones */
+        for (i = 0; i < n_pending; i++) {
+            bid = pending[i] & 0xFFFF;
+            index = pending[i] >> 16;
+            uring_prep_sendmsg(&ring, listeners[index].receiver.socket, &replies[bid].msg, uring_user_data(URING_SEND, pending[i]), i + 1 < n_pending);
+        }
+        in_flight += n_pending;
+        if (received) {
+            stats->batches++;
+            stats->datagrams += received;
+        }
     }
 
-    /* Transoformar de vuelta a un string normal */
-    size = wcstombs(NULL, wide_destiny, 0); /* Calcular el número de char que ocupa el wstring wide_destiny */
-    destiny = (char *) calloc(size + 1, sizeof(char));
-    wcstombs(destiny, wide_destiny, size + 1);
+    /* Enviar las últimas respuestas y esperar a que terminen: hasta entonces el kernel lee de sus buffers */
+    while (in_flight) {
+        if (uring_submit(&ring, 1, -1) < 0) fail("Error al esperar por io_uring");
+        for (; (cqe = uring_peek(&ring)); uring_seen(&ring)) {
+            if (uring_user_op(cqe->user_data) != URING_SEND) continue;  /* Recepciones que aún no se cancelaron */
+            complete_send(&ring, listeners, uring_user_index(cqe->user_data), cqe->res, stats);
+            in_flight--;
+        }
+    }
 
-    if (wide_source) free(wide_source);
-    if (wide_destiny) free(wide_destiny);
+    for (i = 0; i < n_buffers; i++) free(replies[i].transformed);
+    free(replies);
+    free(pending);
+    free(codec);
+    free(recv_msgs);
+    uring_free(&ring);
 
-    return destiny;
+    return 0;
 }
 
+
 static void print_help(char* exe_name){
     /** Cabecera y modo de ejecución **/
-    printf("Uso: %s [-i] <IP> [-p] <port> [-h]\n\n", exe_name);
+    printf("Uso: %s [-p] <port> [-l <[address:]port>[,...]] [-b <batch>] [-w <workers>] [-u] [-g] [-c [<rate>]] [-v <level>] [-s <n>] [-M <KiB>] [-m <file>] [-O <profile>] [-h]\n\n", exe_name);
 
     /** Lista de opciones de uso **/
     printf(" Opción\t\tOpción larga\t\tSignificado\n");
     printf(" -p <port>\t--port <port>\t\tPuerto en el que escucha el emisor al que conectarse.\n");
+    printf(" -l <list>\t--listen <list>\t\tLista separada por comas de puertos o dirección:puerto en los que escuchar a la vez\n"
+           "\t\t\t\t\t(hasta %d, se puede repetir). Sustituye a -p.\n", MAX_ENDPOINTS);
+    printf(" -b <batch>\t--batch <batch>\t\tNúmero máximo de datagramas recibidos por llamada (1-%d, por defecto %d).\n", MAX_BATCH, DEFAULT_BATCH);
+    printf(" -w <workers>\t--workers <workers>\tNúmero de hilos trabajadores, cada uno con su socket (SO_REUSEPORT) (1-%d, por defecto 1).\n", MAX_WORKERS);
+    printf(" -u\t\t--uring\t\t\tUsar io_uring (recepción multishot y envíos encadenados) si el kernel lo permite.\n");
+    printf(" -g\t\t--gso\t\t\tRecibir agregados los datagramas de cada cliente (UDP_GRO) y enviar segmentadas sus respuestas\n"
+           "\t\t\t\t\t(UDP_SEGMENT) si el kernel lo permite. Sin efecto con -u.\n");
+    printf(" -c [<rate>]\t--connect [<rate>]\tConectar un socket propio (SO_REUSEPORT y connect) a cada cliente que envíe más de\n"
+           "\t\t\t\t\t<rate> datagramas por segundo (por defecto %d); se cierra tras %llu ms sin recibir nada.\n"
+           "\t\t\t\t\tSin efecto con -u.\n", DEFAULT_CONNECT_RATE, CONNECTION_IDLE / 1000000);
+    printf(" -v <level>\t--log-level <level>\tNivel de registro: error, warn, info o debug (por defecto info). En debug se registran las líneas.\n");
+    printf(" -s <n>\t\t--log-sample <n>\tRegistrar solo una de cada <n> líneas recibidas y enviadas (por defecto 1).\n");
+    printf(" -M <KiB>\t--memo <KiB>\t\tGuardar las líneas no ASCII ya transformadas (de hasta %d bytes con su transformación) en una\n"
+           "\t\t\t\t\tcaché de <KiB> KiB repartidos entre los trabajadores, y copiar de ella las repetidas (por defecto, sin caché).\n", MEMO_SLOT_SIZE);
+    printf(" -m <file>\t--metrics <file>\tReescribir cada %d ms en <file> las métricas de cada socket (formato de texto de Prometheus).\n", METRICS_INTERVAL);
+    printf(" -O <profile>\t--sockopt <profile>\tOpciones de los sockets de escucha (ver abajo).\n");
     printf(" -h\t\t--help\t\t\tMostrar este texto de ayuda y salir.\n");
 
+    printf("\n" SOCKOPTS_HELP);
+
     /** Consideraciones adicionales **/
     printf("\nSi se especifica varias veces un argumento, el comportamiento está indefinido.\n");
 }
@@ -179,6 +1497,16 @@ static void process_args(struct arguments args) {
 
     /* Inicializar los valores de puerto y backlog a sus valores por defecto */
     *args.receiver_port = DEFAULT_PORT;
+    *args.batch_size = DEFAULT_BATCH;
+    *args.workers = 1;
+    *args.use_uring = 0;
+    *args.use_gso = 0;
+    *args.connect_rate = 0;
+    *args.log_level = DEFAULT_LOG_LEVEL;
+    *args.log_sample = 1;
+    *args.metrics_path = NULL;
+    *args.memo_kib = 0;
+    memset(args.socket_options, 0, sizeof(SocketOptions));
  
     for (i = 1; i < args.argc; i++) { /* Procesamos los argumentos (sin contar el nombre del ejecutable) */
         current_arg = args.argv[i];
@@ -186,6 +1514,17 @@ static void process_args(struct arguments args) {
             /* Manejar las opciones largas */
             if (current_arg[1] == '-') { /* Opción larga */
                 if (!strcmp(current_arg, "--port")) current_arg = "-p";
+                else if (!strcmp(current_arg, "--listen")) current_arg = "-l";
+                else if (!strcmp(current_arg, "--batch")) current_arg = "-b";
+                else if (!strcmp(current_arg, "--workers")) current_arg = "-w";
+                else if (!strcmp(current_arg, "--uring")) current_arg = "-u";
+                else if (!strcmp(current_arg, "--gso")) current_arg = "-g";
+                else if (!strcmp(current_arg, "--connect")) current_arg = "-c";
+                else if (!strcmp(current_arg, "--log-level")) current_arg = "-v";
+                else if (!strcmp(current_arg, "--log-sample")) current_arg = "-s";
+                else if (!strcmp(current_arg, "--memo")) current_arg = "-M";
+                else if (!strcmp(current_arg, "--metrics")) current_arg = "-m";
+                else if (!strcmp(current_arg, "--sockopt")) current_arg = "-O";
                 else if (!strcmp(current_arg, "--help")) current_arg = "-h";
             } 
             switch(current_arg[1]) {
@@ -203,6 +1542,123 @@ static void process_args(struct arguments args) {
                         exit(EXIT_FAILURE);
                     }
                     break;
+                case 'l':   /* Direcciones de escucha */
+                    if (++i < args.argc) {
+                        if (parse_endpoints(args.argv[i], args.endpoints, args.n_endpoints) < 0) {
+                            fprintf(stderr, "La lista de direcciones de escucha especificada (%s) no es válida.\n\n", args.argv[i]);
+                            print_help(args.argv[0]);
+                            exit(EXIT_FAILURE);
+                        }
+                    } else {
+                        fprintf(stderr, "Direcciones de escucha no especificadas tras la opción '-l'.\n\n");
+                        print_help(args.argv[0]);
+                        exit(EXIT_FAILURE);
+                    }
+                    break;
+                case 'b':   /* Tamaño de lote */
+                    if (++i < args.argc) {
+                        *args.batch_size = atoi(args.argv[i]);
+                        if (*args.batch_size < 1 || *args.batch_size > MAX_BATCH) {
+                            fprintf(stderr, "El tamaño de lote especificado (%s) no es válido.\n\n", args.argv[i]);
+                            print_help(args.argv[0]);
+                            exit(EXIT_FAILURE);
+                        }
+                    } else {
+                        fprintf(stderr, "Tamaño de lote no especificado tras la opción '-b'.\n\n");
+                        print_help(args.argv[0]);
+                        exit(EXIT_FAILURE);
+                    }
+                    break;
+                case 'w':   /* Número de trabajadores */
+                    if (++i < args.argc) {
+                        *args.workers = atoi(args.argv[i]);
+                        if (*args.workers < 1 || *args.workers > MAX_WORKERS) {
+                            fprintf(stderr, "El número de trabajadores especificado (%s) no es válido.\n\n", args.argv[i]);
+                            print_help(args.argv[0]);
+                            exit(EXIT_FAILURE);
+                        }
+                    } else {
+                        fprintf(stderr, "Número de trabajadores no especificado tras la opción '-w'.\n\n");
+                        print_help(args.argv[0]);
+                        exit(EXIT_FAILURE);
+                    }
+                    break;
+                case 'u':   /* io_uring */
+                    *args.use_uring = 1;
+                    break;
+                case 'g':   /* Agregación y segmentación UDP */
+                    *args.use_gso = 1;
+                    break;
+                case 'c':   /* Sockets conectados a los clientes más activos; el umbral es opcional */
+                    *args.connect_rate = DEFAULT_CONNECT_RATE;
+                    if (i + 1 < args.argc && args.argv[i + 1][0] != '-') {
+                        *args.connect_rate = atoi(args.argv[++i]);
+                        if (*args.connect_rate < 1) {
+                            fprintf(stderr, "El umbral de datagramas por segundo especificado (%s) no es válido.\n\n", args.argv[i]);
+                            print_help(args.argv[0]);
+                            exit(EXIT_FAILURE);
+                        }
+                    }
+                    break;
+                case 'v':   /* Nivel de registro */
+                    if (++i < args.argc) {
+                        if (!strcmp(args.argv[i], "error")) *args.log_level = LOG_LEVEL_ERROR;
+                        else if (!strcmp(args.argv[i], "warn")) *args.log_level = LOG_LEVEL_WARN;
+                        else if (!strcmp(args.argv[i], "info")) *args.log_level = LOG_LEVEL_INFO;
+                        else if (!strcmp(args.argv[i], "debug")) *args.log_level = LOG_LEVEL_DEBUG;
+                        else {
+                            fprintf(stderr, "El nivel de registro especificado (%s) no es válido.\n\n", args.argv[i]);
+                            print_help(args.argv[0]);
+                            exit(EXIT_FAILURE);
+                        }
+                    } else {
+                        fprintf(stderr, "Nivel de registro no especificado tras la opción '-v'.\n\n");
+                        print_help(args.argv[0]);
+                        exit(EXIT_FAILURE);
+                    }
+                    break;
+                case 's':   /* Muestreo del registro */
+                    if (++i < args.argc) {
+                        *args.log_sample = atoi(args.argv[i]);
+                        if (*args.log_sample < 1) {
+                            fprintf(stderr, "La frecuencia de muestreo especificada (%s) no es válida.\n\n", args.argv[i]);
+                            print_help(args.argv[0]);
+                            exit(EXIT_FAILURE);
+                        }
+                    } else {
+                        fprintf(stderr, "Frecuencia de muestreo no especificada tras la opción '-s'.\n\n");
+                        print_help(args.argv[0]);
+                        exit(EXIT_FAILURE);
+                    }
+                    break;
+                case 'M':   /* Caché de líneas transformadas */
+                    if (++i < args.argc) {
+                        if (atoi(args.argv[i]) < 1) {
+                            fprintf(stderr, "El tamaño de la caché de líneas especificado (%s) no es válido.\n\n", args.argv[i]);
+                            print_help(args.argv[0]);
+                            exit(EXIT_FAILURE);
+                        }
+                        *args.memo_kib = atoi(args.argv[i]);
+                    } else {
+                        fprintf(stderr, "Tamaño de la caché de líneas no especificado tras la opción '-M'.\n\n");
+                        print_help(args.argv[0]);
+                        exit(EXIT_FAILURE);
+                    }
+                    break;
+                case 'm':   /* Fichero de métricas */
+                    if (++i < args.argc) {
+                        *args.metrics_path = args.argv[i];
+                    } else {
+                        fprintf(stderr, "Fichero de métricas no especificado tras la opción '-m'.\n\n");
+                        print_help(args.argv[0]);
+                        exit(EXIT_FAILURE);
+                    }
+                    break;
+                case 'O':   /* Perfil de opciones de los sockets */
+                    if (++i < args.argc && sockopts_parse(args.socket_options, args.argv[i]) == 0) break;
+                    fprintf(stderr, "Perfil de opciones de socket no válido o no especificado tras la opción '-O'.\n\n");
+                    print_help(args.argv[0]);
+                    exit(EXIT_FAILURE);
                 case 'h':   /* Ayuda */
                     print_help(args.argv[0]);
                     exit(EXIT_SUCCESS);
@@ -223,3 +1679,36 @@ static void process_args(struct arguments args) {
 
 
 }
+
+
+static int parse_endpoints(const char* list, Endpoint* endpoints, unsigned int* n_endpoints) {
+    char item[INET_ADDRSTRLEN + 8];
+    const char *start, *end, *colon;
+    struct in_addr address;
+    size_t len;
+    char* port_end;
+    long port;
+
+    for (start = list; *start; start = *end ? end + 1 : end) {
+        if ( !(end = strchr(start, ',')) ) end = start + strlen(start);
+        if ( (len = end - start) >= sizeof(item) || !len || *n_endpoints == MAX_ENDPOINTS) return -1;
+        memcpy(item, start, len);
+        item[len] = '\0';
+
+        /* Cada elemento es un puerto o un par dirección:puerto */
+        endpoints[*n_endpoints].address[0] = '\0';
+        if ( (colon = strrchr(item, ':')) ) {
+            item[colon - item] = '\0';
+            if (inet_pton(AF_INET, item, &address) != 1) return -1;
+            strcpy(endpoints[*n_endpoints].address, item);
+            colon++;
+        } else {
+            colon = item;
+        }
+        port = strtol(colon, &port_end, 10);
+        if (*port_end || port_end == colon || port < 0 || port > 65535) return -1;
+        endpoints[(*n_endpoints)++].port = port;
+    }
+
+    return 0;
+}
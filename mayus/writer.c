@@ -0,0 +1,178 @@
+#define _GNU_SOURCE     /* fallocate */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "writer.h"
+#include "loging.h"
+
+#define PAGE_ALIGN 4096     /* Alineación de los buffers de salida */
+
+
+/**
+ * @brief   Escribe un conjunto de buffers consecutivos en su posición del fichero.
+ *
+ * pwritev puede escribir menos de lo pedido: se repite con lo que falte hasta terminar.
+ *
+ * @param fd        Descriptor del fichero.
+ * @param buffers   Buffers a escribir, con posiciones consecutivas.
+ * @param count     Número de buffers.
+ *
+ * @return  Número de llamadas a pwritev.
+ */
+static unsigned long write_buffers(int fd, OutputBuffer** buffers, unsigned int count) {
+    struct iovec iov[OUTPUT_BUFFERS];
+    struct iovec* next = iov;
+    off_t offset = buffers[0]->offset;
+    ssize_t written;
+    unsigned long calls = 0;
+    unsigned int i, left = count;
+
+    for (i = 0; i < count; i++) iov[i] = (struct iovec) { .iov_base = buffers[i]->data, .iov_len = buffers[i]->len };
+
+    while (left) {
+        if ( (written = pwritev(fd, next, left, offset)) < 0 ) {
+            if (errno == EINTR) continue;
+            fail("No se pudo escribir en el archivo de salida");
+        }
+        calls++;
+        offset += written;
+
+        /* Saltar los buffers ya escritos y recortar el que quedó a medias */
+        for (; left && (size_t) written >= next->iov_len; next++, left--) written -= next->iov_len;
+        if (left) {
+            next->iov_base = (char *) next->iov_base + written;
+            next->iov_len -= written;
+        }
+    }
+
+    return calls;
+}
+
+
+/**
+ * @brief   Función del hilo escritor.
+ *
+ * Espera a que haya buffers llenos, los escribe todos juntos sin tener el cerrojo y los devuelve
+ * a la lista de libres. Termina cuando se está cerrando y ya no queda nada por escribir.
+ *
+ * @param arg   Puntero al OutputWriter.
+ *
+ * @return  NULL.
+ */
+static void* writer_main(void* arg) {
+    OutputWriter* writer = (OutputWriter *) arg;
+    OutputBuffer* batch[OUTPUT_BUFFERS];
+    unsigned int count, i;
+
+    pthread_mutex_lock(&writer->lock);
+    for (;;) {
+        while (!writer->full_count && !writer->closing) pthread_cond_wait(&writer->filled, &writer->lock);
+        if (!writer->full_count) break;     /* Se está cerrando y no queda nada */
+
+        count = writer->full_count;
+        memcpy(batch, writer->full, count * sizeof(OutputBuffer *));
+        writer->full_count = 0;
+        pthread_mutex_unlock(&writer->lock);
+
+        i = write_buffers(writer->fd, batch, count);
+
+        pthread_mutex_lock(&writer->lock);
+        writer->writes += i;
+        for (i = 0; i < count; i++) {
+            batch[i]->len = 0;
+            writer->free[writer->free_count++] = batch[i];
+        }
+        pthread_cond_signal(&writer->emptied);
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    return NULL;
+}
+
+
+/**
+ * @brief   Pasa el buffer en curso al hilo escritor y toma uno libre.
+ *
+ * @param writer    Escritor.
+ */
+static void submit_current(OutputWriter* writer) {
+    pthread_mutex_lock(&writer->lock);
+    writer->full[writer->full_count++] = writer->current;
+    pthread_cond_signal(&writer->filled);
+
+    if (!writer->free_count) writer->stalls++;
+    while (!writer->free_count) pthread_cond_wait(&writer->emptied, &writer->lock);
+    writer->current = writer->free[--writer->free_count];
+    pthread_mutex_unlock(&writer->lock);
+
+    writer->current->offset = writer->offset;
+}
+
+
+void output_open(OutputWriter* writer, const char* path, off_t expected_size) {
+    int i;
+
+    memset(writer, 0, sizeof(OutputWriter));
+    if ( (writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0 ) fail("Error en la apertura del archivo de escritura");
+
+    /* Reservar el espacio previsto; si el sistema de ficheros no lo permite, simplemente no se reserva */
+    if (expected_size > 0 && fallocate(writer->fd, FALLOC_FL_KEEP_SIZE, 0, expected_size) < 0 && errno != EOPNOTSUPP) {
+        perror("No se pudo reservar espacio para el archivo de salida");
+    }
+
+    for (i = 0; i < OUTPUT_BUFFERS; i++) {
+        if ( (errno = posix_memalign((void **) &writer->buffers[i].data, PAGE_ALIGN, OUTPUT_BUFFER_SIZE)) ) fail("No se pudo reservar memoria para la salida");
+        writer->free[writer->free_count++] = &writer->buffers[i];
+    }
+    writer->current = writer->free[--writer->free_count];
+
+    if (pthread_mutex_init(&writer->lock, NULL) || pthread_cond_init(&writer->filled, NULL) || pthread_cond_init(&writer->emptied, NULL)) {
+        fail("No se pudo inicializar la sincronización del escritor");
+    }
+    if (pthread_create(&writer->thread, NULL, writer_main, writer)) fail("No se pudo crear el hilo escritor");
+}
+
+
+void output_append(OutputWriter* writer, const char* data, size_t len) {
+    size_t chunk;
+
+    while (len) {
+        chunk = OUTPUT_BUFFER_SIZE - writer->current->len;
+        if (chunk > len) chunk = len;
+        memcpy(writer->current->data + writer->current->len, data, chunk);
+        writer->current->len += chunk;
+        writer->offset += chunk;
+        data += chunk;
+        len -= chunk;
+
+        if (writer->current->len == OUTPUT_BUFFER_SIZE) submit_current(writer);
+    }
+}
+
+
+void output_close(OutputWriter* writer) {
+    int i;
+
+    /* El último buffer, aunque no esté lleno, y la orden de terminar */
+    pthread_mutex_lock(&writer->lock);
+    if (writer->current->len) writer->full[writer->full_count++] = writer->current;
+    writer->closing = 1;
+    pthread_cond_signal(&writer->filled);
+    pthread_mutex_unlock(&writer->lock);
+
+    if (pthread_join(writer->thread, NULL)) fail("No se pudo esperar al hilo escritor");
+
+    /* Liberar el espacio reservado de más con fallocate si la previsión se quedó larga */
+    if (ftruncate(writer->fd, writer->offset) < 0) fail("No se pudo ajustar el tamaño del archivo de salida");
+    if (close(writer->fd)) fail("No se pudo cerrar el archivo de escritura");
+    for (i = 0; i < OUTPUT_BUFFERS; i++) free(writer->buffers[i].data);
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->filled);
+    pthread_cond_destroy(&writer->emptied);
+}
@@ -0,0 +1,83 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#define OUTPUT_BUFFER_SIZE (1 << 20)    /* Tamaño de cada buffer de salida (múltiplo del tamaño de página) */
+#define OUTPUT_BUFFERS 8                /* Número de buffers de salida */
+
+/**
+ * Buffer de salida, alineado a página, con los datos que van en una posición conocida del fichero.
+ */
+typedef struct {
+    char* data;         /* OUTPUT_BUFFER_SIZE bytes */
+    size_t len;         /* Bytes ocupados */
+    off_t offset;       /* Posición del fichero en la que se escribe data */
+} OutputBuffer;
+
+/**
+ * Escritor del fichero de salida del cliente.
+ *
+ * El hilo que recibe las respuestas solo copia cada una al buffer en curso; cuando se llena, lo pasa
+ * a un hilo escritor, que escribe de una vez con pwritev todos los buffers que tenga pendientes en
+ * la posición del fichero que les corresponde, y coge el siguiente buffer libre. Así la recepción solo
+ * se detiene si el disco es más lento que la red y se agotan los OUTPUT_BUFFERS buffers.
+ */
+typedef struct {
+    int fd;                             /* Descriptor del fichero de salida */
+    OutputBuffer buffers[OUTPUT_BUFFERS];
+    OutputBuffer* current;              /* Buffer que se está llenando (solo lo usa el hilo que recibe) */
+    off_t offset;                       /* Posición del siguiente byte a añadir */
+
+    /* Estado compartido con el hilo escritor, protegido por lock */
+    pthread_mutex_t lock;
+    pthread_cond_t filled;              /* Hay buffers llenos o se está cerrando */
+    pthread_cond_t emptied;             /* Hay buffers libres */
+    OutputBuffer* full[OUTPUT_BUFFERS]; /* Buffers llenos pendientes de escribir, en orden */
+    unsigned int full_count;
+    OutputBuffer* free[OUTPUT_BUFFERS]; /* Buffers libres */
+    unsigned int free_count;
+    int closing;                        /* Distinto de 0 cuando ya no se van a añadir más datos */
+    pthread_t thread;                   /* Hilo escritor */
+
+    /* Estadísticas */
+    unsigned long writes;               /* Llamadas a pwritev */
+    unsigned long stalls;               /* Veces que la recepción tuvo que esperar un buffer libre */
+} OutputWriter;
+
+
+/**
+ * @brief   Crea el fichero de salida y arranca el hilo escritor.
+ *
+ * Si se conoce el tamaño que tendrá el fichero, se reserva su espacio en disco de antemano
+ * con fallocate (sin cambiar el tamaño del fichero), para que las escrituras no tengan que
+ * ir asignando bloques.
+ *
+ * @param writer        Escritor a inicializar.
+ * @param path          Nombre del fichero de salida (se trunca si existe).
+ * @param expected_size Tamaño previsto del fichero, o 0 si no se sabe.
+ */
+void output_open(OutputWriter* writer, const char* path, off_t expected_size);
+
+/**
+ * @brief   Añade datos al final del fichero de salida.
+ *
+ * @param writer    Escritor.
+ * @param data      Datos a añadir.
+ * @param len       Longitud de los datos.
+ */
+void output_append(OutputWriter* writer, const char* data, size_t len);
+
+/**
+ * @brief   Escribe los datos pendientes, espera al hilo escritor y cierra el fichero.
+ *
+ * Los contadores (offset, writes y stalls) siguen disponibles después de cerrar.
+ *
+ * @param writer    Escritor.
+ */
+void output_close(OutputWriter* writer);
+
+
+#endif  /* WRITER_H */
@@ -0,0 +1,313 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <utime.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "loging.h"
+#include "getip.h"
+#include "sender.h"
+
+#define BUFFER_LEN 1024
+#define CHUNK_DELAY 20000       /* Pausa entre dos trozos de una respuesta (us), para que lleguen en recv distintos */
+#define ASYNC_TIMEOUT 5         /* Segundos máximos de espera a la consulta en segundo plano */
+#define CACHED_IP "198.51.100.4"
+#define RESPONDER_IP "203.0.113.7"
+
+/* Comprueba una condición e informa del resultado, sin abortar las demás pruebas */
+#define check(condition, description) { \
+    if (condition) printf(ANSI_COLOR_GREEN "OK" ANSI_COLOR_RESET "     %s\n", description); \
+    else { printf(ANSI_COLOR_RED "FALLO" ANSI_COLOR_RESET "  %s (%s:%d)\n", description, __FILE__, __LINE__); failures++; } \
+}
+
+/**
+ * Servidor HTTP local que sustituye a api.ipify.org. Contesta a cada conexión con la respuesta
+ * configurada, enviada en varios trozos, y la cierra.
+ */
+typedef struct {
+    int socket;             /* Socket de escucha */
+    uint16_t port;          /* Puerto de escucha (en orden de host) */
+    pthread_mutex_t lock;   /* Protege los campos siguientes */
+    const char* const* chunks;  /* Trozos de la respuesta, terminados en NULL */
+    int connections;        /* Conexiones atendidas */
+    int well_formed;        /* Distinto de 0 si todas las peticiones recibidas eran un GET correcto */
+} Responder;
+
+static int failures = 0;
+
+/* Respuestas del servidor local */
+static const char* const chunked_ok[] = { "HTTP/1.", "1 200 OK\r\nContent-Type: text/plain\r\n", "\r\n203.0.", "113.7", NULL };
+static const char* const not_found[] = { "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\n\r\n", RESPONDER_IP, NULL };
+static const char* const not_an_ip[] = { "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\n\r\n", "<html>203.0.113.7</html>", NULL };
+static const char* const bad_octet[] = { "HTTP/1.1 200 OK\r\n\r\n203.0.113.700\n", NULL };
+static const char* const no_body[] = { "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n", NULL };
+
+
+/**
+ * @brief   Función del hilo del servidor local: atiende las conexiones una a una.
+ *
+ * @param arg   Puntero al servidor.
+ *
+ * @return  NULL (no termina nunca).
+ */
+static void* responder_main(void* arg) {
+    Responder* responder = (Responder *) arg;
+    char request[BUFFER_LEN];
+    const char* const* chunks;
+    size_t total;
+    ssize_t bytes;
+    int client, i;
+
+    for (;;) {
+        if ( (client = accept(responder->socket, NULL, NULL)) < 0 ) continue;
+
+        /* Leer la petición hasta la línea en blanco que la termina */
+        total = 0;
+        while (total < BUFFER_LEN - 1 && (bytes = recv(client, request + total, BUFFER_LEN - 1 - total, 0)) > 0) {
+            total += bytes;
+            request[total] = '\0';
+            if (strstr(request, "\r\n\r\n")) break;
+        }
+        request[total] = '\0';
+
+        pthread_mutex_lock(&responder->lock);
+        responder->connections++;
+        if (strncmp(request, "GET / HTTP/1.1\r\n", 16) || !strstr(request, "\r\nHost: ") || !strstr(request, "\r\n\r\n")) responder->well_formed = 0;
+        chunks = responder->chunks;
+        pthread_mutex_unlock(&responder->lock);
+
+        for (i = 0; chunks && chunks[i]; i++) {
+            if (i) usleep(CHUNK_DELAY);
+            send(client, chunks[i], strlen(chunks[i]), MSG_NOSIGNAL);
+        }
+        close(client);
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief   Arranca el servidor local en un puerto libre de loopback, y dirige getip hacia él.
+ *
+ * @param responder Servidor a arrancar.
+ */
+static void responder_start(Responder* responder) {
+    struct sockaddr_in address = { .sin_family = AF_INET, .sin_port = 0, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t address_len = sizeof(address);
+    pthread_t thread;
+    char port[8];
+
+    memset(responder, 0, sizeof(Responder));
+    responder->well_formed = 1;
+    if (pthread_mutex_init(&responder->lock, NULL)) fail("No se pudo inicializar el servidor local");
+    if ( (responder->socket = socket(AF_INET, SOCK_STREAM, 0)) < 0 ) fail("No se pudo crear el socket del servidor local");
+    if (bind(responder->socket, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(responder->socket, 8) < 0
+            || getsockname(responder->socket, (struct sockaddr *) &address, &address_len) < 0) {
+        fail("No se pudo poner a escuchar el servidor local");
+    }
+    responder->port = ntohs(address.sin_port);
+
+    if (pthread_create(&thread, NULL, responder_main, responder)) fail("No se pudo crear el hilo del servidor local");
+    pthread_detach(thread);
+
+    snprintf(port, sizeof(port), "%u", responder->port);
+    setenv("GETIP_HOST", "127.0.0.1", 1);
+    setenv("GETIP_PORT", port, 1);
+}
+
+
+/**
+ * @brief   Cambia la respuesta del servidor local a las siguientes conexiones.
+ *
+ * @param responder Servidor.
+ * @param chunks    Trozos de la respuesta, terminados en NULL.
+ */
+static void responder_reply(Responder* responder, const char* const* chunks) {
+    pthread_mutex_lock(&responder->lock);
+    responder->chunks = chunks;
+    pthread_mutex_unlock(&responder->lock);
+}
+
+
+/**
+ * @brief   Devuelve el número de conexiones que ha atendido el servidor local.
+ *
+ * @param responder Servidor.
+ *
+ * @return  Conexiones atendidas.
+ */
+static int responder_connections(Responder* responder) {
+    int connections;
+
+    pthread_mutex_lock(&responder->lock);
+    connections = responder->connections;
+    pthread_mutex_unlock(&responder->lock);
+
+    return connections;
+}
+
+
+/**
+ * @brief   Consulta la IP al servidor local con una respuesta concreta.
+ *
+ * @param responder Servidor.
+ * @param chunks    Trozos de la respuesta, terminados en NULL.
+ * @param ip        String en la que guardar la IP.
+ * @param len       Longitud de la string ip.
+ *
+ * @return  Lo que devuelva getip.
+ */
+static char* getip_with(Responder* responder, const char* const* chunks, char* ip, size_t len) {
+    responder_reply(responder, chunks);
+    memset(ip, 0, len);
+
+    return getip(ip, len);
+}
+
+
+/**
+ * @brief   Pruebas de la consulta HTTP: respuestas en trozos, códigos de error y cuerpos que no son una IP.
+ *
+ * @param responder Servidor local.
+ */
+static void test_http(Responder* responder) {
+    char ip[INET6_ADDRSTRLEN];
+    int connections = responder_connections(responder);
+
+    printf("\nConsulta HTTP\n");
+    check(getip_with(responder, chunked_ok, ip, sizeof(ip)) == ip && !strcmp(ip, RESPONDER_IP), "respuesta 200 en varios trozos");
+    check(responder_connections(responder) == connections + 1, "una conexión por consulta");
+    check(getip_with(responder, chunked_ok, ip, 8) == NULL, "IP que no cabe en el buffer");
+    check(getip_with(responder, not_found, ip, sizeof(ip)) == NULL, "código distinto de 200");
+    check(getip_with(responder, not_an_ip, ip, sizeof(ip)) == NULL, "cuerpo que no es una IP");
+    check(getip_with(responder, bad_octet, ip, sizeof(ip)) == NULL, "cuerpo con una IP imposible");
+    check(getip_with(responder, no_body, ip, sizeof(ip)) == NULL, "respuesta sin cuerpo");
+    check(responder->well_formed, "peticiones GET con Host y terminadas en línea en blanco");
+}
+
+
+/**
+ * @brief   Pruebas de la caché: escritura, lectura, caducidad con GETIP_TTL y caché desactivada.
+ *
+ * @param path  Fichero a usar como caché.
+ */
+static void test_cache(const char* path) {
+    char ip[INET6_ADDRSTRLEN];
+    struct utimbuf old = { .actime = time(NULL) - 100, .modtime = time(NULL) - 100 };
+    FILE* fp;
+
+    printf("\nCaché\n");
+    setenv("GETIP_CACHE", path, 1);
+    unsetenv("GETIP_TTL");
+    unlink(path);
+    check(getip_cached(ip, sizeof(ip)) == NULL, "sin fichero de caché");
+
+    getip_store(CACHED_IP);
+    check(getip_cached(ip, sizeof(ip)) == ip && !strcmp(ip, CACHED_IP), "lee la IP recién guardada");
+    check(getip_cached(ip, 8) == NULL, "IP guardada que no cabe en el buffer");
+
+    /* La edad de la caché es la de la fecha de modificación del fichero */
+    check(utime(path, &old) == 0, "envejecer la caché 100 s");
+    setenv("GETIP_TTL", "50", 1);
+    check(getip_cached(ip, sizeof(ip)) == NULL, "caducada con GETIP_TTL=50");
+    setenv("GETIP_TTL", "500", 1);
+    check(getip_cached(ip, sizeof(ip)) == ip && !strcmp(ip, CACHED_IP), "todavía válida con GETIP_TTL=500");
+    unsetenv("GETIP_TTL");
+
+    if ( (fp = fopen(path, "w")) ) {
+        fputs("no es una IP\n", fp);
+        fclose(fp);
+    }
+    check(getip_cached(ip, sizeof(ip)) == NULL, "contenido que no es una IP");
+
+    setenv("GETIP_CACHE", "", 1);
+    getip_store(CACHED_IP);
+    check(getip_cached(ip, sizeof(ip)) == NULL, "caché desactivada con GETIP_CACHE vacío");
+    setenv("GETIP_CACHE", path, 1);
+    unlink(path);
+}
+
+
+/**
+ * @brief   Pruebas de la consulta en segundo plano: obtiene la IP del servidor local y la guarda en la caché.
+ *
+ * @param responder Servidor local.
+ * @param path      Fichero a usar como caché.
+ */
+static void test_async(Responder* responder, const char* path) {
+    char ip[INET6_ADDRSTRLEN] = {0};
+    IpLookup* lookup;
+    time_t started = time(NULL);
+    int status;
+
+    printf("\nConsulta en segundo plano\n");
+    setenv("GETIP_CACHE", path, 1);
+    unlink(path);
+    responder_reply(responder, chunked_ok);
+
+    if ( !(lookup = getip_async()) ) fail("No se pudo empezar la consulta en segundo plano");
+    while ( (status = getip_poll(lookup, ip, sizeof(ip))) == 0 && time(NULL) - started < ASYNC_TIMEOUT ) usleep(1000);
+    getip_release(lookup);
+    check(status == 1 && !strcmp(ip, RESPONDER_IP), "obtiene la IP sin bloquear al llamante");
+
+    memset(ip, 0, sizeof(ip));
+    check(getip_cached(ip, sizeof(ip)) == ip && !strcmp(ip, RESPONDER_IP), "guarda la IP obtenida en la caché");
+    unlink(path);
+}
+
+
+/**
+ * @brief   Pruebas del modo sin conexión: la IP sale de una interfaz local y no se consulta al servidor.
+ *
+ * @param responder Servidor local.
+ */
+static void test_offline(Responder* responder) {
+    char ip[INET6_ADDRSTRLEN];
+    struct in_addr address;
+    SenderOptions options = { .offline = 1 };
+    Sender sender;
+    int connections;
+
+    printf("\nModo sin conexión\n");
+    check(getip_local(ip, sizeof(ip)) == ip && inet_pton(AF_INET, ip, &address) == 1, "getip_local devuelve una IPv4");
+    check(getip_local(ip, 4) == NULL, "IP local que no cabe en el buffer");
+
+    /* Con la caché desactivada, un emisor normal tendría que consultar al servidor */
+    setenv("GETIP_CACHE", "", 1);
+    responder_reply(responder, chunked_ok);
+    connections = responder_connections(responder);
+    getip_local(ip, sizeof(ip));
+    sender = create_sender(AF_INET, SOCK_DGRAM, 0, 0, 9, "127.0.0.1", &options);
+    check(sender.ip && !strcmp(sender.ip, ip), "el emisor sin conexión usa la IP local");
+    check(!sender.ip_lookup, "el emisor sin conexión no empieza ninguna consulta");
+    close_sender(&sender);
+    usleep(10 * CHUNK_DELAY);
+    check(responder_connections(responder) == connections, "el servidor no recibe ninguna conexión");
+}
+
+
+int main(int argc, char** argv) {
+    Responder responder;
+    char path[BUFFER_LEN];
+
+    set_colors();
+    fprintf(stderr, ANSI_COLOR_RESET);  /* Los mensajes de error esperados de getip no deben confundirse con fallos */
+
+    snprintf(path, sizeof(path), "/tmp/test_getip_cache.%ld", (long) getpid());
+    responder_start(&responder);
+    printf("Servidor HTTP local en 127.0.0.1:%u\n", responder.port);
+
+    test_http(&responder);
+    test_cache(path);
+    test_async(&responder, path);
+    test_offline(&responder);
+
+    printf("\n%s%d %s\n" ANSI_COLOR_RESET, failures ? ANSI_COLOR_RED : ANSI_COLOR_GREEN, failures, failures == 1 ? "fallo" : "fallos");
+    exit(failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+"""Genera base/upper_tables.h con las tablas de paso a mayúsculas de Unicode.
+
+Usa str.upper() de Python, que aplica las correspondencias completas de Unicode
+(UnicodeData.txt y las incondicionales de SpecialCasing.txt) sin depender del locale.
+
+Tablas generadas:
+  - upper_stage1: para cada bloque de 128 puntos de código, índice del bloque en upper_stage2.
+  - upper_stage2: bloques únicos de 128 entradas; cada entrada es un índice en upper_deltas,
+    o UPPER_SPECIAL si la mayúscula ocupa más de un carácter.
+  - upper_deltas: diferencias entre el punto de código en mayúsculas y el original.
+  - upper_special: correspondencias de varios caracteres (por ejemplo, 'ß' -> "SS"), ya en UTF-8,
+    ordenadas por punto de código para buscarlas por bisección.
+
+Uso: python3 tools/gen_upper_tables.py > base/upper_tables.h
+"""
+
+import sys
+import unicodedata
+
+BLOCK_BITS = 7
+BLOCK_SIZE = 1 << BLOCK_BITS
+
+
+def upper(cp):
+    if 0xD800 <= cp <= 0xDFFF:      # Sustitutos: no son caracteres
+        return chr(cp)
+    return chr(cp).upper()
+
+
+def main():
+    mappings = {}
+    for cp in range(0x110000):
+        u = upper(cp)
+        if u != chr(cp):
+            mappings[cp] = u
+    last = max(mappings)
+    n_blocks = (last >> BLOCK_BITS) + 1
+
+    deltas = [0]
+    special = []
+    expansion = 1
+    for cp, u in sorted(mappings.items()):
+        if len(u) == 1:
+            if ord(u) - cp not in deltas:
+                deltas.append(ord(u) - cp)
+        else:
+            special.append((cp, u.encode("utf-8")))
+        expansion = max(expansion, -(-len(u.encode("utf-8")) // len(chr(cp).encode("utf-8"))))
+    special_index = len(deltas)
+    assert special_index < 255
+
+    blocks = []
+    stage1 = []
+    for b in range(n_blocks):
+        entries = []
+        for cp in range(b * BLOCK_SIZE, (b + 1) * BLOCK_SIZE):
+            u = mappings.get(cp)
+            if u is None:
+                entries.append(0)
+            elif len(u) == 1:
+                entries.append(deltas.index(ord(u) - cp))
+            else:
+                entries.append(special_index)
+        entries = tuple(entries)
+        if entries not in blocks:
+            blocks.append(entries)
+        stage1.append(blocks.index(entries))
+    assert len(blocks) < 256
+    max_special = max(len(s) for _, s in special)
+
+    out = sys.stdout
+    out.write("/* Generado automáticamente por tools/gen_upper_tables.py (Unicode %s). No editar. */\n\n"
+              % unicodedata.unidata_version)
+    out.write("#ifndef UPPER_TABLES_H\n#define UPPER_TABLES_H\n\n#include <stdint.h>\n\n")
+    out.write("#define UPPER_BLOCK_BITS %d\n" % BLOCK_BITS)
+    out.write("#define UPPER_LAST_CODEPOINT 0x%X     /* Último punto de código con mayúscula distinta */\n" % last)
+    out.write("#define UPPER_SPECIAL %d              /* Entrada de upper_stage2 que indica correspondencia de varios caracteres */\n" % special_index)
+    out.write("#define UPPER_SPECIAL_MAX_LEN %d       /* Longitud máxima en UTF-8 de una correspondencia especial */\n" % max_special)
+    out.write("#define UPPER_TABLES_MAX_EXPANSION %d  /* Máximo factor de crecimiento en bytes de un carácter */\n\n" % expansion)
+
+    out.write("static const uint8_t upper_stage1[%d] = {" % n_blocks)
+    for i, v in enumerate(stage1):
+        out.write(("\n    " if i % 16 == 0 else " ") + "%d," % v)
+    out.write("\n};\n\n")
+
+    out.write("static const uint8_t upper_stage2[%d][%d] = {\n" % (len(blocks), BLOCK_SIZE))
+    for block in blocks:
+        out.write("    {")
+        for i, v in enumerate(block):
+            out.write(("\n        " if i % 32 == 0 else " ") + "%d," % v)
+        out.write("\n    },\n")
+    out.write("};\n\n")
+
+    out.write("static const int32_t upper_deltas[%d] = {" % len(deltas))
+    for i, v in enumerate(deltas):
+        out.write(("\n    " if i % 8 == 0 else " ") + "%d," % v)
+    out.write("\n};\n\n")
+
+    out.write("static const struct {\n    uint32_t codepoint;\n    uint8_t len;\n    char utf8[%d];\n} upper_special[%d] = {\n"
+              % (max_special, len(special)))
+    for cp, s in special:
+        out.write('    { 0x%04X, %d, "%s" },\n' % (cp, len(s), "".join("\\x%02X" % b for b in s)))
+    out.write("};\n\n#endif  /* UPPER_TABLES_H */\n")
+
+
+if __name__ == "__main__":
+    main()